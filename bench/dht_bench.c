@@ -0,0 +1,509 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "packet.h"
+#include "util.h"
+
+#define KEY_LEN 10 // 2 spread bytes (they pick the node) + 8 digits
+#define ZIPF_THETA 0.99 // YCSB default skew
+#define HOT_SET 0.2 // hotspot: this share of the keys...
+#define HOT_OPS 0.8 // ...gets this share of the requests
+
+enum { OP_GET, OP_SET, OP_DEL, OPS };
+static const char *op_names[] = {"get", "set", "del"};
+
+typedef enum _key_dist { DIST_UNIFORM, DIST_ZIPF, DIST_HOTSPOT } key_dist;
+
+typedef enum _size_dist { SIZE_FIXED, SIZE_UNIFORM, SIZE_EXP } size_dist;
+
+/*
+ * What the workers send: the mix of operations, which keys and how large the
+ * values are.
+ */
+typedef struct _config {
+    size_t connections;
+    double seconds;
+    size_t keys;
+    double read_share;
+    double write_share; // the rest are deletes
+    key_dist dist;
+    size_dist sizes;
+    size_t size_a; // fixed size, minimum or mean
+    size_t size_b; // maximum
+    bool preload;
+    unsigned timeout_ms; // a request not answered in time is an error
+    bool json;
+    char **hosts;
+    char **ports;
+    size_t n_targets;
+} config;
+
+/*
+ * Latencies of one operation type, in us.
+ */
+typedef struct _samples {
+    uint32_t *us;
+    size_t count;
+    size_t cap;
+} samples;
+
+typedef struct _worker {
+    pthread_t thread;
+    const config *cfg;
+    atomic_bool *stop;
+    size_t index;
+    uint64_t seed;
+    samples lat[OPS];
+    uint64_t misses; // GET/DEL of a key that is not stored
+    uint64_t errors; // no connection or no valid answer
+} worker;
+
+/*
+ * Scrambled zipfian key chooser as in YCSB (Gray et al.).
+ */
+static double zipf_zetan;
+static double zipf_alpha;
+static double zipf_eta;
+
+static void zipf_init(size_t n) {
+    double zeta2 = 1.0 + pow(0.5, ZIPF_THETA);
+    zipf_zetan = 0;
+    for (size_t i = 1; i <= n; i++) {
+        zipf_zetan += 1.0 / pow((double)i, ZIPF_THETA);
+    }
+    zipf_alpha = 1.0 / (1.0 - ZIPF_THETA);
+    zipf_eta = (1.0 - pow(2.0 / n, 1.0 - ZIPF_THETA)) / (1.0 - zeta2 / zipf_zetan);
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static double uniform(uint64_t *rng) {
+    return (double)(xorshift(rng) >> 11) / (double)(1ULL << 53);
+}
+
+static uint64_t scramble(uint64_t x) {
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < 8; i++) {
+        h = (h ^ ((x >> (8 * i)) & 0xff)) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static size_t zipf_next(uint64_t *rng, size_t n) {
+    double u = uniform(rng);
+    double uz = u * zipf_zetan;
+    size_t rank;
+    if (uz < 1.0) {
+        rank = 0;
+    } else if (uz < 1.0 + pow(0.5, ZIPF_THETA)) {
+        rank = 1;
+    } else {
+        rank = (size_t)(n * pow(zipf_eta * u - zipf_eta + 1.0, zipf_alpha));
+    }
+    // scramble, so the hot keys do not end up next to each other
+    return scramble(rank) % n;
+}
+
+static size_t next_key(const config *cfg, uint64_t *rng) {
+    switch (cfg->dist) {
+    case DIST_ZIPF:
+        return zipf_next(rng, cfg->keys);
+    case DIST_HOTSPOT: {
+        size_t hot = (size_t)(cfg->keys * HOT_SET);
+        hot = hot > 0 ? hot : 1;
+        if (uniform(rng) < HOT_OPS || hot == cfg->keys) {
+            return xorshift(rng) % hot;
+        }
+        return hot + xorshift(rng) % (cfg->keys - hot);
+    }
+    default:
+        return xorshift(rng) % cfg->keys;
+    }
+}
+
+static size_t next_size(const config *cfg, uint64_t *rng) {
+    switch (cfg->sizes) {
+    case SIZE_UNIFORM:
+        return cfg->size_a + xorshift(rng) % (cfg->size_b - cfg->size_a + 1);
+    case SIZE_EXP: {
+        size_t size = (size_t)(-log(1.0 - uniform(rng)) * cfg->size_a);
+        return size < cfg->size_b ? size : cfg->size_b;
+    }
+    default:
+        return cfg->size_a;
+    }
+}
+
+/**
+ * @brief The key with index i. The first two bytes decide the responsible
+ * peer (pseudo_hash), so they are spread over the whole ID space.
+ */
+static void make_key(unsigned char *key, size_t i) {
+    uint16_t spread = scramble(i) >> 48;
+    char digits[9];
+    snprintf(digits, sizeof(digits), "%08zu", i % 100000000);
+    key[0] = spread >> 8;
+    key[1] = spread & 0xff;
+    memcpy(key + 2, digits, KEY_LEN - 2);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void samples_add(samples *s, uint32_t us) {
+    if (s->count == s->cap) {
+        s->cap = s->cap > 0 ? 2 * s->cap : 4096;
+        s->us = (uint32_t *)realloc(s->us, s->cap * sizeof(uint32_t));
+    }
+    s->us[s->count++] = us;
+}
+
+/**
+ * @brief Send one request on its own connection (the peer closes it after
+ * the answer) and wait for the answer.
+ *
+ * @return int 1 if acknowledged, 0 if not (e.g. key not found), -1 on error
+ */
+static int request(const config *cfg, size_t target, const packet *p) {
+    int s = connect_socket(cfg->hosts[target], cfg->ports[target]);
+    if (s < 0) {
+        return -1;
+    }
+    struct timeval tv = {cfg->timeout_ms / 1000, (cfg->timeout_ms % 1000) * 1000};
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    size_t raw_len;
+    unsigned char *raw = packet_serialize(p, &raw_len);
+    int status = sendall(s, raw, raw_len);
+    free(raw);
+    if (status != 0) {
+        close(s);
+        return -1;
+    }
+
+    size_t rsp_len;
+    unsigned char *rsp_raw = recvall(s, &rsp_len); // closes the socket
+    packet *rsp = rsp_len >= PKT_HEADER_LEN ? packet_decode(rsp_raw, rsp_len)
+                                            : NULL; // timed out
+    free(rsp_raw);
+    if (rsp == NULL) {
+        return -1;
+    }
+    int acked = (rsp->flags & PKT_FLAG_ACK) ? 1 : 0;
+    packet_free(rsp);
+    return acked;
+}
+
+static void *run_worker(void *arg) {
+    worker *w = (worker *)arg;
+    const config *cfg = w->cfg;
+    uint64_t rng = w->seed;
+    size_t max_size = cfg->sizes == SIZE_FIXED ? cfg->size_a : cfg->size_b;
+    unsigned char *value = (unsigned char *)malloc(max_size + 1);
+    memset(value, 'v', max_size + 1);
+    unsigned char key[KEY_LEN];
+
+    packet p = {0};
+    p.key = key;
+    p.key_len = KEY_LEN;
+    p.value = value;
+
+    while (!atomic_load_explicit(w->stop, memory_order_relaxed)) {
+        make_key(key, next_key(cfg, &rng));
+        double u = uniform(&rng);
+        int op = u < cfg->read_share                      ? OP_GET
+                 : u < cfg->read_share + cfg->write_share ? OP_SET
+                                                          : OP_DEL;
+        p.flags = op == OP_GET   ? PKT_FLAG_GET
+                  : op == OP_SET ? PKT_FLAG_SET
+                                 : PKT_FLAG_DEL;
+        p.value_len = op == OP_SET ? next_size(cfg, &rng) : 0;
+
+        uint64_t start = now_ns();
+        int status = request(cfg, xorshift(&rng) % cfg->n_targets, &p);
+        uint64_t us = (now_ns() - start) / 1000;
+        if (status < 0) {
+            w->errors++;
+            continue;
+        }
+        if (status == 0) {
+            w->misses++;
+        }
+        samples_add(&w->lat[op], us < UINT32_MAX ? us : UINT32_MAX);
+    }
+    free(value);
+    return NULL;
+}
+
+/**
+ * @brief Store every key once (worker i takes every n-th key), so that the
+ * measured GETs find something.
+ */
+static void *run_preload(void *arg) {
+    worker *w = (worker *)arg;
+    const config *cfg = w->cfg;
+    uint64_t rng = w->seed;
+    size_t max_size = cfg->sizes == SIZE_FIXED ? cfg->size_a : cfg->size_b;
+    unsigned char *value = (unsigned char *)malloc(max_size + 1);
+    memset(value, 'v', max_size + 1);
+    unsigned char key[KEY_LEN];
+
+    packet p = {0};
+    p.flags = PKT_FLAG_SET;
+    p.key = key;
+    p.key_len = KEY_LEN;
+    p.value = value;
+    for (size_t i = w->index; i < cfg->keys; i += cfg->connections) {
+        make_key(key, i);
+        p.value_len = next_size(cfg, &rng);
+        if (request(cfg, i % cfg->n_targets, &p) < 0) {
+            w->errors++;
+        }
+    }
+    free(value);
+    return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const samples *s, double q) {
+    if (s->count == 0) {
+        return 0;
+    }
+    size_t rank = (size_t)(q * (s->count - 1) + 0.5);
+    return s->us[rank];
+}
+
+static void samples_merge(samples *dst, const samples *src) {
+    for (size_t i = 0; i < src->count; i++) {
+        samples_add(dst, src->us[i]);
+    }
+}
+
+static void report(const config *cfg, samples *lat, double elapsed,
+                   uint64_t misses, uint64_t errors) {
+    // lat[OPS] holds all operations together
+    const char *names[OPS + 1] = {op_names[0], op_names[1], op_names[2], "all"};
+    for (size_t op = 0; op <= OPS; op++) {
+        qsort(lat[op].us, lat[op].count, sizeof(uint32_t), cmp_u32);
+    }
+
+    if (cfg->json) {
+        printf("{\"connections\": %zu, \"seconds\": %.3f, \"keys\": %zu, "
+               "\"misses\": %llu, \"errors\": %llu",
+               cfg->connections, elapsed, cfg->keys,
+               (unsigned long long)misses, (unsigned long long)errors);
+        for (size_t op = 0; op <= OPS; op++) {
+            const samples *s = &lat[op];
+            printf(", \"%s\": {\"count\": %zu, \"ops_per_s\": %.1f, "
+                   "\"p50_us\": %u, \"p99_us\": %u, \"p999_us\": %u, "
+                   "\"max_us\": %u}",
+                   names[op], s->count, s->count / elapsed,
+                   percentile(s, 0.5), percentile(s, 0.99),
+                   percentile(s, 0.999), percentile(s, 1.0));
+        }
+        printf("}\n");
+        return;
+    }
+
+    printf("%-4s %10s %10s %8s %8s %8s %8s\n", "op", "count", "ops/s",
+           "p50_us", "p99_us", "p999_us", "max_us");
+    for (size_t op = 0; op <= OPS; op++) {
+        const samples *s = &lat[op];
+        printf("%-4s %10zu %10.1f %8u %8u %8u %8u\n", names[op], s->count,
+               s->count / elapsed, percentile(s, 0.5), percentile(s, 0.99),
+               percentile(s, 0.999), percentile(s, 1.0));
+    }
+    printf("misses %llu, errors %llu\n", (unsigned long long)misses,
+           (unsigned long long)errors);
+}
+
+/**
+ * @brief Parse a value size: "N" (fixed), "MIN-MAX" (uniform) or "exp:MEAN"
+ * (exponential, capped at 16 times the mean).
+ */
+static int parse_sizes(config *cfg, const char *spec) {
+    char *end;
+    if (strncmp(spec, "exp:", 4) == 0) {
+        cfg->sizes = SIZE_EXP;
+        cfg->size_a = strtoul(spec + 4, &end, 10);
+        cfg->size_b = 16 * cfg->size_a;
+        return *end == '\0' && cfg->size_a > 0 ? 0 : -1;
+    }
+    cfg->size_a = strtoul(spec, &end, 10);
+    if (*end == '-') {
+        cfg->sizes = SIZE_UNIFORM;
+        cfg->size_b = strtoul(end + 1, &end, 10);
+        return *end == '\0' && cfg->size_b >= cfg->size_a ? 0 : -1;
+    }
+    cfg->sizes = SIZE_FIXED;
+    return *end == '\0' ? 0 : -1;
+}
+
+/**
+ * @brief Closed-loop load generator for running peers. Every connection is a
+ * thread sending one request at a time (the peer closes a connection after
+ * its answer, so requests cannot be pipelined); targets are picked at random.
+ *
+ * Usage: './dht-bench [-c connections] [-d seconds] [-n keys] [-r read%]
+ * [-w write%] [-k uniform|zipf|hotspot] [-v size|min-max|exp:mean]
+ * [-t timeout_ms] [-l] [-j] host:port [host:port ...]'
+ *
+ * -l stores every key before the measurement, -j prints JSON instead of a
+ * table. Requests not answered within the timeout count as errors. Operations that are neither reads nor writes are deletes.
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return int The exit code
+ */
+int main(int argc, char **argv) {
+    config cfg = {0};
+    cfg.connections = 8;
+    cfg.seconds = 5.0;
+    cfg.keys = 10000;
+    cfg.read_share = 0.95;
+    cfg.write_share = 0.05;
+    cfg.dist = DIST_ZIPF;
+    cfg.sizes = SIZE_FIXED;
+    cfg.size_a = 100;
+    cfg.timeout_ms = 2000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:n:r:w:k:v:t:lj")) != -1) {
+        if (opt == 'c') {
+            cfg.connections = strtoul(optarg, NULL, 10);
+        } else if (opt == 'd') {
+            cfg.seconds = strtod(optarg, NULL);
+        } else if (opt == 'n') {
+            cfg.keys = strtoul(optarg, NULL, 10);
+        } else if (opt == 'r') {
+            cfg.read_share = strtod(optarg, NULL) / 100.0;
+        } else if (opt == 'w') {
+            cfg.write_share = strtod(optarg, NULL) / 100.0;
+        } else if (opt == 'k' && strcmp(optarg, "uniform") == 0) {
+            cfg.dist = DIST_UNIFORM;
+        } else if (opt == 'k' && strcmp(optarg, "zipf") == 0) {
+            cfg.dist = DIST_ZIPF;
+        } else if (opt == 'k' && strcmp(optarg, "hotspot") == 0) {
+            cfg.dist = DIST_HOTSPOT;
+        } else if (opt == 'v' && parse_sizes(&cfg, optarg) == 0) {
+            continue;
+        } else if (opt == 't') {
+            cfg.timeout_ms = strtoul(optarg, NULL, 10);
+        } else if (opt == 'l') {
+            cfg.preload = true;
+        } else if (opt == 'j') {
+            cfg.json = true;
+        } else {
+            fprintf(stderr, "Usage: './dht-bench [-c connections] [-d seconds] "
+                            "[-n keys] [-r read%%] [-w write%%] "
+                            "[-k uniform|zipf|hotspot] [-v size|min-max|exp:mean] "
+                            "[-t timeout_ms] [-l] [-j] host:port [host:port ...]'\n");
+            return -1;
+        }
+    }
+    if (optind >= argc || cfg.connections < 1 || cfg.keys < 1 ||
+        cfg.read_share + cfg.write_share > 1.0 + 1e-9) {
+        fprintf(stderr, "Need at least one host:port, a connection, a key and "
+                        "read%% + write%% <= 100!\n");
+        return -1;
+    }
+
+    cfg.n_targets = argc - optind;
+    cfg.hosts = (char **)calloc(cfg.n_targets, sizeof(char *));
+    cfg.ports = (char **)calloc(cfg.n_targets, sizeof(char *));
+    for (size_t i = 0; i < cfg.n_targets; i++) {
+        char *target = argv[optind + i];
+        char *colon = strrchr(target, ':');
+        if (colon == NULL) {
+            fprintf(stderr, "Target %s is not host:port!\n", target);
+            return -1;
+        }
+        *colon = '\0';
+        cfg.hosts[i] = target;
+        cfg.ports[i] = colon + 1;
+    }
+    if (cfg.dist == DIST_ZIPF) {
+        zipf_init(cfg.keys);
+    }
+
+    atomic_bool stop = false;
+    worker *workers = (worker *)calloc(cfg.connections, sizeof(worker));
+    for (size_t i = 0; i < cfg.connections; i++) {
+        workers[i].cfg = &cfg;
+        workers[i].stop = &stop;
+        workers[i].index = i;
+        workers[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+    }
+
+    if (cfg.preload) {
+        for (size_t i = 0; i < cfg.connections; i++) {
+            pthread_create(&workers[i].thread, NULL, run_preload, &workers[i]);
+        }
+        uint64_t errors = 0;
+        for (size_t i = 0; i < cfg.connections; i++) {
+            pthread_join(workers[i].thread, NULL);
+            errors += workers[i].errors;
+            workers[i].errors = 0;
+        }
+        fprintf(stderr, "Stored %zu keys (%llu errors).\n", cfg.keys,
+                (unsigned long long)errors);
+    }
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < cfg.connections; i++) {
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+    struct timespec pause = {(time_t)cfg.seconds,
+                             (long)((cfg.seconds - (time_t)cfg.seconds) * 1e9)};
+    nanosleep(&pause, NULL);
+    atomic_store(&stop, true);
+
+    samples lat[OPS + 1];
+    memset(lat, 0, sizeof(lat));
+    uint64_t misses = 0;
+    uint64_t errors = 0;
+    for (size_t i = 0; i < cfg.connections; i++) {
+        pthread_join(workers[i].thread, NULL);
+        misses += workers[i].misses;
+        errors += workers[i].errors;
+        for (size_t op = 0; op < OPS; op++) {
+            samples_merge(&lat[op], &workers[i].lat[op]);
+            samples_merge(&lat[OPS], &workers[i].lat[op]);
+            free(workers[i].lat[op].us);
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    report(&cfg, lat, elapsed, misses, errors);
+    for (size_t op = 0; op <= OPS; op++) {
+        free(lat[op].us);
+    }
+    free(workers);
+    free(cfg.hosts);
+    free(cfg.ports);
+    return 0;
+}
@@ -0,0 +1,784 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "packet.h"
+#include "util.h"
+#include "vnode.h"
+
+#define HOST "127.0.0.1"
+#define MAX_PEERS 1024
+#define MAX_ARGS 32
+#define POLL_MS 100 // how often the ring state is polled
+#define TIMEOUT_MS 2000 // requests not answered in time fail
+#define STOP_WAIT_MS 3000 // then a peer that was asked to exit is killed
+#define VALUE_LEN 32
+
+/*
+ * A peer process of the cluster. Its stdin stays open while it runs (a peer
+ * exits on input, closing it early makes it spin on POLLHUP).
+ */
+typedef struct _cpeer {
+    uint16_t id;
+    uint16_t port;
+    pid_t pid;
+    int stdin_fd;
+    bool alive;
+} cpeer;
+
+/*
+ * The ring state of one virtual node as reported by STATS.
+ */
+typedef struct _vstate {
+    uint16_t id;
+    int pred;
+    int succ;
+    bool ft_active;
+    int fingers[SIZE_OF_FT];
+} vstate;
+
+typedef struct _samples {
+    uint32_t *us;
+    size_t count;
+    size_t cap;
+} samples;
+
+typedef struct _loader {
+    pthread_t thread;
+    uint64_t seed;
+    samples lat;
+    uint64_t ok;
+    uint64_t wrong; // answered, but not with the stored value
+    uint64_t failed; // no connection or no answer
+} loader;
+
+static struct {
+    size_t n_peers;
+    uint16_t base_port;
+    size_t wave;
+    unsigned wave_gap_ms;
+    double churn_per_s;
+    double seconds;
+    size_t keys;
+    unsigned settle_s;
+    size_t load_threads;
+    const char *log_dir;
+    char peer_path[512];
+    char *peer_opts[MAX_ARGS];
+    size_t n_peer_opts;
+} cfg = {8, 7000, 1, 500, 0.0, 0.0, 1000, 60, 1, NULL, "", {NULL}, 0};
+
+static cpeer peers[MAX_PEERS];
+static size_t n_peers;
+static pthread_mutex_t peers_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_bool stop_load = false;
+static atomic_bool interrupted = false;
+
+static uint64_t work_rng = 0x2545F4914F6CDD1DULL;
+
+static uint64_t xorshift(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static double uniform(uint64_t *state) {
+    return (double)(xorshift(state) >> 11) / (double)(1ULL << 53);
+}
+
+static uint64_t now_ms_mono(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(unsigned ms) {
+    struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+static void on_interrupt(int sig) {
+    (void)sig;
+    atomic_store(&interrupted, true);
+}
+
+/**
+ * @brief Send a packet to a peer on a connection of its own and wait for the
+ * answer (the peer closes the connection after it).
+ *
+ * @return packet* The answer or NULL if there was none in time
+ */
+static packet *request(uint16_t port, const packet *p) {
+    // a peer that is stuck does not accept either: the send timeout bounds
+    // connect too
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    struct timeval tv = {TIMEOUT_MS / 1000, (TIMEOUT_MS % 1000) * 1000};
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, HOST, &addr.sin_addr);
+    if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(s);
+        return NULL;
+    }
+
+    size_t raw_len;
+    unsigned char *raw = packet_serialize(p, &raw_len);
+    int status = sendall(s, raw, raw_len);
+    free(raw);
+    if (status != 0) {
+        close(s);
+        return NULL;
+    }
+    size_t rsp_len;
+    unsigned char *rsp_raw = recvall(s, &rsp_len); // closes the socket
+    packet *rsp = rsp_len >= PKT_HEADER_LEN ? packet_decode(rsp_raw, rsp_len)
+                                            : NULL;
+    free(rsp_raw);
+    return rsp;
+}
+
+/**
+ * @brief Start a peer process, joining the ring via another peer (or
+ * founding it if entry is NULL).
+ */
+static int spawn(cpeer *p, const cpeer *entry) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return -1;
+    }
+
+    char port[16], id[16], entry_port[16];
+    snprintf(port, sizeof(port), "%u", p->port);
+    snprintf(id, sizeof(id), "%u", p->id);
+    char *args[MAX_ARGS + 8];
+    size_t n = 0;
+    args[n++] = cfg.peer_path;
+    for (size_t i = 0; i < cfg.n_peer_opts; i++) {
+        args[n++] = cfg.peer_opts[i];
+    }
+    args[n++] = HOST;
+    args[n++] = port;
+    args[n++] = id;
+    if (entry != NULL) {
+        snprintf(entry_port, sizeof(entry_port), "%u", entry->port);
+        args[n++] = HOST;
+        args[n++] = entry_port;
+    }
+    args[n] = NULL;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(fds[0], STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        char log[512];
+        if (cfg.log_dir != NULL) {
+            snprintf(log, sizeof(log), "%s/peer-%u.log", cfg.log_dir, p->port);
+        } else {
+            snprintf(log, sizeof(log), "/dev/null");
+        }
+        int out = open(log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (out >= 0) {
+            dup2(out, STDOUT_FILENO);
+            dup2(out, STDERR_FILENO);
+            close(out);
+        }
+        execv(cfg.peer_path, args);
+        perror("execv");
+        _exit(127);
+    }
+
+    close(fds[0]);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC); // later children must not hold it
+    p->pid = pid;
+    p->stdin_fd = fds[1];
+    p->alive = true;
+    return 0;
+}
+
+/**
+ * @brief Wait for a peer process to exit.
+ *
+ * @return bool Whether it exited within timeout_ms
+ */
+static bool reap(cpeer *p, unsigned timeout_ms) {
+    uint64_t until = now_ms_mono() + timeout_ms;
+    do {
+        if (waitpid(p->pid, NULL, WNOHANG) == p->pid) {
+            return true;
+        }
+        sleep_ms(10);
+    } while (now_ms_mono() < until);
+    return false;
+}
+
+/**
+ * @brief Stop a peer: ask it to exit (it prints its stats on the way) or kill
+ * it right away to simulate a crash.
+ */
+static void stop_peer(cpeer *p, bool crash) {
+    if (!p->alive) {
+        return;
+    }
+    if (!crash) {
+        ssize_t w = write(p->stdin_fd, "\n", 1);
+        (void)w;
+    }
+    if (crash || !reap(p, STOP_WAIT_MS)) {
+        kill(p->pid, SIGKILL);
+        waitpid(p->pid, NULL, 0);
+    }
+    close(p->stdin_fd);
+    p->alive = false;
+}
+
+static size_t random_alive(uint64_t *rng) {
+    size_t alive = 0;
+    for (size_t i = 0; i < n_peers; i++) {
+        alive += peers[i].alive;
+    }
+    if (alive == 0) {
+        return SIZE_MAX;
+    }
+    size_t k = xorshift(rng) % alive;
+    for (size_t i = 0; i < n_peers; i++) {
+        if (peers[i].alive && k-- == 0) {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+static bool id_taken(uint16_t id) {
+    for (size_t i = 0; i < n_peers; i++) {
+        if (peers[i].id == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Add a peer with a new port and a random unused ID.
+ */
+static cpeer *new_peer(void) {
+    if (n_peers == MAX_PEERS) {
+        return NULL;
+    }
+    cpeer *p = &peers[n_peers];
+    do {
+        p->id = (uint16_t)xorshift(&work_rng);
+    } while (id_taken(p->id));
+    p->port = cfg.base_port + n_peers;
+    n_peers++;
+    return p;
+}
+
+/**
+ * @brief Parse the 'ring{vnode="ID"} pred=.. succ=.. ft=.. fingers=..' lines
+ * of a STATS answer.
+ *
+ * @return size_t The number of virtual nodes found
+ */
+static size_t parse_ring(const char *text, vstate *out, size_t max) {
+    size_t n = 0;
+    const char *line = text;
+    while (line != NULL && *line != '\0' && n < max) {
+        unsigned id;
+        int pred, succ;
+        char ft[16];
+        int used = 0;
+        if (sscanf(line, "ring{vnode=\"%u\"} pred=%d succ=%d ft=%15s fingers=%n",
+                   &id, &pred, &succ, ft, &used) == 4 &&
+            used > 0) {
+            vstate *v = &out[n++];
+            v->id = id;
+            v->pred = pred;
+            v->succ = succ;
+            v->ft_active = strcmp(ft, "active") == 0;
+            const char *f = line + used;
+            for (size_t k = 0; k < SIZE_OF_FT; k++) {
+                v->fingers[k] = *f == '-' ? -1 : atoi(f);
+                f = strchr(f, ',');
+                f = f != NULL ? f + 1 : "";
+            }
+        }
+        line = strchr(line, '\n');
+        line = line != NULL ? line + 1 : NULL;
+    }
+    return n;
+}
+
+static int vstate_cmp(const void *a, const void *b) {
+    return (int)((const vstate *)a)->id - (int)((const vstate *)b)->id;
+}
+
+/**
+ * @brief The ID of the first virtual node at or after an ID.
+ */
+static uint16_t successor_id(const vstate *vs, size_t n, uint16_t id) {
+    for (size_t i = 0; i < n; i++) {
+        if (vs[i].id >= id) {
+            return vs[i].id;
+        }
+    }
+    return vs[0].id;
+}
+
+/**
+ * @brief Ask every running peer for its ring state and check it.
+ *
+ * @param fingers Also require complete and correct finger tables
+ * @param wrong Set to the number of virtual nodes with a wrong state
+ * @return bool Whether all pred, succ (and fingers) are right
+ */
+static bool ring_consistent(bool fingers, size_t *wrong) {
+    size_t cap = MAX_PEERS * VNODES_MAX;
+    vstate *vs = (vstate *)malloc(cap * sizeof(vstate));
+    size_t n = 0;
+    bool answered = true;
+
+    packet stat = {0};
+    stat.flags = PKT_FLAG_STAT;
+    for (size_t i = 0; i < n_peers; i++) {
+        if (!peers[i].alive) {
+            continue;
+        }
+        packet *rsp = request(peers[i].port, &stat);
+        if (rsp == NULL || !(rsp->flags & PKT_FLAG_ACK)) {
+            answered = false;
+            packet_free(rsp);
+            continue;
+        }
+        char *text = (char *)malloc(rsp->value_len + 1);
+        memcpy(text, rsp->value, rsp->value_len);
+        text[rsp->value_len] = '\0';
+        n += parse_ring(text, vs + n, cap - n);
+        free(text);
+        packet_free(rsp);
+    }
+    qsort(vs, n, sizeof(vstate), vstate_cmp);
+
+    *wrong = 0;
+    for (size_t k = 0; k < n && n > 1; k++) {
+        const vstate *v = &vs[k];
+        bool ok = v->succ == vs[(k + 1) % n].id &&
+                  v->pred == vs[(k + n - 1) % n].id;
+        for (size_t f = 0; f < SIZE_OF_FT && fingers && ok; f++) {
+            ok = v->ft_active &&
+                 v->fingers[f] == successor_id(vs, n, finger_start(v->id, f));
+        }
+        *wrong += !ok;
+    }
+    free(vs);
+    return answered && n > 0 && *wrong == 0;
+}
+
+/**
+ * @brief Poll the ring until it is consistent.
+ *
+ * @return double Seconds it took, negative if it did not within settle_s
+ */
+static double settle(bool fingers) {
+    uint64_t start = now_ms_mono();
+    size_t wrong = 0;
+    while (!atomic_load(&interrupted)) {
+        if (ring_consistent(fingers, &wrong)) {
+            return (now_ms_mono() - start) / 1000.0;
+        }
+        if (now_ms_mono() - start > cfg.settle_s * 1000ULL) {
+            fprintf(stderr, "%zu virtual nodes still wrong.\n", wrong);
+            break;
+        }
+        sleep_ms(POLL_MS);
+    }
+    return -1.0;
+}
+
+static void send_fngr(void) {
+    packet fngr = {0};
+    fngr.flags = PKT_FLAG_CTRL | PKT_FLAG_FNGR;
+    for (size_t i = 0; i < n_peers; i++) {
+        if (peers[i].alive) {
+            packet_free(request(peers[i].port, &fngr));
+        }
+    }
+}
+
+static void make_key(unsigned char *key, size_t i) {
+    // the first two bytes pick the responsible peer, spread them
+    uint32_t h = (uint32_t)i * 2654435761u;
+    char digits[9];
+    snprintf(digits, sizeof(digits), "%08zu", i % 100000000);
+    key[0] = h >> 24;
+    key[1] = h >> 16;
+    memcpy(key + 2, digits, 8);
+}
+
+static void make_value(unsigned char *value, size_t i) {
+    snprintf((char *)value, VALUE_LEN + 1, "%0*zu", VALUE_LEN, i);
+}
+
+static void samples_add(samples *s, uint32_t us) {
+    if (s->count == s->cap) {
+        s->cap = s->cap > 0 ? 2 * s->cap : 4096;
+        s->us = (uint32_t *)realloc(s->us, s->cap * sizeof(uint32_t));
+    }
+    s->us[s->count++] = us;
+}
+
+static uint16_t pick_port(uint64_t *rng) {
+    pthread_mutex_lock(&peers_lock);
+    size_t i = random_alive(rng);
+    uint16_t port = i != SIZE_MAX ? peers[i].port : 0;
+    pthread_mutex_unlock(&peers_lock);
+    return port;
+}
+
+/**
+ * @brief GET stored keys from random running peers until stopped; every GET
+ * must return the stored value.
+ */
+static void *run_loader(void *arg) {
+    loader *l = (loader *)arg;
+    unsigned char key[10];
+    unsigned char expected[VALUE_LEN + 1];
+    packet get = {0};
+    get.flags = PKT_FLAG_GET;
+    get.key = key;
+    get.key_len = sizeof(key);
+
+    while (!atomic_load_explicit(&stop_load, memory_order_relaxed)) {
+        size_t i = xorshift(&l->seed) % cfg.keys;
+        make_key(key, i);
+        make_value(expected, i);
+        uint16_t port = pick_port(&l->seed);
+        if (port == 0) {
+            break;
+        }
+
+        uint64_t start = now_us();
+        packet *rsp = request(port, &get);
+        uint64_t us = now_us() - start;
+        if (rsp == NULL) {
+            l->failed++;
+        } else if ((rsp->flags & PKT_FLAG_ACK) && rsp->value_len == VALUE_LEN &&
+                   memcmp(rsp->value, expected, VALUE_LEN) == 0) {
+            l->ok++;
+            samples_add(&l->lat, us < UINT32_MAX ? us : UINT32_MAX);
+        } else {
+            l->wrong++;
+        }
+        packet_free(rsp);
+    }
+    return NULL;
+}
+
+static size_t preload(void) {
+    unsigned char key[10];
+    unsigned char value[VALUE_LEN + 1];
+    packet set = {0};
+    set.flags = PKT_FLAG_SET;
+    set.key = key;
+    set.key_len = sizeof(key);
+    set.value = value;
+    set.value_len = VALUE_LEN;
+
+    size_t stored = 0;
+    for (size_t i = 0; i < cfg.keys && !atomic_load(&interrupted); i++) {
+        make_key(key, i);
+        make_value(value, i);
+        packet *rsp = request(pick_port(&work_rng), &set);
+        stored += rsp != NULL && (rsp->flags & PKT_FLAG_ACK);
+        packet_free(rsp);
+    }
+    return stored;
+}
+
+/**
+ * @brief Crash a running peer, restart a crashed one (same ID and port) or
+ * add a new one, at random.
+ */
+static void churn_event(size_t *kills, size_t *restarts, size_t *joins) {
+    size_t dead = 0;
+    size_t alive = 0;
+    for (size_t i = 0; i < n_peers; i++) {
+        dead += !peers[i].alive;
+        alive += peers[i].alive;
+    }
+    double u = uniform(&work_rng);
+
+    pthread_mutex_lock(&peers_lock);
+    if (u < 1.0 / 3 && alive > 2) {
+        stop_peer(&peers[random_alive(&work_rng)], true);
+        pthread_mutex_unlock(&peers_lock);
+        (*kills)++;
+        return;
+    }
+    size_t entry = random_alive(&work_rng);
+    cpeer *p = NULL;
+    if (u < 2.0 / 3 && dead > 0) {
+        size_t k = xorshift(&work_rng) % dead;
+        for (size_t i = 0; i < n_peers && p == NULL; i++) {
+            if (!peers[i].alive && k-- == 0) {
+                p = &peers[i];
+            }
+        }
+        (*restarts)++;
+    } else {
+        p = new_peer();
+        (*joins)++;
+    }
+    if (p != NULL) {
+        spawn(p, &peers[entry]);
+    }
+    pthread_mutex_unlock(&peers_lock);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void report_load(loader *loaders, double seconds) {
+    samples all = {0};
+    uint64_t ok = 0, wrong = 0, failed = 0;
+    for (size_t i = 0; i < cfg.load_threads; i++) {
+        ok += loaders[i].ok;
+        wrong += loaders[i].wrong;
+        failed += loaders[i].failed;
+        for (size_t k = 0; k < loaders[i].lat.count; k++) {
+            samples_add(&all, loaders[i].lat.us[k]);
+        }
+        free(loaders[i].lat.us);
+    }
+    qsort(all.us, all.count, sizeof(uint32_t), cmp_u32);
+    uint64_t total = ok + wrong + failed;
+
+    printf("lookups: %llu in %.0f s, %.2f%% answered right, %llu wrong or "
+           "missing, %llu without answer\n",
+           (unsigned long long)total, seconds,
+           total > 0 ? 100.0 * ok / total : 0.0, (unsigned long long)wrong,
+           (unsigned long long)failed);
+    if (all.count > 0) {
+        printf("latency us: p50 %u p99 %u p99.9 %u max %u\n",
+               all.us[all.count / 2], all.us[(size_t)(all.count * 0.99)],
+               all.us[(size_t)(all.count * 0.999)], all.us[all.count - 1]);
+    }
+    free(all.us);
+}
+
+/**
+ * @brief Split the peer options ('-t 2 -i 2') into arguments.
+ */
+static void parse_peer_opts(char *opts) {
+    for (char *tok = strtok(opts, " "); tok != NULL && cfg.n_peer_opts < MAX_ARGS;
+         tok = strtok(NULL, " ")) {
+        cfg.peer_opts[cfg.n_peer_opts++] = tok;
+    }
+}
+
+static int parse_ids(char *list) {
+    for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (n_peers == MAX_PEERS) {
+            return -1;
+        }
+        peers[n_peers].id = (uint16_t)strtoul(tok, NULL, 10);
+        peers[n_peers].port = cfg.base_port + n_peers;
+        n_peers++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Launch a local cluster of peers, measure how long the ring takes to
+ * become consistent (pred and succ, then finger tables after a FNGR to every
+ * peer) and optionally run GETs under churn.
+ *
+ * Peers are started in waves of -w peers, -g ms apart; every one joins via a
+ * random peer already running. With -d seconds the cluster stores -k keys and
+ * -t threads GET them from random peers while peers crash, restart and join
+ * at -c events per second. (Peers with one reactor proxy while blocking it, so
+ * several threads can make two of them wait for each other; such requests
+ * time out.) Peer options are passed on with -o, e.g.
+ * -o '-t 2 -i 2'; -L keeps the output of every peer in a log file.
+ *
+ * Usage: './dht-cluster [-n peers] [-I id,id,...] [-b base_port] [-w wave]
+ * [-g wave_gap_ms] [-c churn_per_s] [-d seconds] [-k keys] [-t threads]
+ * [-s settle_s] [-o peer_options] [-L log_dir] [-P peer_binary]'
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return int The exit code
+ */
+int main(int argc, char **argv) {
+    // the peer binary is built next to this one
+    const char *slash = strrchr(argv[0], '/');
+    snprintf(cfg.peer_path, sizeof(cfg.peer_path), "%.*speer",
+             slash != NULL ? (int)(slash - argv[0] + 1) : 0, argv[0]);
+    char *ids = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:I:b:w:g:c:d:k:t:s:o:L:P:")) != -1) {
+        if (opt == 'n') {
+            cfg.n_peers = strtoul(optarg, NULL, 10);
+        } else if (opt == 'I') {
+            ids = optarg;
+        } else if (opt == 'b') {
+            cfg.base_port = (uint16_t)strtoul(optarg, NULL, 10);
+        } else if (opt == 'w') {
+            cfg.wave = strtoul(optarg, NULL, 10);
+        } else if (opt == 'g') {
+            cfg.wave_gap_ms = strtoul(optarg, NULL, 10);
+        } else if (opt == 'c') {
+            cfg.churn_per_s = strtod(optarg, NULL);
+        } else if (opt == 'd') {
+            cfg.seconds = strtod(optarg, NULL);
+        } else if (opt == 'k') {
+            cfg.keys = strtoul(optarg, NULL, 10);
+        } else if (opt == 't') {
+            cfg.load_threads = strtoul(optarg, NULL, 10);
+        } else if (opt == 's') {
+            cfg.settle_s = strtoul(optarg, NULL, 10);
+        } else if (opt == 'o') {
+            parse_peer_opts(optarg);
+        } else if (opt == 'L') {
+            cfg.log_dir = optarg;
+        } else if (opt == 'P') {
+            snprintf(cfg.peer_path, sizeof(cfg.peer_path), "%s", optarg);
+        } else {
+            fprintf(stderr, "Usage: './dht-cluster [-n peers] [-I id,id,...] "
+                            "[-b base_port] [-w wave] [-g wave_gap_ms] "
+                            "[-c churn_per_s] [-d seconds] [-k keys] "
+                            "[-t threads] [-s settle_s] [-o peer_options] [-L log_dir] "
+                            "[-P peer_binary]'\n");
+            return -1;
+        }
+    }
+    if (ids != NULL && parse_ids(ids) != 0) {
+        fprintf(stderr, "At most %d peers!\n", MAX_PEERS);
+        return -1;
+    }
+    while (ids == NULL && n_peers < cfg.n_peers && new_peer() != NULL) {
+    }
+    if (n_peers < 1 || cfg.wave < 1 || cfg.keys < 1 || cfg.load_threads < 1) {
+        fprintf(stderr, "Need at least one peer, a wave of one, a key and a "
+                        "thread!\n");
+        return -1;
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0); // progress shows up while it runs
+    struct sigaction sa = {0};
+    sa.sa_handler = on_interrupt;
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // the first peer founds the ring, the others join in waves
+    uint64_t start = now_ms_mono();
+    spawn(&peers[0], NULL);
+    sleep_ms(cfg.wave_gap_ms);
+    for (size_t i = 1; i < n_peers && !atomic_load(&interrupted);
+         i += cfg.wave) {
+        for (size_t k = i; k < i + cfg.wave && k < n_peers; k++) {
+            size_t entry = xorshift(&work_rng) % i; // one that runs already
+            spawn(&peers[k], &peers[entry]);
+        }
+        sleep_ms(cfg.wave_gap_ms);
+    }
+    printf("%zu peers started in %.1f s (waves of %zu, %u ms apart)\n",
+           n_peers, (now_ms_mono() - start) / 1000.0, cfg.wave,
+           cfg.wave_gap_ms);
+
+    double ring_s = settle(false);
+    if (ring_s >= 0) {
+        printf("pred/succ consistent %.1f s after the last wave\n", ring_s);
+        send_fngr();
+        double fingers_s = settle(true);
+        if (fingers_s >= 0) {
+            printf("finger tables consistent %.1f s after FNGR\n", fingers_s);
+        } else {
+            printf("finger tables not consistent within %u s\n", cfg.settle_s);
+        }
+    } else {
+        printf("pred/succ not consistent within %u s\n", cfg.settle_s);
+    }
+
+    if (cfg.seconds > 0 && !atomic_load(&interrupted)) {
+        printf("stored %zu of %zu keys\n", preload(), cfg.keys);
+
+        loader *loaders = (loader *)calloc(cfg.load_threads, sizeof(loader));
+        for (size_t i = 0; i < cfg.load_threads; i++) {
+            loaders[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+            pthread_create(&loaders[i].thread, NULL, run_loader, &loaders[i]);
+        }
+
+        size_t kills = 0, restarts = 0, joins = 0;
+        uint64_t load_start = now_ms_mono();
+        uint64_t end = load_start + (uint64_t)(cfg.seconds * 1000);
+        double next = cfg.churn_per_s > 0
+                          ? -log(1.0 - uniform(&work_rng)) / cfg.churn_per_s
+                          : cfg.seconds;
+        while (now_ms_mono() < end && !atomic_load(&interrupted)) {
+            if ((now_ms_mono() - load_start) / 1000.0 >= next) {
+                churn_event(&kills, &restarts, &joins);
+                next += -log(1.0 - uniform(&work_rng)) / cfg.churn_per_s;
+            }
+            sleep_ms(10);
+        }
+        atomic_store(&stop_load, true);
+        for (size_t i = 0; i < cfg.load_threads; i++) {
+            pthread_join(loaders[i].thread, NULL);
+        }
+
+        printf("churn: %zu crashed, %zu restarted, %zu joined\n", kills,
+               restarts, joins);
+        report_load(loaders, cfg.seconds);
+        free(loaders);
+        if (kills + restarts + joins > 0) {
+            double again = settle(false);
+            if (again >= 0) {
+                printf("pred/succ consistent again %.1f s after churn\n", again);
+            } else {
+                printf("pred/succ not consistent again within %u s\n",
+                       cfg.settle_s);
+            }
+        }
+    }
+
+    // ask all peers to exit at once, they take a moment each
+    for (size_t i = 0; i < n_peers; i++) {
+        if (peers[i].alive) {
+            ssize_t w = write(peers[i].stdin_fd, "\n", 1);
+            (void)w;
+        }
+    }
+    for (size_t i = 0; i < n_peers; i++) {
+        stop_peer(&peers[i], false);
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kv_store.h"
+#include "util.h"
+
+#define KEY_LEN 16 // "key" + 13 digits
+#define VALUE_LEN 16
+#define EXPIRING 100000 // keys that expire while the expiry is measured
+#define EXPIRING_AFTER_MS 1000 // first of them, idle ticks come before
+
+static uint64_t xorshift(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static void make_key(unsigned char *key, size_t i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key%013zu", i);
+    memcpy(key, buf, KEY_LEN);
+}
+
+/**
+ * @brief A TTL of a key that stays: a quarter each without one, minutes, an
+ * hour and up to a day, so the keys spread over all levels of the wheels.
+ */
+static uint32_t long_ttl(uint64_t *rng) {
+    uint64_t r = xorshift(rng);
+    switch (r % 4) {
+    case 0:
+        return 0;
+    case 1:
+        return 60000 + (r >> 8) % 540000; // 1 - 10 min
+    case 2:
+        return 600000 + (r >> 8) % 3000000; // 10 min - 1 h
+    default:
+        return 3600000 + (r >> 8) % 82800000; // 1 h - 1 day
+    }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void sleep_ms(uint64_t ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * @brief Fill a store with keys of mixed TTLs, let EXPIRING of them run out
+ * within the given time and time every kv_expire tick meanwhile.
+ *
+ * @param n_keys The number of keys in the store
+ * @param seconds How long the expiring keys take to run out
+ */
+static void run(size_t n_keys, double seconds) {
+    kv_store *kv = kv_new(KV_SHARDS);
+    unsigned char key[KEY_LEN];
+    unsigned char value[VALUE_LEN];
+    memset(value, 'v', VALUE_LEN);
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+    uint64_t start = now_ms();
+    for (size_t i = EXPIRING; i < n_keys; i++) {
+        make_key(key, i);
+        kv_set_ttl(kv, key, KEY_LEN, value, VALUE_LEN, long_ttl(&rng));
+    }
+    // the expiring keys go last, the load may take longer than their TTL
+    uint64_t window_ms = (uint64_t)(seconds * 1000);
+    for (size_t i = 0; i < EXPIRING; i++) {
+        make_key(key, i);
+        uint32_t ttl = EXPIRING_AFTER_MS + xorshift(&rng) % window_ms;
+        kv_set_ttl(kv, key, KEY_LEN, value, VALUE_LEN, ttl);
+    }
+    uint64_t load_ms = now_ms() - start;
+
+    // what a tick would cost if it looked at every key
+    uint64_t sweep_start = now_us();
+    volatile size_t due = 0; // keeps the scan from being optimized out
+    uint64_t now = now_ms();
+    for (size_t s = 0; s < kv->n_shards; s++) {
+        htable *entry, *tmp;
+        HASH_ITER(hh, kv->shards[s].table, entry, tmp) {
+            due += entry->expires != 0 && entry->expires <= now;
+        }
+    }
+    uint64_t sweep_us = now_us() - sweep_start;
+
+    size_t max_ticks = (EXPIRING_AFTER_MS + window_ms) / KV_EXPIRY_TICK_MS + 64;
+    uint64_t *busy = (uint64_t *)malloc(max_ticks * sizeof(uint64_t));
+    uint64_t *idle = (uint64_t *)malloc(max_ticks * sizeof(uint64_t));
+    size_t n_busy = 0;
+    size_t n_idle = 0;
+    size_t expired = 0;
+    uint64_t busy_us = 0;
+
+    uint64_t end = now_ms() + EXPIRING_AFTER_MS + window_ms + 200;
+    while (now_ms() < end && n_busy + n_idle < max_ticks) {
+        sleep_ms(KV_EXPIRY_TICK_MS);
+        uint64_t t0 = now_us();
+        size_t removed = kv_expire(kv, now_ms(), NULL);
+        uint64_t dt = now_us() - t0;
+        if (removed > 0) {
+            busy[n_busy++] = dt;
+            busy_us += dt;
+            expired += removed;
+        } else {
+            idle[n_idle++] = dt;
+        }
+    }
+    qsort(busy, n_busy, sizeof(uint64_t), cmp_u64);
+    qsort(idle, n_idle, sizeof(uint64_t), cmp_u64);
+
+    printf("%10zu %8.1f %9.1f %8zu %8zu %9lu %9lu %9lu %8.0f %9.1f\n", n_keys,
+           load_ms / 1000.0, sweep_us / 1000.0, expired, n_busy,
+           n_idle > 0 ? idle[n_idle / 2] : 0, n_busy > 0 ? busy[n_busy / 2] : 0,
+           n_busy > 0 ? busy[n_busy * 99 / 100] : 0,
+           expired > 0 ? busy_us * 1000.0 / expired : 0.0,
+           kv_count(kv) / 1e6);
+
+    free(busy);
+    free(idle);
+    kv_free(kv);
+}
+
+/**
+ * @brief Cost of removing expired keys from stores of growing size: every
+ * store holds keys without TTL and with TTLs of minutes up to a day, and
+ * EXPIRING keys that run out within the given time while kv_expire runs
+ * every KV_EXPIRY_TICK_MS. Prints per store size the time of one full scan
+ * of the keys for comparison, the median kv_expire tick without and with
+ * expired keys, its p99 and the cost per expired key.
+ *
+ * Usage: './kv-expiry [max_keys] [seconds]'
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return int The exit code
+ */
+int main(int argc, char **argv) {
+    size_t max_keys = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+    double seconds = argc > 2 ? strtod(argv[2], NULL) : 5.0;
+
+    printf("%10s %8s %9s %8s %8s %9s %9s %9s %8s %9s\n", "keys", "load_s",
+           "scan_ms", "expired", "ticks", "idle_us", "tick_us", "p99_us",
+           "ns/key", "left_M");
+    for (size_t n = EXPIRING; n <= max_keys; n *= 10) {
+        run(n, seconds);
+    }
+    return 0;
+}
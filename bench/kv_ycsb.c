@@ -0,0 +1,179 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kv_store.h"
+
+#define RECORDS 100000
+#define KEY_LEN 14 // "user" + 10 digits
+#define VALUE_LEN 100
+#define ZIPF_THETA 0.99 // YCSB default skew
+
+/*
+ * A YCSB core workload: the share of reads, the rest are updates.
+ */
+typedef struct _workload {
+    const char *name;
+    double read_share;
+} workload;
+
+static const workload workloads[] = {
+    {"A", 0.50}, // update heavy
+    {"B", 0.95}, // read mostly
+    {"C", 1.00}, // read only
+};
+
+/*
+ * Scrambled zipfian key chooser as in YCSB (Gray et al.).
+ */
+static double zipf_zetan;
+static double zipf_alpha;
+static double zipf_eta;
+
+static void zipf_init(size_t n) {
+    double zeta2 = 1.0 + pow(0.5, ZIPF_THETA);
+    zipf_zetan = 0;
+    for (size_t i = 1; i <= n; i++) {
+        zipf_zetan += 1.0 / pow((double)i, ZIPF_THETA);
+    }
+    zipf_alpha = 1.0 / (1.0 - ZIPF_THETA);
+    zipf_eta = (1.0 - pow(2.0 / n, 1.0 - ZIPF_THETA)) / (1.0 - zeta2 / zipf_zetan);
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static size_t zipf_next(uint64_t *rng, size_t n) {
+    double u = (double)(xorshift(rng) >> 11) / (double)(1ULL << 53);
+    double uz = u * zipf_zetan;
+    size_t rank;
+    if (uz < 1.0) {
+        rank = 0;
+    } else if (uz < 1.0 + pow(0.5, ZIPF_THETA)) {
+        rank = 1;
+    } else {
+        rank = (size_t)(n * pow(zipf_eta * u - zipf_eta + 1.0, zipf_alpha));
+    }
+    // scramble, so the hot keys do not end up next to each other
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < 8; i++) {
+        h = (h ^ ((rank >> (8 * i)) & 0xff)) * 1099511628211ULL;
+    }
+    return h % n;
+}
+
+static void make_key(unsigned char *key, size_t i) {
+    char buf[KEY_LEN + 1];
+    snprintf(buf, sizeof(buf), "user%010zu", i);
+    memcpy(key, buf, KEY_LEN);
+}
+
+typedef struct _worker {
+    pthread_t thread;
+    kv_store *kv;
+    const workload *wl;
+    atomic_bool *stop;
+    uint64_t seed;
+    uint64_t ops;
+} worker;
+
+static void *run_worker(void *arg) {
+    worker *w = (worker *)arg;
+    uint64_t rng = w->seed;
+    unsigned char key[KEY_LEN];
+    unsigned char value[VALUE_LEN];
+    memset(value, 'u', VALUE_LEN);
+
+    while (!atomic_load_explicit(w->stop, memory_order_relaxed)) {
+        make_key(key, zipf_next(&rng, RECORDS));
+        double u = (double)(xorshift(&rng) >> 11) / (double)(1ULL << 53);
+        if (u < w->wl->read_share) {
+            kv_value_unref(kv_get(w->kv, key, KEY_LEN));
+        } else {
+            kv_set(w->kv, key, KEY_LEN, value, VALUE_LEN);
+        }
+        w->ops++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Run a workload with a number of threads for a while.
+ *
+ * @return double The throughput in operations per second
+ */
+static double run(kv_store *kv, const workload *wl, size_t n_threads,
+                  double seconds) {
+    atomic_bool stop = false;
+    worker *workers = (worker *)calloc(n_threads, sizeof(worker));
+    for (size_t i = 0; i < n_threads; i++) {
+        workers[i].kv = kv;
+        workers[i].wl = wl;
+        workers[i].stop = &stop;
+        workers[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+
+    struct timespec pause = {(time_t)seconds,
+                             (long)((seconds - (time_t)seconds) * 1e9)};
+    nanosleep(&pause, NULL);
+    atomic_store(&stop, true);
+
+    uint64_t ops = 0;
+    for (size_t i = 0; i < n_threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+    }
+    free(workers);
+    return ops / seconds;
+}
+
+/**
+ * @brief YCSB-style workloads A, B and C (zipfian keys) against the striped
+ * store and against a single shard (one global lock) for comparison.
+ *
+ * Usage: './kv-ycsb [max_threads] [seconds]'
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return int The exit code
+ */
+int main(int argc, char **argv) {
+    size_t max_threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+    double seconds = argc > 2 ? strtod(argv[2], NULL) : 1.0;
+
+    zipf_init(RECORDS);
+
+    size_t shard_counts[] = {1, KV_SHARDS};
+    printf("%-8s %6s %7s %14s\n", "workload", "shards", "threads", "ops/s");
+    for (size_t s = 0; s < sizeof(shard_counts) / sizeof(size_t); s++) {
+        kv_store *kv = kv_new(shard_counts[s]);
+        unsigned char key[KEY_LEN];
+        unsigned char value[VALUE_LEN];
+        memset(value, 'v', VALUE_LEN);
+        for (size_t i = 0; i < RECORDS; i++) {
+            make_key(key, i);
+            kv_set(kv, key, KEY_LEN, value, VALUE_LEN);
+        }
+
+        for (size_t w = 0; w < sizeof(workloads) / sizeof(workload); w++) {
+            for (size_t t = 1; t <= max_threads; t *= 2) {
+                double tput = run(kv, &workloads[w], t, seconds);
+                printf("%-8s %6zu %7zu %14.0f\n", workloads[w].name,
+                       kv->n_shards, t, tput);
+            }
+        }
+        kv_free(kv);
+    }
+    return 0;
+}
@@ -0,0 +1,392 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vnode.h"
+
+#define NODES 128
+#define LOOKUPS 20000
+#define LATENCY_MS 1.0 // one-way delay of every message
+#define JITTER_MS 1.0  // mean of the exponential extra delay
+#define SLOW_SHARE 0.05 // nodes that take long to answer
+#define SLOW_MS 100.0
+#define LOOKUP_TIMEOUT_MS 500 // as in peer.c: doubles per retry
+#define LOOKUP_MAX_RETRIES 3
+#define LOOKUP_STEP_MS 150 // as in peer.c: iterative step without progress
+
+/*
+ * A message on its way (or the deadline of a lookup attempt).
+ */
+typedef enum _ev_type {
+    LKUP,
+    LKUP_ITER,
+    RPLY,
+    REFERRAL,
+    DEADLINE,
+    STEP
+} ev_type;
+
+typedef struct _event {
+    double t;
+    ev_type type;
+    size_t to;
+    size_t node; // the node named by RPLY and REFERRAL, progress for STEP
+    int attempt; // DEADLINE and STEP only
+} event;
+
+/*
+ * Binary min-heap of events by time.
+ */
+typedef struct _queue {
+    event *ev;
+    size_t count;
+    size_t cap;
+} queue;
+
+static void queue_push(queue *q, event e) {
+    if (q->count == q->cap) {
+        q->cap = q->cap > 0 ? 2 * q->cap : 64;
+        q->ev = (event *)realloc(q->ev, q->cap * sizeof(event));
+    }
+    size_t i = q->count++;
+    while (i > 0 && q->ev[(i - 1) / 2].t > e.t) {
+        q->ev[i] = q->ev[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    q->ev[i] = e;
+}
+
+static event queue_pop(queue *q) {
+    event top = q->ev[0];
+    event last = q->ev[--q->count];
+    size_t i = 0;
+    while (2 * i + 1 < q->count) {
+        size_t c = 2 * i + 1;
+        if (c + 1 < q->count && q->ev[c + 1].t < q->ev[c].t) {
+            c++;
+        }
+        if (last.t <= q->ev[c].t) {
+            break;
+        }
+        q->ev[i] = q->ev[c];
+        i = c;
+    }
+    q->ev[i] = last;
+    return top;
+}
+
+static uint64_t net_rng = 0x9E3779B97F4A7C15ULL; // delays and losses
+static uint64_t work_rng = 0x2545F4914F6CDD1DULL; // ring and lookups
+
+static double uniform(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (double)((*state * 2685821657736338717ULL) >> 11) /
+           (double)(1ULL << 53);
+}
+
+/*
+ * The simulated ring: every node is a vnode with a complete finger table, so
+ * routing decisions are the ones of vnode.c. A peer's port is its index.
+ */
+static vnode nodes[NODES];
+static bool slow[NODES];
+
+static size_t index_of(const peer *p) {
+    return p->port - 1;
+}
+
+static int id_cmp(const void *a, const void *b) {
+    return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+static size_t successor_index(const uint16_t *ids, uint16_t id) {
+    for (size_t i = 0; i < NODES; i++) {
+        if (ids[i] >= id) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static peer *node_peer(const uint16_t *ids, size_t i) {
+    char port[16];
+    snprintf(port, sizeof(port), "%zu", i + 1);
+    return peer_init(ids[i], "127.0.0.1", port);
+}
+
+static void ring_init(void) {
+    uint16_t ids[NODES];
+    for (size_t i = 0; i < NODES; i++) {
+        bool taken;
+        do {
+            ids[i] = (uint16_t)(uniform(&work_rng) * 65536);
+            taken = false;
+            for (size_t k = 0; k < i; k++) {
+                taken |= ids[k] == ids[i];
+            }
+        } while (taken);
+    }
+    qsort(ids, NODES, sizeof(uint16_t), id_cmp);
+
+    for (size_t i = 0; i < NODES; i++) {
+        nodes[i].self = node_peer(ids, i);
+        nodes[i].pred = node_peer(ids, (i + NODES - 1) % NODES);
+        nodes[i].succ = node_peer(ids, (i + 1) % NODES);
+
+        finger_table *fng_tab = calloc(1, sizeof(finger_table));
+        fng_tab->ft = calloc(SIZE_OF_FT, sizeof(peer *));
+        for (size_t k = 0; k < SIZE_OF_FT; k++) {
+            size_t f = successor_index(ids, finger_start(ids[i], k));
+            fng_tab->ft[k] = node_peer(ids, f);
+        }
+        fng_tab->finger_count = SIZE_OF_FT;
+        fng_tab->state = FT_ACTIVE;
+        nodes[i].fng_tab = fng_tab;
+
+        slow[i] = uniform(&work_rng) < SLOW_SHARE;
+    }
+}
+
+/*
+ * One lookup in flight and the network it runs on.
+ */
+typedef struct _sim {
+    queue q;
+    double now;
+    double loss;
+    int alpha; // 0 = recursive
+    size_t origin;
+    uint16_t hash_id;
+
+    bool done;
+    int attempt;
+    uint16_t progress;
+    size_t best; // the closest node a referral named so far
+    size_t messages;
+} sim;
+
+/**
+ * @brief Put a message on the network.
+ *
+ * @param s The lookup
+ * @param from The node that answers a lookup (slow nodes answer late) or
+ * NODES for the origin sending its own probes
+ * @param e The message
+ */
+static void sim_send(sim *s, size_t from, event e) {
+    s->messages++;
+    if (uniform(&net_rng) < s->loss) {
+        return; // lost
+    }
+    e.t = s->now + LATENCY_MS - JITTER_MS * log(1.0 - uniform(&net_rng)) +
+          (from < NODES && slow[from] ? SLOW_MS : 0.0);
+    queue_push(&s->q, e);
+}
+
+static void send_lookup(sim *s, const peer *hop, ev_type type) {
+    event e = {0, type, index_of(hop), 0, 0};
+    sim_send(s, NODES, e);
+}
+
+static void arm_step(sim *s) {
+    event step = {s->now + LOOKUP_STEP_MS, STEP, s->origin, s->progress,
+                  s->attempt};
+    queue_push(&s->q, step);
+}
+
+/**
+ * @brief Probe alpha distinct fingers at once, the next ones on every retry,
+ * like probe_parked_lookup in peer.c.
+ */
+static void send_probes(sim *s) {
+    vnode *v = &nodes[s->origin];
+    peer *probed[SIZE_OF_FT];
+    size_t n_probed = 0;
+    for (int k = 0; k < s->alpha; k++) {
+        peer *hop = vnode_lookup_hop(v, s->hash_id, s->attempt * s->alpha + k);
+        bool dup = false;
+        for (size_t i = 0; i < n_probed; i++) {
+            dup = dup || probed[i] == hop;
+        }
+        if (dup) {
+            continue;
+        }
+        probed[n_probed++] = hop;
+        send_lookup(s, hop, LKUP_ITER);
+    }
+}
+
+/**
+ * @brief Start an attempt of the lookup, like send_parked_lookup in peer.c.
+ */
+static void start_attempt(sim *s) {
+    vnode *v = &nodes[s->origin];
+    event deadline = {s->now + ((double)LOOKUP_TIMEOUT_MS * (1 << s->attempt)),
+                      DEADLINE, s->origin, 0, s->attempt};
+    queue_push(&s->q, deadline);
+
+    if (s->alpha == 0) {
+        send_lookup(s, vnode_lookup_hop(v, s->hash_id, s->attempt), LKUP);
+        return;
+    }
+    s->progress = UINT16_MAX;
+    send_probes(s);
+    arm_step(s);
+}
+
+/**
+ * @brief A node handles a lookup, like handle_lookup in peer.c.
+ */
+static void handle_lookup(sim *s, size_t at, ev_type type) {
+    vnode *v = &nodes[at];
+    event e = {0, RPLY, s->origin, at, 0};
+    if (peer_is_responsible(v->pred->node_id, v->self->node_id, s->hash_id)) {
+        sim_send(s, at, e);
+    } else if (peer_is_responsible(v->self->node_id, v->succ->node_id,
+                                   s->hash_id)) {
+        e.node = index_of(v->succ);
+        sim_send(s, at, e);
+    } else if (type == LKUP_ITER) {
+        e.type = REFERRAL;
+        e.node = index_of(vnode_closest_preceding_finger(v, s->hash_id));
+        sim_send(s, at, e);
+    } else {
+        e.type = LKUP;
+        e.to = index_of(vnode_closest_preceding_finger(v, s->hash_id));
+        sim_send(s, at, e);
+    }
+}
+
+/**
+ * @brief Run one lookup until it is answered or given up.
+ *
+ * @return double The latency in ms (INFINITY if it failed)
+ */
+static double run_lookup(sim *s) {
+    s->q.count = 0;
+    s->now = 0;
+    s->done = false;
+    s->attempt = 0;
+    start_attempt(s);
+
+    while (s->q.count > 0) {
+        event e = queue_pop(&s->q);
+        s->now = e.t;
+        switch (e.type) {
+        case LKUP:
+        case LKUP_ITER:
+            handle_lookup(s, e.to, e.type);
+            break;
+        case RPLY:
+            return s->now;
+        case REFERRAL: {
+            uint16_t dist = s->hash_id - nodes[e.node].self->node_id;
+            if (dist < s->progress) {
+                s->progress = dist;
+                s->best = e.node;
+                send_lookup(s, nodes[e.node].self, LKUP_ITER);
+                arm_step(s);
+            }
+            break;
+        }
+        case STEP:
+            if (e.attempt != s->attempt || e.node != s->progress) {
+                break; // the lookup moved on meanwhile
+            }
+            // no progress for a while: ask again
+            if (s->progress == UINT16_MAX) {
+                send_probes(s);
+            } else {
+                send_lookup(s, nodes[s->best].self, LKUP_ITER);
+            }
+            arm_step(s);
+            break;
+        case DEADLINE:
+            if (e.attempt != s->attempt) {
+                break; // an earlier attempt
+            }
+            if (s->attempt == LOOKUP_MAX_RETRIES) {
+                return INFINITY;
+            }
+            s->attempt++;
+            start_attempt(s);
+            break;
+        }
+    }
+    return INFINITY;
+}
+
+static int double_cmp(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Recursive against iterative lookups (alpha parallel probes) on a
+ * simulated ring with message loss and a few slow nodes. The routing decisions
+ * are made by vnode.c, timeouts and retries are those of peer.c.
+ *
+ * Usage: './lookup-modes [lookups]'
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return int The exit code
+ */
+int main(int argc, char **argv) {
+    size_t lookups = argc > 1 ? strtoul(argv[1], NULL, 10) : LOOKUPS;
+    double losses[] = {0.0, 0.01, 0.05};
+    int alphas[] = {0, 1, 2, 3};
+
+    ring_init();
+    double *lat = (double *)malloc(lookups * sizeof(double));
+
+    printf("%d nodes, %.0f%% slow (+%.0f ms), %.0f ms + exp(%.0f ms) per "
+           "message\n",
+           NODES, SLOW_SHARE * 100, SLOW_MS, LATENCY_MS, JITTER_MS);
+    printf("%-5s %-12s %9s %9s %9s %9s %8s %9s\n", "loss", "mode", "p50 ms",
+           "p99 ms", "p99.9 ms", "max ms", "failed", "msgs/lkp");
+    for (size_t l = 0; l < sizeof(losses) / sizeof(double); l++) {
+        for (size_t a = 0; a < sizeof(alphas) / sizeof(int); a++) {
+            sim s = {0};
+            s.loss = losses[l];
+            s.alpha = alphas[a];
+
+            size_t failed = 0;
+            uint64_t lookup_rng = work_rng; // same lookups for every mode
+            for (size_t i = 0; i < lookups; i++) {
+                // the origin does not look up what it or its succ serves
+                vnode *v;
+                do {
+                    s.origin = (size_t)(uniform(&lookup_rng) * NODES);
+                    s.hash_id = (uint16_t)(uniform(&lookup_rng) * 65536);
+                    v = &nodes[s.origin];
+                } while (peer_is_responsible(v->pred->node_id, v->succ->node_id,
+                                             s.hash_id));
+                lat[i] = run_lookup(&s);
+                failed += isinf(lat[i]);
+            }
+            qsort(lat, lookups, sizeof(double), double_cmp);
+
+            char mode[16];
+            if (s.alpha == 0) {
+                snprintf(mode, sizeof(mode), "recursive");
+            } else {
+                snprintf(mode, sizeof(mode), "iter a=%d", s.alpha);
+            }
+            printf("%4.0f%% %-12s %9.1f %9.1f %9.1f %9.1f %7.2f%% %9.1f\n",
+                   losses[l] * 100, mode, lat[lookups / 2],
+                   lat[(size_t)(lookups * 0.99)], lat[(size_t)(lookups * 0.999)],
+                   lat[lookups - 1], 100.0 * failed / lookups,
+                   (double)s.messages / lookups);
+            free(s.q.ev);
+        }
+    }
+    free(lat);
+    return 0;
+}
@@ -0,0 +1,598 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hash_table.h"
+#include "neighbour.h"
+#include "packet.h"
+#include "requests.h"
+#include "util.h"
+
+#define KEY_LEN 16
+#define VALUE_LEN 32
+#define INPUTS 4096 // precomputed random inputs per case, used round robin
+#define CALIBRATE_NS 10000000 // run at least this long to estimate the rate
+#define MAX_CASES 64
+#define MAX_REPS 100
+
+/*
+ * A case runs its operation iters times on state prepared by setup. The
+ * operations allocate and free what the peer allocates and frees on the same
+ * path (e.g. decoding includes packet_free), so the numbers compare with
+ * what a request costs there.
+ */
+typedef struct _bench_case {
+    const char *name;
+    void *(*setup)(size_t arg);
+    void (*run)(void *state, size_t iters);
+    void (*teardown)(void *state);
+    size_t arg;
+} bench_case;
+
+typedef struct _bench_result {
+    char name[64];
+    size_t iters; // per repetition
+    double ns_per_op; // median of the repetitions
+    double min_ns_per_op;
+} bench_result;
+
+typedef struct _config {
+    const char *filter;
+    double rep_ms;
+    int reps;
+    bool json;
+    const char *out_path;
+    const char *baseline_path;
+    double threshold; // percent
+} config;
+
+// results are folded into this so the compiler keeps the operations
+static volatile uintptr_t sink;
+
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static uint64_t next_rand() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void make_key(unsigned char *key, size_t i) {
+    char digits[32]; // room for any %zu, only KEY_LEN bytes are used
+    snprintf(digits, sizeof(digits), "key-%012zu", i);
+    memcpy(key, digits, KEY_LEN);
+}
+
+/* packet codec */
+
+typedef struct _codec_state {
+    packet *p;
+    unsigned char *raw;
+    size_t raw_len;
+} codec_state;
+
+/**
+ * @brief A control packet for arg 0, otherwise a data packet (SET) with a
+ * value of arg bytes.
+ */
+static void *codec_setup(size_t arg) {
+    codec_state *s = (codec_state *)calloc(1, sizeof(codec_state));
+    s->p = packet_new();
+    if (arg == 0) {
+        s->p->flags = PKT_FLAG_CTRL | PKT_FLAG_LKUP;
+        s->p->hash_id = 4711;
+        s->p->node_id = 1000;
+        s->p->node_ip = 0x7F000001;
+        s->p->node_port = 4711;
+    } else {
+        s->p->flags = PKT_FLAG_SET;
+        s->p->key_len = KEY_LEN;
+        s->p->key = (unsigned char *)malloc(KEY_LEN);
+        make_key(s->p->key, 42);
+        s->p->value_len = (uint32_t)arg;
+        s->p->value = (unsigned char *)malloc(arg);
+        memset(s->p->value, 'v', arg);
+    }
+    s->raw = packet_serialize(s->p, &s->raw_len);
+    return s;
+}
+
+static void codec_teardown(void *state) {
+    codec_state *s = (codec_state *)state;
+    packet_free(s->p);
+    free(s->raw);
+    free(s);
+}
+
+static void run_serialize(void *state, size_t iters) {
+    codec_state *s = (codec_state *)state;
+    for (size_t i = 0; i < iters; i++) {
+        size_t len;
+        unsigned char *raw = packet_serialize(s->p, &len);
+        sink += raw[len - 1];
+        free(raw);
+    }
+}
+
+static void run_decode_hdr(void *state, size_t iters) {
+    codec_state *s = (codec_state *)state;
+    for (size_t i = 0; i < iters; i++) {
+        packet *p = packet_decode_hdr(s->raw, s->raw_len);
+        sink += p->flags;
+        packet_free(p);
+    }
+}
+
+static void run_decode(void *state, size_t iters) {
+    codec_state *s = (codec_state *)state;
+    for (size_t i = 0; i < iters; i++) {
+        packet *p = packet_decode_hdr(s->raw, s->raw_len);
+        p = packet_decode_body(p, s->raw + PKT_HEADER_LEN,
+                               s->raw_len - PKT_HEADER_LEN);
+        sink += p->value_len + p->node_port;
+        packet_free(p);
+    }
+}
+
+/* ring buffer */
+
+typedef struct _rb_state {
+    ring_buffer *rb;
+    unsigned char *chunk;
+    size_t chunk_len;
+} rb_state;
+
+/**
+ * @brief A ring buffer of 64 KiB, written and read in chunks of arg bytes.
+ */
+static void *rb_setup(size_t arg) {
+    rb_state *s = (rb_state *)calloc(1, sizeof(rb_state));
+    s->rb = rb_new(65536);
+    s->chunk = (unsigned char *)malloc(arg);
+    memset(s->chunk, 'c', arg);
+    s->chunk_len = arg;
+    return s;
+}
+
+static void rb_teardown(void *state) {
+    rb_state *s = (rb_state *)state;
+    rb_free(s->rb);
+    free(s->chunk);
+    free(s);
+}
+
+static void run_rb(void *state, size_t iters) {
+    rb_state *s = (rb_state *)state;
+    for (size_t i = 0; i < iters; i++) {
+        rb_write(s->rb, s->chunk, s->chunk_len);
+        sink += rb_read(s->rb, s->chunk, s->chunk_len);
+    }
+}
+
+/* pseudo_hash and peer_is_responsible */
+
+typedef struct _input_state {
+    unsigned char keys[INPUTS][KEY_LEN];
+    uint16_t ids[INPUTS][3];
+} input_state;
+
+static void *input_setup(size_t arg) {
+    (void)arg;
+    input_state *s = (input_state *)malloc(sizeof(input_state));
+    for (size_t i = 0; i < INPUTS; i++) {
+        make_key(s->keys[i], (size_t)next_rand());
+        for (int j = 0; j < 3; j++) {
+            s->ids[i][j] = (uint16_t)next_rand();
+        }
+    }
+    return s;
+}
+
+static void run_pseudo_hash(void *state, size_t iters) {
+    input_state *s = (input_state *)state;
+    for (size_t i = 0; i < iters; i++) {
+        sink += pseudo_hash(s->keys[i % INPUTS], KEY_LEN);
+    }
+}
+
+static void run_peer_is_responsible(void *state, size_t iters) {
+    input_state *s = (input_state *)state;
+    for (size_t i = 0; i < iters; i++) {
+        const uint16_t *ids = s->ids[i % INPUTS];
+        sink += peer_is_responsible(ids[0], ids[1], ids[2]);
+    }
+}
+
+/* hash table */
+
+typedef struct _htable_state {
+    htable *ht;
+    size_t size;
+    unsigned char value[VALUE_LEN];
+    unsigned char keys[INPUTS][KEY_LEN]; // present in the table
+    unsigned char missing[INPUTS][KEY_LEN]; // not in the table
+} htable_state;
+
+/**
+ * @brief A table holding arg keys with values of VALUE_LEN bytes.
+ */
+static void *htable_setup(size_t arg) {
+    htable_state *s = (htable_state *)calloc(1, sizeof(htable_state));
+    s->size = arg;
+    memset(s->value, 'v', VALUE_LEN);
+    unsigned char key[KEY_LEN];
+    for (size_t i = 0; i < arg; i++) {
+        make_key(key, i);
+        htable_set(&s->ht, key, KEY_LEN, kv_value_new(s->value, VALUE_LEN));
+    }
+    for (size_t i = 0; i < INPUTS; i++) {
+        make_key(s->keys[i], (size_t)(next_rand() % arg));
+        make_key(s->missing[i], arg + i);
+    }
+    return s;
+}
+
+static void htable_teardown(void *state) {
+    htable_state *s = (htable_state *)state;
+    htable *e, *tmp;
+    HASH_ITER(hh, s->ht, e, tmp) {
+        kv_value_unref(htable_delete(&s->ht, e->key, e->key_len));
+    }
+    free(s);
+}
+
+static void run_htable_get(void *state, size_t iters) {
+    htable_state *s = (htable_state *)state;
+    for (size_t i = 0; i < iters; i++) {
+        htable *e = htable_get(&s->ht, s->keys[i % INPUTS], KEY_LEN);
+        sink += e->value->len;
+    }
+}
+
+static void run_htable_get_miss(void *state, size_t iters) {
+    htable_state *s = (htable_state *)state;
+    for (size_t i = 0; i < iters; i++) {
+        sink += (uintptr_t)htable_get(&s->ht, s->missing[i % INPUTS], KEY_LEN);
+    }
+}
+
+/**
+ * @brief Overwrite present keys (a SET of a stored key).
+ */
+static void run_htable_set(void *state, size_t iters) {
+    htable_state *s = (htable_state *)state;
+    for (size_t i = 0; i < iters; i++) {
+        kv_value_unref(htable_set(&s->ht, s->keys[i % INPUTS], KEY_LEN,
+                                  kv_value_new(s->value, VALUE_LEN)));
+    }
+}
+
+/**
+ * @brief Insert a new key and delete it again, so the table keeps its size.
+ */
+static void run_htable_set_delete(void *state, size_t iters) {
+    htable_state *s = (htable_state *)state;
+    for (size_t i = 0; i < iters; i++) {
+        const unsigned char *key = s->missing[i % INPUTS];
+        htable_set(&s->ht, key, KEY_LEN, kv_value_new(s->value, VALUE_LEN));
+        kv_value_unref(htable_delete(&s->ht, key, KEY_LEN));
+    }
+}
+
+/* parked requests */
+
+typedef struct _requests_state {
+    rtable *table;
+    size_t per_hash;
+} requests_state;
+
+/**
+ * @brief arg requests wait for the same hash_id, next to 1024 other hash_ids
+ * with one parked request each.
+ */
+static void *requests_setup(size_t arg) {
+    requests_state *s = (requests_state *)calloc(1, sizeof(requests_state));
+    s->per_hash = arg;
+    for (uint16_t h = 0; h < 1024; h++) {
+        add_request(&s->table, (uint16_t)(h + 1), NULL, -1, packet_new());
+    }
+    return s;
+}
+
+static void requests_teardown(void *state) {
+    requests_state *s = (requests_state *)state;
+    for (uint16_t h = 0; h < 1024; h++) {
+        clear_requests(&s->table, (uint16_t)(h + 1));
+    }
+    free(s);
+}
+
+/**
+ * @brief Park per_hash requests for one hash_id and clear them, as when a
+ * lookup is answered. One operation is one request.
+ */
+static void run_requests(void *state, size_t iters) {
+    requests_state *s = (requests_state *)state;
+    for (size_t i = 0; i < iters; i += s->per_hash) {
+        for (size_t j = 0; j < s->per_hash; j++) {
+            packet *p = packet_new();
+            p->flags = PKT_FLAG_GET;
+            add_request(&s->table, 50000, NULL, (int)j, p);
+        }
+        clear_requests(&s->table, 50000);
+    }
+}
+
+static const bench_case cases[] = {
+    {"packet_serialize/ctrl", codec_setup, run_serialize, codec_teardown, 0},
+    {"packet_serialize/data/64", codec_setup, run_serialize, codec_teardown,
+     64},
+    {"packet_serialize/data/1024", codec_setup, run_serialize, codec_teardown,
+     1024},
+    {"packet_serialize/data/65536", codec_setup, run_serialize,
+     codec_teardown, 65536},
+    {"packet_decode_hdr/ctrl", codec_setup, run_decode_hdr, codec_teardown, 0},
+    {"packet_decode_hdr/data", codec_setup, run_decode_hdr, codec_teardown,
+     64},
+    {"packet_decode/ctrl", codec_setup, run_decode, codec_teardown, 0},
+    {"packet_decode/data/64", codec_setup, run_decode, codec_teardown, 64},
+    {"packet_decode/data/1024", codec_setup, run_decode, codec_teardown, 1024},
+    {"packet_decode/data/65536", codec_setup, run_decode, codec_teardown,
+     65536},
+    {"rb_write_read/64", rb_setup, run_rb, rb_teardown, 64},
+    {"rb_write_read/1500", rb_setup, run_rb, rb_teardown, 1500},
+    {"rb_write_read/16384", rb_setup, run_rb, rb_teardown, 16384},
+    {"pseudo_hash", input_setup, run_pseudo_hash, free, 0},
+    {"peer_is_responsible", input_setup, run_peer_is_responsible, free, 0},
+    {"htable_get/1024", htable_setup, run_htable_get, htable_teardown, 1024},
+    {"htable_get/16384", htable_setup, run_htable_get, htable_teardown,
+     16384},
+    {"htable_get/262144", htable_setup, run_htable_get, htable_teardown,
+     262144},
+    {"htable_get_miss/262144", htable_setup, run_htable_get_miss,
+     htable_teardown, 262144},
+    {"htable_set/1024", htable_setup, run_htable_set, htable_teardown, 1024},
+    {"htable_set/262144", htable_setup, run_htable_set, htable_teardown,
+     262144},
+    {"htable_set_delete/1024", htable_setup, run_htable_set_delete,
+     htable_teardown, 1024},
+    {"htable_set_delete/262144", htable_setup, run_htable_set_delete,
+     htable_teardown, 262144},
+    {"add_clear_requests/1", requests_setup, run_requests, requests_teardown,
+     1},
+    {"add_clear_requests/8", requests_setup, run_requests, requests_teardown,
+     8},
+};
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Run a case: find how many iterations take rep_ms, then time reps
+ * repetitions of that many.
+ */
+static void run_case(const bench_case *c, const config *cfg, bench_result *r) {
+    void *state = c->setup(c->arg);
+
+    size_t iters = 1;
+    uint64_t elapsed;
+    for (;;) {
+        uint64_t start = now_ns();
+        c->run(state, iters);
+        elapsed = now_ns() - start;
+        if (elapsed >= CALIBRATE_NS) {
+            break;
+        }
+        iters *= 2;
+    }
+    double per_op = (double)elapsed / iters;
+    iters = (size_t)(cfg->rep_ms * 1e6 / per_op);
+    if (iters < 1) {
+        iters = 1;
+    }
+
+    double ns[MAX_REPS];
+    for (int rep = 0; rep < cfg->reps; rep++) {
+        uint64_t start = now_ns();
+        c->run(state, iters);
+        ns[rep] = (double)(now_ns() - start) / iters;
+    }
+    qsort(ns, cfg->reps, sizeof(double), compare_double);
+
+    snprintf(r->name, sizeof(r->name), "%s", c->name);
+    r->iters = iters;
+    r->ns_per_op = ns[cfg->reps / 2];
+    r->min_ns_per_op = ns[0];
+    c->teardown(state);
+}
+
+/**
+ * @brief Write the results as JSON, one benchmark per line (which is what
+ * load_baseline reads back).
+ */
+static void write_json(FILE *out, const bench_result *results, size_t n) {
+    fprintf(out, "{\"benchmarks\": [\n");
+    for (size_t i = 0; i < n; i++) {
+        fprintf(out,
+                "  {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": "
+                "%.3f, \"min_ns_per_op\": %.3f}%s\n",
+                results[i].name, results[i].iters, results[i].ns_per_op,
+                results[i].min_ns_per_op, i + 1 < n ? "," : "");
+    }
+    fprintf(out, "]}\n");
+}
+
+/**
+ * @brief Read the results of an earlier run written by write_json.
+ *
+ * @return ssize_t The number of results, -1 if the file cannot be read
+ */
+static ssize_t load_baseline(const char *path, bench_result *results) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    char line[512];
+    size_t n = 0;
+    while (n < MAX_CASES && fgets(line, sizeof(line), f) != NULL) {
+        bench_result *r = &results[n];
+        if (sscanf(line,
+                   " {\"name\": \"%63[^\"]\", \"iterations\": %zu, "
+                   "\"ns_per_op\": %lf, \"min_ns_per_op\": %lf",
+                   r->name, &r->iters, &r->ns_per_op,
+                   &r->min_ns_per_op) == 4) {
+            n++;
+        }
+    }
+    fclose(f);
+    return (ssize_t)n;
+}
+
+/**
+ * @brief Print each result next to its baseline.
+ *
+ * @return size_t The number of cases slower than the baseline by more than
+ * the threshold
+ */
+static size_t compare(const bench_result *results, size_t n,
+                      const bench_result *base, size_t n_base,
+                      double threshold, FILE *out) {
+    size_t regressed = 0;
+    fprintf(out, "%-30s %12s %12s %9s\n", "benchmark", "baseline ns",
+            "ns/op", "change");
+    for (size_t i = 0; i < n; i++) {
+        const bench_result *b = NULL;
+        for (size_t j = 0; j < n_base; j++) {
+            if (strcmp(base[j].name, results[i].name) == 0) {
+                b = &base[j];
+                break;
+            }
+        }
+        if (b == NULL) {
+            fprintf(out, "%-30s %12s %12.1f %9s\n", results[i].name, "-",
+                    results[i].ns_per_op, "new");
+            continue;
+        }
+        double change = (results[i].ns_per_op / b->ns_per_op - 1) * 100;
+        bool slower = change > threshold;
+        regressed += slower;
+        fprintf(out, "%-30s %12.1f %12.1f %+8.1f%%%s\n", results[i].name,
+                b->ns_per_op, results[i].ns_per_op, change,
+                slower ? "  REGRESSED" : "");
+    }
+    return regressed;
+}
+
+/**
+ * @brief Time the hot functions of the peer (packet codec, ring buffer,
+ * hashing, key-value table, parked requests) in isolation.
+ *
+ * @return int 0, or 1 if a case regressed against the baseline
+ */
+int main(int argc, char **argv) {
+    config cfg = {NULL, 100, 5, false, NULL, NULL, 10};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:r:jo:b:x:")) != -1) {
+        switch (opt) {
+        case 'f':
+            cfg.filter = optarg;
+            break;
+        case 't':
+            cfg.rep_ms = atof(optarg);
+            break;
+        case 'r':
+            cfg.reps = atoi(optarg);
+            break;
+        case 'j':
+            cfg.json = true;
+            break;
+        case 'o':
+            cfg.out_path = optarg;
+            break;
+        case 'b':
+            cfg.baseline_path = optarg;
+            break;
+        case 'x':
+            cfg.threshold = atof(optarg);
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: './microbench [-f filter] [-t ms_per_rep] "
+                    "[-r reps] [-j] [-o results.json] [-b baseline.json] "
+                    "[-x threshold_percent]'\n");
+            return 1;
+        }
+    }
+    if (cfg.rep_ms <= 0 || cfg.reps < 1 || cfg.reps > MAX_REPS) {
+        fprintf(stderr, "Invalid repetition time or count!\n");
+        return 1;
+    }
+
+    bench_result base[MAX_CASES];
+    ssize_t n_base = 0;
+    if (cfg.baseline_path != NULL) {
+        n_base = load_baseline(cfg.baseline_path, base);
+        if (n_base < 0) {
+            return 1;
+        }
+    }
+
+    // with -j the table goes to stderr, stdout is left for the JSON
+    FILE *table = cfg.json ? stderr : stdout;
+    bench_result results[MAX_CASES];
+    size_t n = 0;
+    if (cfg.baseline_path == NULL) {
+        fprintf(table, "%-30s %12s %12s %12s\n", "benchmark", "iterations",
+                "ns/op", "min ns/op");
+    }
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (cfg.filter != NULL && strstr(cases[i].name, cfg.filter) == NULL) {
+            continue;
+        }
+        run_case(&cases[i], &cfg, &results[n]);
+        if (cfg.baseline_path == NULL) {
+            fprintf(table, "%-30s %12zu %12.1f %12.1f\n", results[n].name,
+                    results[n].iters, results[n].ns_per_op,
+                    results[n].min_ns_per_op);
+        }
+        n++;
+    }
+
+    size_t regressed = 0;
+    if (cfg.baseline_path != NULL) {
+        regressed =
+            compare(results, n, base, (size_t)n_base, cfg.threshold, table);
+        fprintf(table, "%zu of %zu slower than the baseline by more than %.0f%%\n",
+                regressed, n, cfg.threshold);
+    }
+
+    if (cfg.json) {
+        write_json(stdout, results, n);
+    }
+    if (cfg.out_path != NULL) {
+        FILE *out = fopen(cfg.out_path, "w");
+        if (out == NULL) {
+            perror(cfg.out_path);
+            return 1;
+        }
+        write_json(out, results, n);
+        fclose(out);
+    }
+    return regressed > 0;
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "packet.h"
+#include "requests.h"
+
+#define ROUNDS 5
+#define KEY_LEN 16
+#define VALUE_LEN 256
+
+/**
+ * @brief Build a request like the server decodes it from a client.
+ */
+static packet *make_request(size_t i) {
+    packet *p = packet_new();
+    p->flags = PKT_FLAG_SET;
+    p->key_len = KEY_LEN;
+    p->key = (unsigned char *)malloc(KEY_LEN);
+    snprintf((char *)p->key, KEY_LEN, "key-%zu", i);
+    p->value_len = VALUE_LEN;
+    p->value = (unsigned char *)malloc(VALUE_LEN);
+    memset(p->value, 'v', VALUE_LEN);
+    return p;
+}
+
+static double ns_since(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+/**
+ * @brief Park n requests spread over n_hashes hash_ids, then clear them all.
+ */
+static void run(const char *name, size_t n, size_t n_hashes) {
+    rtable *table = NULL;
+    packet **packets = (packet **)malloc(n * sizeof(packet *));
+    double add_ns = 0;
+    double clear_ns = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (size_t i = 0; i < n; i++) {
+            packets[i] = make_request(i);
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < n; i++) {
+            add_request(&table, (uint16_t)(i % n_hashes), NULL, (int)i,
+                        packets[i]);
+        }
+        add_ns += ns_since(&start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t h = 0; h < n_hashes; h++) {
+            clear_requests(&table, (uint16_t)h);
+        }
+        clear_ns += ns_since(&start);
+    }
+
+    printf("%-8s %8zu %8zu %12.1f %12.1f\n", name, n, n_hashes,
+           add_ns / (ROUNDS * n), clear_ns / (ROUNDS * n));
+    free(packets);
+}
+
+/**
+ * @brief Stress the table of parked requests: one hot hash_id that many
+ * clients wait for and requests spread over many hash_ids.
+ *
+ * @return int The exit code
+ */
+int main() {
+    printf("%-8s %8s %8s %12s %12s\n", "workload", "requests", "hashes",
+           "ns/park", "ns/clear");
+    for (size_t n = 1000; n <= 64000; n *= 4) {
+        run("hot", n, 1);
+        run("spread", n, 1024);
+    }
+    return 0;
+}
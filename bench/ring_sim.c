@@ -0,0 +1,699 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stabilizer.h"
+#include "vnode.h"
+
+#define CHECK_MS 50.0 // how often the ring is checked for consistency
+#define SETTLE_MAX_MS 120000.0 // give up waiting for the ring or the FTs
+#define DRAIN_MS 5000.0 // time for the last lookups to finish
+#define HOPS_SHOWN 64 // longer lookups share the last row of the histogram
+
+/*
+ * A message on its way, or a timer of the simulation.
+ */
+typedef enum _ev_type {
+    JOIN,
+    STAB,
+    NTFY,
+    LKUP,
+    RPLY,
+    FNGR,
+    MSG_TYPES, // the ones above travel over the network
+    START, // a node starts and sends its JOIN
+    TICK, // a stabilize round is due
+    LOOKUP, // a data lookup starts
+    CHURN // a node crashes or a new one joins
+} ev_type;
+
+static const char *msg_names[] = {"JOIN", "STAB", "NTFY", "LKUP", "RPLY",
+                                  "FNGR"};
+
+typedef struct _event {
+    double t;
+    ev_type type;
+    size_t to;
+    size_t node; // the node named by the message (node_id/node_port)
+    uint16_t hash_id;
+    size_t hops; // LKUP messages so far
+    long lookup; // index of the data lookup, -1 for finger lookups
+    uint64_t gen; // TICK only: stale ticks are dropped
+} event;
+
+/*
+ * Binary min-heap of events by time.
+ */
+typedef struct _queue {
+    event *ev;
+    size_t count;
+    size_t cap;
+} queue;
+
+static void queue_push(queue *q, event e) {
+    if (q->count == q->cap) {
+        q->cap = q->cap > 0 ? 2 * q->cap : 64;
+        q->ev = (event *)realloc(q->ev, q->cap * sizeof(event));
+    }
+    size_t i = q->count++;
+    while (i > 0 && q->ev[(i - 1) / 2].t > e.t) {
+        q->ev[i] = q->ev[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    q->ev[i] = e;
+}
+
+static event queue_pop(queue *q) {
+    event top = q->ev[0];
+    event last = q->ev[--q->count];
+    size_t i = 0;
+    while (2 * i + 1 < q->count) {
+        size_t c = 2 * i + 1;
+        if (c + 1 < q->count && q->ev[c + 1].t < q->ev[c].t) {
+            c++;
+        }
+        if (last.t <= q->ev[c].t) {
+            break;
+        }
+        q->ev[i] = q->ev[c];
+        i = c;
+    }
+    q->ev[i] = last;
+    return top;
+}
+
+static uint64_t net_rng = 0x9E3779B97F4A7C15ULL; // delays and losses
+static uint64_t work_rng = 0x2545F4914F6CDD1DULL; // IDs, lookups, churn
+
+static double uniform(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (double)((*state * 2685821657736338717ULL) >> 11) /
+           (double)(1ULL << 53);
+}
+
+static double exponential(uint64_t *state, double mean) {
+    return -mean * log(1.0 - uniform(state));
+}
+
+/*
+ * A simulated peer with one virtual node. Its ring state and all decisions on
+ * it are those of vnode.c, its stabilize interval the one of stabilizer.c. A
+ * peer's port is its index + 1.
+ */
+typedef struct _node {
+    vnode v;
+    stabilizer *stab;
+    bool alive;
+    uint64_t tick_gen;
+    size_t received;
+    size_t sent;
+} node;
+
+/*
+ * A data lookup, started at a random node for a random hash.
+ */
+typedef struct _lookup {
+    double start;
+    double latency;
+    size_t hops;
+    bool done;
+    bool correct; // answered with the node actually responsible
+} lookup;
+
+static struct {
+    double join_gap_ms; // a new node joins every join_gap_ms
+    double latency_ms;
+    double jitter_ms;
+    double loss;
+    size_t n_nodes;
+    double churn_per_s;
+    double lookups_per_s;
+    double seconds;
+} cfg = {500.0, 1.0, 1.0, 0.0, 1000, 0.0, 100.0, 60.0};
+
+static node *nodes;
+static size_t n_started; // nodes[0, n_started) exist, alive or crashed
+static size_t capacity;
+static bool id_used[1 << 16];
+
+static queue q;
+static double now;
+static size_t sent_by_type[MSG_TYPES];
+static size_t lost;
+
+static lookup *lookups;
+static size_t n_lookups;
+
+static peer *node_peer(size_t i) {
+    char port[16];
+    snprintf(port, sizeof(port), "%zu", i + 1);
+    return peer_init(nodes[i].v.self->node_id, "127.0.0.1", port);
+}
+
+static size_t index_of(const peer *p) {
+    return p->port - 1;
+}
+
+/**
+ * @brief Put a message on the network. Messages to crashed nodes are lost,
+ * like a connection that cannot be opened.
+ */
+static void sim_send(size_t from, event e) {
+    e.t = now + cfg.latency_ms + exponential(&net_rng, cfg.jitter_ms);
+    sent_by_type[e.type]++;
+    nodes[from].sent++;
+    if (uniform(&net_rng) < cfg.loss) {
+        lost++;
+        return;
+    }
+    queue_push(&q, e);
+}
+
+static void schedule_tick(size_t i, double at) {
+    event e = {at, TICK, i, 0, 0, 0, -1, ++nodes[i].tick_gen};
+    queue_push(&q, e);
+}
+
+/**
+ * @brief Replace a pred or succ like publish_peer in peer.c: the ring
+ * changed, so the stabilize thread wakes up for a round right away.
+ */
+static void publish(size_t i, _Atomic(peer *) *slot, size_t named) {
+    peer *old = atomic_exchange(slot, node_peer(named));
+    if (old != NULL) {
+        peer_free(old);
+    }
+    stabilizer_changed(nodes[i].stab);
+    schedule_tick(i, now);
+}
+
+/**
+ * @brief The node that is actually responsible for a hash: the first live
+ * node clockwise from it.
+ */
+static size_t owner_of(uint16_t hash_id) {
+    size_t best = SIZE_MAX;
+    uint16_t best_dist = UINT16_MAX;
+    for (size_t i = 0; i < n_started; i++) {
+        if (!nodes[i].alive) {
+            continue;
+        }
+        uint16_t dist = nodes[i].v.self->node_id - hash_id;
+        if (best == SIZE_MAX || dist < best_dist) {
+            best = i;
+            best_dist = dist;
+        }
+    }
+    return best;
+}
+
+static void send_lookup(size_t from, const peer *hop, uint16_t hash_id,
+                        size_t hops, long lookup) {
+    event e = {0, LKUP, index_of(hop), from, hash_id, hops + 1, lookup, 0};
+    sim_send(from, e);
+}
+
+static int uint16_cmp(const void *a, const void *b) {
+    return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+/**
+ * @brief Whether every live node has the live nodes next to it as pred and
+ * succ.
+ */
+static bool ring_consistent(void) {
+    uint16_t *ids = (uint16_t *)malloc(n_started * sizeof(uint16_t));
+    size_t *by_id = (size_t *)malloc((1 << 16) * sizeof(size_t));
+    size_t n = 0;
+    for (size_t i = 0; i < n_started; i++) {
+        if (nodes[i].alive) {
+            ids[n++] = nodes[i].v.self->node_id;
+            by_id[nodes[i].v.self->node_id] = i;
+        }
+    }
+    qsort(ids, n, sizeof(uint16_t), uint16_cmp);
+
+    bool ok = true;
+    for (size_t k = 0; k < n && ok && n > 1; k++) {
+        vnode *v = &nodes[by_id[ids[k]]].v;
+        ok = v->succ != NULL && v->pred != NULL &&
+             v->succ->node_id == ids[(k + 1) % n] &&
+             v->pred->node_id == ids[(k + n - 1) % n];
+    }
+    free(ids);
+    free(by_id);
+    return ok;
+}
+
+static size_t fingers_active(void) {
+    size_t active = 0;
+    for (size_t i = 0; i < n_started; i++) {
+        finger_table *fng_tab = nodes[i].v.fng_tab;
+        active += nodes[i].alive && fng_tab != NULL &&
+                  fng_tab->state == FT_ACTIVE;
+    }
+    return active;
+}
+
+static size_t random_live_node(void) {
+    size_t i;
+    do {
+        i = (size_t)(uniform(&work_rng) * n_started);
+    } while (!nodes[i].alive);
+    return i;
+}
+
+/**
+ * @brief Bring up a new node with a fresh ID; it joins via a random live
+ * node, or founds the ring if it is the first.
+ */
+static size_t add_node(void) {
+    size_t i = n_started++;
+    uint16_t id;
+    do {
+        id = (uint16_t)(uniform(&work_rng) * 65536);
+    } while (id_used[id]);
+    id_used[id] = true;
+
+    char port[16];
+    snprintf(port, sizeof(port), "%zu", i + 1);
+    nodes[i].v.self = peer_init(id, "127.0.0.1", port);
+    nodes[i].stab = stabilizer_new(STABILIZE_MIN_MS, STABILIZE_MAX_MS);
+    event start = {now, START, i, 0, 0, 0, -1, 0};
+    queue_push(&q, start);
+    return i;
+}
+
+/**
+ * @brief Handle an event, the messages like handle_ring_ctrl and
+ * handle_route_ctrl in peer.c.
+ */
+static void handle(event e) {
+    size_t at = e.to;
+    node *n = &nodes[at];
+    vnode *v = &n->v;
+    if (!n->alive && e.type != START) {
+        return; // crashed
+    }
+    if (e.type < MSG_TYPES) {
+        n->received++;
+    }
+
+    switch (e.type) {
+    case START: {
+        n->alive = true;
+        if (at > 0) {
+            size_t entry;
+            do {
+                entry = random_live_node();
+            } while (entry == at && n_started > 1);
+            event join = {0, JOIN, entry, at, 0, 0, -1, 0};
+            sim_send(at, join);
+        }
+        schedule_tick(at, now + STABILIZE_MIN_MS);
+        break;
+    }
+    case JOIN: {
+        unsigned actions = vnode_on_join(v, nodes[e.node].v.self->node_id);
+        if (actions & RING_SET_PRED) {
+            publish(at, &v->pred, e.node);
+        }
+        if (actions & RING_SET_SUCC) {
+            publish(at, &v->succ, e.node);
+        }
+        if (actions & RING_REPLY) {
+            event ntfy = {0, NTFY, index_of(v->pred), at, 0, 0, -1, 0};
+            sim_send(at, ntfy);
+        } else if (v->succ != NULL) {
+            e.to = index_of(v->succ);
+            sim_send(at, e);
+        }
+        break;
+    }
+    case STAB: {
+        unsigned actions = vnode_on_stabilize(v, nodes[e.node].v.self->node_id);
+        if (actions & RING_SET_SUCC) {
+            publish(at, &v->succ, e.node);
+        }
+        if (actions & RING_SET_PRED) {
+            publish(at, &v->pred, e.node);
+        }
+        if (actions & RING_REPLY) {
+            event ntfy = {0, NTFY, e.node, index_of(v->pred), 0, 0, -1, 0};
+            sim_send(at, ntfy);
+        }
+        break;
+    }
+    case NTFY:
+        if (vnode_on_notify(v, nodes[e.node].v.self->node_id) & RING_SET_SUCC) {
+            publish(at, &v->succ, e.node);
+        }
+        break;
+    case FNGR: {
+        finger_table *old = atomic_exchange(&v->fng_tab, finger_table_new());
+        if (old != NULL) {
+            finger_table_free(old);
+        }
+        for (size_t i = 0; i < SIZE_OF_FT && v->succ != NULL; i++) {
+            uint16_t start = finger_start(v->self->node_id, i);
+            send_lookup(at, vnode_lookup_hop(v, start, 0), start, 0, -1);
+        }
+        break;
+    }
+    case LKUP: {
+        route r = vnode_route(v, 1, e.hash_id, false);
+        if (r.kind == ROUTE_SELF || r.kind == ROUTE_SUCC) {
+            event rply = {0, RPLY, e.node, index_of(r.next), e.hash_id, e.hops,
+                          e.lookup, 0};
+            sim_send(at, rply);
+        } else if (r.kind == ROUTE_FORWARD && e.hops < capacity) {
+            // (a lookup that took more hops than there are nodes loops)
+            e.to = index_of(r.next);
+            e.hops++;
+            sim_send(at, e);
+        }
+        break;
+    }
+    case RPLY:
+        vnode_add_finger(v, e.hash_id, nodes[e.node].v.self);
+        if (e.lookup >= 0 && !lookups[e.lookup].done) {
+            lookup *lk = &lookups[e.lookup];
+            lk->done = true;
+            lk->latency = now - lk->start;
+            lk->hops = e.hops;
+            lk->correct = e.node == owner_of(e.hash_id);
+        }
+        break;
+    case TICK: {
+        if (e.gen != n->tick_gen) {
+            break; // a round was started early meanwhile
+        }
+        size_t sent = 0;
+        size_t failed = 0;
+        peer *succ = v->succ;
+        if (succ != NULL) {
+            sent++;
+            failed += !nodes[index_of(succ)].alive; // connect fails
+            event stab = {0, STAB, index_of(succ), at, succ->node_id, 0, -1,
+                          0};
+            sim_send(at, stab);
+        }
+        schedule_tick(at, now + stabilizer_round_done(n->stab, sent, failed));
+        break;
+    }
+    case LOOKUP: {
+        size_t origin = random_live_node();
+        lookup *lk = &lookups[e.lookup];
+        lk->start = now;
+        route r = vnode_route(&nodes[origin].v, 1, e.hash_id, false);
+        if (r.kind == ROUTE_SELF || r.kind == ROUTE_SUCC) {
+            // served without a lookup
+            lk->done = true;
+            lk->correct = index_of(r.next) == owner_of(e.hash_id);
+        } else if (r.kind == ROUTE_FORWARD) {
+            send_lookup(origin, vnode_lookup_hop(&nodes[origin].v, e.hash_id, 0),
+                        e.hash_id, 0, e.lookup);
+        }
+        break;
+    }
+    case CHURN:
+        if (uniform(&work_rng) < 0.5 && n_started < capacity) {
+            add_node();
+        } else {
+            size_t alive = 0;
+            for (size_t i = 0; i < n_started; i++) {
+                alive += nodes[i].alive;
+            }
+            if (alive > 2) {
+                nodes[random_live_node()].alive = false;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Process all events up to a point in virtual time.
+ */
+static void run_until(double until) {
+    while (q.count > 0 && q.ev[0].t <= until) {
+        event e = queue_pop(&q);
+        now = e.t;
+        handle(e);
+    }
+    now = until;
+}
+
+/**
+ * @brief Check the ring every CHECK_MS until it is consistent.
+ *
+ * @return double The virtual time it took (INFINITY if it never was)
+ */
+static double settle(double from, double limit) {
+    while (now - from < limit) {
+        run_until(now + CHECK_MS);
+        if (ring_consistent()) {
+            return now - from;
+        }
+    }
+    return INFINITY;
+}
+
+static int size_cmp(const void *a, const void *b) {
+    size_t x = *(const size_t *)a;
+    size_t y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int double_cmp(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report_lookups(void) {
+    size_t hist[HOPS_SHOWN + 1] = {0};
+    size_t done = 0;
+    size_t correct = 0;
+    double hops_sum = 0;
+    double *lat = (double *)malloc((n_lookups + 1) * sizeof(double));
+    for (size_t l = 0; l < n_lookups; l++) {
+        if (!lookups[l].done) {
+            continue;
+        }
+        lat[done++] = lookups[l].latency;
+        correct += lookups[l].correct;
+        hops_sum += lookups[l].hops;
+        hist[lookups[l].hops < HOPS_SHOWN ? lookups[l].hops : HOPS_SHOWN]++;
+    }
+    qsort(lat, done, sizeof(double), double_cmp);
+
+    printf("\nlookups: %zu started, %zu answered (%.2f%%), %zu wrong node, "
+           "mean hops %.2f (log2(N)/2 = %.2f)\n",
+           n_lookups, done, n_lookups > 0 ? 100.0 * done / n_lookups : 0.0,
+           done - correct, done > 0 ? hops_sum / done : 0.0,
+           log2((double)cfg.n_nodes) / 2);
+    if (done > 0) {
+        printf("latency ms: p50 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+               lat[done / 2], lat[(size_t)(done * 0.99)],
+               lat[(size_t)(done * 0.999)], lat[done - 1]);
+    }
+    printf("%-5s %9s %7s\n", "hops", "lookups", "share");
+    for (size_t h = 0; h <= HOPS_SHOWN; h++) {
+        if (hist[h] > 0) {
+            printf("%-5zu%s %8zu %6.2f%%\n", h, h == HOPS_SHOWN ? "+" : " ",
+                   hist[h], 100.0 * hist[h] / done);
+        }
+    }
+    free(lat);
+}
+
+static void report_messages(double seconds) {
+    size_t *received = (size_t *)malloc(n_started * sizeof(size_t));
+    size_t n = 0;
+    double sum = 0;
+    for (size_t i = 0; i < n_started; i++) {
+        if (nodes[i].alive) {
+            received[n++] = nodes[i].received;
+            sum += nodes[i].received;
+        }
+    }
+    qsort(received, n, sizeof(size_t), size_cmp);
+
+    printf("\nmessages per live node and s: mean %.2f p50 %.2f p99 %.2f max "
+           "%.2f\n",
+           sum / n / seconds, received[n / 2] / seconds,
+           received[(size_t)(n * 0.99)] / seconds, received[n - 1] / seconds);
+    printf("sent:");
+    for (size_t t = 0; t < MSG_TYPES; t++) {
+        printf(" %s %zu", msg_names[t], sent_by_type[t]);
+    }
+    printf(", lost %zu\n", lost);
+    free(received);
+}
+
+/**
+ * @brief Chord ring in one process on a virtual clock. Nodes join one after
+ * another, stabilize until every pred and succ is right, then build their
+ * finger tables (FNGR) and serve recursive lookups under churn (crashes and
+ * joins at random). Ring maintenance and routing are decided by vnode.c, the
+ * stabilize interval by stabilizer.c, like in the peer. Lookups get a single
+ * attempt (retries are what lookup-modes is about).
+ *
+ * Usage: './ring-sim [-n nodes] [-g join_gap_ms] [-l latency_ms]
+ * [-j jitter_ms] [-p loss%] [-c churn_per_s] [-q lookups_per_s] [-d seconds]'
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return int The exit code
+ */
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:g:l:j:p:c:q:d:")) != -1) {
+        if (opt == 'n') {
+            cfg.n_nodes = strtoul(optarg, NULL, 10);
+        } else if (opt == 'g') {
+            cfg.join_gap_ms = strtod(optarg, NULL);
+        } else if (opt == 'l') {
+            cfg.latency_ms = strtod(optarg, NULL);
+        } else if (opt == 'j') {
+            cfg.jitter_ms = strtod(optarg, NULL);
+        } else if (opt == 'p') {
+            cfg.loss = strtod(optarg, NULL) / 100.0;
+        } else if (opt == 'c') {
+            cfg.churn_per_s = strtod(optarg, NULL);
+        } else if (opt == 'q') {
+            cfg.lookups_per_s = strtod(optarg, NULL);
+        } else if (opt == 'd') {
+            cfg.seconds = strtod(optarg, NULL);
+        } else {
+            fprintf(stderr, "Usage: './ring-sim [-n nodes] [-g join_gap_ms] "
+                            "[-l latency_ms] "
+                            "[-j jitter_ms] [-p loss%%] [-c churn_per_s] "
+                            "[-q lookups_per_s] [-d seconds]'\n");
+            return -1;
+        }
+    }
+    size_t joins = (size_t)(cfg.churn_per_s * cfg.seconds) + 1;
+    if (cfg.n_nodes < 2 || cfg.n_nodes + joins > 30000) {
+        fprintf(stderr, "Need 2 to 30000 nodes (including those joining by "
+                        "churn)!\n");
+        return -1;
+    }
+
+    capacity = cfg.n_nodes + joins;
+    nodes = (node *)calloc(capacity, sizeof(node));
+    printf("%zu nodes joining %.0f ms apart, %.1f ms + exp(%.1f ms) per "
+           "message, %.1f%% loss\n",
+           cfg.n_nodes, cfg.join_gap_ms, cfg.latency_ms, cfg.jitter_ms,
+           cfg.loss * 100);
+
+    // one node after another joins via a random member
+    for (size_t i = 0; i < cfg.n_nodes; i++) {
+        run_until(i * cfg.join_gap_ms);
+        add_node();
+    }
+    double joined = now;
+    double converged = settle(joined, SETTLE_MAX_MS);
+    if (isinf(converged)) {
+        printf("ring not consistent within %.0f s after the last join\n",
+               SETTLE_MAX_MS / 1000);
+    } else {
+        printf("ring consistent %.0f ms after the last join\n", converged);
+    }
+
+    // build the finger tables, like the FNGR a test harness sends to all
+    double fngr_at = now;
+    for (size_t i = 0; i < n_started; i++) {
+        event fngr = {now, FNGR, i, 0, 0, 0, -1, 0};
+        queue_push(&q, fngr);
+    }
+    while (fingers_active() < cfg.n_nodes && now - fngr_at < SETTLE_MAX_MS &&
+           q.count > 0) {
+        run_until(now + CHECK_MS);
+    }
+    printf("finger tables: %zu of %zu complete after %.0f ms\n",
+           fingers_active(), cfg.n_nodes, now - fngr_at);
+
+    // lookups (and churn) as Poisson processes
+    double start = now;
+    double end = start + cfg.seconds * 1000;
+    size_t max_lookups = (size_t)(cfg.lookups_per_s * cfg.seconds * 2) + 16;
+    lookups = (lookup *)calloc(max_lookups, sizeof(lookup));
+    for (double t = start + exponential(&work_rng, 1000 / cfg.lookups_per_s);
+         t < end && n_lookups < max_lookups && cfg.lookups_per_s > 0;
+         t += exponential(&work_rng, 1000 / cfg.lookups_per_s)) {
+        event e = {t, LOOKUP, 0, 0, (uint16_t)(uniform(&work_rng) * 65536), 0,
+                   (long)n_lookups++, 0};
+        queue_push(&q, e);
+    }
+    size_t churn_events = 0;
+    for (double t = start + exponential(&work_rng, 1000 / cfg.churn_per_s);
+         t < end && cfg.churn_per_s > 0;
+         t += exponential(&work_rng, 1000 / cfg.churn_per_s)) {
+        event e = {t, CHURN, 0, 0, 0, 0, -1, 0};
+        queue_push(&q, e);
+        churn_events++;
+    }
+    for (size_t i = 0; i < n_started; i++) {
+        nodes[i].received = 0;
+    }
+    memset(sent_by_type, 0, sizeof(sent_by_type));
+    lost = 0;
+
+    size_t checks = 0;
+    size_t consistent = 0;
+    while (now < end) {
+        run_until(now + CHECK_MS < end ? now + CHECK_MS : end);
+        checks++;
+        consistent += ring_consistent();
+    }
+    report_messages(cfg.seconds);
+
+    // let the last lookups finish and see when the ring is whole again
+    double again = INFINITY;
+    while (now < end + DRAIN_MS ||
+           (isinf(again) && churn_events > 0 && now - end < SETTLE_MAX_MS)) {
+        run_until(now + CHECK_MS);
+        if (isinf(again) && ring_consistent()) {
+            again = now - end;
+        }
+    }
+    printf("\nchurn: %zu events in %.0f s, ring consistent at %.1f%% of the "
+           "checks\n",
+           churn_events, cfg.seconds, 100.0 * consistent / checks);
+    if (churn_events > 0 && isinf(again)) {
+        printf("ring not consistent again within %.0f s after churn stopped\n",
+               SETTLE_MAX_MS / 1000);
+    } else if (churn_events > 0) {
+        printf("ring consistent again %.0f ms after churn stopped\n", again);
+    }
+    report_lookups();
+
+    for (size_t i = 0; i < n_started; i++) {
+        vnode *v = &nodes[i].v;
+        peer_free(v->self);
+        if (v->pred != NULL) {
+            peer_free(v->pred);
+        }
+        if (v->succ != NULL) {
+            peer_free(v->succ);
+        }
+        if (v->fng_tab != NULL) {
+            finger_table_free(v->fng_tab);
+        }
+        stabilizer_free(nodes[i].stab);
+    }
+    free(nodes);
+    free(lookups);
+    free(q.ev);
+    return 0;
+}
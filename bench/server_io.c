@@ -0,0 +1,202 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "packet.h"
+#include "server.h"
+#include "util.h"
+
+#define CLIENTS 8
+#define SMALL_KEY_LEN (64 - PKT_HEADER_LEN) // 64 byte packets
+#define LARGE_VALUE_LEN (1 << 20)
+
+/*
+ * One kind of request the clients send over and over.
+ */
+typedef struct _workload {
+    const char *name;
+    size_t key_len;
+    size_t value_len;
+} workload;
+
+static const workload workloads[] = {
+    {"64B", SMALL_KEY_LEN, 0},
+    {"1MiB", 4, LARGE_VALUE_LEN},
+};
+
+/**
+ * @brief Acknowledge every packet with its header and key, keep the
+ * connection open.
+ */
+static int answer(server *srv, client *c, packet *p) {
+    (void)srv;
+    packet *rsp = packet_new();
+    rsp->flags = p->flags | PKT_FLAG_ACK;
+    rsp->key_len = p->key_len;
+    rsp->key = p->key;
+
+    unsigned char hdr[PKT_HEADER_LEN];
+    packet_serialize_hdr(rsp, hdr);
+    struct iovec iov[2] = {{hdr, PKT_HEADER_LEN}, {p->key, p->key_len}};
+    sendallv(c->socket, iov, 2);
+
+    rsp->key = NULL;
+    packet_free(rsp);
+    packet_free(p);
+    c->pack = NULL;
+    return CB_OK;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct _worker {
+    pthread_t thread;
+    char *port;
+    const workload *wl;
+    double until;
+    uint64_t requests;
+} worker;
+
+static bool recv_exact(int s, unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(s, buf, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void *run_worker(void *arg) {
+    worker *w = (worker *)arg;
+    int s = connect_socket("127.0.0.1", w->port);
+    if (s < 0) {
+        return NULL;
+    }
+
+    size_t len = PKT_HEADER_LEN + w->wl->key_len + w->wl->value_len;
+    unsigned char *req = (unsigned char *)calloc(1, len);
+    packet *p = packet_new();
+    p->flags = PKT_FLAG_SET;
+    p->key_len = w->wl->key_len;
+    p->value_len = w->wl->value_len;
+    packet_serialize_hdr(p, req);
+    packet_free(p);
+
+    unsigned char rsp[PKT_HEADER_LEN + SMALL_KEY_LEN];
+    size_t rsp_len = PKT_HEADER_LEN + w->wl->key_len;
+    while (now() < w->until) {
+        if (sendall(s, req, len) < 0 || !recv_exact(s, rsp, rsp_len)) {
+            break;
+        }
+        w->requests++;
+    }
+    close(s);
+    free(req);
+    return NULL;
+}
+
+static void *run_server(void *arg) {
+    server_run((server *)arg);
+    return NULL;
+}
+
+/**
+ * @brief Serve one workload with a backend for a while.
+ *
+ * @return double The throughput in requests per second
+ */
+static double run(server_backend backend, const workload *wl, char *port,
+                  double seconds) {
+    // the server stops when its stdin becomes readable
+    int stop[2];
+    if (pipe(stop) < 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    dup2(stop[0], fileno(stdin));
+    close(stop[0]);
+
+    server *srv = server_setup(port, false);
+    if (srv == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    srv->backend = backend;
+    srv->packet_cb = answer;
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_server, srv);
+    usleep(100000); // until it listens
+
+    worker workers[CLIENTS];
+    memset(workers, 0, sizeof(workers));
+    double start = now();
+    for (size_t i = 0; i < CLIENTS; i++) {
+        workers[i].port = port;
+        workers[i].wl = wl;
+        workers[i].until = start + seconds;
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+    uint64_t requests = 0;
+    for (size_t i = 0; i < CLIENTS; i++) {
+        pthread_join(workers[i].thread, NULL);
+        requests += workers[i].requests;
+    }
+    double elapsed = now() - start;
+
+    if (write(stop[1], "q", 1) < 0) {
+        perror("write");
+    }
+    pthread_join(thread, NULL);
+    close(stop[1]);
+    close(srv->socket);
+    free(srv);
+    return requests / elapsed;
+}
+
+/**
+ * @brief Request/response throughput of the poll and the io_uring event loop
+ * on loopback: 64 byte packets and 1 MiB values, CLIENTS connections each
+ * with one request in flight.
+ *
+ * Usage: './server-io [port] [seconds]'
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return int The exit code
+ */
+int main(int argc, char **argv) {
+    char *port = argc > 1 ? argv[1] : "4711";
+    double seconds = argc > 2 ? strtod(argv[2], NULL) : 2.0;
+
+    const char *names[] = {"poll", "io_uring"};
+    server_backend backends[] = {BACKEND_POLL, BACKEND_IO_URING};
+    double results[2][2];
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workload); w++) {
+        for (size_t b = 0; b < 2; b++) {
+            results[w][b] = run(backends[b], &workloads[w], port, seconds);
+        }
+    }
+
+    printf("%-8s %-8s %12s %10s\n", "workload", "backend", "req/s", "MB/s");
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workload); w++) {
+        for (size_t b = 0; b < 2; b++) {
+            size_t len = PKT_HEADER_LEN + workloads[w].key_len +
+                         workloads[w].value_len;
+            printf("%-8s %-8s %12.0f %10.1f\n", workloads[w].name, names[b],
+                   results[w][b], results[w][b] * len / 1e6);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vnode.h"
+
+#define RING_SIZE 65536
+#define TRIALS 200
+
+typedef struct _position {
+    uint16_t id;
+    size_t owner;
+} position;
+
+static int position_cmp(const void *a, const void *b) {
+    return (int)((const position *)a)->id - (int)((const position *)b)->id;
+}
+
+/**
+ * @brief Place n_nodes peers with random base IDs and n_vnodes virtual nodes
+ * each on the ring and measure the key range every peer is responsible for.
+ *
+ * @param n_nodes The number of peer processes
+ * @param n_vnodes The number of virtual nodes per peer
+ * @param max_ratio Output: largest key range / mean key range
+ * @param min_ratio Output: smallest key range / mean key range
+ */
+static void simulate(size_t n_nodes, size_t n_vnodes, double *max_ratio,
+                     double *min_ratio) {
+    position *pos = malloc(n_nodes * n_vnodes * sizeof(position));
+    size_t *load = calloc(n_nodes, sizeof(size_t));
+    size_t n_pos = 0;
+
+    for (size_t node = 0; node < n_nodes; node++) {
+        uint16_t base_id = (uint16_t)rand();
+        size_t index = 0;
+        for (size_t v = 0; v < n_vnodes; v++) {
+            // same collision handling as vnodes_init
+            uint16_t id;
+            bool taken;
+            do {
+                id = vnode_derive_id(base_id, index++);
+                taken = false;
+                for (size_t k = n_pos - v; k < n_pos; k++) {
+                    taken |= pos[k].id == id;
+                }
+            } while (taken);
+            pos[n_pos].id = id;
+            pos[n_pos].owner = node;
+            n_pos++;
+        }
+    }
+
+    qsort(pos, n_pos, sizeof(position), position_cmp);
+
+    // every position owns (pred, self]
+    for (size_t i = 0; i < n_pos; i++) {
+        uint16_t pred = pos[(i + n_pos - 1) % n_pos].id;
+        size_t range = (uint16_t)(pos[i].id - pred);
+        if (range == 0 && n_pos == 1) {
+            range = RING_SIZE;
+        }
+        load[pos[i].owner] += range;
+    }
+
+    double mean = (double)RING_SIZE / n_nodes;
+    size_t max = 0;
+    size_t min = RING_SIZE;
+    for (size_t node = 0; node < n_nodes; node++) {
+        max = load[node] > max ? load[node] : max;
+        min = load[node] < min ? load[node] : min;
+    }
+    *max_ratio = max / mean;
+    *min_ratio = min / mean;
+
+    free(pos);
+    free(load);
+}
+
+/**
+ * @brief Simulate the key range distribution over the ring for a growing
+ * number of virtual nodes per peer.
+ *
+ * Optional arguments:
+ * 1. Number of peer processes (default 8)
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return int The exit code
+ */
+int main(int argc, char **argv) {
+    size_t n_nodes = 8;
+    if (argc > 1) {
+        n_nodes = strtoul(argv[1], NULL, 10);
+    }
+    if (n_nodes == 0) {
+        fprintf(stderr, "Usage: './vnode-balance [nodes]'\n");
+        return -1;
+    }
+
+    printf("%zu peers, %d trials per row\n", n_nodes, TRIALS);
+    printf("%8s %14s %14s %14s\n", "vnodes", "avg max/mean", "worst max/mean",
+           "avg min/mean");
+
+    for (size_t n_vnodes = 1; n_vnodes <= VNODES_MAX; n_vnodes *= 2) {
+        srand(4711);
+        double sum_max = 0, sum_min = 0, worst = 0;
+        for (int t = 0; t < TRIALS; t++) {
+            double max_ratio, min_ratio;
+            simulate(n_nodes, n_vnodes, &max_ratio, &min_ratio);
+            sum_max += max_ratio;
+            sum_min += min_ratio;
+            worst = max_ratio > worst ? max_ratio : worst;
+        }
+        printf("%8zu %14.3f %14.3f %14.3f\n", n_vnodes, sum_max / TRIALS, worst,
+               sum_min / TRIALS);
+    }
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+#include "util.h"
+
+#define MIN_BYTES (64 << 20) // compressed per codec and value size at least
+
+static uint64_t xorshift(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+/**
+ * @brief A JSON document of the given size: an array of records with
+ * repeating field names, a few words, numbers and ids, like the values a
+ * service stores.
+ */
+static unsigned char *make_json(size_t len, uint64_t *rng) {
+    static const char *words[] = {"alpha", "bravo", "charlie", "delta",
+                                  "echo",  "fox",   "golf",    "hotel"};
+    unsigned char *buf = (unsigned char *)malloc(len + 256);
+    size_t n = 0;
+    buf[n++] = '[';
+    while (n < len) {
+        uint64_t r = xorshift(rng);
+        n += snprintf((char *)buf + n, 256,
+                      "{\"id\":%lu,\"name\":\"%s %s\",\"score\":%lu,"
+                      "\"active\":%s,\"tags\":[\"%s\"]},",
+                      r % 1000000, words[r % 8], words[(r >> 3) % 8],
+                      (r >> 16) % 100, (r >> 24) & 1 ? "true" : "false",
+                      words[(r >> 6) % 8]);
+    }
+    buf[len - 1] = ']';
+    return buf;
+}
+
+static unsigned char *make_random(size_t len, uint64_t *rng) {
+    unsigned char *buf = (unsigned char *)malloc(len);
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (unsigned char)xorshift(rng);
+    }
+    return buf;
+}
+
+/**
+ * @brief Compress and decompress a value over and over with a codec and print
+ * the ratio, the throughput and the CPU time per MB of both directions.
+ */
+static void run(codec c, const char *kind, const unsigned char *data,
+                size_t len) {
+    size_t rounds = MIN_BYTES / len + 1;
+    size_t frame_len = len;
+    unsigned char *frame = NULL;
+
+    uint64_t start = now_us();
+    for (size_t i = 0; i < rounds; i++) {
+        free(frame);
+        frame = zip_compress(c, data, len, &frame_len);
+    }
+    uint64_t zip_us = now_us() - start;
+
+    uint64_t unzip_us = 0;
+    if (frame != NULL) {
+        start = now_us();
+        for (size_t i = 0; i < rounds; i++) {
+            size_t raw_len;
+            free(zip_decompress(frame, frame_len, &raw_len));
+        }
+        unzip_us = now_us() - start;
+    } else {
+        frame_len = len; // not smaller, the peer stores it as it is
+    }
+    free(frame);
+
+    double mb = (double)len * rounds / (1 << 20);
+    printf("%-5s %-6s %9zu %7.2f %10.0f %10.0f %9.2f %9.2f\n", codec_name(c),
+           kind, len, (double)len / frame_len, mb / (zip_us / 1e6),
+           unzip_us > 0 ? mb / (unzip_us / 1e6) : 0.0, zip_us / 1000.0 / mb,
+           unzip_us / 1000.0 / mb);
+}
+
+/**
+ * @brief Compare the codecs of this build on values as a peer started with
+ * '-z' stores them: JSON and random bytes (which do not compress) from 1 KiB
+ * up to 1 MiB, or the given files. Prints the compression ratio, the MB/s of
+ * compressing and decompressing and the CPU time per MB of each.
+ *
+ * Usage: './zip-codecs [file...]'
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return int The exit code
+ */
+int main(int argc, char **argv) {
+    static const size_t sizes[] = {1 << 10, 4 << 10, 64 << 10, 1 << 20};
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+    printf("%-5s %-6s %9s %7s %10s %10s %9s %9s\n", "codec", "data", "bytes",
+           "ratio", "zip_MB/s", "unzip_MB/s", "zip_ms/MB", "unzip_ms/MB");
+    for (codec c = CODEC_LZ4; c < CODECS; c++) {
+        if (!codec_available(c)) {
+            printf("%-5s not in this build\n", codec_name(c));
+            continue;
+        }
+        for (int i = 1; i < argc; i++) {
+            FILE *f = fopen(argv[i], "rb");
+            if (f == NULL) {
+                fprintf(stderr, "Could not open %s!\n", argv[i]);
+                return -1;
+            }
+            fseek(f, 0, SEEK_END);
+            size_t len = ftell(f);
+            fseek(f, 0, SEEK_SET);
+            unsigned char *data = (unsigned char *)malloc(len);
+            size_t got = fread(data, 1, len, f);
+            fclose(f);
+            if (got > 0) {
+                run(c, "file", data, got);
+            }
+            free(data);
+        }
+        if (argc > 1) {
+            continue;
+        }
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            unsigned char *json = make_json(sizes[s], &rng);
+            run(c, "json", json, sizes[s]);
+            free(json);
+        }
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            unsigned char *random = make_random(sizes[s], &rng);
+            run(c, "random", random, sizes[s]);
+            free(random);
+        }
+    }
+    return 0;
+}
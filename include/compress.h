@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define ZIP_HDR_LEN 5 // codec (1) + length before compression (4)
+#define ZIP_MIN_LEN 1024 // values are compressed from this size on (default)
+#define ZIP_MAX_LEN (64 << 20) // longer values are never compressed
+#define ZIP_ZSTD_LEVEL 3
+#define ZIP_ZLIB_LEVEL 6
+
+/*
+ * Compression of values. Which codecs a build has depends on the libraries
+ * found at configure time (HAVE_LZ4, HAVE_ZSTD, HAVE_ZLIB). LZ4 is fast,
+ * zstd compresses denser at a moderate cost, zlib is the fallback that is
+ * almost always there.
+ */
+typedef enum _codec {
+    CODEC_NONE,
+    CODEC_LZ4,
+    CODEC_ZSTD,
+    CODEC_ZLIB,
+    CODECS
+} codec;
+
+/**
+ * @brief Find a codec by its name ("none", "lz4", "zstd", "zlib").
+ *
+ * @return codec The codec, CODECS if the name is unknown
+ */
+codec codec_parse(const char *name);
+
+const char *codec_name(codec c);
+
+/**
+ * @brief Whether this build can compress and decompress with a codec.
+ */
+bool codec_available(codec c);
+
+/**
+ * @brief Compress data into a frame: ZIP_HDR_LEN bytes of header (the codec
+ * and the length of the data), then the compressed bytes. Counts the bytes
+ * and the CPU time (see zip_dump).
+ *
+ * @param c The codec
+ * @param data The data
+ * @param len The length of the data
+ * @param frame_len Output: the length of the frame
+ * @return unsigned char* The frame or NULL if the codec is not available,
+ * the data is longer than ZIP_MAX_LEN or the frame would not be smaller than
+ * the data
+ */
+unsigned char *zip_compress(codec c, const unsigned char *data, size_t len,
+                            size_t *frame_len);
+
+/**
+ * @brief The length of the data in a frame, before compression.
+ *
+ * @return size_t The length, 0 if the frame is too short or claims more than
+ * ZIP_MAX_LEN
+ */
+size_t zip_raw_len(const unsigned char *frame, size_t frame_len);
+
+/**
+ * @brief Decompress a frame. Counts the bytes and the CPU time.
+ *
+ * @param frame The frame
+ * @param frame_len The length of the frame
+ * @param len Output: the length of the data
+ * @return unsigned char* The data or NULL if the frame is malformed or its
+ * codec is not available
+ */
+unsigned char *zip_decompress(const unsigned char *frame, size_t frame_len,
+                              size_t *len);
+
+/**
+ * @brief Write the codecs of this build and the CPU time spent per MB
+ * (compressed and decompressed) as STATS lines.
+ */
+void zip_dump(FILE *out);
@@ -1,20 +1,60 @@
 #pragma once
 
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "timer_wheel.h"
 #include "uthash.h"
 
+/*
+ * An immutable, reference counted value. The table holds one reference;
+ * readers take their own, so an overwrite or delete never frees a value that
+ * is still being sent.
+ */
+typedef struct _kv_value {
+    atomic_size_t refs;
+    size_t len;
+    size_t raw_len; // before compression, = len unless zipped
+    bool zipped; // data is a compressed frame (see compress.h)
+    unsigned char data[];
+} kv_value;
+
 /*
  * This is the structure that will be used to store (the data in) the hash
- * table. It is a simple structure that contains a key, a value, and their
- * respective lengths.
+ * table. It is a simple structure that contains a key, its length and the
+ * value.
  */
 typedef struct htable {
     unsigned char *key;
     size_t key_len;
-    unsigned char *value;
-    size_t value_len;
+    kv_value *value;
+    uint64_t expires; // ms, 0 = never
+    timer *expiry; // pending expiry of a key with a TTL (see kv_store.h)
     UT_hash_handle hh; // impementation specific
 } htable;
 
+/**
+ * @brief Create a value with a single reference.
+ *
+ * @param data The bytes of the value (copied)
+ * @param len The length of the value
+ * @return kv_value* The value
+ */
+kv_value *kv_value_new(const unsigned char *data, size_t len);
+
+/**
+ * @brief Take another reference to a value.
+ *
+ * @return kv_value* The value
+ */
+kv_value *kv_value_ref(kv_value *v);
+
+/**
+ * @brief Drop a reference to a value, freeing it with the last one.
+ * NULL is ignored.
+ */
+void kv_value_unref(kv_value *v);
+
 /**
  * @brief Implementation of the SET operation on our hash table.
  * Uses HASH_FIND and HASH_ADD_KEYPTR from uthash.h
@@ -22,11 +62,12 @@ typedef struct htable {
  * @param ht The hash table to perform the operation on
  * @param key The key to use
  * @param key_len The length of the key
- * @param value The value to store
- * @param value_len The length of the value
+ * @param value The value to store (the table takes over this reference)
+ * @return kv_value* The replaced value (the caller drops its reference) or
+ * NULL
  */
-void htable_set(htable **ht, const unsigned char *key, size_t key_len,
-                const unsigned char *value, size_t value_len);
+kv_value *htable_set(htable **ht, const unsigned char *key, size_t key_len,
+                     kv_value *value);
 
 /**
  * @brief Implementation of the GET operation on our hash table.
@@ -47,5 +88,7 @@ htable *htable_get(htable **ht, const unsigned char *key, size_t key_len);
  * @param ht The hash table to perform the operation on
  * @param key The key to use
  * @param key_len The length of the key
+ * @return kv_value* The removed value (the caller drops its reference) or
+ * NULL if the key did not exist
  */
-int htable_delete(htable **ht, const unsigned char *key, size_t key_len);
+kv_value *htable_delete(htable **ht, const unsigned char *key, size_t key_len);
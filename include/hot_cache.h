@@ -0,0 +1,166 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hash_table.h"
+#include "ring_cache.h"
+#include "uthash.h"
+
+#define HOT_SKETCH_DEPTH 4 // rows of the count-min sketch
+#define HOT_SKETCH_WIDTH 2048 // counters per row
+#define HOT_SKETCH_WINDOW 8192 // accesses, then all counts are halved
+#define HOT_MIN_COUNT 16 // estimated accesses that make a key hot
+#define HOT_CACHE_BYTES (8 << 20) // values cached at most, the oldest go first
+#define HOT_DROP_SLOTS 1024 // drop generations, keys share them by their hash
+#define HOT_LEASE_MAX_MS 10000 // how long an owner remembers a lease holder
+#define HOT_LEASE_MAX_HOLDERS 64 // leases per key, further peers get none
+
+/*
+ * A value of another peer cached until its lease runs out (or the owner
+ * revokes it).
+ */
+typedef struct _hot_entry {
+    unsigned char *key;
+    size_t key_len;
+    kv_value *value;
+    uint64_t expires; // ms
+    UT_hash_handle hh; // impementation specific
+} hot_entry;
+
+/*
+ * Proxy side: how often keys of other peers are read (a count-min sketch
+ * that forgets slowly) and the values of the hot ones. Entries are kept in
+ * insertion order, so eviction drops the oldest.
+ */
+typedef struct _hot_cache {
+    pthread_mutex_t lock; // shared by all reactor threads
+    uint32_t sketch[HOT_SKETCH_DEPTH][HOT_SKETCH_WIDTH];
+    size_t touches; // since the counts were halved last
+    hot_entry *entries;
+    size_t bytes; // keys and values cached
+    uint64_t lease_ms;
+    uint32_t dropped[HOT_DROP_SLOTS]; // bumped by hot_drop for keys of a slot
+
+    // counters
+    size_t hits;
+    size_t misses;
+    size_t stores;
+    size_t revoked;
+    size_t stale; // answers not cached, the key was dropped meanwhile
+    size_t evictions;
+} hot_cache;
+
+/*
+ * A peer that caches the value of one of our keys until the given time.
+ */
+typedef struct _lease_holder {
+    ring_node node;
+    uint64_t until; // ms
+    struct _lease_holder *next;
+} lease_holder;
+
+typedef struct _lease {
+    unsigned char *key;
+    size_t key_len;
+    lease_holder *holders;
+    UT_hash_handle hh; // impementation specific
+} lease;
+
+/*
+ * Owner side: the peers holding leases on our keys, to tell them when a key
+ * changes.
+ */
+typedef struct _lease_table {
+    pthread_mutex_t lock; // shared by all reactor threads
+    lease *leases;
+    size_t granted;
+    size_t refused; // the key had HOT_LEASE_MAX_HOLDERS already
+    size_t revoked; // invalidations to send
+} lease_table;
+
+/**
+ * @brief Create an empty cache.
+ *
+ * @param lease_ms How long a cached value is used (at most HOT_LEASE_MAX_MS)
+ * @return hot_cache* The cache
+ */
+hot_cache *hot_cache_new(uint64_t lease_ms);
+
+/**
+ * @brief Count a read of a key and estimate whether it is hot.
+ *
+ * @return bool true if the key was read HOT_MIN_COUNT times recently
+ */
+bool hot_touch(hot_cache *hc, const unsigned char *key, size_t key_len);
+
+/**
+ * @brief Find the cached value of a key, unless its lease ran out.
+ *
+ * @return kv_value* A reference to the value (the caller drops it) or NULL
+ */
+kv_value *hot_get(hot_cache *hc, const unsigned char *key, size_t key_len,
+                  uint64_t now);
+
+/**
+ * @brief The drop generation of a key, taken before its value is asked for:
+ * an invalidation may overtake the answer.
+ */
+uint32_t hot_generation(hot_cache *hc, const unsigned char *key,
+                        size_t key_len);
+
+/**
+ * @brief Cache the value of a key for the lease time, evicting the oldest
+ * entries if the cache is full. Nothing is cached if the key (or one sharing
+ * its slot) was dropped since the generation was taken.
+ */
+void hot_put(hot_cache *hc, const unsigned char *key, size_t key_len,
+             const unsigned char *data, size_t data_len, uint32_t generation,
+             uint64_t now);
+
+/**
+ * @brief Drop the cached value of a key (it changed), answers asked for
+ * before are not cached any more.
+ */
+void hot_drop(hot_cache *hc, const unsigned char *key, size_t key_len);
+
+/**
+ * @brief Write hit rate and memory of the cache as STATS lines.
+ */
+void hot_cache_dump(hot_cache *hc, FILE *out);
+
+lease_table *lease_table_new();
+
+/**
+ * @brief Remember that a peer caches the value of a key (until now +
+ * HOT_LEASE_MAX_MS, it may use it for less).
+ *
+ * @return bool Whether the lease was granted (a new holder is refused once
+ * the key has HOT_LEASE_MAX_HOLDERS)
+ */
+bool lease_grant(lease_table *lt, const unsigned char *key, size_t key_len,
+                 const ring_node *holder, uint64_t now);
+
+/**
+ * @brief Forget the leases of a key that changed.
+ *
+ * @param lt The table
+ * @param key The key
+ * @param key_len The length of the key
+ * @param now The current time (ms)
+ * @param count Output: the number of holders returned
+ * @return ring_node* The peers whose lease was still running, to be told
+ * (free with free) or NULL
+ */
+ring_node *lease_revoke(lease_table *lt, const unsigned char *key,
+                        size_t key_len, uint64_t now, size_t *count);
+
+/**
+ * @brief Drop the leases that ran out.
+ */
+void lease_expire(lease_table *lt, uint64_t now);
+
+void lease_table_dump(lease_table *lt, FILE *out);
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hash_table.h"
+
+#define KV_SHARDS 64 // default number of shards (a power of two)
+#define KV_EXPIRY_TICK_MS 50 // keys with a TTL are removed this late at most
+
+/*
+ * Called for every key kv_expire removes, with the shard of the key locked.
+ */
+typedef void (*kv_expired_cb)(const unsigned char *key, size_t key_len);
+
+/*
+ * One stripe of the store. Shards are aligned to a cache line so that the
+ * locks of neighbouring shards do not share one.
+ */
+typedef struct _kv_shard {
+    _Alignas(64) pthread_rwlock_t lock;
+    htable *table;
+    size_t bytes; // keys and values stored in the shard
+    size_t saved; // bytes the compressed values take less
+    timer_wheel *expiry; // the keys of the shard with a TTL
+} kv_shard;
+
+/*
+ * Concurrent key-value store: the keys are spread over independently locked
+ * shards by their hash, so operations on different shards never wait for
+ * each other and readers of one shard only wait for its writers.
+ *
+ * A key set with a TTL is hidden from readers once it expired and removed by
+ * the next kv_expire, which only touches the keys that are due.
+ */
+typedef struct _kv_store {
+    kv_shard *shards;
+    size_t n_shards;
+    unsigned shard_bits; // n_shards = 2^shard_bits
+} kv_store;
+
+/**
+ * @brief Create an empty store.
+ *
+ * @param n_shards The number of shards (rounded up to a power of two)
+ * @return kv_store* The store
+ */
+kv_store *kv_new(size_t n_shards);
+
+void kv_free(kv_store *kv);
+
+/**
+ * @brief Look up a key. The value is not copied: the caller gets its own
+ * reference, which stays valid however the key changes meanwhile.
+ *
+ * @param kv The store
+ * @param key The key
+ * @param key_len The length of the key
+ * @return kv_value* The value (release with kv_value_unref) or NULL if the key
+ * was not found
+ */
+kv_value *kv_get(kv_store *kv, const unsigned char *key, size_t key_len);
+
+/**
+ * @brief Insert or overwrite a key. Key and value are copied (outside of the
+ * shard lock).
+ *
+ * @param kv The store
+ * @param key The key
+ * @param key_len The length of the key
+ * @param value The value
+ * @param value_len The length of the value
+ */
+void kv_set(kv_store *kv, const unsigned char *key, size_t key_len,
+            const unsigned char *value, size_t value_len);
+
+/**
+ * @brief Insert or overwrite a key that expires after a while. Setting a key
+ * again replaces its TTL.
+ *
+ * @param kv The store
+ * @param key The key
+ * @param key_len The length of the key
+ * @param value The value
+ * @param value_len The length of the value
+ * @param ttl_ms The time to live (ms), 0 = the key does not expire
+ */
+void kv_set_ttl(kv_store *kv, const unsigned char *key, size_t key_len,
+                const unsigned char *value, size_t value_len, uint32_t ttl_ms);
+
+/**
+ * @brief Insert or overwrite a key with a value made by the caller (e.g. a
+ * compressed one).
+ *
+ * @param kv The store
+ * @param key The key
+ * @param key_len The length of the key
+ * @param value The value (the store takes over this reference)
+ * @param ttl_ms The time to live (ms), 0 = the key does not expire
+ */
+void kv_set_value(kv_store *kv, const unsigned char *key, size_t key_len,
+                  kv_value *value, uint32_t ttl_ms);
+
+/**
+ * @brief Remove a key.
+ *
+ * @param kv The store
+ * @param key The key
+ * @param key_len The length of the key
+ * @return int 0 if the key was removed, -1 if it did not exist
+ */
+int kv_delete(kv_store *kv, const unsigned char *key, size_t key_len);
+
+/**
+ * @brief Remove the keys whose TTL ran out (locks every shard in turn).
+ *
+ * @param kv The store
+ * @param now The current time (ms)
+ * @param expired Told about every key removed (NULL: nobody)
+ * @return size_t The number of keys removed
+ */
+size_t kv_expire(kv_store *kv, uint64_t now, kv_expired_cb expired);
+
+/**
+ * @brief Count the keys in the store (locks every shard in turn). Expired
+ * keys count until kv_expire removed them.
+ */
+size_t kv_count(kv_store *kv);
+
+/**
+ * @brief The number of bytes (keys and values) stored.
+ */
+size_t kv_bytes(kv_store *kv);
+
+/**
+ * @brief The number of bytes compressing values saved.
+ */
+size_t kv_saved(kv_store *kv);
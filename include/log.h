@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+#define LOG_LEVEL_TRACE 4
+
+// messages above this level are compiled out (set with -DLOG_LEVEL=...)
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_LINE_MAX 256 // longer messages are truncated
+
+/*
+ * The part of the peer a message comes from. Each one can be switched off at
+ * runtime (see log_enable).
+ */
+typedef enum _log_subsystem {
+    LOG_NET,    // connections, packet decoding
+    LOG_RING,   // join, stabilize, notify, finger tables
+    LOG_LOOKUP, // lookups, replies, referrals
+    LOG_KV,     // requests on the key-value store
+    LOG_SUBSYSTEMS
+} log_subsystem;
+
+/*
+ * Calls below the compile-time level are constant-false branches, so neither
+ * the call nor the evaluation of the arguments is left in the binary, but the
+ * arguments are still type checked.
+ */
+#define LOG_AT(level, sub, ...)                                                \
+    do {                                                                       \
+        if ((level) <= LOG_LEVEL && log_enabled(sub)) {                        \
+            log_write((level), (sub), __VA_ARGS__);                            \
+        }                                                                      \
+    } while (0)
+
+#define LOG_ERROR(sub, ...) LOG_AT(LOG_LEVEL_ERROR, sub, __VA_ARGS__)
+#define LOG_WARN(sub, ...) LOG_AT(LOG_LEVEL_WARN, sub, __VA_ARGS__)
+#define LOG_INFO(sub, ...) LOG_AT(LOG_LEVEL_INFO, sub, __VA_ARGS__)
+#define LOG_DEBUG(sub, ...) LOG_AT(LOG_LEVEL_DEBUG, sub, __VA_ARGS__)
+#define LOG_TRACE(sub, ...) LOG_AT(LOG_LEVEL_TRACE, sub, __VA_ARGS__)
+
+extern unsigned log_mask; // bit per subsystem, all enabled by default
+
+static inline bool log_enabled(log_subsystem sub) {
+    return (log_mask >> sub) & 1u;
+}
+
+/**
+ * @brief Enable only the listed subsystems.
+ *
+ * @param list Comma separated names (net, ring, lookup, kv) or "all"
+ * @return int 0 on success, -1 if a name is unknown
+ */
+int log_enable(const char *list);
+
+/**
+ * @brief Format and emit one message (use the LOG_* macros instead). Written
+ * to stderr directly, or queued if the asynchronous logger runs.
+ */
+void log_write(int level, log_subsystem sub, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * @brief Start the asynchronous logger: messages are copied into a ring of
+ * capacity entries and written to stderr by a background thread, so logging
+ * never blocks on the terminal. Messages are dropped (and counted) while the
+ * ring is full.
+ *
+ * @param capacity The number of queued messages
+ * @return int 0 on success, -1 on error
+ */
+int log_async_start(size_t capacity);
+
+/**
+ * @brief Write all queued messages and stop the background thread. Call it
+ * once no other thread logs anymore.
+ *
+ * @return size_t The number of messages dropped because the ring was full
+ */
+size_t log_async_stop(void);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "neighbour.h"
+
+#define LCACHE_SIZE 64 // bounded number of cached ring ranges
+
+/*
+ * A cached lookup result: node is responsible for every hash in [lo, node_id].
+ * lo is the smallest hash (clockwise) a RPLY named this node for.
+ */
+typedef struct _lcache_entry {
+    uint16_t lo;
+    peer *node;
+    uint64_t last_used; // for LRU eviction
+} lcache_entry;
+
+typedef struct _lcache {
+    pthread_mutex_t lock; // shared by all reactor threads
+    lcache_entry entries[LCACHE_SIZE];
+    size_t count;
+    uint64_t tick;
+
+    // counters
+    size_t hits;
+    size_t misses;
+    size_t inserts;
+    size_t evictions;
+    size_t invalidations;
+} lcache;
+
+lcache *lcache_new();
+
+void lcache_free(lcache *lc);
+
+/**
+ * @brief Find the cached peer responsible for a hashed key.
+ *
+ * @param lc The cache
+ * @param hash_id The hashed key
+ * @return peer* A copy of the responsible peer (to be freed by the caller) or
+ * NULL on a miss
+ */
+peer *lcache_get(lcache *lc, uint16_t hash_id);
+
+/**
+ * @brief Remember the result of a lookup. Entries contradicting it (nodes
+ * inside the learned range) are dropped. The least recently used entry is
+ * evicted if the cache is full.
+ *
+ * @param lc The cache
+ * @param hash_id The hash that was looked up
+ * @param node The responsible peer (ownership moves to the cache)
+ */
+void lcache_put(lcache *lc, uint16_t hash_id, peer *node);
+
+/**
+ * @brief Drop all ranges of a node (e.g. after it could not be reached).
+ */
+void lcache_invalidate_node(lcache *lc, uint16_t node_id);
+
+/**
+ * @brief Drop all ranges a (new) node would take over a part of.
+ */
+void lcache_invalidate_range(lcache *lc, uint16_t node_id);
+
+void lcache_print_stats(lcache *lc, FILE *out);
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define METRICS_MAX_THREADS 64 // threads with counters of their own
+
+// histogram buckets: 2^HIST_SUB_BITS linear sub-buckets per power of two, so
+// every recorded value is exact up to 1/2^HIST_SUB_BITS (about 6%)
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/*
+ * How a client request was served: by one of our virtual nodes, proxied to a
+ * peer known right away (successor, lookup cache), proxied after it was
+ * parked for a lookup or passed to the closest preceding finger (-r).
+ */
+typedef enum _req_path {
+    PATH_LOCAL,
+    PATH_PROXIED,
+    PATH_LOOKED_UP,
+    PATH_ROUTED,
+    PATHS
+} req_path;
+
+typedef enum _metric {
+    // requests by type and path, in the order of req_path
+    M_GET_LOCAL,
+    M_GET_PROXIED,
+    M_GET_LOOKED_UP,
+    M_GET_ROUTED,
+    M_SET_LOCAL,
+    M_SET_PROXIED,
+    M_SET_LOOKED_UP,
+    M_SET_ROUTED,
+    M_DEL_LOCAL,
+    M_DEL_PROXIED,
+    M_DEL_LOOKED_UP,
+    M_DEL_ROUTED,
+
+    M_PARKED,             // requests parked for a lookup
+    M_LOOKUPS_SENT,       // LKUP messages we started
+    M_LOOKUPS_FORWARDED,  // LKUP messages passed on for others
+    M_LOOKUPS_ANSWERED,   // RPLY messages (and referrals) sent
+    M_LOOKUPS_FAILED,     // lookups given up after the last retry
+    M_GETS_COALESCED,     // GETs answered by a fetch for another client
+    M_KEYS_EXPIRED,       // keys removed after their TTL ran out
+    M_ZIP_VALUES,         // values compressed
+    M_ZIP_BYTES_IN,       // their length before compression
+    M_ZIP_BYTES_OUT,      // and after
+    M_ZIP_CPU_NS,         // CPU time spent compressing
+    M_UNZIP_BYTES,        // bytes decompressed (their length afterwards)
+    M_UNZIP_CPU_NS,       // CPU time spent decompressing
+    M_CONN_ACCEPTED,
+    M_CONN_OPENED,
+    M_BYTES_IN,
+    M_BYTES_OUT,
+    M_COUNTERS
+} metric;
+
+typedef enum _histogram {
+    // request latency in us, in the order of req_path
+    H_LATENCY_LOCAL,
+    H_LATENCY_PROXIED,
+    H_LATENCY_LOOKED_UP,
+    H_LATENCY_ROUTED,
+
+    // peers a resolved lookup went through until one answered it: forwards
+    // plus one when recursive, referrals followed plus one when iterative
+    H_LOOKUP_HOPS,
+    H_HISTOGRAMS
+} histogram;
+
+/**
+ * @brief Start the uptime clock (for the rates in the dump).
+ */
+void metrics_init(void);
+
+/**
+ * @brief Add to a counter of the calling thread. Only the owning thread
+ * writes its counters, so this is a plain load and store, no locked
+ * instruction.
+ *
+ * @param m The counter
+ * @param n The amount
+ */
+void metrics_add(metric m, uint64_t n);
+
+/**
+ * @brief Record a value in a histogram of the calling thread.
+ *
+ * @param h The histogram
+ * @param value The value
+ */
+void metrics_record(histogram h, uint64_t value);
+
+/**
+ * @brief Count a client request and record its latency.
+ *
+ * @param flags The flags of the request (GET, SET or DEL)
+ * @param path How it was served
+ * @param latency_us Time from receiving to answering it
+ */
+void metrics_request(uint8_t flags, req_path path, uint64_t latency_us);
+
+/**
+ * @brief Sum a counter over all threads.
+ */
+uint64_t metrics_get(metric m);
+
+/**
+ * @brief Write all counters and histogram summaries as text, one metric per
+ * line. Safe to call while other threads keep counting.
+ *
+ * @param out The stream to write to
+ */
+void metrics_dump(FILE *out);
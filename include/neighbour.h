@@ -16,6 +16,15 @@ peer *peer_init(uint16_t id, const char *hostname, const char *port);
 
 void peer_free(peer *p);
 
+/**
+ * @brief Copy the address of a peer (not its connection). Threads connect
+ * through their own copy since peer_connect stores the socket in the peer.
+ *
+ * @param p The peer
+ * @return peer* The unconnected copy
+ */
+peer *peer_dup(const peer *p);
+
 int peer_connect(peer *p);
 
 void peer_disconnect(peer *p);
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "neighbour.h"
+#include "packet.h"
+
+/*
+ * Control messages waiting to be sent to one next hop.
+ */
+typedef struct _outbox_hop {
+    peer *hop; // unconnected copy
+    packet **msgs;
+    size_t count;
+    size_t cap;
+    struct _outbox_hop *next;
+} outbox_hop;
+
+/*
+ * Outbound control messages (LKUP, RPLY) are collected per next hop instead
+ * of being sent one connection each, and leave as one batch per hop when the
+ * outbox is flushed (once per event loop iteration). Lease invalidations
+ * (PKT_FLAG_INVL) are queued the same way, so a write never waits for a lease
+ * holder; they go first on the connection to their hop, one after another.
+ */
+typedef struct _outbox {
+    pthread_mutex_t lock; // shared by all reactor threads
+    outbox_hop *hops;
+
+    // counters
+    size_t messages;
+    size_t packets; // sent, batches count once
+    size_t failures;
+} outbox;
+
+/*
+ * Called for every message that could not be delivered to its hop.
+ */
+typedef void (*outbox_fail_cb)(const peer *hop, const packet *msg);
+
+outbox *outbox_new();
+
+void outbox_free(outbox *ob);
+
+/**
+ * @brief Queue a control message or an invalidation for a next hop.
+ *
+ * @param ob The outbox
+ * @param hop The next hop (copied)
+ * @param msg The message (copied)
+ */
+void outbox_add(outbox *ob, const peer *hop, const packet *msg);
+
+/**
+ * @brief Send everything queued: a single message for a hop as is, several
+ * as batches of up to PKT_BATCH_MAX messages (one connection each).
+ *
+ * @param ob The outbox
+ * @param failed Called for the messages of unreachable hops (may be NULL)
+ * @return size_t The number of messages sent
+ */
+size_t outbox_flush(outbox *ob, outbox_fail_cb failed);
+
+void outbox_print_stats(outbox *ob, FILE *out);
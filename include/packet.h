@@ -21,17 +21,96 @@
 #define PKT_FLAG_RPLY_POS 1
 #define PKT_FLAG_LKUP_POS 0
 
+#define PKT_FLAG_STAT 1 << 6 // metrics request / answer (text in the value)
+#define PKT_FLAG_DRCT 1 << 5 // client routes itself, do not proxy
+#define PKT_FLAG_RING 1 << 4 // ring view request / "moved" answer
 #define PKT_FLAG_ACK 1 << 3
 #define PKT_FLAG_GET 1 << 2
 #define PKT_FLAG_SET 1 << 1
 #define PKT_FLAG_DEL 1 << 0
 
+#define PKT_FLAG_STAT_POS 6
+#define PKT_FLAG_DRCT_POS 5
+#define PKT_FLAG_RING_POS 4
 #define PKT_FLAG_ACK_POS 3
 #define PKT_FLAG_GET_POS 2
 #define PKT_FLAG_SET_POS 1
 #define PKT_FLAG_DEL_POS 0
 
+// on LKUP: answer the questioner with the next hop instead of forwarding
+// on RPLY: the node is that next hop, not the one responsible (a referral)
+#define PKT_FLAG_ITER PKT_FLAG_FACK
+
+// on LKUP: how often the lookup was forwarded so far, on RPLY: how often the
+// lookup it answers was (PKT_HOPS_MAX means as often or more). LKUP and RPLY
+// are never set along with JOIN, NTFY or STAB, so their bits hold the count.
+#define PKT_HOPS_MASK (PKT_FLAG_JOIN | PKT_FLAG_NTFY | PKT_FLAG_STAB)
+#define PKT_HOPS_POS PKT_FLAG_STAB_POS
+#define PKT_HOPS_MAX 7
+
+// on GET/SET/DEL (and their answers): the value ends with a trace (trace.h)
+#define PKT_FLAG_TRCE PKT_FLAG_STAT
+
+// on a SET request: the value starts with a time to live (ms, PKT_TTL_LEN
+// bytes), the key expires after it. Answers are never sent to a peer, so ACK
+// is free to mark it.
+#define PKT_FLAG_TTL PKT_FLAG_ACK
+#define PKT_TTL_LEN 4
+
+// on a GET request: the client takes the value compressed
+// on a SET request and a GET answer (with ACK): the value is compressed, a
+// frame of compress.h (behind the TTL of a SET, before a trace)
+// RING only asks for the ring view without GET/SET/DEL and marks a "moved"
+// answer without ACK, so it is free to mark both.
+#define PKT_FLAG_ZIP PKT_FLAG_RING
+
 #define PKT_HEADER_LEN 7
+#define PKT_CTRL_LEN 11
+
+/*
+ * A batch carries several control messages (LKUP/RPLY) for one peer in one
+ * packet. LKUP and RPLY are never set together on a single message, so both
+ * together mark a batch: the header holds the number of messages where
+ * hash_id would be, the body the messages one after another, serialized as
+ * usual (PKT_CTRL_LEN bytes each).
+ */
+#define PKT_FLAG_BTCH (PKT_FLAG_LKUP | PKT_FLAG_RPLY)
+#define PKT_BATCH_MAX 256 // control messages per batch
+
+/*
+ * A multi-key request (MGET/MSET/MDEL) carries several data requests in one
+ * packet. A request has a single operation, so all three together mark it:
+ * the key is empty, the value holds the requests one after another, each
+ * serialized as a data packet of its own (header, key, value). The answer has
+ * the same flags along with ACK and holds the answers in the order of the
+ * requests, each with or without its own ACK.
+ */
+#define PKT_FLAG_MULTI (PKT_FLAG_GET | PKT_FLAG_SET | PKT_FLAG_DEL)
+
+/*
+ * Hot keys (see hot_cache.h): a GET with ACK (a request has no use for it)
+ * asks the owner for a lease as well, its value is the node that wants to
+ * cache the answer (a single ring node, RING_NODE_LEN bytes). The owner grants
+ * leases to ring members it knows only and marks the answer with DEL then (a
+ * GET answer never has it); the node takes the mark off and caches the value.
+ * When the key changes the owner sends DEL with ACK and the key to every
+ * holder of a lease: peers never receive answers on their server socket, so
+ * that marks an invalidation.
+ */
+#define PKT_FLAG_LEASE (PKT_FLAG_GET | PKT_FLAG_ACK)
+#define PKT_FLAG_GRANT PKT_FLAG_DEL
+#define PKT_FLAG_INVL (PKT_FLAG_DEL | PKT_FLAG_ACK)
+
+/*
+ * A request routed through the fingers (-r) travels in an envelope from the
+ * first peer on: GET and SET together (a request has a single operation), an
+ * empty key and the request serialized as usual as value. Peers on the way
+ * pass it on without looking its key up, only the first peer does: to their
+ * closest preceding finger, or their successor if there is none they can
+ * reach (no hop parks it). The owner answers the request inside as if it came
+ * from the client.
+ */
+#define PKT_FLAG_ROUTE (PKT_FLAG_GET | PKT_FLAG_SET)
 
 typedef struct _packet {
     uint8_t flags;
@@ -55,6 +134,106 @@ void packet_free(packet *p);
 
 unsigned char *packet_serialize(const packet *p, size_t *buf_len);
 
+/**
+ * @brief Write the header of a data packet (flags and lengths) only, e.g. to
+ * send key and value from where they are stored.
+ *
+ * @param p The packet (key and value are not read)
+ * @param buffer Space for PKT_HEADER_LEN bytes
+ */
+void packet_serialize_hdr(const packet *p, unsigned char *buffer);
+
+/**
+ * @brief Put control messages into one batch packet.
+ *
+ * @param msgs The control messages (at most PKT_BATCH_MAX)
+ * @param count The number of messages
+ * @return packet* The batch (serialize it as any other packet)
+ */
+packet *packet_batch(packet **msgs, size_t count);
+
+int packet_is_batch(const packet *p);
+
+size_t packet_batch_count(const packet *p);
+
+/**
+ * @brief Decode one message of a received batch.
+ *
+ * @param batch The batch
+ * @param i The index of the message
+ * @return packet* The control message (free with packet_free)
+ */
+packet *packet_batch_entry(const packet *batch, size_t i);
+
+/**
+ * @brief Put data requests (or answers) into one multi-key packet.
+ *
+ * @param entries The requests
+ * @param count The number of requests
+ * @return packet* The multi-key packet (flags without ACK)
+ */
+packet *packet_multi(packet **entries, size_t count);
+
+int packet_is_multi(const packet *p);
+
+/**
+ * @brief Decode the next request (or answer) of a multi-key packet.
+ *
+ * @param multi The multi-key packet
+ * @param offset Where the entry starts in the value, moved past it
+ * @return packet* The entry (free with packet_free) or NULL after the last
+ * one or if the rest is malformed
+ */
+packet *packet_multi_next(const packet *multi, size_t *offset);
+
+/**
+ * @brief Put a serialized request into a routing envelope.
+ *
+ * @param raw The serialized request (freed)
+ * @param len The length of the request, updated to that of the envelope
+ * @return unsigned char* The serialized envelope
+ */
+unsigned char *packet_route(unsigned char *raw, size_t *len);
+
+int packet_is_routed(const packet *p);
+
+/**
+ * @brief Decode the request inside a routing envelope.
+ *
+ * @param envelope The envelope
+ * @return packet* The request (free with packet_free) or NULL if it is
+ * malformed or not a single request
+ */
+packet *packet_unroute(const packet *envelope);
+
+/**
+ * @brief Read how often a lookup was forwarded (see PKT_HOPS_MASK).
+ */
+uint8_t packet_hops(const packet *p);
+
+/**
+ * @brief Set how often a lookup was forwarded, at most PKT_HOPS_MAX.
+ */
+void packet_set_hops(packet *p, unsigned hops);
+
+/**
+ * @brief Give a SET a time to live: put it in front of the value.
+ *
+ * @param p The SET request
+ * @param ttl_ms The time to live (ms)
+ */
+void packet_set_ttl(packet *p, uint32_t ttl_ms);
+
+int packet_has_ttl(const packet *p);
+
+/**
+ * @brief Read the time to live of a SET request.
+ *
+ * @param p The request
+ * @return uint32_t The time to live (ms), 0 if it has none
+ */
+uint32_t packet_ttl(const packet *p);
+
 packet *packet_decode_hdr(const unsigned char *buffer, size_t buf_len);
 packet *packet_decode_body(packet *p, const unsigned char *buffer,
                            size_t buf_len);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+#define RCU_MAX_THREADS 64 // reactor threads plus the stabilize thread
+
+/*
+ * Quiescent-state based reclamation for the ring state (pred, succ, finger
+ * tables). Readers load the published pointers without any lock. A writer
+ * swaps in a new object and retires the old one, which is freed once every
+ * online thread passed a quiescent state (e.g. one iteration of its event
+ * loop) and can therefore no longer hold a reference to it.
+ *
+ * Thread slots are not recycled: threads are expected to live as long as the
+ * process.
+ */
+
+/**
+ * @brief Announce that the calling thread is going to read shared ring state.
+ * Registers the thread on its first call.
+ */
+void rcu_thread_online(void);
+
+/**
+ * @brief Announce that the calling thread holds no references to shared ring
+ * state until it calls rcu_thread_online again (e.g. while sleeping).
+ */
+void rcu_thread_offline(void);
+
+/**
+ * @brief Report that the calling thread holds no references obtained before
+ * this call. Frees retired objects whose grace period ended.
+ */
+void rcu_quiescent(void);
+
+/**
+ * @brief Free an object once no reader can reference it anymore.
+ * The object must already be unreachable for new readers.
+ *
+ * @param ptr The object
+ * @param free_fn Called with ptr after the grace period
+ */
+void rcu_retire(void *ptr, void (*free_fn)(void *));
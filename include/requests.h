@@ -1,24 +1,94 @@
 #pragma once
 
+#include <stdio.h>
+
 #include "packet.h"
+#include "ring_cache.h"
 #include "server.h"
+#include "timer_wheel.h"
 #include "uthash.h"
 
+#define REQUEST_POOL_SLAB 64 // request nodes allocated at once
+
 typedef struct _request {
     packet *packet;
+    server *srv; // the reactor the client is connected to
     int socket;
+    uint64_t parked_at; // ms, for the age statistics
+    uint64_t parked_us; // for the latency histogram
     struct _request *next;
 } request;
 
 typedef struct _rtable {
     uint16_t hash_id;
     request *open_requests;
+    request *last_request; // tail of open_requests for O(1) append
+    int attempts; // lookups sent for this hash_id so far minus one
+    uint16_t progress; // iterative: distance of the closest referral so far
+    int referrals; // iterative: referrals followed so far
+    ring_node next_hop; // iterative: the node that referral named
+    timer *step; // iterative: deadline of the current step
+    timer *timer; // deadline of the current lookup attempt
     UT_hash_handle hh; // impementation specific
 } rtable;
 
-void add_request(rtable **table, uint16_t hash_id, int socket,
-                 const packet *packet);
+/*
+ * Counters about requests parked while their hash_id is looked up.
+ */
+typedef struct _request_stats {
+    size_t parked;
+    size_t resolved;
+    size_t retries;
+    size_t timeouts;
+    uint64_t total_age_ms; // summed age of resolved or timed out requests
+    uint64_t max_age_ms;
+} request_stats;
+
+/**
+ * @brief Park a request until the peer responsible for hash_id is known.
+ * The table takes ownership of the packet (it is freed by clear_requests).
+ *
+ * @param table The request table
+ * @param hash_id The hash the request waits for
+ * @param srv The reactor the client is connected to
+ * @param socket The socket of the client
+ * @param packet The request
+ */
+void add_request(rtable **table, uint16_t hash_id, server *srv, int socket,
+                 packet *packet);
+
+rtable *find_requests(rtable **table, uint16_t hash_id);
 
 request *get_requests(rtable **table, uint16_t hash_id);
 
+/**
+ * @brief Drop all requests parked for a hash_id and cancel their deadline.
+ */
 void clear_requests(rtable **table, uint16_t hash_id);
+
+/**
+ * @brief Take all requests parked for a hash_id out of the table and cancel
+ * their deadline, e.g. to answer them without holding the lock of the table.
+ *
+ * @param table The request table
+ * @param hash_id The hash the requests wait for
+ * @return request* The requests (free with free_requests) or NULL
+ */
+request *detach_requests(rtable **table, uint16_t hash_id);
+
+/**
+ * @brief Free detached requests along with their packets. The nodes go back
+ * to a pool shared with the table: call it under the same lock.
+ */
+void free_requests(request *requests);
+
+/**
+ * @brief Account a request that leaves the table (resolved or timed out).
+ */
+void request_stats_record(request_stats *rs, const request *r, uint64_t now);
+
+/**
+ * @brief Print the counters along with the requests still parked.
+ */
+void request_stats_print(const request_stats *rs, rtable **table, uint64_t now,
+                         FILE *out);
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "packet.h"
+
+#define RING_NODE_LEN 8 // node_id (2) + ip (4) + port (2)
+#define RING_CACHE_MAX_QUERIES 64 // peers asked for their view while fetching
+#define RING_CACHE_MAX_HOPS 4 // "moved" answers followed before giving up
+
+/*
+ * A ring member as seen by a client: enough to connect to it directly.
+ */
+typedef struct _ring_node {
+    uint16_t node_id;
+    uint32_t ip;
+    uint16_t port;
+} ring_node;
+
+/*
+ * Client side cache of the ring membership, sorted by node_id.
+ */
+typedef struct _ring_cache {
+    ring_node *nodes;
+    size_t count;
+} ring_cache;
+
+/**
+ * @brief Serialize ring members into the value of a RING packet.
+ *
+ * @param nodes The ring members
+ * @param count The number of ring members
+ * @param buf_len Output: the length of the buffer
+ * @return unsigned char* The serialized view
+ */
+unsigned char *ring_view_serialize(const ring_node *nodes, size_t count,
+                                   size_t *buf_len);
+
+/**
+ * @brief Decode the value of a RING packet.
+ *
+ * @param buffer The serialized view
+ * @param buf_len The length of the buffer
+ * @param count Output: the number of ring members (0 on error)
+ * @return ring_node* The ring members (NULL if there are none or the view is
+ * not a whole number of members, i.e. truncated)
+ */
+ring_node *ring_view_decode(const unsigned char *buffer, size_t buf_len,
+                            size_t *count);
+
+ring_cache *ring_cache_new();
+
+void ring_cache_free(ring_cache *rc);
+
+/**
+ * @brief Add ring members to the cache, replacing entries with the same ID.
+ */
+void ring_cache_merge(ring_cache *rc, const ring_node *nodes, size_t count);
+
+/**
+ * @brief Drop a ring member from the cache (e.g. after a connect failure).
+ */
+void ring_cache_remove(ring_cache *rc, uint16_t node_id);
+
+/**
+ * @brief Find the cached member responsible for a hashed key, i.e. the first
+ * node clockwise at or after hash_id.
+ *
+ * @return const ring_node* The responsible member or NULL if the cache is empty
+ */
+const ring_node *ring_cache_lookup(const ring_cache *rc, uint16_t hash_id);
+
+/**
+ * @brief Find the cached member closest before a hashed key (clockwise), i.e.
+ * the last node before hash_id.
+ *
+ * @return const ring_node* The preceding member or NULL if the cache is empty
+ */
+const ring_node *ring_cache_preceding(const ring_cache *rc, uint16_t hash_id);
+
+/**
+ * @brief Fill the cache by asking a peer for its view of the ring and then
+ * every newly learned member, up to max_queries peers.
+ *
+ * @param rc The cache
+ * @param hostname Hostname of the first peer
+ * @param port Port of the first peer
+ * @param max_queries Upper bound of peers to ask
+ * @return int 0 if at least one peer answered, -1 otherwise
+ */
+int ring_cache_fetch(ring_cache *rc, char *hostname, char *port,
+                     size_t max_queries);
+
+/**
+ * @brief Send a key request straight to the responsible peer.
+ * Follows "moved" answers (which refresh the cache) and falls back to the
+ * proxying peer at hostname:port if the cache does not lead anywhere.
+ *
+ * @param rc The cache
+ * @param p The request
+ * @param hostname Hostname of the fallback peer
+ * @param port Port of the fallback peer
+ * @return packet* The response or NULL on error
+ */
+packet *ring_cache_request(ring_cache *rc, packet *p, char *hostname,
+                           char *port);
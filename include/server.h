@@ -1,17 +1,28 @@
 #pragma once
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <sys/socket.h>
 
 #include "packet.h"
+#include "stabilizer.h"
 #include "util.h"
-#include "neighbour.h" // needet to store peers in server struct
+#include "vnode.h" // needet to store peers in server struct
 
 #define CB_REMOVE_CLIENT (-1)
 #define CB_OK 0
+// the answer comes from elsewhere (a parked or coalesced request): the client
+// is not read anymore and stays open until server_close_socket, so its socket
+// cannot be reused by another connection meanwhile
+#define CB_WAIT 1
+
+#define SERVER_TICK_MS 50 // poll timeout while a tick callback is installed
 
 typedef enum _cstate { IDLE, HDR_RECVD, REMOVE } client_state;
 
+typedef enum _backend { BACKEND_POLL, BACKEND_IO_URING } server_backend;
+
 typedef struct _client {
     int socket;
     struct sockaddr_storage addr;
@@ -20,20 +31,91 @@ typedef struct _client {
     ring_buffer *header_buf;
     ring_buffer *pkt_buf;
     packet *pack;
+    bool armed; // a multishot recv is in flight (io_uring backend)
+    bool waiting; // answered by another thread (CB_WAIT)
     struct _client *next;
 } client;
 
+/*
+ * One reactor: a listening socket and the clients accepted on it. Several
+ * reactors can serve the same port (SO_REUSEPORT), each running its own event
+ * loop on its own thread; the kernel spreads new connections among them.
+ */
 typedef struct _server {
-    peer *p_self; // needet to send stabilize messages when server runs
-    peer *p_succ; // needet to send stabilize messages when server runs
+    vnode *vnodes; // needet to send stabilize messages when server runs
+    size_t n_vnodes; // every virtual node stabilizes with its own succ
+    stabilizer *stab; // schedule of the stabilize thread, none if NULL
     int socket;
+    int shard; // index of the reactor, shard 0 runs on the calling thread
+    server_backend backend;
     int n_clients;
-    bool active;
+    atomic_bool active;
     struct _client *clients;
+
+    // sockets to close, requested by any thread (see server_close_socket)
+    pthread_mutex_t lock;
+    int *closing;
+    size_t n_closing;
+    size_t closing_cap;
+
     int (*packet_cb)(struct _server *srv, struct _client *c, packet *p);
+    void (*tick_cb)(struct _server *srv); // called every loop iteration
 } server;
 
+/**
+ * @brief Close the connection of a client after the current loop iteration.
+ * Safe to call from any thread, e.g. when another reactor answered a request
+ * parked by this one.
+ *
+ * @param srv The reactor the client is connected to
+ * @param socket The socket of the client
+ */
 void server_close_socket(server *srv, int socket);
 
-server *server_setup(char *port);
+void server_remove_client(server *srv, client *c);
+
+/**
+ * @brief Pass received bytes to the packet decoder of a client and deliver
+ * every packet that is complete.
+ *
+ * @param srv The server
+ * @param c The client
+ * @param data The received bytes
+ * @param len The number of bytes
+ * @return int CB_REMOVE_CLIENT if the client is done, CB_OK otherwise
+ */
+int client_feed(server *srv, client *c, const unsigned char *data, size_t len);
+
+void server_mark_closing(server *srv);
+
+void server_stop(server *srv);
+
+/**
+ * @brief Create a reactor listening on a port.
+ *
+ * @param port The port
+ * @param shared Whether further reactors of this process listen on the port
+ * too (SO_REUSEPORT). Otherwise binding a port in use fails, as it should for
+ * a second peer started on it.
+ * @return server* The reactor or NULL if the port cannot be bound
+ */
+server *server_setup(char *port, bool shared);
 void server_run(server *srv);
+
+/**
+ * @brief The event loop of one reactor on io_uring: multishot accept and
+ * multishot recv into a provided buffer ring. Same semantics as the poll loop.
+ *
+ * @param srv The reactor
+ * @return int 0 when stopped, -1 if io_uring is not available
+ */
+int server_loop_uring(server *srv);
+
+/**
+ * @brief Run one event loop per reactor, each on its own thread. Shard 0 runs
+ * on the calling thread, watches stdin and stops all others when it returns.
+ *
+ * @param shards The reactors (all set up for the same port)
+ * @param n_shards The number of reactors
+ */
+void server_run_shards(server **shards, size_t n_shards);
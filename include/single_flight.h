@@ -0,0 +1,77 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "server.h"
+#include "uthash.h"
+
+/*
+ * A client waiting for the answer another client's GET fetches.
+ */
+typedef struct _flight_waiter {
+    server *srv; // the reactor the client is connected to
+    int socket;
+    struct _flight_waiter *next;
+} flight_waiter;
+
+/*
+ * A GET for a key in progress at a proxy. The client that started it (the
+ * leader) fetches the answer; clients asking for the same key meanwhile wait
+ * for that answer instead of fetching their own.
+ */
+typedef struct _flight {
+    unsigned char *key;
+    size_t key_len;
+    int leader; // the socket of the leading client
+    flight_waiter *waiters;
+    UT_hash_handle hh; // impementation specific
+} flight;
+
+typedef struct _flight_table {
+    pthread_mutex_t lock; // shared by all reactor threads
+    flight *flights;
+
+    // counters
+    size_t led;
+    size_t joined;
+    size_t failed; // flights landed without an answer
+} flight_table;
+
+flight_table *flight_table_new();
+
+/**
+ * @brief Take part in the GET of a key: lead a new flight or wait for the
+ * answer of the one in progress.
+ *
+ * @param ft The table
+ * @param key The key
+ * @param key_len The length of the key
+ * @param srv The reactor the client is connected to
+ * @param socket The socket of the client
+ * @return bool true if the client leads the flight (a new one or the one it
+ * started earlier) and has to fetch the answer and land it, false if it waits
+ */
+bool flight_join(flight_table *ft, const unsigned char *key, size_t key_len,
+                 server *srv, int socket);
+
+/**
+ * @brief End a flight led by a client: send the answer to every waiting client
+ * and close their connections. Nothing happens if the client does not lead a
+ * flight for the key.
+ *
+ * @param ft The table
+ * @param key The key
+ * @param key_len The length of the key
+ * @param leader The socket of the leading client
+ * @param rsp The serialized answer or NULL if there is none (the waiting
+ * clients are closed without one)
+ * @param rsp_len The length of the answer
+ * @return size_t The number of waiting clients
+ */
+size_t flight_land(flight_table *ft, const unsigned char *key, size_t key_len,
+                   int leader, const unsigned char *rsp, size_t rsp_len);
+
+void flight_print_stats(flight_table *ft, FILE *out);
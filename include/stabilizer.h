@@ -0,0 +1,83 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define STABILIZE_MIN_MS 250  // interval after a join, failure or ring change
+#define STABILIZE_MAX_MS 8000 // interval of a ring that stays stable
+
+/*
+ * Schedule of the stabilize thread. The interval starts at min_ms, doubles
+ * after every round in which pred and succ stayed the same and drops back to
+ * min_ms as soon as the ring changes (JOIN, a STAB or NTFY that replaced pred
+ * or succ) or a successor stops answering. A change also wakes the thread, so
+ * the next round does not wait for the rest of a long interval.
+ */
+typedef struct _stabilizer {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    uint64_t min_ms;
+    uint64_t max_ms;
+    uint64_t interval_ms;
+    bool changed; // since the last round
+    bool failing; // the last round could not reach a successor
+    bool stopped;
+
+    // counters
+    size_t rounds;
+    size_t stab_sent;
+    size_t stab_failed;
+    size_t stab_received;
+    size_t ntfy_received;
+    size_t changes;
+} stabilizer;
+
+stabilizer *stabilizer_new(uint64_t min_ms, uint64_t max_ms);
+
+void stabilizer_free(stabilizer *st);
+
+/**
+ * @brief Record a change of pred or succ: the next rounds run at min_ms again,
+ * starting right away. Safe to call from any thread.
+ *
+ * @param st The stabilizer
+ */
+void stabilizer_changed(stabilizer *st);
+
+/**
+ * @brief Count a received STAB or NTFY message.
+ *
+ * @param st The stabilizer
+ * @param ntfy Whether it was a NTFY (otherwise a STAB)
+ */
+void stabilizer_received(stabilizer *st, bool ntfy);
+
+/**
+ * @brief Finish a round and pick the next interval.
+ *
+ * @param st The stabilizer
+ * @param sent The number of STAB messages sent in the round
+ * @param failed The number of them that could not be delivered
+ * @return uint64_t The time to wait before the next round in ms
+ */
+uint64_t stabilizer_round_done(stabilizer *st, size_t sent, size_t failed);
+
+/**
+ * @brief Wait for the next round: until the interval passed, the ring
+ * changed or the stabilizer was stopped.
+ *
+ * @param st The stabilizer
+ * @param wait_ms The interval returned by stabilizer_round_done
+ * @return bool false once stopped
+ */
+bool stabilizer_wait(stabilizer *st, uint64_t wait_ms);
+
+/**
+ * @brief Let stabilizer_wait return false from now on.
+ */
+void stabilizer_stop(stabilizer *st);
+
+void stabilizer_print_stats(stabilizer *st, FILE *out);
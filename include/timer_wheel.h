@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TW_SLOT_BITS 8
+#define TW_SLOTS (1 << TW_SLOT_BITS) // per level, level 0 covers TW_SLOTS ticks
+#define TW_LEVELS 4 // each level covers TW_SLOTS rotations of the one below
+
+struct _timer_wheel;
+
+typedef struct _timer {
+    uint64_t deadline; // ms (see now_ms)
+    void *data;
+    struct _timer_wheel *wheel;
+    size_t slot; // level * TW_SLOTS + index
+    struct _timer *prev;
+    struct _timer *next;
+} timer;
+
+/*
+ * Hierarchical timing wheel: a timer due within one rotation is put into the
+ * level 0 slot of its deadline tick, one further away into the slot of a
+ * higher level that covers its deadline. Whenever a level completes a
+ * rotation, the next slot of the level above is emptied into the levels
+ * below, so every timer is moved at most TW_LEVELS - 1 times and a tick only
+ * touches the timers that are due. Deadlines beyond the last level wait in
+ * its furthest slot.
+ */
+typedef struct _timer_wheel {
+    timer *slots[TW_LEVELS * TW_SLOTS];
+    uint64_t tick_ms;
+    uint64_t current; // last tick that was processed
+    size_t count;
+} timer_wheel;
+
+typedef void (*timer_cb)(void *data, void *arg);
+
+timer_wheel *timer_wheel_new(uint64_t tick_ms, uint64_t now);
+
+void timer_wheel_free(timer_wheel *tw);
+
+/**
+ * @brief Schedule a timer.
+ *
+ * @param tw The wheel
+ * @param deadline When to fire (ms)
+ * @param data Passed to the callback
+ * @return timer* Handle to cancel the timer (owned by the wheel)
+ */
+timer *timer_wheel_add(timer_wheel *tw, uint64_t deadline, void *data);
+
+/**
+ * @brief Cancel a pending timer. The handle is invalid afterwards.
+ */
+void timer_cancel(timer *t);
+
+/**
+ * @brief Fire all timers whose deadline passed. A fired timer is freed before
+ * its callback runs, so the callback may add or cancel timers freely.
+ *
+ * @param tw The wheel
+ * @param now The current time (ms)
+ * @param cb Called for every expired timer
+ * @param arg Passed to the callback
+ * @return size_t The number of fired timers
+ */
+size_t timer_wheel_advance(timer_wheel *tw, uint64_t now, timer_cb cb,
+                           void *arg);
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "packet.h"
+
+#define TRACE_RECORD_LEN 11 // node_id (2), stage (1), time in us (8)
+#define TRACE_MAX_RECORDS 64 // further records are dropped
+
+/*
+ * A traced request (PKT_FLAG_TRCE along with GET, SET or DEL) carries its
+ * trace at the end of the value: the records one after another, followed by
+ * their count (2 bytes). Every peer that handles the request appends a record,
+ * the peer that serves it copies the trace into the answer, and proxies add
+ * to it on the way back. Times are taken from the wall clock so that records
+ * of different hosts can be compared.
+ */
+typedef enum _trace_stage {
+    TRACE_RECEIVED,  // a peer got the request from a client or proxy
+    TRACE_PROXY,     // it passes the request on
+    TRACE_PARKED,    // it waits for a lookup of the responsible peer
+    TRACE_REFERRAL,  // iterative lookup step, node is the next hop
+    TRACE_LOOKED_UP, // lookup answered, node is the responsible peer
+    TRACE_STORE,     // the key-value store operation is done
+    TRACE_PROXIED,   // the answer passed back through a proxy
+    TRACE_STAGES
+} trace_stage;
+
+typedef struct _trace_record {
+    uint16_t node_id;
+    uint8_t stage;
+    uint64_t time_us;
+} trace_record;
+
+uint64_t trace_now_us(void);
+
+const char *trace_stage_name(uint8_t stage);
+
+/**
+ * @brief Whether a data packet is a traced request or answer.
+ */
+bool packet_is_traced(const packet *p);
+
+/**
+ * @brief The size of the trace at the end of a value.
+ *
+ * @return size_t The number of bytes, 0 if the value ends with no valid trace
+ */
+size_t trace_size(const unsigned char *value, size_t value_len);
+
+/**
+ * @brief Mark a request as traced and append an empty trace to its value.
+ *
+ * @param p The request
+ */
+void trace_start(packet *p);
+
+/**
+ * @brief Append a record to the trace of a traced packet.
+ *
+ * @param p The packet
+ * @param node_id The peer (or virtual node) the record is about
+ * @param stage What happened
+ */
+void trace_add(packet *p, uint16_t node_id, trace_stage stage);
+
+/**
+ * @brief Append the trace of a request to the value of its answer.
+ *
+ * @param dst The answer
+ * @param src The traced request (nothing happens otherwise)
+ */
+void trace_copy(packet *dst, const packet *src);
+
+/**
+ * @brief Append a record to the trace of a serialized packet (e.g. an answer
+ * piped through a proxy). Packets without a trace are left as they are.
+ *
+ * @param raw The serialized packet (may be reallocated)
+ * @param len Its length, updated
+ * @param node_id The peer the record is about
+ * @param stage What happened
+ * @return unsigned char* The serialized packet
+ */
+unsigned char *trace_add_raw(unsigned char *raw, size_t *len,
+                             uint16_t node_id, trace_stage stage);
+
+/**
+ * @brief Read the records of a trace.
+ *
+ * @param value The value ending with the trace
+ * @param value_len The length of the value
+ * @param records Where to put the records (TRACE_MAX_RECORDS of them)
+ * @return size_t The number of records
+ */
+size_t trace_decode(const unsigned char *value, size_t value_len,
+                    trace_record *records);
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Minimal io_uring wrapper on top of the raw system calls (no liburing):
+ * submission and completion queue, plus a provided buffer ring that lets the
+ * kernel pick a receive buffer when data arrives instead of one buffer being
+ * reserved per connection.
+ */
+typedef struct _uring {
+    int fd;
+
+    // submission queue (shared with the kernel)
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_pending; // prepared but not yet submitted
+
+    // completion queue (shared with the kernel)
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+} uring;
+
+typedef struct _uring_bufs {
+    struct io_uring_buf_ring *ring;
+    size_t ring_len;
+    unsigned char *mem;
+    unsigned count; // a power of two
+    size_t size;    // of every buffer
+    uint16_t bgid;
+} uring_bufs;
+
+/**
+ * @brief Set up a ring.
+ *
+ * @param r The ring
+ * @param entries The size of the submission queue (a power of two)
+ * @return int 0 on success, -1 on error (e.g. io_uring not available)
+ */
+int uring_init(uring *r, unsigned entries);
+
+void uring_exit(uring *r);
+
+/**
+ * @brief Get a cleared submission queue entry. Submits the pending entries if
+ * the queue is full.
+ *
+ * @return struct io_uring_sqe* The entry (never NULL)
+ */
+struct io_uring_sqe *uring_get_sqe(uring *r);
+
+/**
+ * @brief Submit the pending entries and wait for at least wait_nr completions.
+ *
+ * @return int The number of submitted entries or -1 on error
+ */
+int uring_submit_and_wait(uring *r, unsigned wait_nr);
+
+/**
+ * @brief Get the next completion without waiting.
+ *
+ * @return struct io_uring_cqe* The completion or NULL if there is none
+ */
+struct io_uring_cqe *uring_peek_cqe(uring *r);
+
+/**
+ * @brief Hand the completion returned by uring_peek_cqe back to the kernel.
+ */
+void uring_cqe_seen(uring *r);
+
+/**
+ * @brief Register a ring of count buffers of size bytes as buffer group bgid.
+ *
+ * @return int 0 on success, -1 on error
+ */
+int uring_bufs_init(uring *r, uring_bufs *b, uint16_t bgid, unsigned count,
+                    size_t size);
+
+void uring_bufs_free(uring *r, uring_bufs *b);
+
+/**
+ * @brief Get the memory of a provided buffer the kernel filled.
+ */
+unsigned char *uring_buf(uring_bufs *b, uint16_t bid);
+
+/**
+ * @brief Give a provided buffer back to the kernel once it was consumed.
+ */
+void uring_buf_recycle(uring_bufs *b, uint16_t bid);
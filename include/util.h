@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 typedef struct _ring_buffer {
     unsigned char *buffer;
@@ -25,6 +26,16 @@ void rb_free(ring_buffer *rb);
 
 int sendall(int s, unsigned char *buffer, size_t buf_size);
 
+/**
+ * @brief Send several buffers as one message without joining them first.
+ *
+ * @param s The socket
+ * @param iov The buffers (modified while sending)
+ * @param iovcnt The number of buffers
+ * @return int 0 on success, -1 on error
+ */
+int sendallv(int s, struct iovec *iov, int iovcnt);
+
 unsigned char *recvall(int s, size_t *data_len);
 
 /**
@@ -36,4 +47,23 @@ unsigned char *recvall(int s, size_t *data_len);
  */
 uint16_t pseudo_hash(const unsigned char *buffer, size_t buf_len);
 
+/**
+ * @brief Milliseconds on a monotonic clock (for timeouts and ages).
+ */
+uint64_t now_ms();
+
+/**
+ * @brief Microseconds on a monotonic clock (for latencies).
+ */
+uint64_t now_us();
+
 char *get_ip_str(const struct sockaddr *sa, char *s, size_t maxlen);
+
+/**
+ * @brief Connect to a peer of the chord ring.
+ *
+ * @param hostname Hostname of peer
+ * @param port Port of peer
+ * @return int The connected socket or -1 on error
+ */
+int connect_socket(char *hostname, char *port);
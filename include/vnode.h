@@ -0,0 +1,214 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "neighbour.h"
+
+#define SIZE_OF_FT 16 // 2^16 = hash space = node ID space
+#define FT_ACTIVE 0
+#define FT_INACTIVE (-1)
+#define FT_INIT 42
+
+#define VNODES_MAX 64 // upper bound for virtual nodes per peer process
+
+// what a virtual node does about a JOIN, STAB or NTFY (see vnode_on_join etc.)
+#define RING_SET_PRED 1 << 0 // take the sender as pred
+#define RING_SET_SUCC 1 << 1 // take the sender (or the named node) as succ
+#define RING_REPLY 1 << 2    // answer the sender with a NTFY
+#define RING_FORWARD 1 << 3  // pass the JOIN on, somebody else takes it
+
+typedef struct _finger_table {
+    _Atomic int state; // FT_ACTIVE publishes the filled entries to readers
+    int finger_count; // keep track of how much fingers we already added (useful for building up the FT)
+    peer **ft; // our FT stores pointers to peers
+} finger_table;
+
+/*
+ * A virtual node is one position on the ring hosted by this process. Every
+ * virtual node has its own predecessor, successor and finger table, but all of
+ * them share the IP and port (and therefore the server) of the process.
+ *
+ * pred, succ and fng_tab are read by all reactor threads without locking.
+ * Writers publish a new object with an atomic swap and retire the old one
+ * (see rcu.h), so a reader may see either version but never a freed one.
+ */
+typedef struct _vnode {
+    peer *self;
+    _Atomic(peer *) pred;
+    _Atomic(peer *) succ;
+    _Atomic(finger_table *) fng_tab;
+} vnode;
+
+/*
+ * Where a lookup of a hash goes next (see vnode_route).
+ */
+typedef enum _route_kind {
+    ROUTE_SELF,    // one of our virtual nodes is responsible
+    ROUTE_SUCC,    // the successor of one of them is
+    ROUTE_REFER,   // iterative: tell the questioner to ask next
+    ROUTE_FORWARD, // recursive: pass the lookup on to next
+    ROUTE_NONE     // no successor known yet
+} route_kind;
+
+typedef struct _route {
+    route_kind kind;
+    vnode *v;   // the virtual node that decided
+    peer *next; // the answer (SELF, SUCC, REFER) or next hop (FORWARD)
+} route;
+
+/**
+ * @brief Derive the ring position of the index-th virtual node of a peer.
+ * Index 0 is always the base ID itself, so a peer with one virtual node keeps
+ * the ID it was given on the command line.
+ *
+ * @param base_id The ID of the peer
+ * @param index The index of the virtual node
+ * @return uint16_t The ID of the virtual node
+ */
+uint16_t vnode_derive_id(uint16_t base_id, size_t index);
+
+/**
+ * @brief Allocate count virtual nodes sorted by ID (without pred/succ).
+ *
+ * @param base_id The ID of the peer
+ * @param count The number of virtual nodes
+ * @param hostname The hostname shared by all virtual nodes
+ * @param port The port shared by all virtual nodes
+ * @return vnode* The virtual nodes or NULL on error
+ */
+vnode *vnodes_init(uint16_t base_id, size_t count, const char *hostname,
+                   const char *port);
+
+/**
+ * @brief Link the virtual nodes of a new DHT to a ring of their own.
+ *
+ * @param vn The virtual nodes (sorted by ID)
+ * @param count The number of virtual nodes
+ */
+void vnodes_link_local(vnode *vn, size_t count);
+
+/**
+ * @brief Find the virtual node with exactly the given ID.
+ *
+ * @return vnode* The virtual node or NULL if the ID is not hosted here
+ */
+vnode *vnode_find(vnode *vn, size_t count, uint16_t node_id);
+
+/**
+ * @brief Find the virtual node responsible for a hashed key, i.e. the one with
+ * hash_id in (pred, self]. A virtual node without pred and succ is alone in the
+ * ring and therefore responsible for everything.
+ *
+ * @return vnode* The responsible virtual node or NULL if none of ours is
+ */
+vnode *vnode_responsible(vnode *vn, size_t count, uint16_t hash_id);
+
+/**
+ * @brief Find the virtual node preceding an ID most closely (clockwise) that
+ * already knows its successor. An exact match counts as preceding.
+ *
+ * @return vnode* The closest preceding virtual node or NULL if none has a succ
+ */
+vnode *vnode_closest(vnode *vn, size_t count, uint16_t id);
+
+/**
+ * @brief Find the virtual node that would succeed an ID on the ring.
+ *
+ * @return vnode* The first virtual node clockwise after the ID
+ */
+vnode *vnode_successor_of(vnode *vn, size_t count, uint16_t id);
+
+/**
+ * @brief Pick the next hop for a lookup of hash_id from the finger table of a
+ * virtual node. Falls back to the successor if the FT is not built yet.
+ *
+ * @param v The virtual node
+ * @param hash_id The hash to lookup
+ * @return peer* The closest preceding finger
+ */
+peer *vnode_closest_preceding_finger(const vnode *v, uint16_t hash_id);
+
+/**
+ * @brief Pick the next hop for a (repeated) lookup of hash_id. Attempt 0 is the
+ * closest preceding finger, every further attempt takes the next closest
+ * distinct finger and finally the successor, then wraps around.
+ *
+ * @param v The virtual node
+ * @param hash_id The hash to lookup
+ * @param attempt The number of earlier attempts
+ * @return peer* The next hop
+ */
+peer *vnode_lookup_hop(const vnode *v, uint16_t hash_id, int attempt);
+
+/**
+ * @brief Free a finger table along with its entries.
+ *
+ * @param fng_tab The finger table (void * to be usable with rcu_retire)
+ */
+void finger_table_free(void *fng_tab);
+
+/**
+ * @brief Calculate the start of the i-th finger of a node.
+ *
+ * @return uint16_t (node_id + 2^i) mod 2^16
+ */
+uint16_t finger_start(uint16_t node_id, size_t i);
+
+/**
+ * @brief Decide how a virtual node takes a JOIN: as the new pred (and succ if
+ * it is alone) answered with a NTFY, or passed on along the ring.
+ *
+ * @param v The virtual node that would succeed the joining node
+ * @param joining_id The ID of the joining node
+ * @return unsigned RING_* actions
+ */
+unsigned vnode_on_join(const vnode *v, uint16_t joining_id);
+
+/**
+ * @brief Decide how a virtual node takes a STAB from a node that holds it as
+ * succ. Every STAB is answered with a NTFY naming the pred, once there is one.
+ *
+ * @param v The addressed virtual node
+ * @param sender_id The ID of the sender
+ * @return unsigned RING_* actions
+ */
+unsigned vnode_on_stabilize(const vnode *v, uint16_t sender_id);
+
+/**
+ * @brief Decide whether a NTFY (naming the pred of our succ) gives a virtual
+ * node a new succ.
+ *
+ * @param v The addressed virtual node
+ * @param named_id The ID named by the NTFY
+ * @return unsigned RING_SET_SUCC or 0
+ */
+unsigned vnode_on_notify(const vnode *v, uint16_t named_id);
+
+/**
+ * @brief Route a lookup of hash_id among the virtual nodes of a peer.
+ *
+ * @param vn The virtual nodes
+ * @param count The number of virtual nodes
+ * @param hash_id The hash to lookup
+ * @param iterative Refer the questioner instead of forwarding
+ * @return route Where the lookup goes
+ */
+route vnode_route(vnode *vn, size_t count, uint16_t hash_id, bool iterative);
+
+/**
+ * @brief Allocate an empty finger table in FT_INIT state.
+ */
+finger_table *finger_table_new(void);
+
+/**
+ * @brief Enter the answer to a finger lookup into a finger table still being
+ * built; the table turns FT_ACTIVE with its last entry.
+ *
+ * @param v The virtual node
+ * @param hash_id The looked up hash (the start of a finger)
+ * @param p The responsible peer (copied)
+ */
+void vnode_add_finger(vnode *v, uint16_t hash_id, const peer *p);
@@ -1,6 +1,10 @@
+#include "compress.h"
 #include "packet.h"
+#include "ring_cache.h"
+#include "trace.h"
 #include "util.h"
 
+#include <getopt.h>
 #include <netdb.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -46,58 +50,156 @@ unsigned char *read_stdin(size_t *len) {
 }
 
 /**
- * @brief Connect to a peer of the chord ring.
+ * @brief Print the hop timeline of a traced answer, relative to the time the
+ * request was sent.
  *
- * @param host Hostname of peer
- * @param port Port of peer
+ * @param rsp The answer
+ * @param sent When the request was sent (us, wall clock)
+ * @param received When the answer arrived (us, wall clock)
  */
-int connect_socket(char *hostname, char *port) {
-    struct addrinfo *res;
-    struct addrinfo hints;
-
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-
-    int status = getaddrinfo(hostname, port, &hints, &res);
-    if (status != 0) {
-        perror("getaddrinfo:");
-        return -1;
+void print_trace(const packet *rsp, uint64_t sent, uint64_t received) {
+    trace_record records[TRACE_MAX_RECORDS];
+    size_t count = trace_decode(rsp->value, rsp->value_len, records);
+
+    fprintf(stderr, "%10.3f ms  %-12s %s\n", 0.0, "client", "sent");
+    for (size_t i = 0; i < count; i++) {
+        char node[16];
+        snprintf(node, sizeof(node), "node %u", records[i].node_id);
+        fprintf(stderr, "%10.3f ms  %-12s %s\n",
+                ((double)records[i].time_us - sent) / 1000.0, node,
+                trace_stage_name(records[i].stage));
     }
+    fprintf(stderr, "%10.3f ms  %-12s %s\n", (received - sent) / 1000.0,
+            "client", "answer received");
+}
 
-    struct addrinfo *p;
-    int sock = -1;
-    bool connected = false;
-
-    char ipstr[INET6_ADDRSTRLEN];
-
-    for (p = res; p != NULL; p = p->ai_next) {
-        sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (sock < 0) {
-            continue;
+/**
+ * @brief Read a whole file.
+ *
+ * @param path The path of the file
+ * @param len Length of the data read
+ * @return unsigned char* The data or NULL if the file cannot be read
+ */
+unsigned char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    size_t buf_size = 1024;
+    unsigned char *buffer = (unsigned char *)malloc(buf_size);
+    *len = 0;
+    size_t bytes;
+    while ((bytes = fread(buffer + *len, 1, buf_size - *len, f)) > 0) {
+        *len += bytes;
+        if (*len == buf_size) {
+            buf_size *= 2;
+            buffer = realloc(buffer, buf_size);
         }
+    }
+    fclose(f);
+    return buffer;
+}
 
-        get_ip_str(p->ai_addr, ipstr, INET6_ADDRSTRLEN);
-        fprintf(stderr, "Attempting connection to %s\n", ipstr);
+/**
+ * @brief Send a multi-key request (MGET key..., MSET key file ..., MDEL
+ * key...) and print the result of every key: found values go to stdout as
+ * "key length" followed by the value on its own line, everything else to
+ * stderr.
+ *
+ * @param hostname Hostname of the chord peer
+ * @param port Port of the chord peer
+ * @param method MGET, MSET or MDEL
+ * @param args The keys (for MSET: key and file in turns)
+ * @param n_args The number of args
+ * @return int 0 if every key succeeded, -1 otherwise
+ */
+int multi_request(char *hostname, char *port, const char *method, char **args,
+                  int n_args) {
+    uint8_t op;
+    int step = 1;
+    if (strcmp(method, "MGET") == 0) {
+        op = PKT_FLAG_GET;
+    } else if (strcmp(method, "MSET") == 0) {
+        op = PKT_FLAG_SET;
+        step = 2;
+    } else {
+        op = PKT_FLAG_DEL;
+    }
+    if (n_args % step != 0) {
+        fprintf(stderr, "MSET needs a file for every key!\n");
+        return -1;
+    }
 
-        status = connect(sock, p->ai_addr, p->ai_addrlen);
-        if (status < 0) {
-            perror("connect");
-            close(sock);
-            continue;
+    size_t count = n_args / step;
+    packet **reqs = (packet **)calloc(count, sizeof(packet *));
+    int status = 0;
+    for (size_t i = 0; i < count && status == 0; i++) {
+        reqs[i] = packet_new();
+        reqs[i]->flags = op;
+        reqs[i]->key = (unsigned char *)strdup(args[i * step]);
+        reqs[i]->key_len = strlen(args[i * step]);
+        if (op == PKT_FLAG_SET) {
+            size_t len = 0;
+            reqs[i]->value = read_file(args[i * step + 1], &len);
+            reqs[i]->value_len = len;
+            status = reqs[i]->value != NULL ? 0 : -1;
         }
-        connected = true;
-        break;
     }
-    freeaddrinfo(res);
+    packet *m = status == 0 ? packet_multi(reqs, count) : NULL;
+    for (size_t i = 0; i < count; i++) {
+        packet_free(reqs[i]);
+    }
+    free(reqs);
+    if (m == NULL) {
+        return -1;
+    }
 
-    if (!connected) {
+    int s = connect_socket(hostname, port);
+    if (s < 0) {
+        fprintf(stderr, "Could not connect to host!\n");
+        packet_free(m);
         return -1;
     }
+    size_t raw_size;
+    unsigned char *raw_pkt = packet_serialize(m, &raw_size);
+    packet_free(m);
+    sendall(s, raw_pkt, raw_size);
+    free(raw_pkt);
 
-    fprintf(stderr, "Connected to %s.\n", ipstr);
+    size_t response_len;
+    unsigned char *response = recvall(s, &response_len);
+    packet *rsp = response_len >= PKT_HEADER_LEN
+                      ? packet_decode(response, response_len)
+                      : NULL;
+    free(response);
+    if (rsp == NULL || !packet_is_multi(rsp) || !(rsp->flags & PKT_FLAG_ACK)) {
+        fprintf(stderr, "Server did not acknowledge operation!\n");
+        packet_free(rsp);
+        return -1;
+    }
 
-    return sock;
+    size_t offset = 0;
+    size_t ok = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char *key = args[i * step];
+        packet *a = packet_multi_next(rsp, &offset);
+        if (a == NULL || !(a->flags & PKT_FLAG_ACK)) {
+            fprintf(stderr, "%s: %s\n", key,
+                    op == PKT_FLAG_SET ? "failed" : "not found");
+        } else if (op == PKT_FLAG_GET) {
+            printf("%s %u\n", key, a->value_len);
+            fwrite(a->value, 1, a->value_len, stdout);
+            printf("\n");
+            ok++;
+        } else {
+            fprintf(stderr, "%s: ok\n", key);
+            ok++;
+        }
+        packet_free(a);
+    }
+    packet_free(rsp);
+    return ok == count ? 0 : -1;
 }
 
 /**
@@ -109,11 +211,60 @@ int connect_socket(char *hostname, char *port) {
  * 3. Command to execute
  * 4. Key to update
  *
+ * The method STATS takes no key and prints the metrics of the peer. With
+ * '--trace' the request collects a record of every peer it passes and the
+ * client prints that timeline to stderr. With '--ttl ms' a SET key expires
+ * after that many milliseconds. With '--zip' a GET takes the value as the
+ * peer stores it, compressed, and the client decompresses it.
+ *
+ * With the option '-s' the client fetches the ring membership from the peer
+ * first and sends the request straight to the peer responsible for the key.
+ *
+ * MGET, MSET and MDEL take several keys (MSET a key and a file with its value
+ * in turns) and send them in one multi-key request to the given peer.
+ *
  * @param argc The number of arguments.
  * @param argv The arguments.
  */
 int main(int argc, char **argv) {
-    if (argc < 5) {
+    bool smart = false;
+    bool traced = false;
+    uint32_t ttl_ms = 0;
+    bool zipped = false;
+
+    static const struct option options[] = {
+        {"trace", no_argument, NULL, 't'},
+        {"ttl", required_argument, NULL, 'e'},
+        {"zip", no_argument, NULL, 'z'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "st", options, NULL)) != -1) {
+        if (opt == 's') {
+            smart = true;
+        } else if (opt == 't') {
+            traced = true;
+        } else if (opt == 'e') {
+            ttl_ms = strtoul(optarg, NULL, 10);
+        } else if (opt == 'z') {
+            zipped = true;
+        } else {
+            fprintf(stderr, "Usage: './client [-s] [--trace] [--ttl ms] [--zip] host port method [key...]'\n");
+            return -1;
+        }
+    }
+    // drop the options so that the positional arguments keep their indices
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc >= 5 && (strcmp(argv[3], "MGET") == 0 ||
+                      strcmp(argv[3], "MSET") == 0 ||
+                      strcmp(argv[3], "MDEL") == 0)) {
+        return multi_request(argv[1], argv[2], argv[3], argv + 4, argc - 4);
+    }
+
+    bool stats = argc == 4 && strcmp(argv[3], "STATS") == 0;
+    if (argc < 5 && !stats) {
         fprintf(stderr, "Not enough args!\n");
         return -1;
     }
@@ -122,15 +273,11 @@ int main(int argc, char **argv) {
     char *hostname = argv[1];
     char *port = argv[2];
     char *method = argv[3];
-    char *key = argv[4];
-
-    int s = connect_socket(hostname, port);
-    if (s < 0) {
-        fprintf(stderr, "Could not connect to host!\n");
-        return -1;
-    }
+    char *key = stats ? "" : argv[4];
 
     packet *p = packet_new();
+    p->key = (unsigned char *)strdup(key);
+    p->key_len = strlen(key);
 
     // check for command type
     if (strcmp(method, "SET") == 0) {
@@ -139,60 +286,100 @@ int main(int argc, char **argv) {
         unsigned char *data = read_stdin(&data_len);
 
         fprintf(stderr, "%zu bytes read from stdin.\n", data_len);
-        p->key = (unsigned char *)strdup(key);
-        p->key_len = strlen(key);
         p->flags = PKT_FLAG_SET;
         p->value = data;
         p->value_len = data_len;
-
-        size_t raw_size;
-        unsigned char *raw_pkt = packet_serialize(p, &raw_size);
-        packet_free(p); // frees data as well
-
-        sendall(s, raw_pkt, raw_size);
+        if (ttl_ms > 0) {
+            packet_set_ttl(p, ttl_ms);
+        }
     } else if (strcmp(method, "GET") == 0) {
         // GET command
-        p->key = (unsigned char *)strdup(key);
-        p->key_len = strlen(key);
         p->flags = PKT_FLAG_GET;
-
-        size_t raw_size;
-        unsigned char *raw_pkt = packet_serialize(p, &raw_size);
-        packet_free(p);
-        sendall(s, raw_pkt, raw_size);
-
+        p->flags |= zipped ? PKT_FLAG_ZIP : 0;
     } else if (strcmp(method, "DELETE") == 0) {
         // DELETE command
-        p->key = (unsigned char *)strdup(key);
-        p->key_len = strlen(key);
         p->flags = PKT_FLAG_DEL;
-
-        size_t raw_size;
-        unsigned char *raw_pkt = packet_serialize(p, &raw_size);
-        packet_free(p);
-        sendall(s, raw_pkt, raw_size);
-
+    } else if (stats) {
+        // STATS command (always asks the given peer)
+        p->flags = PKT_FLAG_STAT;
+        smart = false;
     } else {
         fprintf(stderr, "Unknown method %s!\n", method);
         packet_free(p);
         return -1;
     }
 
-    size_t response_len;
-    unsigned char *response = recvall(s, &response_len);
-    packet *rsp = packet_decode(response, response_len);
-    free(response);
+    if (traced && !stats) {
+        trace_start(p);
+    }
+    uint64_t sent = trace_now_us();
+
+    packet *rsp = NULL;
+    if (smart) {
+        ring_cache *rc = ring_cache_new();
+        if (ring_cache_fetch(rc, hostname, port, RING_CACHE_MAX_QUERIES) != 0) {
+            fprintf(stderr, "Could not fetch ring view, using %s:%s only.\n",
+                    hostname, port);
+        }
+        rsp = ring_cache_request(rc, p, hostname, port);
+        ring_cache_free(rc);
+        packet_free(p); // frees data as well
+    } else {
+        int s = connect_socket(hostname, port);
+        if (s < 0) {
+            fprintf(stderr, "Could not connect to host!\n");
+            packet_free(p);
+            return -1;
+        }
+
+        size_t raw_size;
+        unsigned char *raw_pkt = packet_serialize(p, &raw_size);
+        packet_free(p); // frees data as well
+        sendall(s, raw_pkt, raw_size);
+        free(raw_pkt);
+
+        size_t response_len;
+        unsigned char *response = recvall(s, &response_len);
+        rsp = packet_decode(response, response_len);
+        free(response);
+    }
 
     if (rsp == NULL) {
         return -1;
     }
+    uint64_t received = trace_now_us();
+
+    if (packet_is_traced(rsp)) {
+        // the trace is not part of the value
+        print_trace(rsp, sent, received);
+        rsp->value_len -= trace_size(rsp->value, rsp->value_len);
+    }
 
     if (!(rsp->flags & PKT_FLAG_ACK)) {
         fprintf(stderr, "Server did not acknowledge operation!\n");
+        if (rsp->value_len > 0) {
+            fprintf(stderr, "Reason: %.*s\n", (int)rsp->value_len,
+                    (char *)rsp->value);
+        }
         return -1;
     }
 
-    if (strcmp(method, "GET") == 0) {
+    if ((rsp->flags & PKT_FLAG_GET) && (rsp->flags & PKT_FLAG_ZIP)) {
+        size_t len = 0;
+        unsigned char *data = zip_decompress(rsp->value, rsp->value_len, &len);
+        if (data == NULL) {
+            fprintf(stderr, "Could not decompress the value!\n");
+            packet_free(rsp);
+            return -1;
+        }
+        fprintf(stderr, "%u bytes received, %zu bytes decompressed (%s).\n",
+                rsp->value_len, len, codec_name(rsp->value[0]));
+        free(rsp->value);
+        rsp->value = data;
+        rsp->value_len = len;
+    }
+
+    if (strcmp(method, "GET") == 0 || stats) {
         size_t written = 0;
         while (written < rsp->value_len) {
             size_t n = fwrite(rsp->value + written, 1, rsp->value_len - written,
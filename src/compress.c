@@ -0,0 +1,212 @@
+#include "compress.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "metrics.h"
+
+static const char *codec_names[CODECS] = {"none", "lz4", "zstd", "zlib"};
+
+codec codec_parse(const char *name) {
+    for (int c = 0; c < CODECS; c++) {
+        if (strcmp(name, codec_names[c]) == 0) {
+            return (codec)c;
+        }
+    }
+    return CODECS;
+}
+
+const char *codec_name(codec c) {
+    return c < CODECS ? codec_names[c] : "unknown";
+}
+
+bool codec_available(codec c) {
+    switch (c) {
+    case CODEC_NONE:
+        return true;
+#ifdef HAVE_LZ4
+    case CODEC_LZ4:
+        return true;
+#endif
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+        return true;
+#endif
+#ifdef HAVE_ZLIB
+    case CODEC_ZLIB:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief CPU time of the calling thread (ns), the cost of a codec does not
+ * include the time the thread was not running.
+ */
+static uint64_t cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Compress with a codec into a buffer of the given capacity.
+ *
+ * @return size_t The compressed length, 0 on failure
+ */
+static size_t codec_compress(codec c, const unsigned char *data, size_t len,
+                             unsigned char *out, size_t cap) {
+    switch (c) {
+#ifdef HAVE_LZ4
+    case CODEC_LZ4: {
+        int n = LZ4_compress_default((const char *)data, (char *)out,
+                                     (int)len, (int)cap);
+        return n > 0 ? (size_t)n : 0;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD: {
+        size_t n = ZSTD_compress(out, cap, data, len, ZIP_ZSTD_LEVEL);
+        return ZSTD_isError(n) ? 0 : n;
+    }
+#endif
+#ifdef HAVE_ZLIB
+    case CODEC_ZLIB: {
+        uLongf n = cap;
+        int status = compress2(out, &n, data, len, ZIP_ZLIB_LEVEL);
+        return status == Z_OK ? (size_t)n : 0;
+    }
+#endif
+    default:
+        (void)data, (void)len, (void)out, (void)cap;
+        return 0;
+    }
+}
+
+/**
+ * @brief Decompress with a codec into a buffer of exactly the original length.
+ *
+ * @return bool true if the data had that length
+ */
+static bool codec_decompress(codec c, const unsigned char *data, size_t len,
+                             unsigned char *out, size_t raw_len) {
+    switch (c) {
+#ifdef HAVE_LZ4
+    case CODEC_LZ4:
+        return LZ4_decompress_safe((const char *)data, (char *)out, (int)len,
+                                   (int)raw_len) == (int)raw_len;
+#endif
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+        return ZSTD_decompress(out, raw_len, data, len) == raw_len;
+#endif
+#ifdef HAVE_ZLIB
+    case CODEC_ZLIB: {
+        uLongf n = raw_len;
+        return uncompress(out, &n, data, len) == Z_OK && n == raw_len;
+    }
+#endif
+    default:
+        (void)data, (void)len, (void)out, (void)raw_len;
+        return false;
+    }
+}
+
+unsigned char *zip_compress(codec c, const unsigned char *data, size_t len,
+                            size_t *frame_len) {
+    if (c == CODEC_NONE || !codec_available(c) || len <= ZIP_HDR_LEN ||
+        len > ZIP_MAX_LEN) {
+        return NULL;
+    }
+    uint64_t start = cpu_ns();
+
+    // not worth it unless the frame is smaller than the data
+    size_t cap = len - ZIP_HDR_LEN;
+    unsigned char *frame = (unsigned char *)malloc(len);
+    frame[0] = (uint8_t)c;
+    frame[1] = (uint8_t)(len >> 24u) & 0xFFu;
+    frame[2] = (uint8_t)(len >> 16u) & 0xFFu;
+    frame[3] = (uint8_t)(len >> 8u) & 0xFFu;
+    frame[4] = (uint8_t)(len >> 0u) & 0xFFu;
+    size_t n = codec_compress(c, data, len, frame + ZIP_HDR_LEN, cap);
+
+    metrics_add(M_ZIP_CPU_NS, cpu_ns() - start);
+    metrics_add(M_ZIP_BYTES_IN, len);
+    if (n == 0) {
+        metrics_add(M_ZIP_BYTES_OUT, len); // stays as it is
+        free(frame);
+        return NULL;
+    }
+    metrics_add(M_ZIP_VALUES, 1);
+    metrics_add(M_ZIP_BYTES_OUT, ZIP_HDR_LEN + n);
+
+    *frame_len = ZIP_HDR_LEN + n;
+    return (unsigned char *)realloc(frame, *frame_len);
+}
+
+size_t zip_raw_len(const unsigned char *frame, size_t frame_len) {
+    if (frame_len < ZIP_HDR_LEN) {
+        return 0;
+    }
+    size_t len = ((size_t)frame[1] << 24u) | ((size_t)frame[2] << 16u) |
+                 ((size_t)frame[3] << 8u) | ((size_t)frame[4] << 0u);
+    return len <= ZIP_MAX_LEN ? len : 0; // nobody compresses more
+}
+
+unsigned char *zip_decompress(const unsigned char *frame, size_t frame_len,
+                              size_t *len) {
+    size_t raw_len = zip_raw_len(frame, frame_len);
+    if (raw_len == 0 || frame[0] >= CODECS || !codec_available(frame[0])) {
+        return NULL;
+    }
+    uint64_t start = cpu_ns();
+
+    unsigned char *data = (unsigned char *)malloc(raw_len);
+    bool ok = codec_decompress(frame[0], frame + ZIP_HDR_LEN,
+                               frame_len - ZIP_HDR_LEN, data, raw_len);
+
+    metrics_add(M_UNZIP_CPU_NS, cpu_ns() - start);
+    if (!ok) {
+        free(data);
+        return NULL;
+    }
+    metrics_add(M_UNZIP_BYTES, raw_len);
+    *len = raw_len;
+    return data;
+}
+
+void zip_dump(FILE *out) {
+    fprintf(out, "compress_codecs ");
+    const char *sep = "";
+    for (int c = CODEC_NONE + 1; c < CODECS; c++) {
+        if (codec_available(c)) {
+            fprintf(out, "%s%s", sep, codec_names[c]);
+            sep = ",";
+        }
+    }
+    fprintf(out, "%s\n", *sep == '\0' ? "none" : "");
+
+    uint64_t in = metrics_get(M_ZIP_BYTES_IN);
+    uint64_t zipped = metrics_get(M_ZIP_BYTES_OUT);
+    uint64_t unzipped = metrics_get(M_UNZIP_BYTES);
+    fprintf(out, "compress_ratio %.3f\n", zipped > 0 ? (double)in / zipped : 1.0);
+    fprintf(out, "compress_cpu_ms_per_mb %.3f\n",
+            in > 0 ? metrics_get(M_ZIP_CPU_NS) / 1e6 / (in / 1048576.0) : 0.0);
+    fprintf(out, "decompress_cpu_ms_per_mb %.3f\n",
+            unzipped > 0
+                ? metrics_get(M_UNZIP_CPU_NS) / 1e6 / (unzipped / 1048576.0)
+                : 0.0);
+}
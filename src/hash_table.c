@@ -1,29 +1,51 @@
 #include "hash_table.h"
 
-void htable_set(htable **ht, const unsigned char *key, size_t key_len,
-                const unsigned char *value, size_t value_len) {
+kv_value *kv_value_new(const unsigned char *data, size_t len) {
+    kv_value *v = (kv_value *)malloc(sizeof(kv_value) + len);
+    atomic_init(&v->refs, 1);
+    v->len = len;
+    v->raw_len = len;
+    v->zipped = false;
+    if (len > 0) {
+        memcpy(v->data, data, len);
+    }
+    return v;
+}
+
+kv_value *kv_value_ref(kv_value *v) {
+    atomic_fetch_add_explicit(&v->refs, 1, memory_order_relaxed);
+    return v;
+}
+
+void kv_value_unref(kv_value *v) {
+    if (v != NULL &&
+        atomic_fetch_sub_explicit(&v->refs, 1, memory_order_acq_rel) == 1) {
+        free(v);
+    }
+}
+
+kv_value *htable_set(htable **ht, const unsigned char *key, size_t key_len,
+                     kv_value *value) {
     htable *existing;
     // from uthash.h
     HASH_FIND(hh, *ht, key, key_len, existing);
     if (existing != NULL) {
-        free(existing->value);
-        existing->value = (unsigned char *)malloc(value_len);
-        memcpy(existing->value, value, value_len);
-        existing->value_len = value_len;
+        kv_value *old = existing->value;
+        existing->value = value;
+        return old;
     } else {
         htable *entry = malloc(sizeof(htable));
         memset(entry, 0, sizeof(htable));
 
         entry->key = (unsigned char *)malloc(key_len);
-        entry->value = (unsigned char *)malloc(value_len);
         entry->key_len = key_len;
-        entry->value_len = value_len;
+        entry->value = value;
 
         memcpy(entry->key, key, key_len);
-        memcpy(entry->value, value, value_len);
 
         // from uthash.h
         HASH_ADD_KEYPTR(hh, *ht, entry->key, entry->key_len, entry);
+        return NULL;
     }
 }
 
@@ -34,17 +56,19 @@ htable *htable_get(htable **ht, const unsigned char *key, size_t key_len) {
     return existing;
 }
 
-int htable_delete(htable **ht, const unsigned char *key, size_t key_len) {
+kv_value *htable_delete(htable **ht, const unsigned char *key, size_t key_len) {
     htable *existing;
     // from uthash.h
     HASH_FIND(hh, *ht, key, key_len, existing);
     if (existing != NULL) {
+        kv_value *old = existing->value;
+        timer_cancel(existing->expiry);
         free(existing->key);
-        free(existing->value);
         // from uthash.h
         HASH_DEL(*ht, existing);
-        return 0;
+        free(existing);
+        return old;
     } else {
-        return -1;
+        return NULL;
     }
 }
@@ -0,0 +1,272 @@
+#include "hot_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief FNV-1a of a key, the sketch rows take their index from its two
+ * halves (h1 + row * h2).
+ */
+static uint64_t key_hash(const unsigned char *key, size_t key_len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < key_len; i++) {
+        h ^= key[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+hot_cache *hot_cache_new(uint64_t lease_ms) {
+    hot_cache *hc = (hot_cache *)calloc(1, sizeof(hot_cache));
+    pthread_mutex_init(&hc->lock, NULL);
+    hc->lease_ms = lease_ms < HOT_LEASE_MAX_MS ? lease_ms : HOT_LEASE_MAX_MS;
+    return hc;
+}
+
+bool hot_touch(hot_cache *hc, const unsigned char *key, size_t key_len) {
+    uint64_t h = key_hash(key, key_len);
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+
+    pthread_mutex_lock(&hc->lock);
+    if (++hc->touches >= HOT_SKETCH_WINDOW) {
+        // old reads count half, so a key that cooled down stops being hot
+        for (size_t r = 0; r < HOT_SKETCH_DEPTH; r++) {
+            for (size_t i = 0; i < HOT_SKETCH_WIDTH; i++) {
+                hc->sketch[r][i] >>= 1;
+            }
+        }
+        hc->touches = 0;
+    }
+    uint32_t estimate = UINT32_MAX;
+    for (uint32_t r = 0; r < HOT_SKETCH_DEPTH; r++) {
+        uint32_t *c = &hc->sketch[r][(h1 + r * h2) % HOT_SKETCH_WIDTH];
+        if (*c < UINT32_MAX) {
+            (*c)++;
+        }
+        if (*c < estimate) {
+            estimate = *c;
+        }
+    }
+    pthread_mutex_unlock(&hc->lock);
+    return estimate >= HOT_MIN_COUNT;
+}
+
+static void hot_remove(hot_cache *hc, hot_entry *e) {
+    HASH_DEL(hc->entries, e);
+    hc->bytes -= e->key_len + e->value->len;
+    kv_value_unref(e->value);
+    free(e->key);
+    free(e);
+}
+
+kv_value *hot_get(hot_cache *hc, const unsigned char *key, size_t key_len,
+                  uint64_t now) {
+    kv_value *value = NULL;
+
+    pthread_mutex_lock(&hc->lock);
+    hot_entry *e;
+    HASH_FIND(hh, hc->entries, key, key_len, e);
+    if (e != NULL && e->expires <= now) {
+        hot_remove(hc, e);
+        e = NULL;
+    }
+    if (e != NULL) {
+        value = kv_value_ref(e->value);
+        hc->hits++;
+    } else {
+        hc->misses++;
+    }
+    pthread_mutex_unlock(&hc->lock);
+    return value;
+}
+
+uint32_t hot_generation(hot_cache *hc, const unsigned char *key,
+                        size_t key_len) {
+    uint32_t slot = key_hash(key, key_len) % HOT_DROP_SLOTS;
+    pthread_mutex_lock(&hc->lock);
+    uint32_t generation = hc->dropped[slot];
+    pthread_mutex_unlock(&hc->lock);
+    return generation;
+}
+
+void hot_put(hot_cache *hc, const unsigned char *key, size_t key_len,
+             const unsigned char *data, size_t data_len, uint32_t generation,
+             uint64_t now) {
+    if (key_len + data_len > HOT_CACHE_BYTES) {
+        return;
+    }
+    uint32_t slot = key_hash(key, key_len) % HOT_DROP_SLOTS;
+    kv_value *value = kv_value_new(data, data_len);
+
+    pthread_mutex_lock(&hc->lock);
+    if (hc->dropped[slot] != generation) {
+        hc->stale++;
+        pthread_mutex_unlock(&hc->lock);
+        kv_value_unref(value);
+        return;
+    }
+    hot_entry *e;
+    HASH_FIND(hh, hc->entries, key, key_len, e);
+    if (e != NULL) {
+        hot_remove(hc, e);
+    }
+    while (hc->entries != NULL &&
+           hc->bytes + key_len + data_len > HOT_CACHE_BYTES) {
+        hot_remove(hc, hc->entries); // the oldest
+        hc->evictions++;
+    }
+
+    e = (hot_entry *)malloc(sizeof(hot_entry));
+    e->key = (unsigned char *)malloc(key_len);
+    memcpy(e->key, key, key_len);
+    e->key_len = key_len;
+    e->value = value;
+    e->expires = now + hc->lease_ms;
+    HASH_ADD_KEYPTR(hh, hc->entries, e->key, e->key_len, e);
+    hc->bytes += key_len + data_len;
+    hc->stores++;
+    pthread_mutex_unlock(&hc->lock);
+}
+
+void hot_drop(hot_cache *hc, const unsigned char *key, size_t key_len) {
+    uint32_t slot = key_hash(key, key_len) % HOT_DROP_SLOTS;
+    pthread_mutex_lock(&hc->lock);
+    hc->dropped[slot]++;
+    hot_entry *e;
+    HASH_FIND(hh, hc->entries, key, key_len, e);
+    if (e != NULL) {
+        hot_remove(hc, e);
+        hc->revoked++;
+    }
+    pthread_mutex_unlock(&hc->lock);
+}
+
+void hot_cache_dump(hot_cache *hc, FILE *out) {
+    pthread_mutex_lock(&hc->lock);
+    size_t lookups = hc->hits + hc->misses;
+    fprintf(out, "hot_cache_hits %zu\n", hc->hits);
+    fprintf(out, "hot_cache_misses %zu\n", hc->misses);
+    fprintf(out, "hot_cache_hit_ratio %.4f\n",
+            lookups > 0 ? (double)hc->hits / lookups : 0.0);
+    fprintf(out, "hot_cache_entries %u\n", HASH_COUNT(hc->entries));
+    fprintf(out, "hot_cache_bytes %zu\n", hc->bytes);
+    fprintf(out, "hot_cache_stores %zu\n", hc->stores);
+    fprintf(out, "hot_cache_revoked %zu\n", hc->revoked);
+    fprintf(out, "hot_cache_stale %zu\n", hc->stale);
+    fprintf(out, "hot_cache_evictions %zu\n", hc->evictions);
+    pthread_mutex_unlock(&hc->lock);
+}
+
+lease_table *lease_table_new() {
+    lease_table *lt = (lease_table *)calloc(1, sizeof(lease_table));
+    pthread_mutex_init(&lt->lock, NULL);
+    return lt;
+}
+
+static void lease_remove(lease_table *lt, lease *l) {
+    HASH_DEL(lt->leases, l);
+    while (l->holders != NULL) {
+        lease_holder *next = l->holders->next;
+        free(l->holders);
+        l->holders = next;
+    }
+    free(l->key);
+    free(l);
+}
+
+bool lease_grant(lease_table *lt, const unsigned char *key, size_t key_len,
+                 const ring_node *holder, uint64_t now) {
+    pthread_mutex_lock(&lt->lock);
+    lease *l;
+    HASH_FIND(hh, lt->leases, key, key_len, l);
+    if (l == NULL) {
+        l = (lease *)calloc(1, sizeof(lease));
+        l->key = (unsigned char *)malloc(key_len);
+        memcpy(l->key, key, key_len);
+        l->key_len = key_len;
+        HASH_ADD_KEYPTR(hh, lt->leases, l->key, l->key_len, l);
+    }
+
+    lease_holder *h = l->holders;
+    size_t n = 0;
+    while (h != NULL && h->node.node_id != holder->node_id) {
+        h = h->next;
+        n++;
+    }
+    if (h == NULL && n >= HOT_LEASE_MAX_HOLDERS) {
+        lt->refused++;
+        pthread_mutex_unlock(&lt->lock);
+        return false;
+    } else if (h == NULL) {
+        h = (lease_holder *)malloc(sizeof(lease_holder));
+        h->next = l->holders;
+        l->holders = h;
+    }
+    h->node = *holder;
+    h->until = now + HOT_LEASE_MAX_MS;
+    lt->granted++;
+    pthread_mutex_unlock(&lt->lock);
+    return true;
+}
+
+ring_node *lease_revoke(lease_table *lt, const unsigned char *key,
+                        size_t key_len, uint64_t now, size_t *count) {
+    *count = 0;
+    ring_node *nodes = NULL;
+
+    pthread_mutex_lock(&lt->lock);
+    lease *l;
+    HASH_FIND(hh, lt->leases, key, key_len, l);
+    if (l != NULL) {
+        size_t n = 0;
+        for (lease_holder *h = l->holders; h != NULL; h = h->next) {
+            n++;
+        }
+        nodes = (ring_node *)malloc(n * sizeof(ring_node));
+        for (lease_holder *h = l->holders; h != NULL; h = h->next) {
+            if (h->until > now) {
+                nodes[(*count)++] = h->node;
+            }
+        }
+        lt->revoked += *count;
+        lease_remove(lt, l);
+    }
+    pthread_mutex_unlock(&lt->lock);
+
+    if (*count == 0) {
+        free(nodes);
+        nodes = NULL;
+    }
+    return nodes;
+}
+
+void lease_expire(lease_table *lt, uint64_t now) {
+    pthread_mutex_lock(&lt->lock);
+    lease *l, *tmp;
+    HASH_ITER(hh, lt->leases, l, tmp) {
+        lease_holder **h = &l->holders;
+        while (*h != NULL) {
+            if ((*h)->until <= now) {
+                lease_holder *gone = *h;
+                *h = gone->next;
+                free(gone);
+            } else {
+                h = &(*h)->next;
+            }
+        }
+        if (l->holders == NULL) {
+            lease_remove(lt, l);
+        }
+    }
+    pthread_mutex_unlock(&lt->lock);
+}
+
+void lease_table_dump(lease_table *lt, FILE *out) {
+    pthread_mutex_lock(&lt->lock);
+    fprintf(out, "leases_active %u\n", HASH_COUNT(lt->leases));
+    fprintf(out, "leases_granted %zu\n", lt->granted);
+    fprintf(out, "leases_refused %zu\n", lt->refused);
+    fprintf(out, "leases_revoked %zu\n", lt->revoked);
+    pthread_mutex_unlock(&lt->lock);
+}
@@ -0,0 +1,212 @@
+#include "kv_store.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+kv_store *kv_new(size_t n_shards) {
+    kv_store *kv = (kv_store *)malloc(sizeof(kv_store));
+    kv->shard_bits = 0;
+    while (((size_t)1 << kv->shard_bits) < n_shards) {
+        kv->shard_bits++;
+    }
+    kv->n_shards = (size_t)1 << kv->shard_bits;
+
+    kv->shards = (kv_shard *)aligned_alloc(
+        _Alignof(kv_shard), kv->n_shards * sizeof(kv_shard));
+    for (size_t i = 0; i < kv->n_shards; i++) {
+        pthread_rwlock_init(&kv->shards[i].lock, NULL);
+        kv->shards[i].table = NULL;
+        kv->shards[i].bytes = 0;
+        kv->shards[i].saved = 0;
+        kv->shards[i].expiry = timer_wheel_new(KV_EXPIRY_TICK_MS, now_ms());
+    }
+    return kv;
+}
+
+void kv_free(kv_store *kv) {
+    if (kv == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < kv->n_shards; i++) {
+        htable *entry, *tmp;
+        HASH_ITER(hh, kv->shards[i].table, entry, tmp) {
+            HASH_DEL(kv->shards[i].table, entry);
+            free(entry->key);
+            kv_value_unref(entry->value);
+            free(entry);
+        }
+        timer_wheel_free(kv->shards[i].expiry);
+        pthread_rwlock_destroy(&kv->shards[i].lock);
+    }
+    free(kv->shards);
+    free(kv);
+}
+
+/**
+ * @brief Find the shard of a key. The shard is taken from the high bits of
+ * the hash since uthash picks its buckets by the low bits.
+ */
+static kv_shard *kv_shard_of(kv_store *kv, const unsigned char *key,
+                             size_t key_len) {
+    if (kv->shard_bits == 0) {
+        return &kv->shards[0];
+    }
+    unsigned hashv;
+    HASH_VALUE(key, key_len, hashv);
+    return &kv->shards[(uint32_t)hashv >> (32 - kv->shard_bits)];
+}
+
+kv_value *kv_get(kv_store *kv, const unsigned char *key, size_t key_len) {
+    kv_shard *shard = kv_shard_of(kv, key, key_len);
+    kv_value *value = NULL;
+
+    pthread_rwlock_rdlock(&shard->lock);
+    htable *entry = htable_get(&shard->table, key, key_len);
+    // an expired key is gone, even if kv_expire did not get to it yet
+    if (entry != NULL && (entry->expires == 0 || entry->expires > now_ms())) {
+        value = kv_value_ref(entry->value);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return value;
+}
+
+void kv_set(kv_store *kv, const unsigned char *key, size_t key_len,
+            const unsigned char *value, size_t value_len) {
+    kv_set_ttl(kv, key, key_len, value, value_len, 0);
+}
+
+void kv_set_ttl(kv_store *kv, const unsigned char *key, size_t key_len,
+                const unsigned char *value, size_t value_len, uint32_t ttl_ms) {
+    kv_set_value(kv, key, key_len, kv_value_new(value, value_len), ttl_ms);
+}
+
+/**
+ * @brief The bytes a value takes less compressed. A frame of a client may be
+ * longer than the data it holds, that saves nothing.
+ */
+static size_t kv_value_saved(const kv_value *v) {
+    return v->raw_len > v->len ? v->raw_len - v->len : 0;
+}
+
+void kv_set_value(kv_store *kv, const unsigned char *key, size_t key_len,
+                  kv_value *v, uint32_t ttl_ms) {
+    kv_shard *shard = kv_shard_of(kv, key, key_len);
+    uint64_t expires = ttl_ms > 0 ? now_ms() + ttl_ms : 0;
+
+    pthread_rwlock_wrlock(&shard->lock);
+    kv_value *old = htable_set(&shard->table, key, key_len, v);
+    shard->bytes += v->len + (old != NULL ? 0 : key_len);
+    shard->bytes -= old != NULL ? old->len : 0;
+    shard->saved += kv_value_saved(v);
+    shard->saved -= old != NULL ? kv_value_saved(old) : 0;
+    if (expires != 0 || shard->expiry->count > 0) {
+        // only then the key may have a TTL to set or to replace
+        htable *entry = htable_get(&shard->table, key, key_len);
+        timer_cancel(entry->expiry);
+        entry->expiry = expires != 0
+                            ? timer_wheel_add(shard->expiry, expires, entry)
+                            : NULL;
+        entry->expires = expires;
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    kv_value_unref(old); // readers may still hold it
+}
+
+int kv_delete(kv_store *kv, const unsigned char *key, size_t key_len) {
+    kv_shard *shard = kv_shard_of(kv, key, key_len);
+
+    pthread_rwlock_wrlock(&shard->lock);
+    bool expired = false;
+    if (shard->expiry->count > 0) {
+        htable *entry = htable_get(&shard->table, key, key_len);
+        expired = entry != NULL && entry->expires != 0 &&
+                  entry->expires <= now_ms();
+    }
+    kv_value *old = htable_delete(&shard->table, key, key_len);
+    if (old != NULL) {
+        shard->bytes -= key_len + old->len;
+        shard->saved -= kv_value_saved(old);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    if (old == NULL) {
+        return -1;
+    }
+    kv_value_unref(old);
+    return expired ? -1 : 0; // it was gone for readers already
+}
+
+/*
+ * The shard kv_expire works on and whom to tell about removed keys.
+ */
+typedef struct _kv_expiry {
+    kv_shard *shard;
+    kv_expired_cb expired;
+} kv_expiry;
+
+/**
+ * @brief Remove a key whose TTL ran out (a timer callback, the shard is
+ * locked).
+ *
+ * @param data The entry of the key
+ * @param arg The kv_expiry
+ */
+static void kv_expired(void *data, void *arg) {
+    htable *entry = (htable *)data;
+    kv_expiry *ex = (kv_expiry *)arg;
+    kv_shard *shard = ex->shard;
+    entry->expiry = NULL; // fired, the wheel freed it
+
+    if (ex->expired != NULL) {
+        ex->expired(entry->key, entry->key_len);
+    }
+    shard->bytes -= entry->key_len + entry->value->len;
+    shard->saved -= kv_value_saved(entry->value);
+    kv_value_unref(htable_delete(&shard->table, entry->key, entry->key_len));
+}
+
+size_t kv_expire(kv_store *kv, uint64_t now, kv_expired_cb expired) {
+    size_t removed = 0;
+    for (size_t i = 0; i < kv->n_shards; i++) {
+        kv_expiry ex = {&kv->shards[i], expired};
+        pthread_rwlock_wrlock(&ex.shard->lock);
+        removed += timer_wheel_advance(ex.shard->expiry, now, kv_expired, &ex);
+        pthread_rwlock_unlock(&ex.shard->lock);
+    }
+    return removed;
+}
+
+size_t kv_count(kv_store *kv) {
+    size_t count = 0;
+    for (size_t i = 0; i < kv->n_shards; i++) {
+        pthread_rwlock_rdlock(&kv->shards[i].lock);
+        count += HASH_COUNT(kv->shards[i].table);
+        pthread_rwlock_unlock(&kv->shards[i].lock);
+    }
+    return count;
+}
+
+size_t kv_bytes(kv_store *kv) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < kv->n_shards; i++) {
+        pthread_rwlock_rdlock(&kv->shards[i].lock);
+        bytes += kv->shards[i].bytes;
+        pthread_rwlock_unlock(&kv->shards[i].lock);
+    }
+    return bytes;
+}
+
+size_t kv_saved(kv_store *kv) {
+    size_t saved = 0;
+    for (size_t i = 0; i < kv->n_shards; i++) {
+        pthread_rwlock_rdlock(&kv->shards[i].lock);
+        saved += kv->shards[i].saved;
+        pthread_rwlock_unlock(&kv->shards[i].lock);
+    }
+    return saved;
+}
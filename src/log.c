@@ -0,0 +1,163 @@
+#include "log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+unsigned log_mask = ~0u;
+
+static const char *level_names[] = {"ERROR", "WARN", "INFO", "DEBUG",
+                                    "TRACE"};
+static const char *subsystem_names[] = {"net", "ring", "lookup", "kv"};
+
+/*
+ * Messages waiting for the background thread. Producers copy a formatted line
+ * into the slot at wpos; the writer prints the slots in [rpos, wpos) without
+ * holding the lock, since producers never reuse a slot before rpos passed it.
+ */
+typedef struct _log_ring {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    char (*lines)[LOG_LINE_MAX];
+    size_t capacity;
+    size_t wpos; // both only grow, the slot is pos % capacity
+    size_t rpos;
+    size_t dropped;
+    bool running;
+    char batch[64 * LOG_LINE_MAX]; // used by the writer only
+} log_ring;
+
+static log_ring *ring = NULL;
+
+int log_enable(const char *list) {
+    if (strcmp(list, "all") == 0) {
+        log_mask = ~0u;
+        return 0;
+    }
+    unsigned mask = 0;
+    const char *name = list;
+    while (*name != '\0') {
+        size_t len = strcspn(name, ",");
+        size_t sub = 0;
+        while (sub < LOG_SUBSYSTEMS &&
+               (strlen(subsystem_names[sub]) != len ||
+                strncmp(subsystem_names[sub], name, len) != 0)) {
+            sub++;
+        }
+        if (sub == LOG_SUBSYSTEMS) {
+            fprintf(stderr, "Unknown log subsystem '%.*s'!\n", (int)len, name);
+            return -1;
+        }
+        mask |= 1u << sub;
+        name += name[len] == ',' ? len + 1 : len;
+    }
+    log_mask = mask;
+    return 0;
+}
+
+void log_write(int level, log_subsystem sub, const char *fmt, ...) {
+    char line[LOG_LINE_MAX];
+    int n = snprintf(line, sizeof(line), "[%s %s] ", level_names[level],
+                     subsystem_names[sub]);
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(line + n, sizeof(line) - n - 1, fmt, args);
+    va_end(args);
+    strcat(line, "\n");
+
+    log_ring *r = ring;
+    if (r == NULL) {
+        fputs(line, stderr);
+        return;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    if (r->wpos - r->rpos == r->capacity) {
+        r->dropped++;
+    } else {
+        memcpy(r->lines[r->wpos % r->capacity], line, strlen(line) + 1);
+        r->wpos++;
+        pthread_cond_signal(&r->wake);
+    }
+    pthread_mutex_unlock(&r->lock);
+}
+
+static void *log_writer(void *arg) {
+    log_ring *r = (log_ring *)arg;
+
+    pthread_mutex_lock(&r->lock);
+    while (r->running || r->rpos != r->wpos) {
+        if (r->rpos == r->wpos) {
+            pthread_cond_wait(&r->wake, &r->lock);
+            continue;
+        }
+        size_t end = r->wpos;
+        pthread_mutex_unlock(&r->lock);
+
+        // one write per batch of lines, stderr itself is unbuffered
+        size_t len = 0;
+        for (size_t pos = r->rpos; pos < end; pos++) {
+            const char *line = r->lines[pos % r->capacity];
+            size_t line_len = strlen(line);
+            if (len + line_len > sizeof(r->batch)) {
+                fwrite(r->batch, 1, len, stderr);
+                len = 0;
+            }
+            memcpy(r->batch + len, line, line_len);
+            len += line_len;
+        }
+        fwrite(r->batch, 1, len, stderr);
+
+        pthread_mutex_lock(&r->lock);
+        r->rpos = end;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+int log_async_start(size_t capacity) {
+    if (ring != NULL || capacity == 0) {
+        return -1;
+    }
+    log_ring *r = (log_ring *)calloc(1, sizeof(log_ring));
+    r->lines = calloc(capacity, LOG_LINE_MAX);
+    if (r->lines == NULL) {
+        free(r);
+        return -1;
+    }
+    r->capacity = capacity;
+    r->running = true;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->wake, NULL);
+    if (pthread_create(&r->thread, NULL, log_writer, r) != 0) {
+        free(r->lines);
+        free(r);
+        return -1;
+    }
+    ring = r;
+    return 0;
+}
+
+size_t log_async_stop(void) {
+    log_ring *r = ring;
+    if (r == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&r->lock);
+    r->running = false;
+    pthread_cond_signal(&r->wake);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+
+    // from here on, messages are written directly again
+    ring = NULL;
+    size_t dropped = r->dropped;
+    pthread_cond_destroy(&r->wake);
+    pthread_mutex_destroy(&r->lock);
+    free(r->lines);
+    free(r);
+    return dropped;
+}
@@ -0,0 +1,144 @@
+#include "lookup_cache.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * @brief Check whether id lies in the clockwise range [lo, hi].
+ */
+static bool in_range(uint16_t lo, uint16_t hi, uint16_t id) {
+    return (uint16_t)(id - lo) <= (uint16_t)(hi - lo);
+}
+
+lcache *lcache_new() {
+    lcache *lc = (lcache *)calloc(1, sizeof(lcache));
+    pthread_mutex_init(&lc->lock, NULL);
+    return lc;
+}
+
+static void lcache_remove(lcache *lc, size_t i) {
+    peer_free(lc->entries[i].node);
+    lc->entries[i] = lc->entries[--lc->count];
+}
+
+void lcache_free(lcache *lc) {
+    if (lc != NULL) {
+        while (lc->count > 0) {
+            lcache_remove(lc, 0);
+        }
+        pthread_mutex_destroy(&lc->lock);
+        free(lc);
+    }
+}
+
+peer *lcache_get(lcache *lc, uint16_t hash_id) {
+    peer *node = NULL;
+
+    pthread_mutex_lock(&lc->lock);
+    for (size_t i = 0; i < lc->count; i++) {
+        lcache_entry *e = &lc->entries[i];
+        if (in_range(e->lo, e->node->node_id, hash_id)) {
+            e->last_used = ++lc->tick;
+            node = peer_dup(e->node); // the entry may be evicted after unlock
+            break;
+        }
+    }
+    if (node != NULL) {
+        lc->hits++;
+    } else {
+        lc->misses++;
+    }
+    pthread_mutex_unlock(&lc->lock);
+    return node;
+}
+
+void lcache_put(lcache *lc, uint16_t hash_id, peer *node) {
+    lcache_entry *existing = NULL;
+
+    pthread_mutex_lock(&lc->lock);
+    for (size_t i = 0; i < lc->count;) {
+        lcache_entry *e = &lc->entries[i];
+        if (e->node->node_id == node->node_id) {
+            existing = e;
+            i++;
+        } else if (in_range(hash_id, node->node_id, e->node->node_id) ||
+                   in_range(e->lo, e->node->node_id, hash_id)) {
+            // e cannot be responsible for its range anymore
+            lcache_remove(lc, i);
+            lc->invalidations++;
+            existing = NULL; // the array may have moved, search again
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (existing != NULL) {
+        // widen the known range downwards
+        if (!in_range(existing->lo, node->node_id, hash_id)) {
+            existing->lo = hash_id;
+        }
+        existing->last_used = ++lc->tick;
+        pthread_mutex_unlock(&lc->lock);
+        peer_free(node);
+        return;
+    }
+
+    if (lc->count == LCACHE_SIZE) {
+        size_t lru = 0;
+        for (size_t i = 1; i < lc->count; i++) {
+            if (lc->entries[i].last_used < lc->entries[lru].last_used) {
+                lru = i;
+            }
+        }
+        lcache_remove(lc, lru);
+        lc->evictions++;
+    }
+
+    lcache_entry *e = &lc->entries[lc->count++];
+    e->lo = hash_id;
+    e->node = node;
+    e->last_used = ++lc->tick;
+    lc->inserts++;
+    pthread_mutex_unlock(&lc->lock);
+}
+
+void lcache_invalidate_node(lcache *lc, uint16_t node_id) {
+    pthread_mutex_lock(&lc->lock);
+    for (size_t i = 0; i < lc->count;) {
+        if (lc->entries[i].node->node_id == node_id) {
+            lcache_remove(lc, i);
+            lc->invalidations++;
+        } else {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&lc->lock);
+}
+
+void lcache_invalidate_range(lcache *lc, uint16_t node_id) {
+    pthread_mutex_lock(&lc->lock);
+    for (size_t i = 0; i < lc->count;) {
+        lcache_entry *e = &lc->entries[i];
+        if (e->node->node_id != node_id &&
+            in_range(e->lo, e->node->node_id, node_id)) {
+            lcache_remove(lc, i);
+            lc->invalidations++;
+        } else {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&lc->lock);
+}
+
+void lcache_print_stats(lcache *lc, FILE *out) {
+    pthread_mutex_lock(&lc->lock);
+    size_t total = lc->hits + lc->misses;
+    fprintf(out,
+            "Lookup cache: %zu entries, %zu hits, %zu misses (%.1f%% hit "
+            "rate), %zu inserts, %zu evictions, %zu invalidations\n",
+            lc->count, lc->hits, lc->misses,
+            total > 0 ? 100.0 * lc->hits / total : 0.0, lc->inserts,
+            lc->evictions, lc->invalidations);
+    pthread_mutex_unlock(&lc->lock);
+}
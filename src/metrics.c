@@ -0,0 +1,234 @@
+#include "metrics.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "packet.h"
+
+/*
+ * The counters and histograms of one thread. Readers sum all of them; a
+ * thread beyond METRICS_MAX_THREADS shares the overflow block, which is
+ * updated with atomic additions instead.
+ */
+typedef struct _metrics_block {
+    _Alignas(64) _Atomic uint64_t counters[M_COUNTERS];
+    _Atomic uint64_t hist[H_HISTOGRAMS][HIST_BUCKETS];
+    bool shared;
+} metrics_block;
+
+static _Atomic(metrics_block *) blocks[METRICS_MAX_THREADS];
+static atomic_size_t n_blocks = 0;
+static metrics_block overflow = {.shared = true};
+static _Thread_local metrics_block *mine = NULL;
+
+static uint64_t started_ms = 0;
+
+static const char *counter_names[] = {
+    "requests{op=\"get\",path=\"local\"}",
+    "requests{op=\"get\",path=\"proxied\"}",
+    "requests{op=\"get\",path=\"looked_up\"}",
+    "requests{op=\"get\",path=\"routed\"}",
+    "requests{op=\"set\",path=\"local\"}",
+    "requests{op=\"set\",path=\"proxied\"}",
+    "requests{op=\"set\",path=\"looked_up\"}",
+    "requests{op=\"set\",path=\"routed\"}",
+    "requests{op=\"del\",path=\"local\"}",
+    "requests{op=\"del\",path=\"proxied\"}",
+    "requests{op=\"del\",path=\"looked_up\"}",
+    "requests{op=\"del\",path=\"routed\"}",
+    "requests_parked",
+    "lookups_sent",
+    "lookups_forwarded",
+    "lookups_answered",
+    "lookups_failed",
+    "gets_coalesced",
+    "keys_expired",
+    "values_compressed",
+    "compress_bytes_in",
+    "compress_bytes_out",
+    "compress_cpu_ns",
+    "decompress_bytes",
+    "decompress_cpu_ns",
+    "connections_accepted",
+    "connections_opened",
+    "bytes_in",
+    "bytes_out",
+};
+
+static const char *hist_names[] = {
+    "latency_us{path=\"local\"}",
+    "latency_us{path=\"proxied\"}",
+    "latency_us{path=\"looked_up\"}",
+    "latency_us{path=\"routed\"}",
+    "lookup_hops",
+};
+
+static uint64_t metrics_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void metrics_init(void) {
+    started_ms = metrics_now_ms();
+}
+
+/**
+ * @brief The block of the calling thread, claimed on first use.
+ */
+static metrics_block *metrics_mine(void) {
+    if (mine == NULL) {
+        size_t slot = atomic_fetch_add(&n_blocks, 1);
+        if (slot < METRICS_MAX_THREADS) {
+            metrics_block *b =
+                (metrics_block *)aligned_alloc(64, sizeof(metrics_block));
+            *b = (metrics_block){0};
+            atomic_store(&blocks[slot], b); // readers skip slots still NULL
+            mine = b;
+        } else {
+            mine = &overflow;
+        }
+    }
+    return mine;
+}
+
+static void metrics_inc(metrics_block *b, _Atomic uint64_t *slot, uint64_t n) {
+    if (b->shared) {
+        atomic_fetch_add_explicit(slot, n, memory_order_relaxed);
+    } else {
+        uint64_t v = atomic_load_explicit(slot, memory_order_relaxed);
+        atomic_store_explicit(slot, v + n, memory_order_relaxed);
+    }
+}
+
+void metrics_add(metric m, uint64_t n) {
+    metrics_block *b = metrics_mine();
+    metrics_inc(b, &b->counters[m], n);
+}
+
+/**
+ * @brief Map a value to its bucket: values below HIST_SUB have one each,
+ * above that every power of two is split into HIST_SUB buckets.
+ */
+static size_t hist_bucket(uint64_t value) {
+    if (value < HIST_SUB) {
+        return value;
+    }
+    unsigned msb = 63 - __builtin_clzll(value);
+    unsigned shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + ((value >> shift) & (HIST_SUB - 1));
+}
+
+/**
+ * @brief The largest value that falls into a bucket.
+ */
+static uint64_t hist_value(size_t bucket) {
+    if (bucket < HIST_SUB) {
+        return bucket;
+    }
+    unsigned shift = bucket / HIST_SUB - 1;
+    uint64_t lowest = (uint64_t)(HIST_SUB + bucket % HIST_SUB) << shift;
+    return lowest + (((uint64_t)1 << shift) - 1);
+}
+
+void metrics_record(histogram h, uint64_t value) {
+    metrics_block *b = metrics_mine();
+    metrics_inc(b, &b->hist[h][hist_bucket(value)], 1);
+}
+
+void metrics_request(uint8_t flags, req_path path, uint64_t latency_us) {
+    metric first;
+    if (flags & PKT_FLAG_GET) {
+        first = M_GET_LOCAL;
+    } else if (flags & PKT_FLAG_SET) {
+        first = M_SET_LOCAL;
+    } else if (flags & PKT_FLAG_DEL) {
+        first = M_DEL_LOCAL;
+    } else {
+        return;
+    }
+    metrics_add(first + path, 1);
+    metrics_record(H_LATENCY_LOCAL + path, latency_us);
+}
+
+uint64_t metrics_get(metric m) {
+    uint64_t sum = atomic_load_explicit(&overflow.counters[m],
+                                        memory_order_relaxed);
+    for (size_t i = 0; i < METRICS_MAX_THREADS; i++) {
+        metrics_block *b = atomic_load(&blocks[i]);
+        if (b != NULL) {
+            sum += atomic_load_explicit(&b->counters[m], memory_order_relaxed);
+        }
+    }
+    return sum;
+}
+
+/**
+ * @brief Write count, mean, percentiles and maximum of a histogram summed
+ * over all threads.
+ */
+static void hist_dump(histogram h, FILE *out) {
+    uint64_t *merged = (uint64_t *)calloc(HIST_BUCKETS, sizeof(uint64_t));
+    for (size_t k = 0; k < HIST_BUCKETS; k++) {
+        merged[k] = atomic_load_explicit(&overflow.hist[h][k],
+                                         memory_order_relaxed);
+    }
+    for (size_t i = 0; i < METRICS_MAX_THREADS; i++) {
+        metrics_block *b = atomic_load(&blocks[i]);
+        for (size_t k = 0; k < HIST_BUCKETS && b != NULL; k++) {
+            merged[k] +=
+                atomic_load_explicit(&b->hist[h][k], memory_order_relaxed);
+        }
+    }
+
+    uint64_t count = 0;
+    double sum = 0;
+    uint64_t max = 0;
+    for (size_t k = 0; k < HIST_BUCKETS; k++) {
+        count += merged[k];
+        sum += (double)merged[k] * hist_value(k);
+        if (merged[k] > 0) {
+            max = hist_value(k);
+        }
+    }
+
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    const char *labels[] = {"p50", "p90", "p99", "p999"};
+    fprintf(out, "%s count=%llu mean=%.0f", hist_names[h],
+            (unsigned long long)count, count > 0 ? sum / count : 0.0);
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(double); q++) {
+        uint64_t rank = (uint64_t)(quantiles[q] * count + 0.5);
+        uint64_t seen = 0;
+        uint64_t value = 0;
+        for (size_t k = 0; k < HIST_BUCKETS && count > 0; k++) {
+            seen += merged[k];
+            if (seen >= rank && seen > 0) {
+                value = hist_value(k);
+                break;
+            }
+        }
+        fprintf(out, " %s=%llu", labels[q], (unsigned long long)value);
+    }
+    fprintf(out, " max=%llu\n", (unsigned long long)max);
+    free(merged);
+}
+
+void metrics_dump(FILE *out) {
+    double uptime = (metrics_now_ms() - started_ms) / 1000.0;
+    fprintf(out, "uptime_s %.1f\n", uptime);
+
+    for (size_t m = 0; m < M_COUNTERS; m++) {
+        fprintf(out, "%s %llu\n", counter_names[m],
+                (unsigned long long)metrics_get(m));
+    }
+    uint64_t connections =
+        metrics_get(M_CONN_ACCEPTED) + metrics_get(M_CONN_OPENED);
+    fprintf(out, "connections_per_s %.1f\n",
+            uptime > 0 ? connections / uptime : 0.0);
+
+    for (size_t h = 0; h < H_HISTOGRAMS; h++) {
+        hist_dump(h, out);
+    }
+}
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "metrics.h"
 #include "neighbour.h"
 #include "packet.h"
 
@@ -33,6 +34,16 @@ void peer_free(peer *p) {
     free(p);
 }
 
+peer *peer_dup(const peer *p) {
+    peer *d = (peer *)malloc(sizeof(peer));
+    memset(d, 0, sizeof(peer));
+    d->node_id = p->node_id;
+    d->hostname = strdup(p->hostname);
+    d->port = p->port;
+    d->socket = -1;
+    return d;
+}
+
 peer *peer_from_packet(const packet *pack) {
     peer *p = (peer *)malloc(sizeof(peer));
     memset(p, 0, sizeof(peer));
@@ -101,6 +112,7 @@ int peer_connect(peer *p) {
         return -1;
     }
 
+    metrics_add(M_CONN_OPENED, 1);
     return 0;
 }
 
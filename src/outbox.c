@@ -0,0 +1,154 @@
+#include "outbox.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "util.h"
+
+outbox *outbox_new() {
+    outbox *ob = (outbox *)calloc(1, sizeof(outbox));
+    pthread_mutex_init(&ob->lock, NULL);
+    return ob;
+}
+
+static void outbox_hop_free(outbox_hop *h) {
+    for (size_t i = 0; i < h->count; i++) {
+        packet_free(h->msgs[i]);
+    }
+    free(h->msgs);
+    peer_free(h->hop);
+    free(h);
+}
+
+void outbox_free(outbox *ob) {
+    if (ob != NULL) {
+        outbox_hop *next;
+        for (outbox_hop *h = ob->hops; h != NULL; h = next) {
+            next = h->next;
+            outbox_hop_free(h);
+        }
+        pthread_mutex_destroy(&ob->lock);
+        free(ob);
+    }
+}
+
+void outbox_add(outbox *ob, const peer *hop, const packet *msg) {
+    packet *copy;
+    if (msg->flags & PKT_FLAG_CTRL) {
+        copy = packet_new();
+        *copy = *msg; // control messages own no buffers
+    } else {
+        copy = packet_dup(msg);
+    }
+
+    pthread_mutex_lock(&ob->lock);
+    outbox_hop *h = ob->hops;
+    while (h != NULL && (h->hop->port != hop->port ||
+                         strcmp(h->hop->hostname, hop->hostname) != 0)) {
+        h = h->next;
+    }
+    if (h == NULL) {
+        h = (outbox_hop *)calloc(1, sizeof(outbox_hop));
+        h->hop = peer_dup(hop);
+        h->next = ob->hops;
+        ob->hops = h;
+    }
+    if (h->count == h->cap) {
+        h->cap = h->cap > 0 ? 2 * h->cap : 16;
+        h->msgs = (packet **)realloc(h->msgs, h->cap * sizeof(packet *));
+    }
+    h->msgs[h->count++] = copy;
+    ob->messages++;
+    pthread_mutex_unlock(&ob->lock);
+}
+
+/**
+ * @brief Send up to PKT_BATCH_MAX messages over a new connection.
+ *
+ * @return int 0 on success, -1 if the hop could not be reached
+ */
+static int outbox_send(peer *hop, packet **msgs, size_t count) {
+    if (peer_connect(hop) != 0) {
+        return -1;
+    }
+
+    // invalidations go first, the hop reads on after them; the control
+    // messages follow as one batch
+    packet *ctrl[count];
+    size_t n_ctrl = 0;
+    int status = 0;
+    size_t data_len;
+    for (size_t i = 0; i < count; i++) {
+        if (msgs[i]->flags & PKT_FLAG_CTRL) {
+            ctrl[n_ctrl++] = msgs[i];
+            continue;
+        }
+        unsigned char *raw = packet_serialize(msgs[i], &data_len);
+        status |= sendall(hop->socket, raw, data_len);
+        free(raw);
+    }
+
+    if (n_ctrl > 0) {
+        packet *p = n_ctrl == 1 ? ctrl[0] : packet_batch(ctrl, n_ctrl);
+        unsigned char *raw = packet_serialize(p, &data_len);
+        status |= sendall(hop->socket, raw, data_len);
+        free(raw);
+        if (p != ctrl[0]) {
+            packet_free(p);
+        }
+    }
+
+    peer_disconnect(hop);
+    return status < 0 ? -1 : 0;
+}
+
+size_t outbox_flush(outbox *ob, outbox_fail_cb failed) {
+    // take everything queued so far, senders may queue more meanwhile
+    pthread_mutex_lock(&ob->lock);
+    outbox_hop *hops = ob->hops;
+    ob->hops = NULL;
+    pthread_mutex_unlock(&ob->lock);
+
+    size_t sent = 0, packets = 0, failures = 0;
+    outbox_hop *next;
+    for (outbox_hop *h = hops; h != NULL; h = next) {
+        next = h->next;
+        for (size_t i = 0; i < h->count; i += PKT_BATCH_MAX) {
+            size_t n = h->count - i < PKT_BATCH_MAX ? h->count - i : PKT_BATCH_MAX;
+            if (outbox_send(h->hop, h->msgs + i, n) == 0) {
+                sent += n;
+                packets++;
+                continue;
+            }
+            LOG_WARN(LOG_LOOKUP, "Failed to send %zu control message(s) to %s:%d",
+                     n, h->hop->hostname, h->hop->port);
+            failures += n;
+            for (size_t k = i; k < i + n && failed != NULL; k++) {
+                failed(h->hop, h->msgs[k]);
+            }
+        }
+        outbox_hop_free(h);
+    }
+
+    if (hops != NULL) {
+        pthread_mutex_lock(&ob->lock);
+        ob->packets += packets;
+        ob->failures += failures;
+        pthread_mutex_unlock(&ob->lock);
+    }
+    return sent;
+}
+
+void outbox_print_stats(outbox *ob, FILE *out) {
+    pthread_mutex_lock(&ob->lock);
+    fprintf(out,
+            "Control messages: %zu queued, %zu packets sent (%.1f messages "
+            "per packet), %zu failed\n",
+            ob->messages, ob->packets,
+            ob->packets > 0
+                ? (double)(ob->messages - ob->failures) / ob->packets
+                : 0.0,
+            ob->failures);
+    pthread_mutex_unlock(&ob->lock);
+}
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "log.h"
+
 packet *packet_new() {
     packet *p = (packet *)malloc(sizeof(packet));
     p->flags = 0;
@@ -41,14 +43,13 @@ size_t packet_body_size(packet *p) {
     if (!(p->flags & PKT_FLAG_CTRL)) {
         return p->key_len + p->value_len;
     }
+    if (packet_is_batch(p)) {
+        return packet_batch_count(p) * PKT_CTRL_LEN;
+    }
     return 4; // Control packets are always 11 bytes long
 }
 
-unsigned char *packet_serialize_data(const packet *p, size_t *buf_len) {
-    size_t header_len = 7;
-    size_t packet_size = header_len + p->key_len + p->value_len;
-    unsigned char *buffer = (unsigned char *)malloc(packet_size);
-
+void packet_serialize_hdr(const packet *p, unsigned char *buffer) {
     buffer[0] = p->flags;
 
     buffer[1] = (uint8_t)(p->key_len >> 8u) & 0xFFu;
@@ -58,6 +59,14 @@ unsigned char *packet_serialize_data(const packet *p, size_t *buf_len) {
     buffer[4] = (uint8_t)(p->value_len >> 16u) & 0xFFu;
     buffer[5] = (uint8_t)(p->value_len >> 8u) & 0xFFu;
     buffer[6] = (uint8_t)(p->value_len >> 0u) & 0xFFu;
+}
+
+unsigned char *packet_serialize_data(const packet *p, size_t *buf_len) {
+    size_t header_len = 7;
+    size_t packet_size = header_len + p->key_len + p->value_len;
+    unsigned char *buffer = (unsigned char *)malloc(packet_size);
+
+    packet_serialize_hdr(p, buffer);
 
     if (p->key != NULL && p->key_len != 0) {
         memcpy(buffer + 7, p->key, p->key_len);
@@ -71,8 +80,27 @@ unsigned char *packet_serialize_data(const packet *p, size_t *buf_len) {
     return buffer;
 }
 
+unsigned char *packet_serialize_batch(const packet *p, size_t *buf_len) {
+    size_t packet_size = PKT_HEADER_LEN + p->value_len;
+    unsigned char *buffer = (unsigned char *)calloc(1, packet_size);
+
+    buffer[0] = p->flags;
+
+    buffer[1] = (uint8_t)(p->hash_id >> 8u) & 0xFFu;
+    buffer[2] = (uint8_t)(p->hash_id >> 0u) & 0xFFu;
+
+    memcpy(buffer + PKT_HEADER_LEN, p->value, p->value_len);
+
+    *buf_len = packet_size;
+    return buffer;
+}
+
 unsigned char *packet_serialize_ctrl(const packet *p, size_t *buf_len) {
-    size_t packet_size = 11;
+    if (packet_is_batch(p)) {
+        return packet_serialize_batch(p, buf_len);
+    }
+
+    size_t packet_size = PKT_CTRL_LEN;
     unsigned char *buffer = (unsigned char *)malloc(packet_size);
 
     buffer[0] = p->flags;
@@ -102,6 +130,161 @@ unsigned char *packet_serialize(const packet *p, size_t *buf_len) {
     return packet_serialize_data(p, buf_len);
 }
 
+packet *packet_batch(packet **msgs, size_t count) {
+    packet *b = packet_new();
+    b->flags = PKT_FLAG_CTRL | PKT_FLAG_BTCH;
+    b->hash_id = count; // the number of messages
+    b->value_len = count * PKT_CTRL_LEN;
+    b->value = (unsigned char *)malloc(b->value_len);
+
+    for (size_t i = 0; i < count; i++) {
+        size_t len;
+        unsigned char *raw = packet_serialize_ctrl(msgs[i], &len);
+        memcpy(b->value + i * PKT_CTRL_LEN, raw, PKT_CTRL_LEN);
+        free(raw);
+    }
+    return b;
+}
+
+int packet_is_batch(const packet *p) {
+    return (p->flags & PKT_FLAG_CTRL) &&
+           (p->flags & PKT_FLAG_BTCH) == PKT_FLAG_BTCH;
+}
+
+size_t packet_batch_count(const packet *p) {
+    return p->hash_id;
+}
+
+packet *packet_batch_entry(const packet *batch, size_t i) {
+    const unsigned char *raw = batch->value + i * PKT_CTRL_LEN;
+    packet *p = packet_new();
+    p->flags = raw[0];
+    p->hash_id = (raw[1] << 8u) | (raw[2] << 0u);
+    p->node_id = (raw[3] << 8u) | (raw[4] << 0u);
+    p->node_ip = ((uint32_t)raw[5] << 24u) | (raw[6] << 16u) | (raw[7] << 8u) |
+                 (raw[8] << 0u);
+    p->node_port = (raw[9] << 8u) | (raw[10] << 0u);
+    return p;
+}
+
+packet *packet_multi(packet **entries, size_t count) {
+    packet *m = packet_new();
+    m->flags = PKT_FLAG_MULTI;
+    for (size_t i = 0; i < count; i++) {
+        m->value_len += PKT_HEADER_LEN + entries[i]->key_len +
+                        entries[i]->value_len;
+    }
+    m->value = (unsigned char *)malloc(m->value_len > 0 ? m->value_len : 1);
+
+    unsigned char *pos = m->value;
+    for (size_t i = 0; i < count; i++) {
+        packet_serialize_hdr(entries[i], pos);
+        pos += PKT_HEADER_LEN;
+        if (entries[i]->key_len > 0) {
+            memcpy(pos, entries[i]->key, entries[i]->key_len);
+            pos += entries[i]->key_len;
+        }
+        if (entries[i]->value_len > 0) {
+            memcpy(pos, entries[i]->value, entries[i]->value_len);
+            pos += entries[i]->value_len;
+        }
+    }
+    return m;
+}
+
+int packet_is_multi(const packet *p) {
+    return !(p->flags & PKT_FLAG_CTRL) &&
+           (p->flags & PKT_FLAG_MULTI) == PKT_FLAG_MULTI;
+}
+
+packet *packet_multi_next(const packet *multi, size_t *offset) {
+    if (*offset + PKT_HEADER_LEN > multi->value_len) {
+        return NULL;
+    }
+    const unsigned char *raw = multi->value + *offset;
+    size_t rest = multi->value_len - *offset;
+    if (raw[0] & PKT_FLAG_CTRL) {
+        LOG_WARN(LOG_NET, "Control packet inside a multi-key packet!");
+        return NULL;
+    }
+
+    packet *p = packet_decode_hdr(raw, rest);
+    p = packet_decode_body(p, raw + PKT_HEADER_LEN, rest - PKT_HEADER_LEN);
+    if (p != NULL) {
+        *offset += PKT_HEADER_LEN + p->key_len + p->value_len;
+    }
+    return p;
+}
+
+unsigned char *packet_route(unsigned char *raw, size_t *len) {
+    packet env = {0};
+    env.flags = PKT_FLAG_ROUTE;
+    env.value_len = *len;
+
+    unsigned char *buf = (unsigned char *)malloc(PKT_HEADER_LEN + *len);
+    packet_serialize_hdr(&env, buf);
+    memcpy(buf + PKT_HEADER_LEN, raw, *len);
+    free(raw);
+    *len += PKT_HEADER_LEN;
+    return buf;
+}
+
+int packet_is_routed(const packet *p) {
+    return !(p->flags & PKT_FLAG_CTRL) &&
+           (p->flags & PKT_FLAG_MULTI) == PKT_FLAG_ROUTE;
+}
+
+packet *packet_unroute(const packet *envelope) {
+    // the value is laid out as a multi-key packet with one request
+    size_t offset = 0;
+    packet *p = packet_multi_next(envelope, &offset);
+    if (p != NULL && (packet_is_multi(p) || packet_is_routed(p) ||
+                      !(p->flags & PKT_FLAG_MULTI))) {
+        LOG_WARN(LOG_NET, "No single request inside a routing envelope!");
+        packet_free(p);
+        return NULL;
+    }
+    return p;
+}
+
+void packet_set_ttl(packet *p, uint32_t ttl_ms) {
+    unsigned char *value = (unsigned char *)malloc(PKT_TTL_LEN + p->value_len);
+    value[0] = (uint8_t)(ttl_ms >> 24u) & 0xFFu;
+    value[1] = (uint8_t)(ttl_ms >> 16u) & 0xFFu;
+    value[2] = (uint8_t)(ttl_ms >> 8u) & 0xFFu;
+    value[3] = (uint8_t)(ttl_ms >> 0u) & 0xFFu;
+    if (p->value_len > 0) {
+        memcpy(value + PKT_TTL_LEN, p->value, p->value_len);
+    }
+    free(p->value);
+    p->value = value;
+    p->value_len += PKT_TTL_LEN;
+    p->flags |= PKT_FLAG_TTL;
+}
+
+uint8_t packet_hops(const packet *p) {
+    return (p->flags & (PKT_HOPS_MASK)) >> PKT_HOPS_POS;
+}
+
+void packet_set_hops(packet *p, unsigned hops) {
+    hops = hops < PKT_HOPS_MAX ? hops : PKT_HOPS_MAX;
+    p->flags = (p->flags & ~(PKT_HOPS_MASK)) | (hops << PKT_HOPS_POS);
+}
+
+int packet_has_ttl(const packet *p) {
+    return (p->flags & (PKT_FLAG_CTRL | PKT_FLAG_MULTI | PKT_FLAG_TTL)) ==
+               (PKT_FLAG_SET | PKT_FLAG_TTL) &&
+           p->value_len >= PKT_TTL_LEN;
+}
+
+uint32_t packet_ttl(const packet *p) {
+    if (!packet_has_ttl(p)) {
+        return 0;
+    }
+    return ((uint32_t)p->value[0] << 24u) | (p->value[1] << 16u) |
+           (p->value[2] << 8u) | (p->value[3] << 0u);
+}
+
 packet *packet_decode(const unsigned char *buffer, size_t buf_len) {
 
     packet *p = packet_decode_hdr(buffer, buf_len);
@@ -116,8 +299,8 @@ packet *packet_decode(const unsigned char *buffer, size_t buf_len) {
 
 packet *packet_decode_hdr(const unsigned char *buffer, size_t buf_len) {
     if (buf_len < PKT_HEADER_LEN) {
-        fprintf(stderr, "Buffer to short (%zu bytes) to decode packet!\n",
-                buf_len);
+        LOG_WARN(LOG_NET, "Buffer to short (%zu bytes) to decode packet!",
+                 buf_len);
         return NULL;
     }
 
@@ -130,21 +313,22 @@ packet *packet_decode_hdr(const unsigned char *buffer, size_t buf_len) {
         p->value_len = (buffer[3] << 24u) | (buffer[4] << 16u) |
                        (buffer[5] << 8u) | (buffer[6] << 0u);
 
-        fprintf(stderr, "Decoded packet header: \n");
-        fprintf(stderr, "\tACK: %d\n", (p->flags >> PKT_FLAG_ACK_POS) & 1);
-        fprintf(stderr, "\tGET: %d\n", (p->flags >> PKT_FLAG_GET_POS) & 1);
-        fprintf(stderr, "\tSET: %d\n", (p->flags >> PKT_FLAG_SET_POS) & 1);
-        fprintf(stderr, "\tDEL: %d\n", (p->flags >> PKT_FLAG_DEL_POS) & 1);
-        fprintf(stderr, "\tKey Length: %d Bytes\n", p->key_len);
-        fprintf(stderr, "\tValue Length: %d Bytes\n", p->value_len);
+        LOG_TRACE(LOG_NET,
+                  "Decoded packet header: ACK %d GET %d SET %d DEL %d, key %d "
+                  "bytes, value %d bytes",
+                  (p->flags >> PKT_FLAG_ACK_POS) & 1,
+                  (p->flags >> PKT_FLAG_GET_POS) & 1,
+                  (p->flags >> PKT_FLAG_SET_POS) & 1,
+                  (p->flags >> PKT_FLAG_DEL_POS) & 1, p->key_len, p->value_len);
     } else {
-        fprintf(stderr, "Decoded control packet header: \n");
-        fprintf(stderr, "\tJOIN: %d\n", (p->flags >> PKT_FLAG_JOIN_POS) & 1);
-        fprintf(stderr, "\tNOTIFY: %d\n", (p->flags >> PKT_FLAG_NTFY_POS) & 1);
-        fprintf(stderr, "\tSTABILIZE: %d\n",
-                (p->flags >> PKT_FLAG_STAB_POS) & 1);
-        fprintf(stderr, "\tLOOKUP: %d\n", (p->flags >> PKT_FLAG_LKUP_POS) & 1);
-        fprintf(stderr, "\tREPLY: %d\n", (p->flags >> PKT_FLAG_RPLY_POS) & 1);
+        LOG_TRACE(LOG_NET,
+                  "Decoded control packet header: JOIN %d NOTIFY %d STABILIZE "
+                  "%d LOOKUP %d REPLY %d",
+                  (p->flags >> PKT_FLAG_JOIN_POS) & 1,
+                  (p->flags >> PKT_FLAG_NTFY_POS) & 1,
+                  (p->flags >> PKT_FLAG_STAB_POS) & 1,
+                  (p->flags >> PKT_FLAG_LKUP_POS) & 1,
+                  (p->flags >> PKT_FLAG_RPLY_POS) & 1);
 
         p->hash_id = (buffer[1] << 8u) | (buffer[2] << 0u);
         p->node_id = (buffer[3] << 8u) | (buffer[4] << 0u);
@@ -159,6 +343,20 @@ packet *packet_decode_hdr(const unsigned char *buffer, size_t buf_len) {
 
 packet *packet_decode_body(packet *p, const unsigned char *buffer,
                            size_t buf_len) {
+    if (packet_is_batch(p)) {
+        // the messages stay serialized until packet_batch_entry
+        p->node_id = 0;
+        p->node_ip = 0;
+        p->value_len = packet_batch_count(p) * PKT_CTRL_LEN;
+        if (buf_len < p->value_len) {
+            LOG_WARN(LOG_NET, "Batch shorter than expected from header!");
+            packet_free(p);
+            return NULL;
+        }
+        p->value = (unsigned char *)malloc(p->value_len);
+        memcpy(p->value, buffer, p->value_len);
+        return p;
+    }
     if (p->flags & PKT_FLAG_CTRL) {
         p->node_ip |=
             (buffer[0] << 8u) |
@@ -171,10 +369,10 @@ packet *packet_decode_body(packet *p, const unsigned char *buffer,
     size_t pkt_size = p->key_len + p->value_len;
 
     if (buf_len < pkt_size) {
-        fprintf(stderr,
-                "Buffer shorter than expected from header! (Expected: %zu Got: "
-                "%zu)\n",
-                pkt_size, buf_len);
+        LOG_WARN(LOG_NET,
+                 "Buffer shorter than expected from header! (Expected: %zu "
+                 "Got: %zu)",
+                 pkt_size, buf_len);
         packet_free(p);
         return NULL;
     }
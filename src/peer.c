@@ -1,40 +1,96 @@
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <unistd.h>
-#include <math.h>
 
-#include "hash_table.h"
+#include "compress.h"
+#include "hot_cache.h"
+#include "kv_store.h"
+#include "log.h"
+#include "lookup_cache.h"
+#include "metrics.h"
 #include "neighbour.h"
+#include "outbox.h"
 #include "packet.h"
+#include "rcu.h"
 #include "requests.h"
+#include "ring_cache.h"
 #include "server.h"
+#include "single_flight.h"
+#include "stabilizer.h"
+#include "timer_wheel.h"
+#include "trace.h"
 #include "util.h"
+#include "vnode.h"
+
+#define LOOKUP_TIMEOUT_MS 500 // deadline of the first lookup, doubles per retry
+#define LOOKUP_MAX_RETRIES 3
+#define LOOKUP_STEP_MS 150 // iterative: ask again after a step without progress
+#define LOOKUP_STEP_TIMER (1u << 16) // marks step deadlines in the timer wheel
+#define LOG_ASYNC_LINES 4096 // messages the asynchronous logger can queue
+#define PROXY_TIMEOUT_MS 1000 // a proxy gives up waiting for the answer
+#define LEASE_EXPIRE_MS 1000 // how often leases that ran out are dropped
+
+// actual underlying key-value store (safe to use from all reactors)
+kv_store *kv = NULL;
+rtable **rt = NULL;
 
-#define SIZE_OF_FT 16 // 2^16 = hash space = node ID space
-#define FT_ACTIVE 0
-#define FT_INACTIVE (-1)
-#define FT_INIT 42
+// guards rt, tw and rstats: any reactor may receive the reply for a lookup
+pthread_mutex_t route_lock = PTHREAD_MUTEX_INITIALIZER;
 
-typedef struct _finger_table {
-    int state;
-    int finger_count; // keep track of how much fingers we already added (useful for building up the FT)
-    peer **ft; // our FT stores pointers to peers
-} finger_table;
+// serializes the writers of the ring state, readers do not lock (see rcu.h)
+pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
 
-// finger table
-finger_table *fng_tab;
+// recently looked up ranges -> responsible peer
+lcache *lc = NULL;
 
-// actual underlying hash table
-htable **ht = NULL;
-rtable **rt = NULL;
+// deadlines of lookups for parked requests
+timer_wheel *tw = NULL;
+request_stats rstats;
+
+// GETs proxied right now, by key: the same GET meanwhile waits for them
+flight_table *flights = NULL;
+
+// values of hot keys of other peers, NULL unless enabled (-c lease_ms)
+hot_cache *hot = NULL;
+
+// peers caching values of our keys, told when one of them changes
+lease_table *leases = NULL;
+
+// values from zip_min_len bytes on are stored (and sent between peers)
+// compressed with zip_codec (-z codec[:min_bytes])
+codec zip_codec = CODEC_NONE;
+size_t zip_min_len = ZIP_MIN_LEN;
+
+// LKUP and RPLY messages on their way out, batched per next hop
+outbox *ob = NULL;
 
-// chord peers
-peer *self = NULL;
-peer *pred = NULL;
-peer *succ = NULL;
+// iterative lookups: parallel probes per attempt, 0 = recursive forwarding
+int lookup_alpha = 0;
 
-// make it a global variable to update the peers in it if necessary
-server *srv = NULL;
+// pass requests for unknown owners to the closest preceding finger instead
+// of parking them for a lookup (-r)
+bool route_data = false;
+
+// every node learned from answers to iterative lookups (guarded by route_lock)
+ring_cache *known = NULL;
+
+// adaptive interval of the stabilize thread, fast while the ring changes
+stabilizer *stab = NULL;
+
+// set by SIGUSR1, the next tick dumps the metrics to stderr
+atomic_bool stats_requested = false;
+
+// chord peers: one (self, pred, succ, FT) per virtual node, sorted by ID
+vnode *vnodes = NULL;
+size_t n_vnodes = 1;
+
+// one reactor per thread, all listening on our port
+server **shards = NULL;
+size_t n_shards = 1;
 
 /**
  * @brief Forward a packet to a peer.
@@ -44,175 +100,1355 @@ server *srv = NULL;
  * @return int The status of the sending procedure
  */
 int forward(peer *p, packet *pack) {
+    // p may be ring state shared with other threads, connect through a copy
+    peer *conn = peer_dup(p);
+
     // check whether we can connect to the peer
-    if (peer_connect(p) != 0) {
-        fprintf(stderr, "Failed to connect to peer %s:%d\n", p->hostname,
-                p->port);
+    if (peer_connect(conn) != 0) {
+        LOG_WARN(LOG_NET, "Failed to connect to peer %s:%d", conn->hostname,
+                 conn->port);
+        lcache_invalidate_node(lc, conn->node_id);
+        peer_free(conn);
         return -1;
     }
 
     size_t data_len;
     unsigned char *raw = packet_serialize(pack, &data_len);
-    int status = sendall(p->socket, raw, data_len);
+    int status = sendall(conn->socket, raw, data_len);
     free(raw);
     raw = NULL;
 
-    peer_disconnect(p);
+    peer_disconnect(conn);
+    peer_free(conn);
     return status;
 }
 
 /**
- * @brief Forward a request to the successor.
+ * @brief Limit how long a proxy waits for the answer of a peer. The reactor
+ * waits meanwhile; two peers proxying to each other at the same time would
+ * wait forever.
  *
- * @param srv The server
+ * @param socket The socket connected to the peer
+ */
+void set_proxy_timeout(int socket) {
+    struct timeval tv = {PROXY_TIMEOUT_MS / 1000,
+                         (PROXY_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * @brief Whether a request may be answered with the answer fetched for
+ * another one: plain GETs (a traced GET collects a trace of its own, a GET
+ * taking the value compressed gets another answer).
+ */
+bool coalescable(const packet *p) {
+    return (p->flags & (PKT_FLAG_MULTI | PKT_FLAG_TRCE | PKT_FLAG_ZIP)) ==
+           PKT_FLAG_GET;
+}
+
+/**
+ * @brief Make a peer out of a ring member learned from an answer.
+ */
+peer *peer_from_ring_node(const ring_node *n) {
+    packet tmp = {0};
+    tmp.node_id = n->node_id;
+    tmp.node_ip = n->ip;
+    tmp.node_port = n->port;
+    return peer_from_packet(&tmp);
+}
+
+/**
+ * @brief Whether a GET asks for a lease along with the value (see
+ * PKT_FLAG_LEASE): its value is the node that wants to cache it.
+ */
+bool is_lease_request(const packet *p) {
+    return (p->flags & (PKT_FLAG_MULTI | PKT_FLAG_ACK | PKT_FLAG_TRCE)) ==
+               PKT_FLAG_LEASE &&
+           p->value_len == RING_NODE_LEN;
+}
+
+/**
+ * @brief Whether a peer is the given ring node (same ID and address).
+ */
+bool is_ring_node(const peer *p, const ring_node *n) {
+    return p != NULL && p->node_id == n->node_id && p->port == n->port &&
+           peer_get_ip(p) == n->ip;
+}
+
+/**
+ * @brief Whether a node asking for a lease is a member of the ring we know:
+ * the predecessor, successor or a finger of one of our virtual nodes, or a
+ * node we looked up or learned from lookups. We never lease to ourselves.
+ */
+bool is_ring_member(const ring_node *n) {
+    if (vnode_find(vnodes, n_vnodes, n->node_id) != NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < n_vnodes; i++) {
+        if (is_ring_node(vnodes[i].pred, n) ||
+            is_ring_node(vnodes[i].succ, n)) {
+            return true;
+        }
+        finger_table *fng_tab = vnodes[i].fng_tab;
+        if (fng_tab != NULL && fng_tab->state == FT_ACTIVE) {
+            for (size_t k = 0; k < SIZE_OF_FT; k++) {
+                if (is_ring_node(fng_tab->ft[k], n)) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    peer *c = lcache_get(lc, n->node_id);
+    bool member = is_ring_node(c, n);
+    if (c != NULL) {
+        peer_free(c);
+    }
+    if (!member) {
+        pthread_mutex_lock(&route_lock);
+        const ring_node *k = ring_cache_lookup(known, n->node_id);
+        member = k != NULL && k->node_id == n->node_id && k->ip == n->ip &&
+                 k->port == n->port;
+        pthread_mutex_unlock(&route_lock);
+    }
+    return member;
+}
+
+/**
+ * @brief Turn a GET for a hot key into a lease request naming us, unless it
+ * carries a value already (e.g. a lease request of another peer).
+ */
+void ask_for_lease(packet *p) {
+    if (p->value_len > 0) {
+        return;
+    }
+    p->flags |= PKT_FLAG_LEASE;
+    ring_node self = {vnodes[0].self->node_id, peer_get_ip(vnodes[0].self),
+                      vnodes[0].self->port};
+    size_t len;
+    free(p->value);
+    p->value = ring_view_serialize(&self, 1, &len);
+    p->value_len = len;
+}
+
+/**
+ * @brief Whether the owner granted the lease we asked for with a request
+ * (see PKT_FLAG_GRANT). The mark is taken off, the client gets a plain
+ * answer.
+ *
+ * @param p The request
+ * @param rsp The raw answer of the owner
+ * @param rsp_len The length of the answer
+ * @return bool Whether we may cache the value
+ */
+bool lease_granted(const packet *p, unsigned char *rsp, size_t rsp_len) {
+    if (hot == NULL || !is_lease_request(p) || rsp_len < PKT_HEADER_LEN ||
+        (rsp[0] & (PKT_FLAG_MULTI | PKT_FLAG_ACK)) !=
+            (PKT_FLAG_LEASE | PKT_FLAG_GRANT)) {
+        return false;
+    }
+    size_t count;
+    ring_node *holder = ring_view_decode(p->value, p->value_len, &count);
+    bool ours = holder->node_id == vnodes[0].self->node_id;
+    free(holder);
+    if (ours) {
+        rsp[0] &= ~(PKT_FLAG_GRANT);
+    }
+    return ours;
+}
+
+/**
+ * @brief Cache the value of a key the owner granted us a lease on.
+ *
+ * @param p The request
+ * @param rsp The raw answer of the owner (without the grant)
+ * @param rsp_len The length of the answer
+ * @param generation The drop generation of the key when we asked (see
+ * hot_generation)
+ */
+void accept_lease(const packet *p, const unsigned char *rsp, size_t rsp_len,
+                  uint32_t generation) {
+    if (rsp[0] != (PKT_FLAG_GET | PKT_FLAG_ACK)) {
+        return;
+    }
+    packet *a = packet_decode(rsp, rsp_len);
+    if (a != NULL) {
+        hot_put(hot, p->key, p->key_len, a->value, a->value_len, generation,
+                now_ms());
+        packet_free(a);
+    }
+}
+
+/**
+ * @brief Tell the peers holding a lease on a key that changed or expired to
+ * drop their copy. The invalidations leave with the next outbox flush, a
+ * write does not wait for the holders.
+ *
+ * @param key The key
+ * @param key_len The length of the key
+ */
+void revoke_leases(const unsigned char *key, size_t key_len) {
+    size_t count;
+    ring_node *holders = lease_revoke(leases, key, key_len, now_ms(), &count);
+    if (holders == NULL) {
+        return;
+    }
+    packet invl = {0};
+    invl.flags = PKT_FLAG_INVL;
+    invl.key = (unsigned char *)key; // copied by outbox_add
+    invl.key_len = key_len;
+    for (size_t i = 0; i < count; i++) {
+        peer *holder = peer_from_ring_node(&holders[i]);
+        LOG_DEBUG(LOG_KV, "Revoking the lease of %d.", holder->node_id);
+        outbox_add(ob, holder, &invl);
+        peer_free(holder);
+    }
+    free(holders);
+}
+
+/**
+ * @brief Serialize a request for the peer it is proxied to. With -z values
+ * travel compressed between peers: a plain GET asks for the value as it is
+ * stored, a long enough SET value is compressed here.
+ *
+ * @param p The request
+ * @param data_len Output: the length of the packet
+ * @param asked Output: whether we asked for a compressed answer (the client
+ * did not, see unzip_answer)
+ * @return unsigned char* The packet
+ */
+unsigned char *serialize_for_peer(const packet *p, size_t *data_len,
+                                  bool *asked) {
+    uint8_t kind = p->flags & (PKT_FLAG_MULTI | PKT_FLAG_TRCE | PKT_FLAG_ZIP);
+    *asked = zip_codec != CODEC_NONE && kind == PKT_FLAG_GET;
+    if (*asked) {
+        unsigned char *raw = packet_serialize(p, data_len);
+        raw[0] |= PKT_FLAG_ZIP;
+        return raw;
+    }
+
+    size_t ttl_len = packet_has_ttl(p) ? PKT_TTL_LEN : 0;
+    size_t frame_len;
+    unsigned char *frame = NULL;
+    if (zip_codec != CODEC_NONE && kind == PKT_FLAG_SET &&
+        p->value_len - ttl_len >= zip_min_len) {
+        frame = zip_compress(zip_codec, p->value + ttl_len,
+                             p->value_len - ttl_len, &frame_len);
+    }
+    if (frame == NULL) {
+        return packet_serialize(p, data_len);
+    }
+
+    packet z = *p; // key and TTL stay where they are
+    z.flags |= PKT_FLAG_ZIP;
+    z.value_len = ttl_len + frame_len;
+    z.value = (unsigned char *)malloc(z.value_len);
+    memcpy(z.value, p->value, ttl_len);
+    memcpy(z.value + ttl_len, frame, frame_len);
+    free(frame);
+    unsigned char *raw = packet_serialize(&z, data_len);
+    free(z.value);
+    return raw;
+}
+
+/**
+ * @brief Decompress the answer to a GET we asked to be compressed for a client
+ * that did not.
+ *
+ * @param rsp The raw answer (freed if it is replaced)
+ * @param rsp_len The length of the answer, updated
+ * @return unsigned char* The answer with the value as it was set
+ */
+unsigned char *unzip_answer(unsigned char *rsp, size_t *rsp_len) {
+    if (*rsp_len < PKT_HEADER_LEN ||
+        rsp[0] != (PKT_FLAG_GET | PKT_FLAG_ACK | PKT_FLAG_ZIP)) {
+        return rsp;
+    }
+    packet *a = packet_decode(rsp, *rsp_len);
+    free(rsp);
+    if (a == NULL) {
+        a = packet_new();
+    }
+    size_t len = 0;
+    unsigned char *data = zip_decompress(a->value, a->value_len, &len);
+    if (data == NULL) {
+        LOG_WARN(LOG_KV, "Could not decompress the value of a peer!");
+    }
+    free(a->value);
+    a->value = data;
+    a->value_len = len;
+    a->flags = data != NULL ? PKT_FLAG_GET | PKT_FLAG_ACK : PKT_FLAG_GET;
+
+    rsp = packet_serialize(a, rsp_len);
+    packet_free(a);
+    return rsp;
+}
+
+/**
+ * @brief Forward a request to a peer we are already connected to and pipe
+ * its response to the client. A GET for a key that is being fetched already
+ * waits for that answer instead, the one fetching hands it to every client
+ * that waits.
+ *
+ * @param srv The reactor the client is connected to
  * @param csocket The scokent of the client
  * @param p The packet to forward
- * @param n The peer to forward to
- * @return int The callback status
+ * @param n The connected peer to forward to
+ * @param routed Whether n routes it on (in an envelope, see PKT_FLAG_ROUTE)
+ * rather than owning its key
+ * @return int The callback status (CB_WAIT while the client waits)
  */
-int proxy_request(server *srv, int csocket, packet *p, peer *n) {
-    // check whether we can connect to the peer
-    if (peer_connect(n) != 0) {
-        fprintf(stderr,
-                "Could not connect to peer %s:%d to proxy request for client!",
-                n->hostname, n->port);
-        return CB_REMOVE_CLIENT;
+int proxy_connected(server *srv, int csocket, packet *p, peer *n,
+                    bool routed) {
+    bool shared = coalescable(p);
+    if (shared && !flight_join(flights, p->key, p->key_len, srv, csocket)) {
+        LOG_DEBUG(LOG_KV, "Same GET in flight, waiting for its answer.");
+        metrics_add(M_GETS_COALESCED, 1);
+        return CB_WAIT;
     }
+    uint16_t self_id = vnodes[0].self->node_id;
+    trace_add(p, self_id, TRACE_PROXY);
 
     size_t data_len;
-    unsigned char *raw = packet_serialize(p, &data_len);
+    bool asked;
+    unsigned char *raw = serialize_for_peer(p, &data_len, &asked);
+    if (routed) {
+        raw = packet_route(raw, &data_len);
+    }
+    // an invalidation arriving before the answer outdates it
+    uint32_t generation = hot != NULL && is_lease_request(p)
+                              ? hot_generation(hot, p->key, p->key_len)
+                              : 0;
     sendall(n->socket, raw, data_len);
     free(raw);
     raw = NULL;
 
+    set_proxy_timeout(n->socket);
+
     size_t rsp_len = 0;
     unsigned char *rsp = recvall(n->socket, &rsp_len);
+    // recvall closed the socket; closing it again in peer_disconnect could hit
+    // a client another reactor accepted on the same descriptor meanwhile
+    n->socket = -1;
+    bool leased = lease_granted(p, rsp, rsp_len);
+    if (asked) {
+        rsp = unzip_answer(rsp, &rsp_len);
+    }
+    if (packet_is_traced(p)) {
+        rsp = trace_add_raw(rsp, &rsp_len, self_id, TRACE_PROXIED);
+    }
 
     // Just pipe everything through unfiltered. Yolo!
     sendall(csocket, rsp, rsp_len);
+    if (leased) {
+        accept_lease(p, rsp, rsp_len, generation);
+    }
+    if (shared) {
+        flight_land(flights, p->key, p->key_len, csocket, rsp, rsp_len);
+    }
     free(rsp);
 
     return CB_REMOVE_CLIENT;
 }
 
 /**
- * @brief Lookup the peer responsible for a hash_id.
+ * @brief Pass a request on in an envelope (see PKT_FLAG_ROUTE) to a peer that
+ * routes it on, and its answer to the client.
  *
- * @param hash_id The hash to lookup
+ * @param srv The reactor the client is connected to
+ * @param csocket The socket of the client
+ * @param p The request
+ * @param hop The peer to pass it to
+ * @param status Output: the callback status, if it was passed on
+ * @return bool false if hop is NULL, one of our virtual nodes or unreachable
+ */
+bool route_to(server *srv, int csocket, packet *p, const peer *hop,
+              int *status) {
+    if (hop == NULL || vnode_find(vnodes, n_vnodes, hop->node_id) != NULL) {
+        return false;
+    }
+    peer *conn = peer_dup(hop);
+    if (peer_connect(conn) != 0) {
+        lcache_invalidate_node(lc, conn->node_id);
+        peer_free(conn);
+        return false;
+    }
+    LOG_DEBUG(LOG_KV, "Routing it to %d.", conn->node_id);
+    *status = proxy_connected(srv, csocket, p, conn, true);
+    peer_disconnect(conn);
+    peer_free(conn);
+    return true;
+}
+
+/**
+ * @brief Forward a request to the successor.
+ *
+ * @param srv The server
+ * @param csocket The scokent of the client
+ * @param p The packet to forward
+ * @param n The peer to forward to
  * @return int The callback status
  */
-int lookup_peer(uint16_t hash_id) {
-    // We could see whether or not we need to repeat the lookup
+int proxy_request(server *srv, int csocket, packet *p, peer *n) {
+    // n may be ring state shared with other threads, connect through a copy
+    peer *conn = peer_dup(n);
+
+    // check whether we can connect to the peer
+    if (peer_connect(conn) != 0) {
+        LOG_WARN(LOG_KV,
+                 "Could not connect to peer %s:%d to proxy request for client!",
+                 conn->hostname, conn->port);
+        lcache_invalidate_node(lc, conn->node_id);
+        peer_free(conn);
+        // GETs that wait for this one (see handle_reply) get no answer either
+        flight_land(flights, p->key, p->key_len, csocket, NULL, 0);
+        return CB_REMOVE_CLIENT;
+    }
 
+    int status = proxy_connected(srv, csocket, p, conn, false);
+    peer_disconnect(conn);
+    peer_free(conn);
+    return status;
+}
+
+/**
+ * @brief Queue a lookup of a hash_id, it leaves with the next outbox flush.
+ *
+ * @param v The virtual node that starts the lookup (gets the answer)
+ * @param hop The peer to send it to
+ * @param hash_id The hash to lookup
+ * @param flags PKT_FLAG_ITER for an iterative lookup, 0 otherwise
+ */
+void send_lookup(vnode *v, const peer *hop, uint16_t hash_id, uint8_t flags) {
     // build a new packet for the lookup
     packet *lkp = packet_new();
-    lkp->flags = PKT_FLAG_CTRL | PKT_FLAG_LKUP;
+    lkp->flags = PKT_FLAG_CTRL | PKT_FLAG_LKUP | flags;
     lkp->hash_id = hash_id;
-    lkp->node_id = self->node_id;
-    lkp->node_port = self->port;
+    lkp->node_id = v->self->node_id;
+    lkp->node_port = v->self->port;
+
+    lkp->node_ip = peer_get_ip(v->self);
+
+    metrics_add(M_LOOKUPS_SENT, 1);
+    outbox_add(ob, hop, lkp);
+    packet_free(lkp);
+}
+
+/**
+ * @brief Lookup the peer responsible for a hash_id (recursively).
+ *
+ * @param v The virtual node that starts the lookup
+ * @param hash_id The hash to lookup
+ * @param attempt The number of earlier attempts (selects the first hop)
+ */
+void lookup_peer(vnode *v, uint16_t hash_id, int attempt) {
+    send_lookup(v, vnode_lookup_hop(v, hash_id, attempt), hash_id, 0);
+}
+
+/**
+ * @brief Give the current step of an iterative lookup LOOKUP_STEP_MS to make
+ * progress before it is asked again.
+ *
+ * @param entry The parked requests
+ */
+void arm_step(rtable *entry) {
+    timer_cancel(entry->step);
+    entry->step = timer_wheel_add(
+        tw, now_ms() + LOOKUP_STEP_MS,
+        (void *)(uintptr_t)(entry->hash_id | LOOKUP_STEP_TIMER));
+}
+
+/**
+ * @brief Probe lookup_alpha distinct fingers at once (the next ones on every
+ * retry) and the closest node learned earlier. Every probe answers with a
+ * referral or the responsible peer itself.
+ *
+ * @param v The virtual node that starts the lookup
+ * @param entry The parked requests
+ */
+void send_probes(vnode *v, rtable *entry) {
+    uint16_t hash_id = entry->hash_id;
+    peer *probed[lookup_alpha];
+    size_t n_probed = 0;
+    uint16_t closest = UINT16_MAX;
+
+    for (int k = 0; k < lookup_alpha; k++) {
+        peer *hop = vnode_lookup_hop(v, hash_id, entry->attempts * lookup_alpha + k);
+        bool dup = false;
+        for (size_t i = 0; i < n_probed; i++) {
+            dup = dup || probed[i]->node_id == hop->node_id;
+        }
+        if (dup) {
+            continue; // fewer fingers than probes
+        }
+        probed[n_probed++] = hop;
+        send_lookup(v, hop, hash_id, PKT_FLAG_ITER);
+        if ((uint16_t)(hash_id - hop->node_id) < closest) {
+            closest = hash_id - hop->node_id;
+        }
+    }
+
+    const ring_node *n = ring_cache_preceding(known, hash_id);
+    if (n != NULL && (uint16_t)(hash_id - n->node_id) < closest) {
+        peer *hop = peer_from_ring_node(n);
+        send_lookup(v, hop, hash_id, PKT_FLAG_ITER);
+        peer_free(hop);
+    }
+}
+
+/**
+ * @brief Start an iterative lookup for parked requests.
+ *
+ * @param v The virtual node that starts the lookup
+ * @param entry The parked requests
+ */
+void probe_parked_lookup(vnode *v, rtable *entry) {
+    entry->progress = UINT16_MAX;
+    send_probes(v, entry);
+    arm_step(entry);
+}
+
+/**
+ * @brief A step of an iterative lookup made no progress in time (the probe or
+ * its answer got lost, or the node is slow): ask again.
+ *
+ * @param hash_id The hash of the parked requests
+ */
+void step_expired(uint16_t hash_id) {
+    rtable *entry = find_requests(rt, hash_id);
+    vnode *v = vnode_closest(vnodes, n_vnodes, hash_id);
+    if (entry == NULL || v == NULL) {
+        return;
+    }
+    entry->step = NULL; // freed by the wheel
+
+    if (entry->progress == UINT16_MAX) {
+        send_probes(v, entry);
+    } else {
+        peer *hop = peer_from_ring_node(&entry->next_hop);
+        send_lookup(v, hop, hash_id, PKT_FLAG_ITER);
+        peer_free(hop);
+    }
+    arm_step(entry);
+}
+
+/**
+ * @brief Send the lookup for parked requests and set its deadline.
+ * If the first hop cannot be reached the next attempt starts on the next tick
+ * (see control_failed).
+ *
+ * @param v The virtual node that starts the lookup
+ * @param entry The parked requests
+ */
+void send_parked_lookup(vnode *v, rtable *entry) {
+    uint64_t timeout = (uint64_t)LOOKUP_TIMEOUT_MS << entry->attempts;
+    if (lookup_alpha > 0) {
+        probe_parked_lookup(v, entry);
+    } else {
+        lookup_peer(v, entry->hash_id, entry->attempts);
+    }
+    entry->timer = timer_wheel_add(tw, now_ms() + timeout,
+                                   (void *)(uintptr_t)entry->hash_id);
+}
+
+/**
+ * @brief A control message from the outbox could not be delivered. If it was
+ * the lookup for our parked requests, move its deadline to now so that the
+ * next attempt starts right away.
+ *
+ * @param hop The unreachable next hop
+ * @param msg The message
+ */
+void control_failed(const peer *hop, const packet *msg) {
+    lcache_invalidate_node(lc, hop->node_id);
+    if (!(msg->flags & PKT_FLAG_CTRL) || !(msg->flags & PKT_FLAG_LKUP) ||
+        vnode_find(vnodes, n_vnodes, msg->node_id) == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&route_lock);
+    rtable *entry = find_requests(rt, msg->hash_id);
+    if (entry != NULL && entry->timer != NULL) {
+        timer_cancel(entry->timer);
+        entry->timer = timer_wheel_add(tw, now_ms(),
+                                       (void *)(uintptr_t)entry->hash_id);
+    }
+    pthread_mutex_unlock(&route_lock);
+}
+
+/**
+ * @brief Tell a client its request could not be routed in time.
+ * The answer carries no ACK and the reason as value.
+ *
+ * @param csocket The socket of the client
+ * @param p The request
+ */
+void answer_timeout(int csocket, const packet *p) {
+    packet *rsp = packet_new();
+    rsp->flags = p->flags & (PKT_FLAG_GET | PKT_FLAG_SET | PKT_FLAG_DEL);
+    rsp->key = (unsigned char *)malloc(p->key_len);
+    rsp->key_len = p->key_len;
+    memcpy(rsp->key, p->key, p->key_len);
+    rsp->value = (unsigned char *)strdup("Lookup timed out");
+    rsp->value_len = strlen((char *)rsp->value);
+
+    size_t data_len;
+    unsigned char *raw = packet_serialize(rsp, &data_len);
+    packet_free(rsp);
+    sendall(csocket, raw, data_len);
+    free(raw);
+    raw = NULL;
+}
+
+/**
+ * @brief The deadline of a lookup passed: retry via another hop or give up.
+ * The requests of a lookup that gave up are taken out of the table, their
+ * clients are answered once route_lock is released (see answer_failed).
+ *
+ * @param data The hash_id of the parked requests
+ * @param arg The list to append the requests of failed lookups to
+ */
+void lookup_expired(void *data, void *arg) {
+    request **failed = (request **)arg;
+    uint16_t hash_id = (uint16_t)(uintptr_t)data;
+    if ((uintptr_t)data & LOOKUP_STEP_TIMER) {
+        step_expired(hash_id);
+        return;
+    }
+
+    rtable *entry = find_requests(rt, hash_id);
+    if (entry == NULL) {
+        return;
+    }
+    entry->timer = NULL; // freed by the wheel
+
+    vnode *v = vnode_closest(vnodes, n_vnodes, hash_id);
+    if (entry->attempts < LOOKUP_MAX_RETRIES && v != NULL) {
+        entry->attempts++;
+        rstats.retries++;
+        LOG_INFO(LOG_LOOKUP, "Lookup of %d timed out, retry %d.", hash_id,
+                 entry->attempts);
+        send_parked_lookup(v, entry);
+        return;
+    }
+
+    LOG_WARN(LOG_LOOKUP, "Lookup of %d failed, giving up.", hash_id);
+    metrics_add(M_LOOKUPS_FAILED, 1);
+    uint64_t now = now_ms();
+    for (request *r = entry->open_requests; r != NULL; r = r->next) {
+        request_stats_record(&rstats, r, now);
+        rstats.timeouts++;
+    }
+    request *last = entry->last_request;
+    last->next = *failed;
+    *failed = detach_requests(rt, hash_id);
+}
 
-    lkp->node_ip = peer_get_ip(self);
+/**
+ * @brief Tell the clients of lookups that gave up, without holding
+ * route_lock: a slow client does not stall the other reactors.
+ *
+ * @param failed The requests (freed)
+ */
+void answer_failed(request *failed) {
+    if (failed == NULL) {
+        return;
+    }
+    for (request *r = failed; r != NULL; r = r->next) {
+        answer_timeout(r->socket, r->packet);
+        server_close_socket(r->srv, r->socket);
+    }
+    pthread_mutex_lock(&route_lock);
+    free_requests(failed);
+    pthread_mutex_unlock(&route_lock);
+}
+
+/**
+ * @brief Write the ring state of every virtual node as one line: pred, succ
+ * (-1 if unknown), the state of the finger table and its entries ('-' until
+ * it is active), e.g. 'ring{vnode="138"} pred=74 succ=202 ft=active
+ * fingers=202,202,...'.
+ *
+ * @param out The stream to write to
+ */
+void ring_dump(FILE *out) {
+    for (size_t i = 0; i < n_vnodes; i++) {
+        vnode *v = &vnodes[i];
+        peer *pred = v->pred;
+        peer *succ = v->succ;
+        finger_table *fng_tab = v->fng_tab;
+        const char *ft = "none";
+        if (fng_tab != NULL) {
+            ft = fng_tab->state == FT_ACTIVE ? "active" : "building";
+        }
+
+        fprintf(out, "ring{vnode=\"%u\"} pred=%d succ=%d ft=%s fingers=",
+                v->self->node_id, pred != NULL ? pred->node_id : -1,
+                succ != NULL ? succ->node_id : -1, ft);
+        for (size_t k = 0; k < SIZE_OF_FT; k++) {
+            // entries of a table being built are not published yet
+            peer *f = fng_tab != NULL && fng_tab->state == FT_ACTIVE
+                          ? fng_tab->ft[k]
+                          : NULL;
+            if (f != NULL) {
+                fprintf(out, k > 0 ? ",%u" : "%u", f->node_id);
+            } else {
+                fprintf(out, k > 0 ? ",-" : "-");
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
+
+/**
+ * @brief Write the gauges of this peer (store, waiting requests), its ring
+ * state and all metrics as text.
+ *
+ * @param out The stream to write to
+ */
+void stats_dump(FILE *out) {
+    pthread_mutex_lock(&route_lock);
+    size_t waiting = rstats.parked - rstats.resolved - rstats.timeouts;
+    pthread_mutex_unlock(&route_lock);
+
+    fprintf(out, "store_entries %zu\n", kv_count(kv));
+    fprintf(out, "store_bytes %zu\n", kv_bytes(kv));
+    fprintf(out, "store_saved_bytes %zu\n", kv_saved(kv));
+    fprintf(out, "compress_codec %s\n", codec_name(zip_codec));
+    zip_dump(out);
+    fprintf(out, "requests_waiting %zu\n", waiting);
+    if (hot != NULL) {
+        hot_cache_dump(hot, out);
+    }
+    lease_table_dump(leases, out);
+    ring_dump(out);
+    metrics_dump(out);
+}
+
+/**
+ * @brief Signal handler of SIGUSR1, the dump itself happens on the next tick.
+ */
+void request_stats_dump(int sig) {
+    (void)sig;
+    atomic_store(&stats_requested, true);
+}
+
+/**
+ * @brief Periodic work of the event loop: send the control messages queued
+ * during this iteration and fire expired lookup deadlines.
+ *
+ * @param srv The server
+ */
+void handle_tick(server *srv) {
+    outbox_flush(ob, control_failed);
+
+    if (atomic_exchange(&stats_requested, false)) {
+        stats_dump(stderr);
+    }
+
+    request *failed = NULL;
+    pthread_mutex_lock(&route_lock);
+    timer_wheel_advance(tw, now_ms(), lookup_expired, &failed);
+    pthread_mutex_unlock(&route_lock);
+    answer_failed(failed);
+
+    // one reactor is enough to drop the keys and leases that ran out, the
+    // holders of a lease on an expired key are told like after a DEL
+    if (srv == shards[0]) {
+        metrics_add(M_KEYS_EXPIRED, kv_expire(kv, now_ms(), revoke_leases));
+    }
+    static uint64_t last_expire = 0;
+    if (srv == shards[0] && now_ms() - last_expire >= LEASE_EXPIRE_MS) {
+        last_expire = now_ms();
+        lease_expire(leases, last_expire);
+    }
+}
+
+/**
+ * @brief Answer a GET. Header, key and value are sent from where they are.
+ *
+ * @param csocket The socket of the client
+ * @param p The request
+ * @param flags The flags of the answer (TRCE is added for a traced request)
+ * @param data The value
+ * @param len The length of the value
+ * @return int The status of the sending procedure
+ */
+int answer_data(int csocket, const packet *p, uint8_t flags,
+                const unsigned char *data, size_t len) {
+    // a traced request gets its trace back behind the value
+    size_t trace_len =
+        packet_is_traced(p) ? trace_size(p->value, p->value_len) : 0;
+
+    packet hdr = {0};
+    hdr.flags = flags;
+    hdr.flags |= trace_len > 0 ? PKT_FLAG_TRCE : 0;
+    hdr.key_len = p->key_len;
+    hdr.value_len = len + trace_len;
+
+    unsigned char raw[PKT_HEADER_LEN];
+    packet_serialize_hdr(&hdr, raw);
+
+    struct iovec iov[4] = {
+        {raw, PKT_HEADER_LEN},
+        {p->key, p->key_len},
+        {(unsigned char *)data, len},
+        {p->value + p->value_len - trace_len, trace_len},
+    };
+    return sendallv(csocket, iov, trace_len > 0 ? 4 : 3);
+}
+
+/**
+ * @brief Answer a GET with a stored value, the value is not copied. A
+ * compressed value is sent as it is if the client takes it compressed and
+ * decompressed otherwise.
+ *
+ * @param csocket The socket of the client
+ * @param p The request
+ * @param value A reference to the value
+ * @param leased Whether a lease on the key was granted with it (GRANT is
+ * added)
+ * @return int The status of the sending procedure
+ */
+int answer_value(int csocket, const packet *p, kv_value *value, bool leased) {
+    uint8_t grant = leased ? PKT_FLAG_GRANT : 0;
+    if (!value->zipped || (p->flags & PKT_FLAG_ZIP)) {
+        uint8_t flags = PKT_FLAG_GET | PKT_FLAG_ACK | grant;
+        flags |= value->zipped ? PKT_FLAG_ZIP : 0;
+        return answer_data(csocket, p, flags, value->data, value->len);
+    }
+
+    size_t len = 0;
+    unsigned char *data = zip_decompress(value->data, value->len, &len);
+    if (data == NULL) {
+        LOG_WARN(LOG_KV, "Could not decompress a stored value!");
+        return answer_data(csocket, p, PKT_FLAG_GET, NULL, 0);
+    }
+    int status = answer_data(csocket, p, PKT_FLAG_GET | PKT_FLAG_ACK | grant,
+                             data, len);
+    free(data);
+    return status;
+}
+
+/**
+ * @brief Make the value of a SET to store: compressed if it is long enough
+ * and gets shorter, as it is if the sender compressed it already. A frame of
+ * the sender is decompressed once, so that only frames every GET can
+ * decompress are stored.
+ *
+ * @param p The request
+ * @param data The value (without TTL and trace)
+ * @param len The length of the value
+ * @return kv_value* The value or NULL if a compressed value is malformed
+ */
+kv_value *value_to_store(const packet *p, const unsigned char *data,
+                         size_t len) {
+    if (p->flags & PKT_FLAG_ZIP) {
+        size_t raw_len = 0;
+        unsigned char *raw = len > 0 && data[0] != CODEC_NONE
+                                 ? zip_decompress(data, len, &raw_len)
+                                 : NULL;
+        if (raw == NULL) {
+            return NULL;
+        }
+        free(raw);
+        kv_value *v = kv_value_new(data, len);
+        v->raw_len = raw_len;
+        v->zipped = true;
+        return v;
+    }
+
+    size_t frame_len;
+    unsigned char *frame =
+        len >= zip_min_len ? zip_compress(zip_codec, data, len, &frame_len)
+                           : NULL;
+    if (frame == NULL) {
+        return kv_value_new(data, len);
+    }
+    kv_value *v = kv_value_new(frame, frame_len);
+    free(frame);
+    v->raw_len = len;
+    v->zipped = true;
+    return v;
+}
+
+/**
+ * @brief Handle a client request we are resonspible for.
+ *
+ * @param csocket The socket of the client
+ * @param p The packet
+ * @return int The callback status
+ */
+int handle_own_request(int csocket, packet *p) {
+    // build a new packet for the request
+    packet *rsp = packet_new();
+
+    // the trace at the end of the value of a traced request is not stored
+    size_t trace_len =
+        packet_is_traced(p) ? trace_size(p->value, p->value_len) : 0;
+    uint16_t self_id = vnodes[0].self->node_id;
+
+    if (p->flags & PKT_FLAG_GET) {
+        // this is a GET request
+        // the lease is granted before the value is read: a SET that stores
+        // a newer value after that revokes it (see revoke_leases)
+        bool leased = false;
+        if (is_lease_request(p)) {
+            size_t count;
+            ring_node *holder = ring_view_decode(p->value, p->value_len, &count);
+            leased = is_ring_member(holder) &&
+                     lease_grant(leases, p->key, p->key_len, holder, now_ms());
+            free(holder);
+        }
+        kv_value *value = kv_get(kv, p->key, p->key_len);
+        trace_add(p, self_id, TRACE_STORE);
+        if (value != NULL) {
+            packet_free(rsp);
+            answer_value(csocket, p, value, leased);
+            kv_value_unref(value);
+            return CB_REMOVE_CLIENT;
+        }
+        rsp->flags = PKT_FLAG_GET;
+        rsp->key = (unsigned char *)malloc(p->key_len);
+        rsp->key_len = p->key_len;
+        memcpy(rsp->key, p->key, p->key_len);
+    } else if (p->flags & PKT_FLAG_SET) {
+        // this is a SET request
+        // a TTL comes before the value
+        size_t ttl_len = packet_has_ttl(p) ? PKT_TTL_LEN : 0;
+        kv_value *value = value_to_store(p, p->value + ttl_len,
+                                         p->value_len - ttl_len - trace_len);
+        if (value != NULL) {
+            rsp->flags = PKT_FLAG_SET | PKT_FLAG_ACK;
+            kv_set_value(kv, p->key, p->key_len, value, packet_ttl(p));
+            revoke_leases(p->key, p->key_len);
+        } else {
+            rsp->flags = PKT_FLAG_SET;
+        }
+        trace_add(p, self_id, TRACE_STORE);
+    } else if (p->flags & PKT_FLAG_DEL) {
+        // this is a DELETE request
+        int status = kv_delete(kv, p->key, p->key_len);
+        revoke_leases(p->key, p->key_len);
+        trace_add(p, self_id, TRACE_STORE);
+
+        if (status == 0) {
+            rsp->flags = PKT_FLAG_DEL | PKT_FLAG_ACK;
+        } else {
+            rsp->flags = PKT_FLAG_DEL;
+        }
+    } else {
+        // send some default data
+        rsp->flags = p->flags | PKT_FLAG_ACK;
+        rsp->key = (unsigned char *)strdup("Rick Astley");
+        rsp->key_len = strlen((char *)rsp->key);
+        rsp->value = (unsigned char *)strdup("Never Gonna Give You Up!\n");
+        rsp->value_len = strlen((char *)rsp->value);
+    }
+    trace_copy(rsp, p);
+
+    size_t data_len;
+    unsigned char *raw = packet_serialize(rsp, &data_len);
+    packet_free(rsp);
+    sendall(csocket, raw, data_len);
+    free(raw);
+    raw = NULL;
+
+    return CB_REMOVE_CLIENT;
+}
+
+/**
+ * @brief Answer a lookup request from a peer (via the outbox, so replies to
+ * the same questioner leave together).
+ *
+ * @param p The packet
+ * @param n The peer
+ * @param flags PKT_FLAG_ITER if n is only the next hop, 0 otherwise
+ * @return int The callback status
+ */
+int answer_lookup(packet *p, peer *n, uint8_t flags) {
+    peer *questioner = peer_from_packet(p);
+
+    // build a new packet for the response
+    packet *rsp = packet_new();
+    rsp->flags = PKT_FLAG_CTRL | PKT_FLAG_RPLY | flags;
+    rsp->hash_id = p->hash_id;
+    rsp->node_id = n->node_id;
+    rsp->node_port = n->port;
+    rsp->node_ip = peer_get_ip(n);
+    packet_set_hops(rsp, packet_hops(p)); // for the questioner's metrics
+
+    metrics_add(M_LOOKUPS_ANSWERED, 1);
+    outbox_add(ob, questioner, rsp);
+    packet_free(rsp);
+    peer_free(questioner);
+    return CB_REMOVE_CLIENT;
+}
+
+/**
+ * @brief Serve a request at the peer responsible for it. Requests for one of
+ * our own virtual nodes are handled locally instead of proxying them to
+ * ourselves.
+ *
+ * @param srv The server
+ * @param csocket The socket of the client
+ * @param p The packet
+ * @param n The responsible peer
+ * @return int The callback status
+ */
+int serve_request(server *srv, int csocket, packet *p, peer *n) {
+    if (vnode_find(vnodes, n_vnodes, n->node_id) != NULL) {
+        return handle_own_request(csocket, p);
+    }
+    return proxy_request(srv, csocket, p, n);
+}
+
+/**
+ * @brief Append a peer to a list of ring members unless it is already in it.
+ */
+void ring_view_add(ring_node *nodes, size_t *count, const peer *p, uint32_t ip) {
+    if (p == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < *count; i++) {
+        if (nodes[i].node_id == p->node_id) {
+            return;
+        }
+    }
+    nodes[*count].node_id = p->node_id;
+    nodes[*count].ip = ip != 0 ? ip : peer_get_ip(p);
+    nodes[*count].port = p->port;
+    (*count)++;
+}
+
+/**
+ * @brief Answer a smart client with what we know about the ring: our virtual
+ * nodes, their neighbours and their fingers.
+ *
+ * @param csocket The socket of the client
+ * @param flags The flags of the answer (RING is added)
+ * @return int The callback status
+ */
+int answer_ring_view(int csocket, uint8_t flags) {
+    ring_node *nodes = calloc(n_vnodes * (SIZE_OF_FT + 3), sizeof(ring_node));
+    size_t count = 0;
+
+    uint32_t ip_self = peer_get_ip(vnodes[0].self);
+    for (size_t i = 0; i < n_vnodes; i++) {
+        ring_view_add(nodes, &count, vnodes[i].self, ip_self);
+    }
+    for (size_t i = 0; i < n_vnodes; i++) {
+        ring_view_add(nodes, &count, vnodes[i].pred, 0);
+        ring_view_add(nodes, &count, vnodes[i].succ, 0);
+        finger_table *fng_tab = vnodes[i].fng_tab;
+        if (fng_tab != NULL && fng_tab->state == FT_ACTIVE) {
+            for (size_t k = 0; k < SIZE_OF_FT; k++) {
+                ring_view_add(nodes, &count, fng_tab->ft[k], 0);
+            }
+        }
+    }
+
+    packet *rsp = packet_new();
+    rsp->flags = flags | PKT_FLAG_RING;
+    size_t view_len;
+    rsp->value = ring_view_serialize(nodes, count, &view_len);
+    rsp->value_len = view_len;
+    free(nodes);
+
+    size_t data_len;
+    unsigned char *raw = packet_serialize(rsp, &data_len);
+    packet_free(rsp);
+    sendall(csocket, raw, data_len);
+    free(raw);
+    raw = NULL;
+
+    return CB_REMOVE_CLIENT;
+}
+
+/**
+ * @brief Answer a STATS request with the text of stats_dump.
+ *
+ * @param csocket The socket of the client
+ * @return int The callback status
+ */
+int answer_stats(int csocket) {
+    packet *rsp = packet_new();
+    rsp->flags = PKT_FLAG_STAT | PKT_FLAG_ACK;
+
+    char *text = NULL;
+    size_t text_len = 0;
+    FILE *out = open_memstream(&text, &text_len);
+    stats_dump(out);
+    fclose(out);
+    rsp->value = (unsigned char *)text;
+    rsp->value_len = text_len;
+
+    size_t data_len;
+    unsigned char *raw = packet_serialize(rsp, &data_len);
+    packet_free(rsp);
+    sendall(csocket, raw, data_len);
+    free(raw);
+    raw = NULL;
+
+    return CB_REMOVE_CLIENT;
+}
+
+/**
+ * @brief Count a client request along with its latency.
+ *
+ * @param p The request
+ * @param path How it was served
+ * @param start When it was received (us)
+ * @param status The callback status of serving it
+ * @return int The callback status
+ */
+int request_served(const packet *p, req_path path, uint64_t start, int status) {
+    metrics_request(p->flags, path, now_us() - start);
+    return status;
+}
+
+/*
+ * The keys of a multi-key request that go to the same peer.
+ */
+typedef struct _multi_group {
+    peer *hop;
+    size_t *index; // positions of the keys in the request
+    size_t count;
+    int socket; // -1 until the sub-request is sent
+} multi_group;
+
+/**
+ * @brief Serve one request of a multi-key request we are responsible for.
+ *
+ * @param p The request
+ * @return packet* The answer
+ */
+packet *serve_multi_entry(const packet *p) {
+    packet *rsp = packet_new();
+    if (packet_is_multi(p)) {
+        return rsp; // not nested
+    }
+    rsp->flags = p->flags & (PKT_FLAG_GET | PKT_FLAG_SET | PKT_FLAG_DEL);
+
+    if (p->flags & PKT_FLAG_GET) {
+        rsp->key = (unsigned char *)malloc(p->key_len);
+        rsp->key_len = p->key_len;
+        memcpy(rsp->key, p->key, p->key_len);
+        kv_value *value = kv_get(kv, p->key, p->key_len);
+        if (value != NULL && value->zipped) {
+            size_t len = 0;
+            rsp->value = zip_decompress(value->data, value->len, &len);
+            rsp->value_len = len;
+            rsp->flags |= rsp->value != NULL ? PKT_FLAG_ACK : 0;
+        } else if (value != NULL) {
+            rsp->flags |= PKT_FLAG_ACK;
+            rsp->value = (unsigned char *)malloc(value->len);
+            rsp->value_len = value->len;
+            memcpy(rsp->value, value->data, value->len);
+        }
+        kv_value_unref(value);
+    } else if (p->flags & PKT_FLAG_SET) {
+        size_t ttl_len = packet_has_ttl(p) ? PKT_TTL_LEN : 0;
+        kv_value *value =
+            value_to_store(p, p->value + ttl_len, p->value_len - ttl_len);
+        if (value != NULL) {
+            kv_set_value(kv, p->key, p->key_len, value, packet_ttl(p));
+            revoke_leases(p->key, p->key_len);
+            rsp->flags |= PKT_FLAG_ACK;
+        }
+    } else if (p->flags & PKT_FLAG_DEL) {
+        if (kv_delete(kv, p->key, p->key_len) == 0) {
+            rsp->flags |= PKT_FLAG_ACK;
+        }
+        revoke_leases(p->key, p->key_len);
+    }
+    return rsp;
+}
+
+/**
+ * @brief Pick the peer a key of a multi-key request goes to: the responsible
+ * peer if we know it (our successor or the lookup cache), otherwise the
+ * closest preceding finger, which passes the key on the same way.
+ *
+ * @param hash_id The hash of the key
+ * @return peer* A copy of the next hop or NULL if we are responsible
+ */
+peer *multi_hop(uint16_t hash_id) {
+    route r = vnode_route(vnodes, n_vnodes, hash_id, false);
+    if (r.kind == ROUTE_SELF || r.kind == ROUTE_NONE ||
+        vnode_find(vnodes, n_vnodes, r.next->node_id) != NULL) {
+        return NULL;
+    } else if (r.kind == ROUTE_SUCC) {
+        return peer_dup(r.next);
+    }
 
-    forward(succ, lkp);
-    return 0;
+    peer *n = lcache_get(lc, hash_id);
+    if (n != NULL && vnode_find(vnodes, n_vnodes, n->node_id) != NULL) {
+        peer_free(n);
+        return NULL;
+    }
+    return n != NULL ? n : peer_dup(r.next);
 }
 
 /**
- * @brief Handle a client request we are resonspible for.
+ * @brief Send the keys of a group to its peer as one multi-key request.
  *
- * @param c The client
- * @param p The packet
- * @return int The callback status
+ * @param g The group (its socket is set if the request was sent)
+ * @param reqs The requests of the whole multi-key request
  */
-int handle_own_request(server* srv, client *c, packet *p) {
-    // build a new packet for the request
-    packet *rsp = packet_new();
-
-    if (p->flags & PKT_FLAG_GET) {
-        // this is a GET request
-        htable *entry = htable_get(ht, p->key, p->key_len);
-        if (entry != NULL) {
-            rsp->flags = PKT_FLAG_GET | PKT_FLAG_ACK;
-
-            rsp->key = (unsigned char *)malloc(entry->key_len);
-            rsp->key_len = entry->key_len;
-            memcpy(rsp->key, entry->key, entry->key_len);
-
-            rsp->value = (unsigned char *)malloc(entry->value_len);
-            rsp->value_len = entry->value_len;
-            memcpy(rsp->value, entry->value, entry->value_len);
-        } else {
-            rsp->flags = PKT_FLAG_GET;
-            rsp->key = (unsigned char *)malloc(p->key_len);
-            rsp->key_len = p->key_len;
-            memcpy(rsp->key, p->key, p->key_len);
-        }
-    } else if (p->flags & PKT_FLAG_SET) {
-        // this is a SET request
-        rsp->flags = PKT_FLAG_SET | PKT_FLAG_ACK;
-        htable_set(ht, p->key, p->key_len, p->value, p->value_len);
-    } else if (p->flags & PKT_FLAG_DEL) {
-        // this is a DELETE request
-        int status = htable_delete(ht, p->key, p->key_len);
+void multi_send(multi_group *g, packet **reqs) {
+    if (peer_connect(g->hop) != 0) {
+        LOG_WARN(LOG_KV, "Could not connect to peer %s:%d for %zu keys!",
+                 g->hop->hostname, g->hop->port, g->count);
+        lcache_invalidate_node(lc, g->hop->node_id);
+        return;
+    }
+    set_proxy_timeout(g->hop->socket);
 
-        if (status == 0) {
-            rsp->flags = PKT_FLAG_DEL | PKT_FLAG_ACK;
-        } else {
-            rsp->flags = PKT_FLAG_DEL;
-        }
-    } else {
-        // send some default data
-        rsp->flags = p->flags | PKT_FLAG_ACK;
-        rsp->key = (unsigned char *)strdup("Rick Astley");
-        rsp->key_len = strlen((char *)rsp->key);
-        rsp->value = (unsigned char *)strdup("Never Gonna Give You Up!\n");
-        rsp->value_len = strlen((char *)rsp->value);
+    packet **sub = (packet **)malloc(g->count * sizeof(packet *));
+    for (size_t j = 0; j < g->count; j++) {
+        sub[j] = reqs[g->index[j]];
     }
+    packet *m = packet_multi(sub, g->count);
+    free(sub);
 
     size_t data_len;
-    unsigned char *raw = packet_serialize(rsp, &data_len);
-    free(rsp);
-    sendall(c->socket, raw, data_len);
+    unsigned char *raw = packet_serialize(m, &data_len);
+    packet_free(m);
+    if (sendall(g->hop->socket, raw, data_len) == 0) {
+        g->socket = g->hop->socket;
+    } else {
+        peer_disconnect(g->hop);
+    }
     free(raw);
-    raw = NULL;
+}
 
-    return CB_REMOVE_CLIENT;
+/**
+ * @brief Wait for the answer of a group and put its entries in place.
+ *
+ * @param g The group
+ * @param answers The answers of the whole multi-key request
+ */
+void multi_collect(multi_group *g, packet **answers) {
+    if (g->socket < 0) {
+        return;
+    }
+    size_t rsp_len = 0;
+    unsigned char *rsp = recvall(g->socket, &rsp_len); // closes the socket
+    g->hop->socket = -1;
+
+    packet *m = rsp_len >= PKT_HEADER_LEN ? packet_decode(rsp, rsp_len) : NULL;
+    free(rsp);
+    if (m == NULL || !packet_is_multi(m) || !(m->flags & PKT_FLAG_ACK)) {
+        LOG_WARN(LOG_KV, "No answer from peer %s:%d for %zu keys!",
+                 g->hop->hostname, g->hop->port, g->count);
+        packet_free(m);
+        return;
+    }
+    size_t offset = 0;
+    for (size_t j = 0; j < g->count; j++) {
+        packet *a = packet_multi_next(m, &offset);
+        if (a == NULL) {
+            break;
+        }
+        answers[g->index[j]] = a;
+    }
+    packet_free(m);
 }
 
 /**
- * @brief Answer a lookup request from a peer.
+ * @brief Handle a multi-key request: serve the keys we are responsible for,
+ * send the others grouped by next hop, one request per peer, to all peers
+ * before waiting for the first answer, and answer with the results of all
+ * keys in their order. Keys whose peer does not answer in time fail.
  *
- * @param p The packet
- * @param n The peer
+ * @param csocket The socket of the client
+ * @param p The multi-key request
  * @return int The callback status
  */
-int answer_lookup(packet *p, peer *n) {
-    peer *questioner = peer_from_packet(p);
+int handle_multi_request(int csocket, packet *p) {
+    uint64_t start = now_us();
+
+    size_t count = 0;
+    size_t cap = 16;
+    packet **reqs = (packet **)malloc(cap * sizeof(packet *));
+    size_t offset = 0;
+    packet *e;
+    while ((e = packet_multi_next(p, &offset)) != NULL) {
+        if (count == cap) {
+            cap *= 2;
+            reqs = (packet **)realloc(reqs, cap * sizeof(packet *));
+        }
+        reqs[count++] = e;
+    }
 
-    // check whether we can connect to the peer
-    if (peer_connect(questioner) != 0) {
-        fprintf(stderr, "Could not connect to questioner of lookup at %s:%d\n!",
-                questioner->hostname, questioner->port);
-        peer_free(questioner);
-        return CB_REMOVE_CLIENT;
+    packet **answers = (packet **)calloc(count + 1, sizeof(packet *));
+    multi_group *groups = (multi_group *)calloc(count + 1, sizeof(multi_group));
+    size_t n_groups = 0;
+    for (size_t i = 0; i < count; i++) {
+        peer *hop = multi_hop(pseudo_hash(reqs[i]->key, reqs[i]->key_len));
+        if (hop == NULL) {
+            answers[i] = serve_multi_entry(reqs[i]);
+            metrics_request(reqs[i]->flags, PATH_LOCAL, now_us() - start);
+            continue;
+        }
+
+        multi_group *g = NULL;
+        for (size_t k = 0; k < n_groups; k++) {
+            if (groups[k].hop->node_id == hop->node_id) {
+                g = &groups[k];
+                break;
+            }
+        }
+        if (g == NULL) {
+            g = &groups[n_groups++];
+            g->hop = hop;
+            g->index = (size_t *)malloc(count * sizeof(size_t));
+            g->socket = -1;
+        } else {
+            peer_free(hop);
+        }
+        g->index[g->count++] = i;
     }
+    LOG_DEBUG(LOG_KV, "Multi-key request: %zu keys, %zu other peers.", count,
+              n_groups);
 
-    // build a new packet for the response
-    packet *rsp = packet_new();
-    rsp->flags = PKT_FLAG_CTRL | PKT_FLAG_RPLY;
-    rsp->hash_id = p->hash_id;
-    rsp->node_id = n->node_id;
-    rsp->node_port = n->port;
-    rsp->node_ip = peer_get_ip(n);
+    // all peers work on their keys while we wait for the first one
+    for (size_t k = 0; k < n_groups; k++) {
+        multi_send(&groups[k], reqs);
+    }
+    for (size_t k = 0; k < n_groups; k++) {
+        multi_collect(&groups[k], answers);
+        for (size_t j = 0; j < groups[k].count; j++) {
+            metrics_request(reqs[groups[k].index[j]]->flags, PATH_PROXIED,
+                            now_us() - start);
+        }
+        free(groups[k].index);
+        peer_free(groups[k].hop);
+    }
+    free(groups);
+
+    for (size_t i = 0; i < count; i++) {
+        if (answers[i] == NULL) {
+            answers[i] = packet_new();
+            answers[i]->flags = reqs[i]->flags & PKT_FLAG_MULTI;
+        }
+    }
+    packet *rsp = packet_multi(answers, count);
+    rsp->flags |= PKT_FLAG_ACK;
+    for (size_t i = 0; i < count; i++) {
+        packet_free(answers[i]);
+        packet_free(reqs[i]);
+    }
+    free(answers);
+    free(reqs);
 
     size_t data_len;
     unsigned char *raw = packet_serialize(rsp, &data_len);
-    free(rsp);
-    sendall(questioner->socket, raw, data_len);
+    packet_free(rsp);
+    sendall(csocket, raw, data_len);
     free(raw);
-    raw = NULL;
-    peer_disconnect(questioner);
-    peer_free(questioner);
+
     return CB_REMOVE_CLIENT;
 }
 
@@ -225,25 +1461,144 @@ int answer_lookup(packet *p, peer *n) {
  * @return int The callback status
  */
 int handle_packet_data(server *srv, client *c, packet *p) {
+    // another peer routes the request towards its key (-r)
+    bool routed = packet_is_routed(p);
+    if (routed) {
+        packet *inner = packet_unroute(p);
+        if (inner == NULL) {
+            return CB_REMOVE_CLIENT;
+        }
+        packet_free(c->pack);
+        c->pack = inner;
+        p = inner;
+    }
+    uint8_t op = p->flags & (PKT_FLAG_GET | PKT_FLAG_SET | PKT_FLAG_DEL);
+
+    if ((p->flags & PKT_FLAG_RING) && op == 0) {
+        // a smart client wants to fill its ring cache
+        return answer_ring_view(c->socket, PKT_FLAG_ACK);
+    } else if ((p->flags & PKT_FLAG_STAT) && op == 0) {
+        return answer_stats(c->socket);
+    } else if (packet_is_multi(p)) {
+        return handle_multi_request(c->socket, p);
+    } else if ((p->flags & (PKT_FLAG_MULTI | PKT_FLAG_ACK)) == PKT_FLAG_INVL) {
+        // the owner revokes our lease on a key that changed
+        if (hot != NULL) {
+            hot_drop(hot, p->key, p->key_len);
+        }
+        // the owner may send more of them on this connection (see outbox.h)
+        return CB_OK;
+    }
+    uint64_t start = now_us();
+    trace_add(p, vnodes[0].self->node_id, TRACE_RECEIVED);
+
     // Hash the key of the <key, value> pair to use for the hash table
     uint16_t hash_id = pseudo_hash(p->key, p->key_len);
-    fprintf(stderr, "Hash id: %d\n", hash_id);
+    LOG_DEBUG(LOG_KV, "Hash id: %d", hash_id);
+
+    // the local ring position preceding the key decides where to go next
+    vnode *v = vnode_closest(vnodes, n_vnodes, hash_id);
+    peer *succ = v != NULL ? v->succ : NULL; // load the published succ once
 
     // Forward the packet to the correct peer
-    if (peer_is_responsible(pred->node_id, self->node_id, hash_id)) {
+    if (vnode_responsible(vnodes, n_vnodes, hash_id) != NULL || v == NULL) {
         // We are responsible for this key
-        fprintf(stderr, "We are responsible.\n");
-        return handle_own_request(srv, c, p);
-    } else if (peer_is_responsible(self->node_id, succ->node_id, hash_id)) {
+        LOG_DEBUG(LOG_KV, "We are responsible.");
+        return request_served(p, PATH_LOCAL, start,
+                              handle_own_request(c->socket, p));
+    } else if (p->flags & PKT_FLAG_DRCT) {
+        // The client routes itself: tell it the key moved and where to look
+        LOG_DEBUG(LOG_KV, "Not ours, sending ring view.");
+        return answer_ring_view(c->socket, op);
+    }
+
+    if (hot != NULL && coalescable(p)) {
+        // a hot key of another peer may be cached here
+        kv_value *value = hot_get(hot, p->key, p->key_len, now_ms());
+        if (value != NULL) {
+            LOG_DEBUG(LOG_KV, "Hot key, answering from the cache.");
+            answer_value(c->socket, p, value, false);
+            kv_value_unref(value);
+            return request_served(p, PATH_LOCAL, start, CB_REMOVE_CLIENT);
+        } else if (hot_touch(hot, p->key, p->key_len)) {
+            ask_for_lease(p);
+        }
+    } else if (hot != NULL && op != PKT_FLAG_GET) {
+        // our copy is outdated once the write passed, whatever the owner says
+        hot_drop(hot, p->key, p->key_len);
+    }
+
+    if (peer_is_responsible(v->self->node_id, succ->node_id, hash_id)) {
         // Our successor is responsible for this key
-        fprintf(stderr, "Successor's business.\n");
-        return proxy_request(srv, c->socket, p, succ);
+        LOG_DEBUG(LOG_KV, "Successor's business.");
+        req_path path = vnode_find(vnodes, n_vnodes, succ->node_id) != NULL
+                            ? PATH_LOCAL
+                            : PATH_PROXIED;
+        return request_served(p, path, start,
+                              serve_request(srv, c->socket, p, succ));
+    }
+
+    // We may have looked up this range recently
+    peer *n = lcache_get(lc, hash_id);
+    if (n != NULL && vnode_find(vnodes, n_vnodes, n->node_id) != NULL) {
+        peer_free(n);
+        return request_served(p, PATH_LOCAL, start,
+                              handle_own_request(c->socket, p));
+    } else if (n != NULL && peer_connect(n) == 0) {
+        LOG_DEBUG(LOG_KV, "Known from an earlier lookup.");
+        int status = proxy_connected(srv, c->socket, p, n, false);
+        peer_disconnect(n);
+        peer_free(n);
+        return request_served(p, PATH_PROXIED, start, status);
     } else {
+        if (n != NULL) {
+            // stale entry, the peer is gone
+            lcache_invalidate_node(lc, n->node_id);
+            peer_free(n);
+        }
+
+        // The request itself travels towards the key, every hop routes it
+        // the same way and the answer comes back along the path
+        if (route_data || routed) {
+            int status;
+            bool sent = route_to(srv, c->socket, p,
+                                 vnode_closest_preceding_finger(v, hash_id),
+                                 &status);
+            if (!sent && routed) {
+                // an envelope is never looked up (see PKT_FLAG_ROUTE): it
+                // goes on to the successor instead, a step closer to the key
+                sent = route_to(srv, c->socket, p, succ, &status);
+            }
+            if (sent && !routed) {
+                // nothing waits for the answer, it fills the lookup cache
+                // for the next requests in this range
+                lookup_peer(v, hash_id, 0);
+            }
+            if (sent) {
+                return request_served(p, PATH_ROUTED, start, status);
+            } else if (routed) {
+                LOG_WARN(LOG_KV, "No peer to route a request on to!");
+                answer_timeout(c->socket, p);
+                return request_served(p, PATH_ROUTED, start, CB_REMOVE_CLIENT);
+            }
+            // the first peer falls back to a lookup
+        }
+
         // We need to find the peer responsible for this key
-        fprintf(stderr, "No idea! Just looking it up!.\n");
-        add_request(rt, hash_id, c->socket, p);
-        lookup_peer(hash_id);
-        return CB_OK;
+        LOG_DEBUG(LOG_KV, "No idea! Just looking it up!.");
+        trace_add(p, vnodes[0].self->node_id, TRACE_PARKED);
+        pthread_mutex_lock(&route_lock);
+        bool pending = get_requests(rt, hash_id) != NULL;
+        add_request(rt, hash_id, srv, c->socket, p);
+        c->pack = NULL; // the request table owns the packet now
+        rstats.parked++;
+        metrics_add(M_PARKED, 1);
+        if (!pending) {
+            // requests parked for the same hash share one lookup
+            send_parked_lookup(v, find_requests(rt, hash_id));
+        }
+        pthread_mutex_unlock(&route_lock);
+        return CB_WAIT;
     }
 }
 
@@ -267,233 +1622,403 @@ packet *build_ctrl_pkt(peer *p, uint8_t flag) {
 }
 
 /**
- * @brief Start building our finger table.
+ * @brief Start building the finger table of a virtual node.
+ *
+ * @param v The virtual node
  */
-void build_finger_table() {
+void build_finger_table(vnode *v) {
 
-    // we already have an existing FT but we will build a new one so that we are up-to-date
-    if (fng_tab != NULL && fng_tab->state == FT_ACTIVE) {
-        free(fng_tab->ft);
-        free(fng_tab);
-    }
+    // initialize finger table (FT_INIT: building the FT begins)
+    finger_table *fng_tab = finger_table_new();
 
-    // initialize finger table
-    fng_tab = calloc(1, sizeof(finger_table));
-    fng_tab->ft = calloc(SIZE_OF_FT, sizeof(peer *));
-    fng_tab->finger_count = 0;
-    fng_tab->state = FT_INIT; // switch to initialization state (building FT begins)
+    // we may already have an existing FT but we build a new one so that we are
+    // up-to-date; readers may still use the old one for a while
+    rcu_retire(atomic_exchange(&v->fng_tab, fng_tab), finger_table_free);
+
+    // a node without succ can only answer for itself
+    if (v->succ == NULL) {
+        return;
+    }
 
     // now we lookup the peers that we want to find
     for (size_t i = 0; i < SIZE_OF_FT; i++) {
-
-        int start = (int)(self->node_id + pow(2, i)) % (int)pow(2, SIZE_OF_FT);
-        lookup_peer(start);
+        lookup_peer(v, finger_start(v->self->node_id, i), 0);
     }
 
     return;
 }
 
 /**
- * @brief Handle a control packet from another peer.
- * Lookup vs. Proxy Reply
+ * @brief Find the virtual node a control message is addressed to.
+ * Senders put the ID of the virtual node they mean into hash_id; if none of
+ * ours carries that ID we fall back to the position the ID suggests.
+ *
+ * @param target The addressed ID (hash_id of the packet)
+ * @param fallback ID used to pick the closest preceding virtual node
+ * @return vnode* The addressed virtual node
+ */
+vnode *addressed_vnode(uint16_t target, uint16_t fallback) {
+    vnode *v = vnode_find(vnodes, n_vnodes, target);
+    if (v == NULL) {
+        v = vnode_closest(vnodes, n_vnodes, fallback);
+    }
+    return v != NULL ? v : &vnodes[0];
+}
+
+/**
+ * @brief Free a retired peer (for rcu_retire).
+ */
+void free_peer(void *p) {
+    peer_free((peer *)p);
+}
+
+/**
+ * @brief Replace a pred or succ of a virtual node. Readers on other threads
+ * may still use the old peer, so it is freed after a grace period. The ring
+ * changed, so the next stabilize rounds run at the fast interval again.
+ *
+ * @param slot The pred or succ of the virtual node
+ * @param p The new peer
+ */
+void publish_peer(_Atomic(peer *) *slot, peer *p) {
+    rcu_retire(atomic_exchange(slot, p), free_peer);
+    stabilizer_changed(stab);
+}
+
+/**
+ * @brief Handle a control packet that changes the ring state (JOIN, STAB,
+ * NTFY, FNGR). Callers hold ring_lock, so writers never race each other;
+ * new pred/succ are published with publish_peer for the lock-free readers.
  *
- * @param srv The server
  * @param c The client
  * @param p The packet
  * @return int The callback status
  */
-int handle_packet_ctrl(server *srv, client *c, packet *p) {
+int handle_ring_ctrl(client *c, packet *p) {
+    /**
+     * TODO:
+     * Extend handled control messages.
+     * For the first task, this means that join-, stabilize-, and notify-messages should be understood.
+     * For the second task, finger- and f-ack-messages need to be used as well.
+     **/
+    if (p->flags & PKT_FLAG_JOIN) {
+        // we recieved a JOIN message
+        LOG_INFO(LOG_RING, "RECIEVED JOIN -> from [port=%u]", p->node_port);
+        lcache_invalidate_range(lc, p->node_id);
+
+        // the virtual node that would become the successor of the joining node
+        vnode *v = vnode_successor_of(vnodes, n_vnodes, p->node_id);
+        unsigned actions = vnode_on_join(v, p->node_id);
+
+        if (actions & RING_SET_PRED) {
+            // we are responsible
+            publish_peer(&v->pred, peer_from_packet(p)); // update pred
+        }
+        if (actions & RING_SET_SUCC) {
+            publish_peer(&v->succ, peer_from_packet(p)); // update succ
+        }
+        if (actions & RING_REPLY) {
+            // reply with notify (that contains our self) to our updated pred
+            packet *reply_pkt = build_ctrl_pkt(v->self, PKT_FLAG_NTFY);
+            reply_pkt->hash_id = p->node_id;
+            sleep(0.2); // let the joinig peer start his server before answering him
+            return forward(v->pred, reply_pkt);
+
+        } else if ((v = vnode_closest(vnodes, n_vnodes, p->node_id)) != NULL) {
+            // somebody else is responsible -> forward join request to succ
+            return forward(v->succ, p);
+        }
 
-    fprintf(stderr, "Handling control packet...\n");
+    } else if (p->flags & PKT_FLAG_STAB) {
+        // we recieved a STABILIZE message (always our own responsibility)
+        stabilizer_received(stab, false);
+        lcache_invalidate_range(lc, p->node_id);
 
-    if (p->flags & PKT_FLAG_LKUP) {
-        // we received a lookup request
+        // the sender takes the addressed virtual node as its succ
+        vnode *v = vnode_find(vnodes, n_vnodes, p->hash_id);
+        if (v == NULL) {
+            v = vnode_successor_of(vnodes, n_vnodes, p->node_id);
+        }
+        unsigned actions = vnode_on_stabilize(v, p->node_id);
 
-        if (fng_tab != NULL && fng_tab->state == FT_ACTIVE) {
-            // use the FT to improve efficiency of lookup
-            if (peer_is_responsible(pred->node_id, self->node_id, p->hash_id)) {
-                // we are responsible
-                return answer_lookup(p, self);
+        if (actions & RING_SET_SUCC) {
+            // we have no succ yet, time to get one...
+            publish_peer(&v->succ, peer_from_packet(p)); // update succ
+        }
+        if (actions & RING_SET_PRED) {
+            // we have no pred yet or the sender is closer
+            publish_peer(&v->pred, peer_from_packet(p)); // update pred
+        }
 
-            } else if (peer_is_responsible(self->node_id, succ->node_id, p->hash_id)) {
-                // our succ is responsible
-                return answer_lookup(p, succ);
+        // reply to every stab message with a notify that contains our pred
+        if (actions & RING_REPLY) {
+            packet *reply_pkt = build_ctrl_pkt(v->pred, PKT_FLAG_NTFY);
+            reply_pkt->hash_id = p->node_id;
 
-            } else {
-                // Great! Somebody else's job! -> forward using FT
+            // also reply directly to the sender of the stab via the sender's socket
+            // (the only purpose to do this is to pass 'test_full_join_student')
+            size_t data_len;
+            unsigned char *raw = packet_serialize(reply_pkt, &data_len);
+            sendall(c->socket, raw, data_len);
+            free(raw);
+            raw = NULL;
 
-                // find the closest pred from p->hash_id
-                int closest_pred_idx = -1;
-                for (size_t i = 0; i < SIZE_OF_FT; i++) {
+            return forward(peer_from_packet(p), reply_pkt);
+        }
 
-                    int current_peer = (int)(self->node_id + pow(2, i)) % (int)pow(2, SIZE_OF_FT);
-                    if (current_peer < p->hash_id) {
-                        closest_pred_idx = i; // found a closer pred
-                    }
-                }
+    } else if (p->flags & PKT_FLAG_NTFY) {
+        // we recieved a NOTIFY message (always our own responsibility)
+        stabilizer_received(stab, true);
+        lcache_invalidate_range(lc, p->node_id);
 
-                if (closest_pred_idx != -1) {
-                    // forward to closest pred
-                    forward(fng_tab->ft[closest_pred_idx], p);
-                } else {
-                    fprintf(stderr, "Something went wrong in the FT!\n");
-                }
-            }
+        vnode *v = addressed_vnode(p->hash_id, p->node_id);
+        if (vnode_on_notify(v, p->node_id) & RING_SET_SUCC) {
+            // we have no succ yet or the named node is closer
+            publish_peer(&v->succ, peer_from_packet(p)); // update succ
+        }
 
-        } else {
-            // use naive forwarding (FT is not build yet)
-            if (peer_is_responsible(pred->node_id, self->node_id, p->hash_id)) {
-                // we are responsible
-                return answer_lookup(p, self);
+    } else if (p->flags & PKT_FLAG_FNGR) {
+        // we recieved a request to build our finger table (always our own responsibility)
+        LOG_INFO(LOG_RING, "<<<<< FNGR >>>>>");
 
-            } else if (peer_is_responsible(self->node_id, succ->node_id, p->hash_id)) {
-                // our succ is responsible
-                return answer_lookup(p, succ);
+        // create finger-acknowledgment packet
+        packet *fack_pkt = packet_new();
+        fack_pkt->flags = PKT_FLAG_CTRL | PKT_FLAG_FACK;
 
-            } else {
-                // Great! Somebody else's job! -> forward to succ
-                forward(succ, p);
-            }
+        // reply with finger-acknowledgment packet to client
+        size_t data_len;
+        unsigned char *raw = packet_serialize(fack_pkt, &data_len);
+        int status = sendall(c->socket, raw, data_len);
+        free(raw);
+        raw = NULL;
+
+        // start building our finger tables (do this after the fack_pkt got send, otherwise test will fail)
+        for (size_t i = 0; i < n_vnodes; i++) {
+            build_finger_table(&vnodes[i]);
         }
 
-    } else if (p->flags & PKT_FLAG_RPLY) {
-        // Look for open requests and proxy them
-        peer *n = peer_from_packet(p);
+        return status;
+    }
+    return CB_REMOVE_CLIENT;
+}
 
-        // filling the FT still in progress...
-        if (fng_tab != NULL && fng_tab->state == FT_INIT && fng_tab->finger_count < SIZE_OF_FT) {
+/**
+ * @brief Handle a lookup request: answer it if we or our successor are
+ * responsible, pass it on otherwise (or for an iterative lookup, tell the
+ * questioner where to ask next).
+ *
+ * @param p The packet
+ * @return int The callback status
+ */
+int handle_lookup(packet *p) {
+    route r = vnode_route(vnodes, n_vnodes, p->hash_id, p->flags & PKT_FLAG_ITER);
+    switch (r.kind) {
+    case ROUTE_SELF:
+    case ROUTE_SUCC:
+        // we or our succ are responsible
+        return answer_lookup(p, r.next, 0);
+    case ROUTE_REFER:
+        // the questioner drives the lookup itself
+        return answer_lookup(p, r.next, PKT_FLAG_ITER);
+    case ROUTE_FORWARD:
+        // Great! Somebody else's job! -> forward using FT
+        metrics_add(M_LOOKUPS_FORWARDED, 1);
+        packet_set_hops(p, packet_hops(p) + 1);
+        outbox_add(ob, r.next, p);
+        break;
+    case ROUTE_NONE:
+        LOG_WARN(LOG_LOOKUP, "No successor known to forward lookup!");
+        break;
+    }
+    return CB_REMOVE_CLIENT;
+}
 
-            peer *ft_peer = peer_from_packet(p); // the peer we where looking for
+/**
+ * @brief Handle the answer to a lookup: fill the finger table and serve the
+ * requests parked for the hash (on the reactors their clients are connected
+ * to). The requests are taken out of the table first and served without
+ * holding route_lock, every one may take a round trip to the owner.
+ *
+ * @param p The packet
+ * @return int The callback status
+ */
+int handle_reply(packet *p) {
+    // Look for open requests and proxy them
+    peer *n = peer_from_packet(p);
+    if (lookup_alpha > 0) {
+        pthread_mutex_lock(&route_lock);
+        ring_node learned = {n->node_id, p->node_ip, p->node_port};
+        ring_cache_merge(known, &learned, 1);
+        pthread_mutex_unlock(&route_lock);
+    }
 
-            // make sure we find the correct position for the entry
-            int start = p->hash_id;
-            for (size_t i = 0; i < SIZE_OF_FT; i++) {
+    // filling the FT (of any of our virtual nodes) still in progress...
+    pthread_mutex_lock(&ring_lock);
+    for (size_t k = 0; k < n_vnodes; k++) {
+        vnode_add_finger(&vnodes[k], p->hash_id, n);
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    pthread_mutex_lock(&route_lock);
+    bool parked = find_requests(rt, p->hash_id) != NULL;
+    pthread_mutex_unlock(&route_lock);
+    bool local = vnode_find(vnodes, n_vnodes, n->node_id) != NULL;
+    bool probed = parked && !local;
+    if (probed && peer_connect(n) != 0) {
+        // the answer names a peer that is gone: keep the requests parked,
+        // the deadline of the lookup starts the next attempt
+        LOG_WARN(LOG_LOOKUP, "Looked up peer %s:%d is unreachable!",
+                 n->hostname, n->port);
+        lcache_invalidate_node(lc, n->node_id);
+        peer_free(n);
+        return CB_REMOVE_CLIENT;
+    }
 
-                int start_tmp = (int)(self->node_id + pow(2, i)) % (int)pow(2, SIZE_OF_FT);
-                if (start == start_tmp && fng_tab->ft[i] == NULL) {
-                    // we found the correct position
-                    fng_tab->ft[i] = ft_peer; // add FT entry
-                    fng_tab->finger_count++; // one more FT entry filled succesfully
-                    break;
-                }
-            }
+    pthread_mutex_lock(&route_lock);
+    rtable *entry = find_requests(rt, p->hash_id);
+    // a referral is an answer, the RPLY counts no forwards then
+    int hops = entry != NULL ? entry->referrals + packet_hops(p) + 1 : 0;
+    request *requests = detach_requests(rt, p->hash_id);
+    uint64_t now = now_ms();
+    size_t count = 0;
+    for (request *r = requests; r != NULL; r = r->next) {
+        request_stats_record(&rstats, r, now);
+        rstats.resolved++;
+        count++;
+    }
+    pthread_mutex_unlock(&route_lock);
+    if (hops > 0) {
+        metrics_record(H_LOOKUP_HOPS, hops);
+    }
 
-            // filling the FT completed
-            if (fng_tab->finger_count == SIZE_OF_FT) {
-                fng_tab->state = FT_ACTIVE;   
-            }
+    // parked GETs for the same key share one fetch: the first one leads,
+    // the others wait for its answer
+    bool *waiting = (bool *)calloc(count + 1, sizeof(bool));
+    size_t i = 0;
+    for (request *r = requests; r != NULL; r = r->next) {
+        if (!local && coalescable(r->packet)) {
+            waiting[i] = !flight_join(flights, r->packet->key,
+                                      r->packet->key_len, r->srv, r->socket);
+            metrics_add(M_GETS_COALESCED, waiting[i]);
         }
+        i++;
+    }
 
-        for (request *r = get_requests(rt, p->hash_id); r != NULL;
-             r = r->next) {
-            proxy_request(srv, r->socket, r->packet, n);
-            server_close_socket(srv, r->socket);
+    i = 0;
+    for (request *r = requests; r != NULL; r = r->next) {
+        trace_add(r->packet, n->node_id, TRACE_LOOKED_UP);
+        int status = CB_OK;
+        if (waiting[i++]) {
+            // answered and closed by the request leading the fetch
+        } else if (probed && r == requests) {
+            // reachability was checked with it
+            status = proxy_connected(r->srv, r->socket, r->packet, n, false);
+        } else {
+            status = serve_request(r->srv, r->socket, r->packet, n);
         }
-        clear_requests(rt, p->hash_id);
-    } else {
-        /**
-         * TODO:
-         * Extend handled control messages.
-         * For the first task, this means that join-, stabilize-, and notify-messages should be understood.
-         * For the second task, finger- and f-ack-messages need to be used as well.
-         **/
-        if (p->flags & PKT_FLAG_JOIN) {
-            // we recieved a JOIN message
-            printf("RECIEVED JOIN -> from [port=%u]\n", p->node_port);
-
-            if (pred == NULL) {
-                // we are responsible
-                pred = peer_from_packet(p); // update pred
-                if (succ == NULL) {
-                    succ = peer_from_packet(p); // update succ
-                    srv->p_succ = succ; // also update in server struct!
-                }
-                // reply with notify (that contains our self) to our updated pred
-                packet *reply_pkt = build_ctrl_pkt(self, PKT_FLAG_NTFY);
-                sleep(0.2); // let the joinig peer start his server before answering him
-                return forward(pred, reply_pkt);
-
-            } else if (pred != NULL && peer_is_responsible(pred->node_id, self->node_id, p->node_id)) {
-                // we are responsible
-                pred = peer_from_packet(p); // update pred
-                // reply with notify (that contains our self) to our updated pred
-                packet *reply_pkt = build_ctrl_pkt(self, PKT_FLAG_NTFY);
-                sleep(0.2); // let the joinig peer start his server before answering him
-                return forward(pred, reply_pkt);
-
-            } else if (succ != NULL) {
-                // somebody else is responsible -> forward join request to succ
-                return forward(succ, p);
-            }
-
-        } else if (p->flags & PKT_FLAG_STAB) {
-            // we recieved a STABILIZE message (always our own responsibility)
-            printf("RECIEVED STABILIZE (always our own responsibility!)\n");
-
-            if (succ == NULL) {
-                // we have no succ yet, time to get one...
-                succ = peer_from_packet(p); // update succ
-                srv->p_succ = succ; // also update in server struct!
-
-            } else if (pred == NULL) {
-                // we have no pred yet, time to get one...
-                pred = peer_from_packet(p); // update pred
-
-            } else if (peer_is_responsible(pred->node_id, self->node_id, p->node_id)) {
-                // we have to update our pred
-                pred = peer_from_packet(p); // update pred
-            }
-
-            // reply to every stab message with a notify that contains our pred
-            if (pred != NULL) {
-                packet *reply_pkt = build_ctrl_pkt(pred, PKT_FLAG_NTFY);
+        if (status == CB_REMOVE_CLIENT) {
+            server_close_socket(r->srv, r->socket);
+        }
+        metrics_request(r->packet->flags, PATH_LOOKED_UP,
+                        now_us() - r->parked_us);
+    }
+    free(waiting);
+    if (requests != NULL) {
+        pthread_mutex_lock(&route_lock);
+        free_requests(requests);
+        pthread_mutex_unlock(&route_lock);
+    }
+    if (probed) {
+        peer_disconnect(n);
+    }
 
-                // also reply directly to the sender of the stab via the sender's socket
-                // (the only purpose to do this is to pass 'test_full_join_student')
-                size_t data_len;
-                unsigned char *raw = packet_serialize(reply_pkt, &data_len);
-                sendall(c->socket, raw, data_len);
-                free(raw);
-                raw = NULL;
+    // remember the answer for the next request in this range
+    lcache_put(lc, p->hash_id, n);
+    return CB_REMOVE_CLIENT;
+}
 
-                return forward(peer_from_packet(p), reply_pkt);
-            }
+/**
+ * @brief Handle a referral for an iterative lookup: ask the named node next,
+ * unless another probe already led closer to the hash.
+ *
+ * @param p The packet
+ * @return int The callback status
+ */
+int handle_referral(packet *p) {
+    peer *n = peer_from_packet(p);
+    uint16_t dist = p->hash_id - n->node_id;
+
+    pthread_mutex_lock(&route_lock);
+    ring_node learned = {n->node_id, p->node_ip, p->node_port};
+    ring_cache_merge(known, &learned, 1);
+
+    rtable *entry = find_requests(rt, p->hash_id);
+    vnode *v = vnode_closest(vnodes, n_vnodes, p->hash_id);
+    if (entry != NULL && v != NULL && dist < entry->progress) {
+        LOG_DEBUG(LOG_LOOKUP, "Referred to %d for %d.", n->node_id,
+                  p->hash_id);
+        entry->progress = dist;
+        entry->referrals++;
+        for (request *r = entry->open_requests; r != NULL; r = r->next) {
+            trace_add(r->packet, n->node_id, TRACE_REFERRAL);
+        }
+        entry->next_hop = learned;
+        send_lookup(v, n, p->hash_id, PKT_FLAG_ITER);
+        arm_step(entry);
+    }
+    pthread_mutex_unlock(&route_lock);
 
-        } else if (p->flags & PKT_FLAG_NTFY) {
-            // we recieved a NOTIFY message (always our own responsibility)
-            printf("RECIEVED NOTIFY (always our own responsibility!)\n");
+    peer_free(n);
+    return CB_REMOVE_CLIENT;
+}
 
-            if (succ == NULL) {
-                // we have no succ yet, time to get one...
-                succ = peer_from_packet(p); // update succ
-                srv->p_succ = succ; // also update in server struct!
+/**
+ * @brief Handle a lookup, reply or referral (alone or out of a batch).
+ *
+ * @param p The packet
+ * @return int The callback status
+ */
+int handle_route_ctrl(packet *p) {
+    if (p->flags & PKT_FLAG_LKUP) {
+        // we received a lookup request
+        return handle_lookup(p);
+    } else if (p->flags & PKT_FLAG_ITER) {
+        return handle_referral(p);
+    }
+    return handle_reply(p);
+}
 
-            } else if (peer_is_responsible(self->node_id, succ->node_id, p->node_id)) {
-                // we have to update our succ
-                succ = peer_from_packet(p); // update succ
-                srv->p_succ = succ; // also update in server struct!
+/**
+ * @brief Handle a control packet from another peer.
+ * Lookup vs. Proxy Reply
+ *
+ * @param c The client
+ * @param p The packet
+ * @return int The callback status
+ */
+int handle_packet_ctrl(client *c, packet *p) {
+
+    LOG_TRACE(LOG_NET, "Handling control packet...");
+
+    if (packet_is_batch(p)) {
+        // several lookups and replies from one peer
+        size_t count = packet_batch_count(p);
+        LOG_DEBUG(LOG_LOOKUP, "Batch of %zu control messages.", count);
+        for (size_t i = 0; i < count; i++) {
+            packet *msg = packet_batch_entry(p, i);
+            if (msg->flags & (PKT_FLAG_LKUP | PKT_FLAG_RPLY)) {
+                handle_route_ctrl(msg);
             }
-
-        } else if (p->flags & PKT_FLAG_FNGR) {
-            // we recieved a request to build our finger table (always our own responsibility)
-            printf("<<<<< FNGR >>>>>\n");
-
-            // create finger-acknowledgment packet
-            packet *fack_pkt = packet_new();
-            fack_pkt->flags = PKT_FLAG_CTRL | PKT_FLAG_FACK;
-
-            // reply with finger-acknowledgment packet to client
-            size_t data_len;
-            unsigned char *raw = packet_serialize(fack_pkt, &data_len);
-            int status = sendall(c->socket, raw, data_len);
-            free(raw);
-            raw = NULL;
-
-            // start building our finger table (do this after the fack_pkt got send, otherwise test will fail)
-            build_finger_table();
-
-            return status;
+            packet_free(msg);
         }
+    } else if (p->flags & (PKT_FLAG_LKUP | PKT_FLAG_RPLY)) {
+        return handle_route_ctrl(p);
+    } else {
+        // JOIN, STAB, NTFY and FNGR change the ring state
+        pthread_mutex_lock(&ring_lock);
+        int status = handle_ring_ctrl(c, p);
+        pthread_mutex_unlock(&ring_lock);
+        return status;
     }
     return CB_REMOVE_CLIENT;
 }
@@ -510,7 +2035,7 @@ int handle_packet_ctrl(server *srv, client *c, packet *p) {
  */
 int handle_packet(server *srv, client *c, packet *p) {
     if (p->flags & PKT_FLAG_CTRL) {
-        return handle_packet_ctrl(srv, c, p);
+        return handle_packet_ctrl(c, p);
     } else {
         return handle_packet_data(srv, c, p);
     }
@@ -525,6 +2050,21 @@ int handle_packet(server *srv, client *c, packet *p) {
  * 2. Own ID (optional, zero if not passed);
  * 3. IP and port of Node in existing DHT. This is optional: If not passed, establish new DHT, otherwise join existing.
  *
+ * The option '-v vnodes' lets the peer host several virtual nodes. The first
+ * one keeps the given ID, the others are derived from it. The option
+ * '-t threads' runs that many reactors, each with its own listening socket.
+ * The option '-u' runs the reactors on io_uring instead of poll. With
+ * '-i alpha' the peer looks up parked requests iteratively, with alpha
+ * parallel probes, instead of letting the lookup be forwarded hop by hop.
+ * '-l subsystems' limits the log to e.g. 'ring,lookup' (see log.h) and '-a'
+ * writes it from a background thread. With '-r' requests for keys of unknown
+ * owners are passed to the closest preceding finger right away instead of
+ * being parked for a lookup. '-c lease_ms' caches the values of hot keys of
+ * other peers for up to lease_ms (see hot_cache.h). '-z codec[:min_bytes]'
+ * stores values from min_bytes (default ZIP_MIN_LEN) on compressed with lz4,
+ * zstd or zlib (as far as the build has them) and sends them compressed to
+ * other peers.
+ *
  * @param argc The number of arguments
  * @param argv The arguments
  * @return int The exit code
@@ -540,9 +2080,71 @@ int main(int argc, char **argv) {
     char *ipEntry = NULL;
     char *portEntry = NULL;
 
-    // entry node and join message
+    // entry node
     peer *entry_peer = NULL;
-    packet *join_pkt = NULL;
+
+    int opt;
+    server_backend backend = BACKEND_POLL;
+    bool log_async = false;
+    while ((opt = getopt(argc, argv, "v:t:ui:l:arc:z:")) != -1) {
+        if (opt == 'v') {
+            n_vnodes = strtoul(optarg, NULL, 10);
+        } else if (opt == 't') {
+            n_shards = strtoul(optarg, NULL, 10);
+        } else if (opt == 'u') {
+            backend = BACKEND_IO_URING;
+        } else if (opt == 'i') {
+            lookup_alpha = strtol(optarg, NULL, 10);
+        } else if (opt == 'l') {
+            if (log_enable(optarg) != 0) {
+                return -1;
+            }
+        } else if (opt == 'a') {
+            log_async = true;
+        } else if (opt == 'r') {
+            route_data = true;
+        } else if (opt == 'c') {
+            uint64_t lease_ms = strtoull(optarg, NULL, 10);
+            if (lease_ms == 0 || lease_ms > HOT_LEASE_MAX_MS) {
+                fprintf(stderr, "The lease must be in [1, %d] ms!\n",
+                        HOT_LEASE_MAX_MS);
+                return -1;
+            }
+            hot = hot_cache_new(lease_ms);
+        } else if (opt == 'z') {
+            char *min_len = strchr(optarg, ':');
+            if (min_len != NULL) {
+                *min_len++ = '\0';
+                zip_min_len = strtoul(min_len, NULL, 10);
+            }
+            zip_codec = codec_parse(optarg);
+            if (!codec_available(zip_codec)) {
+                fprintf(stderr, "Codec %s is not available in this build!\n",
+                        optarg);
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "Usage: './peer [-v vnodes] [-t threads] [-u] [-i alpha] [-l subsystems] [-a] [-r] [-c lease_ms] [-z codec[:min_bytes]] ipSelf portSelf [idSelf] [ipEntry portEntry]'\n");
+            return -1;
+        }
+    }
+    if (lookup_alpha < 0 || lookup_alpha > SIZE_OF_FT) {
+        fprintf(stderr, "The number of parallel probes must be in [0, %d]!\n",
+                SIZE_OF_FT);
+        return -1;
+    }
+    if (n_shards < 1 || n_shards >= RCU_MAX_THREADS) {
+        fprintf(stderr, "The number of threads must be in [1, %d)!\n",
+                RCU_MAX_THREADS);
+        return -1;
+    }
+    if (log_async && log_async_start(LOG_ASYNC_LINES) != 0) {
+        fprintf(stderr, "Could not start the asynchronous logger!\n");
+        return -1;
+    }
+    // drop the options so that the positional arguments keep their indices
+    argc -= optind - 1;
+    argv += optind - 1;
 
     if (argc == 6) {
         // case 1: join DHT via entry node (set idSelf to argument ID)
@@ -555,12 +2157,8 @@ int main(int argc, char **argv) {
         ipEntry = argv[4];
         portEntry = argv[5];
 
-        self = peer_init(idSelf, ipSelf, portSelf);
-
         // construct entry node (ID doesn't matter for our use -> default=0)
         entry_peer = peer_init(0, ipEntry, portEntry);
-        // construct join message
-        join_pkt = build_ctrl_pkt(self, PKT_FLAG_JOIN);
 
     } else if (argc == 5) {
         // case 2: join DHT via entry node (set idSelf to default ID)
@@ -573,12 +2171,8 @@ int main(int argc, char **argv) {
         ipEntry = argv[3];
         portEntry = argv[4];
 
-        self = peer_init(idSelf, ipSelf, portSelf);
-
         // construct entry node (ID doesn't matter for our use -> default=0)
         entry_peer = peer_init(0, ipEntry, portEntry);
-        // construct join message
-        join_pkt = build_ctrl_pkt(self, PKT_FLAG_JOIN);
 
     } else if (argc == 4) {
         // case 3: first node in new DHT (set idSelf to argument ID)
@@ -588,8 +2182,6 @@ int main(int argc, char **argv) {
         portSelf = argv[2];
         idSelf = strtoul(argv[3], NULL, 10);
 
-        self = peer_init(idSelf, ipSelf, portSelf);
-
     } else if (argc == 3) {
         // case 4: first node in new DHT (set idSelf to default ID)
         printf("case 4: first node in NEW DHT (default ID)\n");
@@ -598,39 +2190,95 @@ int main(int argc, char **argv) {
         portSelf = argv[2];
         idSelf = 0;
 
-        self = peer_init(idSelf, ipSelf, portSelf);
-
     } else {
-        fprintf(stderr, "Wrong amount of args! Usage: './peer ipSelf portSelf [idSelf] [ipEntry portEntry]'\n");
+        fprintf(stderr, "Wrong amount of args! Usage: './peer [-v vnodes] [-t threads] [-u] [-i alpha] [-l subsystems] [-a] [-r] [-c lease_ms] [-z codec[:min_bytes]] ipSelf portSelf [idSelf] [ipEntry portEntry]'\n");
+        return -1;
     }
 
-    // Initialize outer server for communication with clients
-    srv = server_setup(portSelf);
-    if (srv == NULL) {
-        fprintf(stderr, "Server setup failed!\n");
+    vnodes = vnodes_init(idSelf, n_vnodes, ipSelf, portSelf);
+    if (vnodes == NULL) {
         return -1;
     }
-    // Initialize hash table
-    ht = (htable **)malloc(sizeof(htable *));
+    if (entry_peer == NULL) {
+        // our virtual nodes form the new DHT on their own
+        vnodes_link_local(vnodes, n_vnodes);
+    }
+
+    // Initialize outer servers for communication with clients
+    shards = (server **)calloc(n_shards, sizeof(server *));
+    for (size_t i = 0; i < n_shards; i++) {
+        shards[i] = server_setup(portSelf, n_shards > 1);
+        if (shards[i] == NULL) {
+            fprintf(stderr, "Server setup failed!\n");
+            return -1;
+        }
+    }
+    // Initialize key-value store
+    kv = kv_new(KV_SHARDS);
     // Initiale reuqest table
     rt = (rtable **)malloc(sizeof(rtable *));
-    *ht = NULL;
     *rt = NULL;
+    // Initialize lookup cache
+    lc = lcache_new();
+    // Initialize deadlines of parked requests
+    tw = timer_wheel_new(SERVER_TICK_MS, now_ms());
+    // Initialize the table of GETs in flight
+    flights = flight_table_new();
+    // Initialize the leases on our keys (granted whether caching or not)
+    leases = lease_table_new();
+    // Initialize outbound control messages
+    ob = outbox_new();
+    // Initialize the nodes learned by iterative lookups
+    known = ring_cache_new();
+    // Start counting (rates are per uptime), dump the metrics on SIGUSR1
+    metrics_init();
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stats_dump;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    // Initialize the stabilization schedule
+    stab = stabilizer_new(STABILIZE_MIN_MS, STABILIZE_MAX_MS);
 
     // start listening (because server is not running yet)
-    listen(srv->socket, 10);
+    for (size_t i = 0; i < n_shards; i++) {
+        listen(shards[i]->socket, 10);
+    }
+
+    // forward one join message per virtual node to entry node
+    if (entry_peer != NULL) {
+        for (size_t i = 0; i < n_vnodes; i++) {
+            packet *join_pkt = build_ctrl_pkt(vnodes[i].self, PKT_FLAG_JOIN);
+            forward(entry_peer, join_pkt);
+            printf("JOIN MESSAGE SEND to -> [port=%u]\n", entry_peer->port);
+        }
+    }
+
+    for (size_t i = 0; i < n_shards; i++) {
+        // store our virtual nodes in srv to send stabilize messages when server runs
+        shards[i]->vnodes = vnodes;
+        shards[i]->n_vnodes = n_vnodes;
+        shards[i]->stab = stab;
 
-    // forward join message to entry node
-    if (entry_peer != NULL && join_pkt != NULL) {
-        forward(entry_peer, join_pkt);
-        printf("JOIN MESSAGE SEND to -> [port=%u]\n", entry_peer->port);
+        shards[i]->backend = backend;
+        shards[i]->packet_cb = handle_packet;
+        shards[i]->tick_cb = handle_tick;
+    }
+    server_run_shards(shards, n_shards);
+    for (size_t i = 0; i < n_shards; i++) {
+        close(shards[i]->socket);
     }
 
-    // store self and succ in srv to send stabilize messages when server runs
-    srv->p_self = self;
-    srv->p_succ = succ;
+    size_t dropped = log_async_stop();
+    if (dropped > 0) {
+        fprintf(stderr, "%zu log messages dropped.\n", dropped);
+    }
 
-    srv->packet_cb = handle_packet;
-    server_run(srv);
-    close(srv->socket);
+    lcache_print_stats(lc, stderr);
+    outbox_print_stats(ob, stderr);
+    flight_print_stats(flights, stderr);
+    stabilizer_print_stats(stab, stderr);
+    stats_dump(stderr);
+    request_stats_print(&rstats, rt, now_ms(), stderr);
 }
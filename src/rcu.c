@@ -0,0 +1,115 @@
+#include "rcu.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RCU_OFFLINE 0 // epochs start at 1
+
+typedef struct _rcu_retired {
+    void *ptr;
+    void (*free_fn)(void *);
+    uint64_t epoch; // global epoch when the object was retired
+    struct _rcu_retired *next;
+} rcu_retired;
+
+static _Atomic uint64_t rcu_epoch = 1;
+
+// the last epoch every thread observed at a quiescent state
+static _Atomic uint64_t rcu_seen[RCU_MAX_THREADS];
+static atomic_bool rcu_used[RCU_MAX_THREADS];
+
+static pthread_mutex_t rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+static rcu_retired *rcu_list = NULL;
+static atomic_size_t rcu_pending = 0;
+
+static _Thread_local int rcu_slot = -1;
+
+/**
+ * @brief Claim a slot for the calling thread.
+ */
+static void rcu_register(void) {
+    for (int i = 0; i < RCU_MAX_THREADS; i++) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&rcu_used[i], &expected, true)) {
+            rcu_slot = i;
+            return;
+        }
+    }
+    fprintf(stderr, "Error! More than %d threads read the ring state!\n",
+            RCU_MAX_THREADS);
+    abort();
+}
+
+/**
+ * @brief Free all retired objects no online thread can still reference.
+ */
+static void rcu_reclaim(void) {
+    if (pthread_mutex_trylock(&rcu_lock) != 0) {
+        return; // somebody else is reclaiming already
+    }
+
+    uint64_t min = UINT64_MAX;
+    for (int i = 0; i < RCU_MAX_THREADS; i++) {
+        uint64_t seen = atomic_load(&rcu_seen[i]);
+        if (seen != RCU_OFFLINE && seen < min) {
+            min = seen;
+        }
+    }
+
+    rcu_retired **prev = &rcu_list;
+    while (*prev != NULL) {
+        rcu_retired *r = *prev;
+        if (r->epoch < min) {
+            *prev = r->next;
+            r->free_fn(r->ptr);
+            free(r);
+            atomic_fetch_sub(&rcu_pending, 1);
+        } else {
+            prev = &r->next;
+        }
+    }
+    pthread_mutex_unlock(&rcu_lock);
+}
+
+void rcu_thread_online(void) {
+    if (rcu_slot < 0) {
+        rcu_register();
+    }
+    atomic_store(&rcu_seen[rcu_slot], atomic_load(&rcu_epoch));
+}
+
+void rcu_thread_offline(void) {
+    if (rcu_slot >= 0) {
+        atomic_store(&rcu_seen[rcu_slot], RCU_OFFLINE);
+    }
+    if (atomic_load(&rcu_pending) > 0) {
+        rcu_reclaim();
+    }
+}
+
+void rcu_quiescent(void) {
+    rcu_thread_online();
+    if (atomic_load(&rcu_pending) > 0) {
+        rcu_reclaim();
+    }
+}
+
+void rcu_retire(void *ptr, void (*free_fn)(void *)) {
+    if (ptr == NULL) {
+        return;
+    }
+    rcu_retired *r = (rcu_retired *)malloc(sizeof(rcu_retired));
+    r->ptr = ptr;
+    r->free_fn = free_fn;
+
+    pthread_mutex_lock(&rcu_lock);
+    // readers that see a later epoch started after ptr was unpublished
+    r->epoch = atomic_fetch_add(&rcu_epoch, 1);
+    r->next = rcu_list;
+    rcu_list = r;
+    atomic_fetch_add(&rcu_pending, 1);
+    pthread_mutex_unlock(&rcu_lock);
+}
@@ -1,32 +1,63 @@
 #include "requests.h"
 
-void add_request(rtable **table, uint16_t hash_id, int socket,
-                 const packet *packet) {
-    request *r = (request *)malloc(sizeof(request));
-    r->packet = packet_dup(packet);
+// request nodes are recycled through a free list instead of malloc/free
+static request *request_pool = NULL;
+
+static request *request_alloc() {
+    if (request_pool == NULL) {
+        request *slab = (request *)malloc(REQUEST_POOL_SLAB * sizeof(request));
+        for (size_t i = 0; i < REQUEST_POOL_SLAB; i++) {
+            slab[i].next = request_pool;
+            request_pool = &slab[i];
+        }
+    }
+    request *r = request_pool;
+    request_pool = r->next;
+    return r;
+}
+
+static void request_release(request *r) {
+    r->next = request_pool;
+    request_pool = r;
+}
+
+void add_request(rtable **table, uint16_t hash_id, server *srv, int socket,
+                 packet *packet) {
+    request *r = request_alloc();
+    r->packet = packet;
+    r->srv = srv;
     r->socket = socket;
+    r->parked_at = now_ms();
+    r->parked_us = now_us();
+    r->next = NULL;
 
     rtable *existing;
     HASH_FIND(hh, *table, &hash_id, sizeof(uint16_t), existing);
     if (existing != NULL) {
-        request *re;
-        for (re = existing->open_requests; re->next != NULL; re = re->next) {
-            // Just loop-di-loop;
-        }
-        re->next = r;
-        r->next = NULL;
+        existing->last_request->next = r;
+        existing->last_request = r;
     } else {
         rtable *entry = (rtable *)malloc(sizeof(rtable));
         entry->hash_id = hash_id;
         entry->open_requests = r;
-        r->next = NULL;
+        entry->last_request = r;
+        entry->attempts = 0;
+        entry->progress = UINT16_MAX;
+        entry->referrals = 0;
+        entry->step = NULL;
+        entry->timer = NULL;
         HASH_ADD(hh, *table, hash_id, sizeof(uint16_t), entry);
     }
 }
 
-request *get_requests(rtable **table, uint16_t hash_id) {
+rtable *find_requests(rtable **table, uint16_t hash_id) {
     rtable *existing;
     HASH_FIND(hh, *table, &hash_id, sizeof(uint16_t), existing);
+    return existing;
+}
+
+request *get_requests(rtable **table, uint16_t hash_id) {
+    rtable *existing = find_requests(table, hash_id);
     if (existing != NULL) {
         return existing->open_requests;
     }
@@ -34,18 +65,61 @@ request *get_requests(rtable **table, uint16_t hash_id) {
 }
 
 void clear_requests(rtable **table, uint16_t hash_id) {
+    free_requests(detach_requests(table, hash_id));
+}
+
+request *detach_requests(rtable **table, uint16_t hash_id) {
     rtable *existing;
     HASH_FIND(hh, *table, &hash_id, sizeof(uint16_t), existing);
+    if (existing == NULL) {
+        return NULL;
+    }
 
-    if (existing != NULL) {
-        request *re = existing->open_requests;
+    request *requests = existing->open_requests;
+    timer_cancel(existing->timer);
+    timer_cancel(existing->step);
+    HASH_DEL(*table, existing);
+    free(existing);
+    return requests;
+}
+
+void free_requests(request *requests) {
+    while (requests != NULL) {
+        request *next = requests->next;
+        packet_free(requests->packet);
+        request_release(requests);
+        requests = next;
+    }
+}
+
+void request_stats_record(request_stats *rs, const request *r, uint64_t now) {
+    uint64_t age = now - r->parked_at;
+    rs->total_age_ms += age;
+    if (age > rs->max_age_ms) {
+        rs->max_age_ms = age;
+    }
+}
 
-        while (re != NULL) {
-            request *next = re->next;
-            free(re->packet);
-            free(re);
-            re = next;
+void request_stats_print(const request_stats *rs, rtable **table, uint64_t now,
+                         FILE *out) {
+    size_t waiting = 0;
+    uint64_t oldest = 0;
+    for (rtable *e = *table; e != NULL; e = e->hh.next) {
+        for (request *r = e->open_requests; r != NULL; r = r->next) {
+            waiting++;
+            if (now - r->parked_at > oldest) {
+                oldest = now - r->parked_at;
+            }
         }
-        HASH_DEL(*table, existing);
     }
+
+    size_t done = rs->resolved + rs->timeouts;
+    fprintf(out,
+            "Parked requests: %zu waiting (oldest %llu ms), %zu parked, %zu "
+            "resolved, %zu timed out, %zu lookup retries, age mean %llu ms "
+            "max %llu ms\n",
+            waiting, (unsigned long long)oldest, rs->parked, rs->resolved,
+            rs->timeouts, rs->retries,
+            (unsigned long long)(done > 0 ? rs->total_age_ms / done : 0),
+            (unsigned long long)rs->max_age_ms);
 }
@@ -0,0 +1,286 @@
+#include "ring_cache.h"
+
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "util.h"
+
+unsigned char *ring_view_serialize(const ring_node *nodes, size_t count,
+                                   size_t *buf_len) {
+    unsigned char *buffer = (unsigned char *)malloc(count * RING_NODE_LEN);
+
+    for (size_t i = 0; i < count; i++) {
+        unsigned char *b = buffer + i * RING_NODE_LEN;
+        b[0] = (uint8_t)(nodes[i].node_id >> 8u) & 0xFFu;
+        b[1] = (uint8_t)(nodes[i].node_id >> 0u) & 0xFFu;
+
+        b[2] = (uint8_t)(nodes[i].ip >> 24u) & 0xFFu;
+        b[3] = (uint8_t)(nodes[i].ip >> 16u) & 0xFFu;
+        b[4] = (uint8_t)(nodes[i].ip >> 8u) & 0xFFu;
+        b[5] = (uint8_t)(nodes[i].ip >> 0u) & 0xFFu;
+
+        b[6] = (uint8_t)(nodes[i].port >> 8u) & 0xFFu;
+        b[7] = (uint8_t)(nodes[i].port >> 0u) & 0xFFu;
+    }
+
+    *buf_len = count * RING_NODE_LEN;
+    return buffer;
+}
+
+ring_node *ring_view_decode(const unsigned char *buffer, size_t buf_len,
+                            size_t *count) {
+    *count = 0;
+    if (buf_len == 0 || buf_len % RING_NODE_LEN != 0) {
+        return NULL; // empty or truncated
+    }
+    *count = buf_len / RING_NODE_LEN;
+
+    ring_node *nodes = (ring_node *)malloc(*count * sizeof(ring_node));
+    for (size_t i = 0; i < *count; i++) {
+        const unsigned char *b = buffer + i * RING_NODE_LEN;
+        nodes[i].node_id = (b[0] << 8u) | (b[1] << 0u);
+        nodes[i].ip = ((uint32_t)b[2] << 24u) | (b[3] << 16u) | (b[4] << 8u) |
+                      (b[5] << 0u);
+        nodes[i].port = (b[6] << 8u) | (b[7] << 0u);
+    }
+    return nodes;
+}
+
+ring_cache *ring_cache_new() {
+    ring_cache *rc = (ring_cache *)malloc(sizeof(ring_cache));
+    rc->nodes = NULL;
+    rc->count = 0;
+    return rc;
+}
+
+void ring_cache_free(ring_cache *rc) {
+    if (rc != NULL) {
+        free(rc->nodes);
+        free(rc);
+    }
+}
+
+static int ring_node_cmp(const void *a, const void *b) {
+    return (int)((const ring_node *)a)->node_id -
+           (int)((const ring_node *)b)->node_id;
+}
+
+void ring_cache_merge(ring_cache *rc, const ring_node *nodes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        ring_node *existing =
+            bsearch(&nodes[i], rc->nodes, rc->count, sizeof(ring_node),
+                    ring_node_cmp);
+        if (existing != NULL) {
+            *existing = nodes[i];
+            continue;
+        }
+
+        rc->nodes = realloc(rc->nodes, (rc->count + 1) * sizeof(ring_node));
+        rc->nodes[rc->count++] = nodes[i];
+        qsort(rc->nodes, rc->count, sizeof(ring_node), ring_node_cmp);
+    }
+}
+
+void ring_cache_remove(ring_cache *rc, uint16_t node_id) {
+    for (size_t i = 0; i < rc->count; i++) {
+        if (rc->nodes[i].node_id == node_id) {
+            memmove(&rc->nodes[i], &rc->nodes[i + 1],
+                    (rc->count - i - 1) * sizeof(ring_node));
+            rc->count--;
+            return;
+        }
+    }
+}
+
+const ring_node *ring_cache_lookup(const ring_cache *rc, uint16_t hash_id) {
+    if (rc->count == 0) {
+        return NULL;
+    }
+
+    // first node at or after hash_id, wrapping around to the smallest ID
+    for (size_t i = 0; i < rc->count; i++) {
+        if (rc->nodes[i].node_id >= hash_id) {
+            return &rc->nodes[i];
+        }
+    }
+    return &rc->nodes[0];
+}
+
+const ring_node *ring_cache_preceding(const ring_cache *rc, uint16_t hash_id) {
+    if (rc->count == 0) {
+        return NULL;
+    }
+
+    // last node before hash_id, wrapping around to the largest ID
+    for (size_t i = rc->count; i > 0; i--) {
+        if (rc->nodes[i - 1].node_id < hash_id) {
+            return &rc->nodes[i - 1];
+        }
+    }
+    return &rc->nodes[rc->count - 1];
+}
+
+/**
+ * @brief Connect to a cached ring member.
+ *
+ * @return int The connected socket or -1 on error
+ */
+static int ring_node_connect(const ring_node *n) {
+    char hostname[INET_ADDRSTRLEN];
+    struct in_addr addr;
+    addr.s_addr = htonl(n->ip);
+    inet_ntop(AF_INET, &addr, hostname, INET_ADDRSTRLEN);
+
+    char portstr[16];
+    snprintf(portstr, 16, "%d", n->port);
+
+    return connect_socket(hostname, portstr);
+}
+
+/**
+ * @brief Send a packet over a connected socket and wait for the response.
+ * The socket is closed afterwards.
+ *
+ * @return packet* The response or NULL on error
+ */
+static packet *exchange(int s, const packet *p) {
+    size_t raw_size;
+    unsigned char *raw_pkt = packet_serialize(p, &raw_size);
+    int status = sendall(s, raw_pkt, raw_size);
+    free(raw_pkt);
+
+    size_t response_len;
+    unsigned char *response = recvall(s, &response_len);
+    packet *rsp = NULL;
+    if (status == 0) {
+        rsp = packet_decode(response, response_len);
+    }
+    free(response);
+    return rsp;
+}
+
+/**
+ * @brief Merge the ring view carried by a RING packet into the cache.
+ *
+ * @return size_t The number of ring members in the view
+ */
+static size_t merge_view(ring_cache *rc, const packet *rsp) {
+    size_t count;
+    ring_node *nodes = ring_view_decode(rsp->value, rsp->value_len, &count);
+    ring_cache_merge(rc, nodes, count);
+    free(nodes);
+    return count;
+}
+
+int ring_cache_fetch(ring_cache *rc, char *hostname, char *port,
+                     size_t max_queries) {
+    packet *req = packet_new();
+    req->flags = PKT_FLAG_RING;
+
+    int s = connect_socket(hostname, port);
+    packet *rsp = s < 0 ? NULL : exchange(s, req);
+    if (rsp == NULL || !(rsp->flags & PKT_FLAG_RING)) {
+        fprintf(stderr, "Peer did not answer ring view request!\n");
+        packet_free(rsp);
+        packet_free(req);
+        return -1;
+    }
+    merge_view(rc, rsp);
+    packet_free(rsp);
+
+    // ask every member we learn about once, until the view stops growing
+    uint16_t *asked = (uint16_t *)malloc(max_queries * sizeof(uint16_t));
+    size_t n_asked = 0;
+    bool grown = true;
+    while (grown && n_asked < max_queries) {
+        grown = false;
+        for (size_t i = 0; i < rc->count && n_asked < max_queries; i++) {
+            bool seen = false;
+            for (size_t k = 0; k < n_asked; k++) {
+                seen |= asked[k] == rc->nodes[i].node_id;
+            }
+            if (seen) {
+                continue;
+            }
+            asked[n_asked++] = rc->nodes[i].node_id;
+
+            ring_node n = rc->nodes[i];
+            s = ring_node_connect(&n);
+            if (s < 0) {
+                ring_cache_remove(rc, n.node_id);
+                // indices shifted, start over: the members asked already
+                // are skipped, and max_queries bounds the loop as every
+                // pass asks one more
+                grown = true;
+                break;
+            }
+
+            size_t before = rc->count;
+            rsp = exchange(s, req);
+            if (rsp != NULL && (rsp->flags & PKT_FLAG_RING)) {
+                merge_view(rc, rsp);
+            }
+            packet_free(rsp);
+
+            if (rc->count != before) {
+                grown = true;
+                break;
+            }
+        }
+    }
+
+    free(asked);
+    packet_free(req);
+    return 0;
+}
+
+packet *ring_cache_request(ring_cache *rc, packet *p, char *hostname,
+                           char *port) {
+    uint16_t hash_id = pseudo_hash(p->key, p->key_len);
+    uint8_t flags = p->flags;
+
+    p->flags = flags | PKT_FLAG_DRCT;
+    for (int hop = 0; hop < RING_CACHE_MAX_HOPS; hop++) {
+        const ring_node *n = ring_cache_lookup(rc, hash_id);
+        if (n == NULL) {
+            break;
+        }
+
+        uint16_t node_id = n->node_id;
+        int s = ring_node_connect(n);
+        if (s < 0) {
+            ring_cache_remove(rc, node_id);
+            continue;
+        }
+
+        packet *rsp = exchange(s, p);
+        if (rsp == NULL) {
+            ring_cache_remove(rc, node_id);
+            continue;
+        }
+
+        if ((rsp->flags & PKT_FLAG_RING) && !(rsp->flags & PKT_FLAG_ACK)) {
+            // not responsible: the answer carries the peer's view of the ring
+            LOG_DEBUG(LOG_LOOKUP, "Key moved away from node %d, refreshing.",
+                      node_id);
+            merge_view(rc, rsp);
+            packet_free(rsp);
+            continue;
+        }
+
+        p->flags = flags;
+        return rsp;
+    }
+
+    // let the ring route the request for us
+    p->flags = flags;
+    int s = connect_socket(hostname, port);
+    if (s < 0) {
+        return NULL;
+    }
+    return exchange(s, p);
+}
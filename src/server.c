@@ -1,6 +1,7 @@
 #include "server.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netdb.h>
 #include <poll.h>
 #include <stdio.h>
@@ -10,15 +11,37 @@
 #include <unistd.h>
 #include <pthread.h>
 
+#include "log.h"
+#include "metrics.h"
 #include "packet.h"
+#include "rcu.h"
 
 void server_close_socket(server *srv, int socket) {
-    for (client *c = srv->clients; c != NULL; c = c->next) {
-        if (c->socket == socket) {
-            c->state = REMOVE;
-            break;
+    pthread_mutex_lock(&srv->lock);
+    if (srv->n_closing == srv->closing_cap) {
+        srv->closing_cap = srv->closing_cap > 0 ? 2 * srv->closing_cap : 16;
+        srv->closing =
+            (int *)realloc(srv->closing, srv->closing_cap * sizeof(int));
+    }
+    srv->closing[srv->n_closing++] = socket;
+    pthread_mutex_unlock(&srv->lock);
+}
+
+/**
+ * @brief Mark the clients whose closing was requested for removal.
+ */
+void server_mark_closing(server *srv) {
+    pthread_mutex_lock(&srv->lock);
+    for (size_t i = 0; i < srv->n_closing; i++) {
+        for (client *c = srv->clients; c != NULL; c = c->next) {
+            if (c->socket == srv->closing[i]) {
+                c->state = REMOVE;
+                break;
+            }
         }
     }
+    srv->n_closing = 0;
+    pthread_mutex_unlock(&srv->lock);
 }
 
 void server_remove_client(server *srv, client *c) {
@@ -62,6 +85,8 @@ void client_decode_hdr(client *c) {
     c->state = HDR_RECVD;
     unsigned char hdr[PKT_HEADER_LEN];
     rb_read(c->header_buf, hdr, PKT_HEADER_LEN);
+    // a client kept open (CB_OK) sends the next packet on the same connection
+    packet_free(c->pack);
     c->pack = packet_decode_hdr(hdr, PKT_HEADER_LEN);
 
     c->pkt_buf = rb_new(packet_body_size(c->pack));
@@ -79,28 +104,74 @@ void client_decode_body(client *c) {
     c->pkt_buf = NULL;
 }
 
-void server_deliver_packet(server *srv, client *c) {
+int server_deliver_packet(server *srv, client *c) {
 
     if (srv->packet_cb != NULL) {
-        int rsp = srv->packet_cb(srv, c, c->pack);
-        if (rsp == CB_REMOVE_CLIENT) {
-            server_remove_client(srv, c);
+        return srv->packet_cb(srv, c, c->pack);
+    }
+    return CB_OK;
+}
+
+int client_feed(server *srv, client *c, const unsigned char *data, size_t len) {
+    metrics_add(M_BYTES_IN, len);
+    while (len > 0) {
+        ring_buffer *rb = c->state == IDLE ? c->header_buf : c->pkt_buf;
+        size_t n = rb_can_write(rb);
+        if (n > len) {
+            n = len;
+        }
+        rb_write(rb, data, n);
+        data += n;
+        len -= n;
+
+        if (c->state == IDLE) {
+            if (rb_can_read(c->header_buf) < PKT_HEADER_LEN) {
+                continue;
+            }
+            client_decode_hdr(c);
+            // packets without body are complete already
+            if (rb_can_write(c->pkt_buf) != 0) {
+                continue;
+            }
+        } else if (rb_can_write(c->pkt_buf) != 0) {
+            continue;
+        }
+
+        // FULL PACKET RECEIVED
+        client_decode_body(c);
+        int status = server_deliver_packet(srv, c);
+        if (status == CB_REMOVE_CLIENT) {
+            return CB_REMOVE_CLIENT;
+        } else if (status == CB_WAIT) {
+            c->waiting = true;
+            return CB_OK;
         }
     }
+    return CB_OK;
 }
 
 void server_add_client(server *srv) {
     // accept connections
     client *new_client = (client *)malloc(sizeof(client));
+    new_client->addr_len = sizeof(new_client->addr);
     new_client->socket =
         accept(srv->socket, (struct sockaddr *)&(new_client->addr),
                &(new_client->addr_len));
+    if (new_client->socket < 0) {
+        perror("accept");
+        free(new_client);
+        return;
+    }
 
     new_client->state = IDLE;
+    new_client->armed = false;
+    new_client->waiting = false;
     new_client->header_buf = rb_new(PKT_HEADER_LEN);
     new_client->pkt_buf = NULL;
     new_client->pack = NULL;
 
+    metrics_add(M_CONN_ACCEPTED, 1);
+
     // Append to front
     new_client->next = srv->clients;
     srv->clients = new_client;
@@ -126,20 +197,25 @@ void server_stop(server *srv) {
  */
 int forward_pkt(peer *p, packet *pack) {
 
+    // the succ is shared with the reactors, connect through a copy
+    peer *conn = peer_dup(p);
+
     // check whether we can connect to the peer
-    if (peer_connect(p) != 0) {
-        fprintf(stderr, "Failed to connect to peer %s:%d\n", p->hostname,
-                p->port);
+    if (peer_connect(conn) != 0) {
+        LOG_WARN(LOG_NET, "Failed to connect to peer %s:%d", conn->hostname,
+                 conn->port);
+        peer_free(conn);
         return -1;
     }
 
     size_t data_len;
     unsigned char *raw = packet_serialize(pack, &data_len);
-    int status = sendall(p->socket, raw, data_len);
+    int status = sendall(conn->socket, raw, data_len);
     free(raw);
     raw = NULL;
 
-    peer_disconnect(p);
+    peer_disconnect(conn);
+    peer_free(conn);
     return status;
 }
 
@@ -151,22 +227,25 @@ int forward_pkt(peer *p, packet *pack) {
  * @return int The status of the sending procedure
  */
 int send_stabilize(peer *p_sender, peer *p_reciever) {
-    
-    printf(">>> send(stabilize) to -> [port=%u, ID=%u] <<<\n", p_reciever->port, p_reciever->node_id);
 
     // build a stabilize message (i.e contains infos about our self)
+    // hash_id addresses the virtual node of the reciever we take as succ
     packet *stab_pkt = packet_new();
     stab_pkt->flags = PKT_FLAG_CTRL | PKT_FLAG_STAB;
+    stab_pkt->hash_id = p_reciever->node_id;
     stab_pkt->node_id = p_sender->node_id;
     stab_pkt->node_ip = peer_get_ip(p_sender);
     stab_pkt->node_port = p_sender->port;
 
     // forward stabilize message to successor
-    return forward_pkt(p_reciever, stab_pkt);
+    int status = forward_pkt(p_reciever, stab_pkt);
+    packet_free(stab_pkt);
+    return status;
 }
 
 /**
- * @brief Periodic Dissemination of stabilize messages via new thread.
+ * @brief Periodic Dissemination of stabilize messages via new thread. The
+ * rounds follow the adaptive interval of srv->stab.
  *
  * @param arg The server
  * @return NULL
@@ -175,37 +254,52 @@ void *stabilize(void *arg) {
 
     server *srv = (server *) arg;
 
-    while (srv->active) {
-        if (srv->p_succ != NULL) {
-            printf("IT'S TIME\n");
-            send_stabilize(srv->p_self, srv->p_succ);
+    uint64_t wait_ms = srv->stab->min_ms;
+    while (srv->active && stabilizer_wait(srv->stab, wait_ms)) {
+        size_t sent = 0;
+        size_t failed = 0;
+        rcu_thread_online();
+        for (size_t i = 0; i < srv->n_vnodes; i++) {
+            vnode *v = &srv->vnodes[i];
+            peer *succ = v->succ;
+            if (succ != NULL) {
+                sent++;
+                if (send_stabilize(v->self, succ) != 0) {
+                    failed++;
+                }
+            }
         }
-        sleep(1.9); // sleep for 1.9 seconds
+        rcu_thread_offline(); // do not hold up reclamation while sleeping
+        wait_ms = stabilizer_round_done(srv->stab, sent, failed);
     }
 
     return NULL;
 }
 
-void server_run(server *srv) {
-    /**
-     * TODO:
-     * Add periodic dissemination of stabilize messages.
-     */
-    listen(srv->socket, 10);
-    srv->active = true;
-    fprintf(stderr, "Starting server. Press any key to exit.\n");
-
-    // create new thread for periodic dissemination of stabilize messages
-    pthread_t thread;
-    pthread_create(&thread, NULL, stabilize, (void *) srv);
+/**
+ * @brief The event loop of one reactor.
+ *
+ * @param srv The reactor
+ */
+void server_loop(server *srv) {
+    if (srv->backend == BACKEND_IO_URING) {
+        if (server_loop_uring(srv) == 0) {
+            return;
+        }
+        fprintf(stderr, "io_uring not available, falling back to poll.\n");
+    }
+    rcu_thread_online();
 
     struct pollfd *fds = NULL;
     int i, ready;
     while (srv->active) {
+        // nothing from the last iteration is referenced anymore
+        rcu_quiescent();
+
         fds = (struct pollfd *)realloc(fds, (srv->n_clients + 2) *
                                                 sizeof(struct pollfd));
         memset(fds, 0, (srv->n_clients + 2) * sizeof(struct pollfd));
-        fds[0].fd = fileno(stdin);
+        fds[0].fd = srv->shard == 0 ? fileno(stdin) : -1; // ignored by poll
         fds[0].events = POLLIN;
 
         fds[1].fd = srv->socket;
@@ -214,12 +308,16 @@ void server_run(server *srv) {
         client *c;
         for (i = 2, c = srv->clients; (i < srv->n_clients + 2) && (c != NULL);
              i++, c = c->next) {
-            fds[i].fd = c->socket;
+            // a hang-up of a waiting client is noticed by the answer
+            fds[i].fd = c->waiting ? -1 : c->socket;
             fds[i].events = POLLIN;
         }
 
-        ready = poll(fds, srv->n_clients + 2, 5000);
-        if (ready < 0) {
+        ready = poll(fds, srv->n_clients + 2,
+                     srv->tick_cb != NULL ? SERVER_TICK_MS : 5000);
+        if (ready < 0 && errno == EINTR) {
+            ready = 0; // a signal (e.g. SIGUSR1), still run the tick
+        } else if (ready < 0) {
             perror("Poll:");
             break;
         }
@@ -233,74 +331,105 @@ void server_run(server *srv) {
             for (i = 2, c = srv->clients;
                  (i < srv->n_clients + 2) && (c != NULL); i++, c = next) {
                 next = c->next;
-                if (fds[i].revents == POLLIN) {
+                // hang-ups and errors are noticed by the failing recv
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
                     // receive
-                    if (c->state == IDLE) {
-                        int bytes_needed = rb_can_write(c->header_buf);
-                        unsigned char buffer[bytes_needed];
-                        int nbytes = recv(fds[i].fd, buffer, bytes_needed, 0);
-
-                        if (nbytes > 0) {
-                            rb_write(c->header_buf, buffer, nbytes);
-
-                            if (rb_can_read(c->header_buf) == PKT_HEADER_LEN) {
-                                client_decode_hdr(c);
-                            }
-
-                        } else if (nbytes == 0) {
-                            char addr[INET6_ADDRSTRLEN];
-                            get_ip_str((struct sockaddr *)&(c->addr), addr,
-                                       INET6_ADDRSTRLEN);
-                            fprintf(stderr, "%s: Connection closed.\n", addr);
+                    ring_buffer *rb = c->state == IDLE ? c->header_buf : c->pkt_buf;
+                    int bytes_needed = rb_can_write(rb);
+                    unsigned char buffer[bytes_needed];
+                    int nbytes = recv(fds[i].fd, buffer, bytes_needed, 0);
+
+                    if (nbytes > 0) {
+                        if (client_feed(srv, c, buffer, nbytes) == CB_REMOVE_CLIENT) {
                             server_remove_client(srv, c);
                         }
                     } else {
-                        int bytes_needed = rb_can_write(c->pkt_buf);
-                        unsigned char buffer[bytes_needed];
-                        int nbytes = recv(fds[i].fd, buffer, bytes_needed, 0);
-
-                        if (nbytes > 0) {
-                            rb_write(c->pkt_buf, buffer, nbytes);
-                            if (rb_can_write(c->pkt_buf) == 0) {
-                                // FULL PACKET RECEIVED
-                                client_decode_body(c);
-                                server_deliver_packet(srv, c);
-                            }
-
-                        } else if (nbytes == 0) {
-                            char addr[INET6_ADDRSTRLEN];
-                            get_ip_str((struct sockaddr *)&(c->addr), addr,
-                                       INET6_ADDRSTRLEN);
-                            fprintf(stderr, "%s: Connection closed.\n", addr);
-                            server_remove_client(srv, c);
-                        }
+                        LOG_DEBUG(LOG_NET, "Connection %d closed.", c->socket);
+                        server_remove_client(srv, c);
                     }
                 }
             }
+        } else if (srv->tick_cb == NULL) {
+            LOG_TRACE(LOG_NET, "Nothing is happening...");
+        }
 
-            c = srv->clients;
-            while (c != NULL) {
-                client *next = c->next;
-                if (c->state == REMOVE) {
-                    fprintf(stderr, "Connection marked for removal\n");
-                    server_remove_client(srv, c);
-                }
-                c = next;
-            }
+        if (srv->tick_cb != NULL) {
+            srv->tick_cb(srv);
+        }
 
-            if (fds[1].revents == POLLIN) {
-                server_add_client(srv);
+        server_mark_closing(srv);
+        c = srv->clients;
+        while (c != NULL) {
+            client *next = c->next;
+            if (c->state == REMOVE) {
+                LOG_DEBUG(LOG_NET, "Connection marked for removal");
+                server_remove_client(srv, c);
             }
+            c = next;
+        }
 
-        } else {
-            fprintf(stderr, "Nothing is happening...\n");
+        if (ready > 0 && fds[1].revents == POLLIN) {
+            server_add_client(srv);
         }
     }
     free(fds);
     server_stop(srv);
+    rcu_thread_offline();
+}
+
+/**
+ * @brief Thread entry of the reactors besides shard 0.
+ *
+ * @param arg The reactor
+ * @return NULL
+ */
+void *server_thread(void *arg) {
+    server_loop((server *)arg);
+    return NULL;
+}
+
+void server_run_shards(server **shards, size_t n_shards) {
+    for (size_t i = 0; i < n_shards; i++) {
+        listen(shards[i]->socket, 10);
+        shards[i]->shard = i;
+        shards[i]->active = true;
+    }
+    fprintf(stderr, "Starting server with %zu reactor(s). Press any key to exit.\n",
+            n_shards);
+
+    // create new thread for periodic dissemination of stabilize messages
+    pthread_t thread;
+    if (shards[0]->stab != NULL) {
+        pthread_create(&thread, NULL, stabilize, (void *) shards[0]);
+    }
+
+    pthread_t *threads = (pthread_t *)calloc(n_shards, sizeof(pthread_t));
+    for (size_t i = 1; i < n_shards; i++) {
+        pthread_create(&threads[i], NULL, server_thread, shards[i]);
+    }
+
+    server_loop(shards[0]);
+
+    // the other reactors notice within one poll timeout
+    for (size_t i = 1; i < n_shards; i++) {
+        shards[i]->active = false;
+    }
+    for (size_t i = 1; i < n_shards; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    if (shards[0]->stab != NULL) {
+        stabilizer_stop(shards[0]->stab);
+        pthread_join(thread, NULL);
+    }
 }
 
-server *server_setup(char *port) {
+void server_run(server *srv) {
+    server_run_shards(&srv, 1);
+}
+
+server *server_setup(char *port, bool shared) {
     struct addrinfo hints;
     struct addrinfo *res;
     struct addrinfo *r;
@@ -322,6 +451,13 @@ server *server_setup(char *port) {
             return NULL;
         }
 
+        // every reactor binds its own socket to the port
+        int on = 1;
+        if (shared &&
+            setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            perror("setsockopt");
+        }
+
         status = bind(s, r->ai_addr, r->ai_addrlen);
         if (status < 0) {
             perror("bind");
@@ -343,9 +479,19 @@ server *server_setup(char *port) {
     }
 
     serv->socket = s;
+    serv->shard = 0;
+    serv->backend = BACKEND_POLL;
     serv->clients = NULL;
     serv->n_clients = 0;
     serv->active = false;
     serv->packet_cb = NULL;
+    serv->tick_cb = NULL;
+    serv->vnodes = NULL;
+    serv->n_vnodes = 0;
+    serv->stab = NULL;
+    pthread_mutex_init(&serv->lock, NULL);
+    serv->closing = NULL;
+    serv->n_closing = 0;
+    serv->closing_cap = 0;
     return serv;
 }
@@ -0,0 +1,232 @@
+#include "server.h"
+
+#include <stdio.h>
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "rcu.h"
+#include "uring.h"
+
+#define URING_ENTRIES 256
+#define URING_BUFS 256        // provided receive buffers per reactor
+#define URING_BUF_SIZE 16384  // bytes per receive buffer
+#define URING_BGID 0
+
+// user_data of a completion: a client pointer (aligned) or'ed with the event
+#define EV_MASK 7u
+#define EV_RECV 1u
+#define EV_ACCEPT 2u
+#define EV_TICK 3u
+#define EV_STDIN 4u
+
+static void arm_accept(uring *r, server *srv) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = srv->socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT; // one CQE per new connection
+    sqe->user_data = EV_ACCEPT;
+}
+
+static void arm_recv(uring *r, client *c) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT; // one CQE per received chunk
+    sqe->flags = IOSQE_BUFFER_SELECT;    // the kernel picks the buffer
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (uint64_t)(uintptr_t)c | EV_RECV;
+    c->armed = true;
+}
+
+static void arm_tick(uring *r, struct __kernel_timespec *ts) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)(uintptr_t)ts;
+    sqe->len = 1;
+    sqe->user_data = EV_TICK;
+}
+
+static void arm_stdin(uring *r) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fileno(stdin);
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = EV_STDIN;
+}
+
+/**
+ * @brief Register an accepted connection as a client.
+ */
+static client *uring_add_client(server *srv, int socket) {
+    client *c = (client *)calloc(1, sizeof(client));
+    c->socket = socket;
+    c->addr_len = sizeof(c->addr);
+    getpeername(socket, (struct sockaddr *)&c->addr, &c->addr_len);
+    c->state = IDLE;
+    c->header_buf = rb_new(PKT_HEADER_LEN);
+    metrics_add(M_CONN_ACCEPTED, 1);
+
+    c->next = srv->clients;
+    srv->clients = c;
+    srv->n_clients++;
+    return c;
+}
+
+/**
+ * @brief Handle a completion of the multishot recv of a client. A client is
+ * only freed after its recv terminated, since the kernel still refers to it.
+ */
+static void uring_recv_done(uring *r, uring_bufs *bufs, server *srv,
+                            client *c, int res, unsigned flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+        c->armed = false;
+    }
+
+    if (res > 0) {
+        uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (c->state != REMOVE &&
+            client_feed(srv, c, uring_buf(bufs, bid), res) == CB_REMOVE_CLIENT) {
+            c->state = REMOVE;
+        }
+        uring_buf_recycle(bufs, bid);
+    } else if (res != -ENOBUFS && c->state != REMOVE && !c->waiting) {
+        LOG_DEBUG(LOG_NET, "Connection %d closed.", c->socket);
+        c->state = REMOVE;
+    }
+
+    // the recv stops e.g. when all buffers are in use, start it again (a
+    // waiting client is not read anymore, see CB_WAIT)
+    if (!c->armed && c->state != REMOVE && !c->waiting) {
+        arm_recv(r, c);
+    }
+}
+
+/**
+ * @brief Remove the clients marked for removal. Clients with a recv in flight
+ * are shut down first; they are removed once the recv reports the end.
+ */
+static void uring_sweep(server *srv) {
+    client *c = srv->clients;
+    while (c != NULL) {
+        client *next = c->next;
+        if (c->state == REMOVE) {
+            if (c->armed) {
+                shutdown(c->socket, SHUT_RDWR);
+            } else {
+                server_remove_client(srv, c);
+            }
+        }
+        c = next;
+    }
+}
+
+int server_loop_uring(server *srv) {
+    uring r;
+    uring_bufs bufs;
+    if (uring_init(&r, URING_ENTRIES) != 0) {
+        return -1;
+    }
+    if (uring_bufs_init(&r, &bufs, URING_BGID, URING_BUFS, URING_BUF_SIZE) !=
+        0) {
+        uring_exit(&r);
+        return -1;
+    }
+    rcu_thread_online();
+
+    uint64_t tick_ms = srv->tick_cb != NULL ? SERVER_TICK_MS : 5000;
+    struct __kernel_timespec ts = {(long long)(tick_ms / 1000),
+                                   (long long)(tick_ms % 1000) * 1000000};
+
+    arm_accept(&r, srv);
+    arm_tick(&r, &ts);
+    if (srv->shard == 0) {
+        arm_stdin(&r);
+    }
+
+    bool stopping = false;
+    while (true) {
+        // nothing from the last iteration is referenced anymore
+        rcu_quiescent();
+
+        if (uring_submit_and_wait(&r, 1) < 0) {
+            break;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&r)) != NULL) {
+            uint64_t ud = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            uring_cqe_seen(&r);
+
+            switch (ud & EV_MASK) {
+            case EV_RECV: {
+                client *c = (client *)(uintptr_t)(ud & ~(uint64_t)EV_MASK);
+                uring_recv_done(&r, &bufs, srv, c, res, flags);
+                break;
+            }
+            case EV_ACCEPT:
+                if (res >= 0 && !stopping) {
+                    arm_recv(&r, uring_add_client(srv, res));
+                } else if (res >= 0) {
+                    close(res);
+                }
+                if (!(flags & IORING_CQE_F_MORE) && !stopping) {
+                    arm_accept(&r, srv);
+                }
+                break;
+            case EV_TICK:
+                arm_tick(&r, &ts);
+                break;
+            case EV_STDIN:
+                srv->active = false;
+                break;
+            }
+        }
+
+        if (srv->tick_cb != NULL && !stopping) {
+            srv->tick_cb(srv);
+        }
+
+        if (!srv->active && !stopping) {
+            // end all connections, then wait for their recvs to finish
+            stopping = true;
+            for (client *c = srv->clients; c != NULL; c = c->next) {
+                c->state = REMOVE;
+            }
+        }
+
+        server_mark_closing(srv);
+        uring_sweep(srv);
+
+        if (stopping && srv->clients == NULL) {
+            break;
+        }
+    }
+
+    server_stop(srv);
+    rcu_thread_offline();
+    // no recv can use the buffers anymore, the rest is cancelled by the exit
+    uring_bufs_free(&r, &bufs);
+    uring_exit(&r);
+    return 0;
+}
+
+#else
+
+int server_loop_uring(server *srv) {
+    (void)srv;
+    fprintf(stderr, "Built without io_uring support!\n");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include "single_flight.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+flight_table *flight_table_new() {
+    flight_table *ft = (flight_table *)calloc(1, sizeof(flight_table));
+    pthread_mutex_init(&ft->lock, NULL);
+    return ft;
+}
+
+bool flight_join(flight_table *ft, const unsigned char *key, size_t key_len,
+                 server *srv, int socket) {
+    bool lead = true;
+
+    pthread_mutex_lock(&ft->lock);
+    flight *f;
+    HASH_FIND(hh, ft->flights, key, key_len, f);
+    if (f == NULL) {
+        f = (flight *)malloc(sizeof(flight));
+        f->key = (unsigned char *)malloc(key_len);
+        memcpy(f->key, key, key_len);
+        f->key_len = key_len;
+        f->leader = socket;
+        f->waiters = NULL;
+        HASH_ADD_KEYPTR(hh, ft->flights, f->key, f->key_len, f);
+        ft->led++;
+    } else if (f->leader != socket) {
+        flight_waiter *w = (flight_waiter *)malloc(sizeof(flight_waiter));
+        w->srv = srv;
+        w->socket = socket;
+        w->next = f->waiters;
+        f->waiters = w;
+        ft->joined++;
+        lead = false;
+    }
+    pthread_mutex_unlock(&ft->lock);
+    return lead;
+}
+
+size_t flight_land(flight_table *ft, const unsigned char *key, size_t key_len,
+                   int leader, const unsigned char *rsp, size_t rsp_len) {
+    pthread_mutex_lock(&ft->lock);
+    flight *f;
+    HASH_FIND(hh, ft->flights, key, key_len, f);
+    if (f == NULL || f->leader != leader) {
+        pthread_mutex_unlock(&ft->lock);
+        return 0;
+    }
+    HASH_DEL(ft->flights, f);
+    ft->failed += rsp == NULL;
+    pthread_mutex_unlock(&ft->lock);
+
+    // the answer goes out without holding the lock
+    size_t count = 0;
+    flight_waiter *w = f->waiters;
+    while (w != NULL) {
+        flight_waiter *next = w->next;
+        if (rsp != NULL) {
+            sendall(w->socket, (unsigned char *)rsp, rsp_len);
+        }
+        server_close_socket(w->srv, w->socket);
+        free(w);
+        count++;
+        w = next;
+    }
+    free(f->key);
+    free(f);
+    return count;
+}
+
+void flight_print_stats(flight_table *ft, FILE *out) {
+    pthread_mutex_lock(&ft->lock);
+    fprintf(out,
+            "Single-flight GETs: %zu fetched, %zu served by another fetch, "
+            "%zu failed, %u in flight\n",
+            ft->led, ft->joined, ft->failed, HASH_COUNT(ft->flights));
+    pthread_mutex_unlock(&ft->lock);
+}
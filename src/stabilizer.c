@@ -0,0 +1,113 @@
+#include "stabilizer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+stabilizer *stabilizer_new(uint64_t min_ms, uint64_t max_ms) {
+    stabilizer *st = (stabilizer *)calloc(1, sizeof(stabilizer));
+    pthread_mutex_init(&st->lock, NULL);
+
+    // waits are measured on the monotonic clock, not the wall clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&st->wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    st->min_ms = min_ms;
+    st->max_ms = max_ms > min_ms ? max_ms : min_ms;
+    st->interval_ms = min_ms;
+    return st;
+}
+
+void stabilizer_free(stabilizer *st) {
+    if (st != NULL) {
+        pthread_cond_destroy(&st->wake);
+        pthread_mutex_destroy(&st->lock);
+        free(st);
+    }
+}
+
+void stabilizer_changed(stabilizer *st) {
+    pthread_mutex_lock(&st->lock);
+    st->changed = true;
+    st->interval_ms = st->min_ms;
+    st->changes++;
+    pthread_cond_signal(&st->wake);
+    pthread_mutex_unlock(&st->lock);
+}
+
+void stabilizer_received(stabilizer *st, bool ntfy) {
+    pthread_mutex_lock(&st->lock);
+    if (ntfy) {
+        st->ntfy_received++;
+    } else {
+        st->stab_received++;
+    }
+    pthread_mutex_unlock(&st->lock);
+}
+
+uint64_t stabilizer_round_done(stabilizer *st, size_t sent, size_t failed) {
+    pthread_mutex_lock(&st->lock);
+    st->rounds++;
+    st->stab_sent += sent;
+    st->stab_failed += failed;
+
+    if (st->changed) {
+        // the ring is still settling, keep the fast pace
+        st->changed = false;
+        st->interval_ms = st->min_ms;
+    } else if (failed > 0 && !st->failing) {
+        // a successor just failed, look again soon (but back off if it stays
+        // unreachable, nobody else can repair it faster)
+        st->interval_ms = st->min_ms;
+    } else {
+        st->interval_ms = 2 * st->interval_ms < st->max_ms ? 2 * st->interval_ms
+                                                          : st->max_ms;
+    }
+    st->failing = failed > 0;
+    uint64_t wait_ms = st->interval_ms;
+    pthread_mutex_unlock(&st->lock);
+    return wait_ms;
+}
+
+bool stabilizer_wait(stabilizer *st, uint64_t wait_ms) {
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += wait_ms / 1000;
+    until.tv_nsec += (wait_ms % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&st->lock);
+    while (!st->stopped && !st->changed) {
+        if (pthread_cond_timedwait(&st->wake, &st->lock, &until) ==
+            ETIMEDOUT) {
+            break;
+        }
+    }
+    bool running = !st->stopped;
+    pthread_mutex_unlock(&st->lock);
+    return running;
+}
+
+void stabilizer_stop(stabilizer *st) {
+    pthread_mutex_lock(&st->lock);
+    st->stopped = true;
+    pthread_cond_signal(&st->wake);
+    pthread_mutex_unlock(&st->lock);
+}
+
+void stabilizer_print_stats(stabilizer *st, FILE *out) {
+    pthread_mutex_lock(&st->lock);
+    fprintf(out,
+            "Stabilization: %zu rounds, %zu STAB sent (%zu failed), %zu STAB "
+            "and %zu NTFY received, %zu ring changes, interval %llu ms\n",
+            st->rounds, st->stab_sent, st->stab_failed, st->stab_received,
+            st->ntfy_received, st->changes,
+            (unsigned long long)st->interval_ms);
+    pthread_mutex_unlock(&st->lock);
+}
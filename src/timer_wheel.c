@@ -0,0 +1,155 @@
+#include "timer_wheel.h"
+
+#include <stdlib.h>
+
+timer_wheel *timer_wheel_new(uint64_t tick_ms, uint64_t now) {
+    timer_wheel *tw = (timer_wheel *)calloc(1, sizeof(timer_wheel));
+    tw->tick_ms = tick_ms;
+    tw->current = now / tick_ms;
+    return tw;
+}
+
+void timer_wheel_free(timer_wheel *tw) {
+    if (tw == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < TW_LEVELS * TW_SLOTS; i++) {
+        timer *t = tw->slots[i];
+        while (t != NULL) {
+            timer *next = t->next;
+            free(t);
+            t = next;
+        }
+    }
+    free(tw);
+}
+
+/**
+ * @brief Put a timer into the slot of its deadline tick: the lowest level
+ * whose rotation still reaches it.
+ *
+ * @param tw The wheel
+ * @param t The timer
+ * @param earliest The first tick that is still processed
+ */
+static void timer_link(timer_wheel *tw, timer *t, uint64_t earliest) {
+    // round up, so the deadline has passed once the wheel reaches the slot
+    uint64_t tick = (t->deadline + tw->tick_ms - 1) / tw->tick_ms;
+    if (tick < earliest) {
+        tick = earliest; // already due, fire on the next tick processed
+    }
+    uint64_t delta = tick - tw->current;
+
+    size_t level = 0;
+    while (level < TW_LEVELS - 1 &&
+           delta >= (uint64_t)1 << ((level + 1) * TW_SLOT_BITS)) {
+        level++;
+    }
+    unsigned shift = level * TW_SLOT_BITS;
+    if (delta >= (uint64_t)1 << ((level + 1) * TW_SLOT_BITS)) {
+        // beyond the last level: the slot emptied last, and then again
+        tick = tw->current + ((uint64_t)(TW_SLOTS - 1) << shift);
+    }
+    t->slot = level * TW_SLOTS + (tick >> shift) % TW_SLOTS;
+
+    timer **slot = &tw->slots[t->slot];
+    t->prev = NULL;
+    t->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->prev = t;
+    }
+    *slot = t;
+}
+
+timer *timer_wheel_add(timer_wheel *tw, uint64_t deadline, void *data) {
+    timer *t = (timer *)malloc(sizeof(timer));
+    t->deadline = deadline;
+    t->data = data;
+    t->wheel = tw;
+
+    // the current tick was processed already
+    timer_link(tw, t, tw->current + 1);
+
+    tw->count++;
+    return t;
+}
+
+/**
+ * @brief Unlink a timer from its slot without freeing it.
+ */
+static void timer_unlink(timer *t) {
+    timer_wheel *tw = t->wheel;
+    if (t->prev != NULL) {
+        t->prev->next = t->next;
+    } else {
+        tw->slots[t->slot] = t->next; // head of its slot
+    }
+    if (t->next != NULL) {
+        t->next->prev = t->prev;
+    }
+    tw->count--;
+}
+
+void timer_cancel(timer *t) {
+    if (t != NULL) {
+        timer_unlink(t);
+        free(t);
+    }
+}
+
+/**
+ * @brief Move the timers of the upper levels that become due within the next
+ * rotation of the level below into the lower levels. Runs at the start of a
+ * tick, before its level 0 slot fires.
+ */
+static void timer_cascade(timer_wheel *tw) {
+    for (size_t level = 1; level < TW_LEVELS; level++) {
+        unsigned shift = level * TW_SLOT_BITS;
+        if (tw->current & (((uint64_t)1 << shift) - 1)) {
+            break; // the level below is in the middle of a rotation
+        }
+        timer **slot =
+            &tw->slots[level * TW_SLOTS + (tw->current >> shift) % TW_SLOTS];
+        timer *t = *slot;
+        *slot = NULL;
+        while (t != NULL) {
+            timer *next = t->next;
+            timer_link(tw, t, tw->current);
+            t = next;
+        }
+    }
+}
+
+size_t timer_wheel_advance(timer_wheel *tw, uint64_t now, timer_cb cb,
+                           void *arg) {
+    uint64_t target = now / tw->tick_ms;
+    size_t fired = 0;
+
+    // an empty wheel has nothing to cascade, however long we were away
+    if (tw->count == 0 && tw->current < target) {
+        tw->current = target;
+    }
+
+    while (tw->current < target) {
+        tw->current++;
+        timer_cascade(tw);
+        timer **slot = &tw->slots[tw->current % TW_SLOTS];
+
+        // restart from the head after every callback, it may change the slot
+        timer *t = *slot;
+        while (t != NULL) {
+            if (t->deadline > now) {
+                t = t->next;
+                continue;
+            }
+
+            void *data = t->data;
+            timer_unlink(t);
+            free(t);
+            fired++;
+            cb(data, arg);
+            t = *slot;
+        }
+    }
+    return fired;
+}
@@ -0,0 +1,138 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *stage_names[] = {
+    "received", "proxy", "parked", "referral", "looked up", "store", "proxied",
+};
+
+uint64_t trace_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+const char *trace_stage_name(uint8_t stage) {
+    return stage < TRACE_STAGES ? stage_names[stage] : "?";
+}
+
+bool packet_is_traced(const packet *p) {
+    return !(p->flags & PKT_FLAG_CTRL) && (p->flags & PKT_FLAG_TRCE) &&
+           (p->flags & (PKT_FLAG_GET | PKT_FLAG_SET | PKT_FLAG_DEL));
+}
+
+size_t trace_size(const unsigned char *value, size_t value_len) {
+    if (value == NULL || value_len < 2) {
+        return 0;
+    }
+    size_t count = (value[value_len - 2] << 8u) | value[value_len - 1];
+    size_t size = count * TRACE_RECORD_LEN + 2;
+    return size <= value_len ? size : 0;
+}
+
+void trace_start(packet *p) {
+    p->flags |= PKT_FLAG_TRCE;
+    p->value = (unsigned char *)realloc(p->value, p->value_len + 2);
+    p->value[p->value_len] = 0;
+    p->value[p->value_len + 1] = 0;
+    p->value_len += 2;
+}
+
+/**
+ * @brief Write a record over the count at the end of a trace, followed by
+ * the new count. The buffer must have room for TRACE_RECORD_LEN more bytes.
+ */
+static void trace_put(unsigned char *end, size_t count, uint16_t node_id,
+                      trace_stage stage) {
+    unsigned char *r = end - 2;
+    uint64_t now = trace_now_us();
+    r[0] = node_id >> 8;
+    r[1] = node_id & 0xff;
+    r[2] = stage;
+    for (size_t i = 0; i < 8; i++) {
+        r[3 + i] = now >> (56 - 8 * i);
+    }
+    r[TRACE_RECORD_LEN] = (count + 1) >> 8;
+    r[TRACE_RECORD_LEN + 1] = (count + 1) & 0xff;
+}
+
+void trace_add(packet *p, uint16_t node_id, trace_stage stage) {
+    if (!packet_is_traced(p) || trace_size(p->value, p->value_len) == 0) {
+        return;
+    }
+    size_t count = (p->value[p->value_len - 2] << 8u) | p->value[p->value_len - 1];
+    if (count >= TRACE_MAX_RECORDS) {
+        return;
+    }
+    p->value = (unsigned char *)realloc(p->value,
+                                        p->value_len + TRACE_RECORD_LEN);
+    trace_put(p->value + p->value_len, count, node_id, stage);
+    p->value_len += TRACE_RECORD_LEN;
+}
+
+unsigned char *trace_add_raw(unsigned char *raw, size_t *len,
+                             uint16_t node_id, trace_stage stage) {
+    if (*len < PKT_HEADER_LEN) {
+        return raw;
+    }
+    packet *hdr = packet_decode_hdr(raw, *len);
+    bool traced = hdr != NULL && packet_is_traced(hdr) &&
+                  *len == PKT_HEADER_LEN + hdr->key_len + hdr->value_len;
+    size_t value_len = traced ? hdr->value_len : 0;
+    packet_free(hdr);
+
+    unsigned char *value = raw + *len - value_len;
+    if (!traced || trace_size(value, value_len) == 0) {
+        return raw;
+    }
+    size_t count = (raw[*len - 2] << 8u) | raw[*len - 1];
+    if (count >= TRACE_MAX_RECORDS) {
+        return raw;
+    }
+
+    raw = (unsigned char *)realloc(raw, *len + TRACE_RECORD_LEN);
+    trace_put(raw + *len, count, node_id, stage);
+    *len += TRACE_RECORD_LEN;
+
+    // the value grew along with the trace
+    value_len += TRACE_RECORD_LEN;
+    raw[3] = value_len >> 24;
+    raw[4] = value_len >> 16;
+    raw[5] = value_len >> 8;
+    raw[6] = value_len & 0xff;
+    return raw;
+}
+
+void trace_copy(packet *dst, const packet *src) {
+    size_t size = trace_size(src->value, src->value_len);
+    if (!packet_is_traced(src) || size == 0) {
+        return;
+    }
+    dst->flags |= PKT_FLAG_TRCE;
+    dst->value = (unsigned char *)realloc(dst->value, dst->value_len + size);
+    memcpy(dst->value + dst->value_len, src->value + src->value_len - size,
+           size);
+    dst->value_len += size;
+}
+
+size_t trace_decode(const unsigned char *value, size_t value_len,
+                    trace_record *records) {
+    size_t size = trace_size(value, value_len);
+    if (size == 0) {
+        return 0;
+    }
+    size_t count = (size - 2) / TRACE_RECORD_LEN;
+    const unsigned char *r = value + value_len - size;
+    for (size_t k = 0; k < count && k < TRACE_MAX_RECORDS;
+         k++, r += TRACE_RECORD_LEN) {
+        records[k].node_id = (r[0] << 8u) | r[1];
+        records[k].stage = r[2];
+        records[k].time_us = 0;
+        for (size_t i = 0; i < 8; i++) {
+            records[k].time_us = (records[k].time_us << 8) | r[3 + i];
+        }
+    }
+    return count < TRACE_MAX_RECORDS ? count : TRACE_MAX_RECORDS;
+}
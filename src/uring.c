@@ -0,0 +1,216 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                        NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg,
+                                 unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(uring));
+
+    r->fd = sys_io_uring_setup(entries, &p);
+    if (r->fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+
+    r->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        // both queues live in one mapping
+        if (r->cq_ring_len > r->sq_ring_len) {
+            r->sq_ring_len = r->cq_ring_len;
+        }
+        r->cq_ring_len = r->sq_ring_len;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        perror("mmap");
+        close(r->fd);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            perror("mmap");
+            munmap(r->sq_ring, r->sq_ring_len);
+            close(r->fd);
+            return -1;
+        }
+    }
+
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        perror("mmap");
+        uring_exit(r);
+        return -1;
+    }
+
+    unsigned char *sq = (unsigned char *)r->sq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+    unsigned char *cq = (unsigned char *)r->cq_ring;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+void uring_exit(uring *r) {
+    if (r->sqes != NULL && r->sqes != MAP_FAILED) {
+        munmap(r->sqes, r->sqes_len);
+    }
+    if (r->cq_ring != NULL && r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_ring_len);
+    }
+    munmap(r->sq_ring, r->sq_ring_len);
+    close(r->fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(uring *r) {
+    unsigned head = atomic_load_explicit((_Atomic unsigned *)r->sq_head,
+                                         memory_order_acquire);
+    unsigned tail = *r->sq_tail + r->sq_pending;
+    if (tail - head > r->sq_mask) {
+        uring_submit_and_wait(r, 0); // queue full, make room
+        head = atomic_load_explicit((_Atomic unsigned *)r->sq_head,
+                                    memory_order_acquire);
+        tail = *r->sq_tail + r->sq_pending;
+    }
+
+    unsigned idx = tail & r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    r->sq_array[idx] = idx;
+    r->sq_pending++;
+    return sqe;
+}
+
+int uring_submit_and_wait(uring *r, unsigned wait_nr) {
+    unsigned to_submit = r->sq_pending;
+    if (to_submit > 0) {
+        // publish the prepared entries to the kernel
+        atomic_store_explicit((_Atomic unsigned *)r->sq_tail,
+                              *r->sq_tail + to_submit, memory_order_release);
+        r->sq_pending = 0;
+    }
+    if (to_submit == 0 && wait_nr == 0) {
+        return 0;
+    }
+
+    int ret;
+    do {
+        ret = sys_io_uring_enter(r->fd, to_submit, wait_nr,
+                                 wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        perror("io_uring_enter");
+    }
+    return ret;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring *r) {
+    unsigned head = *r->cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)r->cq_tail,
+                                         memory_order_acquire);
+    if (head == tail) {
+        return NULL;
+    }
+    return &r->cqes[head & r->cq_mask];
+}
+
+void uring_cqe_seen(uring *r) {
+    atomic_store_explicit((_Atomic unsigned *)r->cq_head, *r->cq_head + 1,
+                          memory_order_release);
+}
+
+int uring_bufs_init(uring *r, uring_bufs *b, uint16_t bgid, unsigned count,
+                    size_t size) {
+    b->count = count;
+    b->size = size;
+    b->bgid = bgid;
+
+    // the ring has to be page aligned
+    b->ring_len = count * sizeof(struct io_uring_buf);
+    b->ring = mmap(NULL, b->ring_len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b->ring == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    b->mem = (unsigned char *)malloc(count * size);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)b->ring;
+    reg.ring_entries = count;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring_register");
+        munmap(b->ring, b->ring_len);
+        free(b->mem);
+        return -1;
+    }
+
+    b->ring->tail = 0;
+    for (unsigned i = 0; i < count; i++) {
+        uring_buf_recycle(b, i);
+    }
+    return 0;
+}
+
+void uring_bufs_free(uring *r, uring_bufs *b) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = b->bgid;
+    sys_io_uring_register(r->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(b->ring, b->ring_len);
+    free(b->mem);
+}
+
+unsigned char *uring_buf(uring_bufs *b, uint16_t bid) {
+    return b->mem + (size_t)bid * b->size;
+}
+
+void uring_buf_recycle(uring_bufs *b, uint16_t bid) {
+    uint16_t tail = b->ring->tail;
+    struct io_uring_buf *buf = &b->ring->bufs[tail & (b->count - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buf(b, bid);
+    buf->len = b->size;
+    buf->bid = bid;
+    // the kernel may take the buffer as soon as it sees the new tail
+    atomic_store_explicit((_Atomic uint16_t *)&b->ring->tail, tail + 1,
+                          memory_order_release);
+}
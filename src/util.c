@@ -1,11 +1,17 @@
 #include "util.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <unistd.h>
 
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
+
+#include "log.h"
+#include "metrics.h"
 
 uint16_t pseudo_hash(const unsigned char *buffer, size_t buf_len) {
     uint16_t hash = 0;
@@ -18,6 +24,18 @@ uint16_t pseudo_hash(const unsigned char *buffer, size_t buf_len) {
     return hash;
 }
 
+uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 int sendall(int s, unsigned char *buffer, size_t buf_size) {
     size_t sent = 0;
     while (sent < buf_size) {
@@ -28,6 +46,29 @@ int sendall(int s, unsigned char *buffer, size_t buf_size) {
         }
         sent += n;
     }
+    metrics_add(M_BYTES_OUT, buf_size);
+    return 0;
+}
+
+int sendallv(int s, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(s, iov, iovcnt);
+        if (n < 1) {
+            perror("sendallv");
+            return -1;
+        }
+        metrics_add(M_BYTES_OUT, n);
+        // skip what was sent, resume within a partially sent buffer
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (unsigned char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
     return 0;
 }
 
@@ -48,7 +89,7 @@ unsigned char *recvall(int s, size_t *data_len) {
             write_ptr = buffer + pos;
         }
 
-        size_t bytes = recv(s, write_ptr, buffer + buf_size - write_ptr, 0);
+        ssize_t bytes = recv(s, write_ptr, buffer + buf_size - write_ptr, 0);
 
         if (bytes < 1) {
             break;
@@ -60,9 +101,60 @@ unsigned char *recvall(int s, size_t *data_len) {
     close(s);
 
     *data_len = write_ptr - buffer;
+    metrics_add(M_BYTES_IN, *data_len);
     return buffer;
 }
 
+int connect_socket(char *hostname, char *port) {
+    struct addrinfo *res;
+    struct addrinfo hints;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int status = getaddrinfo(hostname, port, &hints, &res);
+    if (status != 0) {
+        perror("getaddrinfo:");
+        return -1;
+    }
+
+    struct addrinfo *p;
+    int sock = -1;
+    bool connected = false;
+
+    char ipstr[INET6_ADDRSTRLEN];
+
+    for (p = res; p != NULL; p = p->ai_next) {
+        sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+
+        get_ip_str(p->ai_addr, ipstr, INET6_ADDRSTRLEN);
+        LOG_DEBUG(LOG_NET, "Attempting connection to %s", ipstr);
+
+        status = connect(sock, p->ai_addr, p->ai_addrlen);
+        if (status < 0) {
+            perror("connect");
+            close(sock);
+            continue;
+        }
+        connected = true;
+        break;
+    }
+    freeaddrinfo(res);
+
+    if (!connected) {
+        return -1;
+    }
+
+    LOG_DEBUG(LOG_NET, "Connected to %s.", ipstr);
+    metrics_add(M_CONN_OPENED, 1);
+
+    return sock;
+}
+
 char *get_ip_str(const struct sockaddr *sa, char *s, size_t maxlen) {
     switch (sa->sa_family) {
     case AF_INET:
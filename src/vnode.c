@@ -0,0 +1,278 @@
+#include "vnode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Clockwise distance between two IDs on the ring.
+ */
+static uint16_t ring_dist(uint16_t from, uint16_t to) {
+    return (uint16_t)(to - from);
+}
+
+uint16_t vnode_derive_id(uint16_t base_id, size_t index) {
+    if (index == 0) {
+        return base_id;
+    }
+
+    // murmur3 finalizer over (base_id, index), folded to 16 bit
+    uint32_t hash = ((uint32_t)base_id << 16) | (uint32_t)(index & 0xFFFF);
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return (uint16_t)(hash ^ (hash >> 16));
+}
+
+static int vnode_cmp(const void *a, const void *b) {
+    const vnode *va = (const vnode *)a;
+    const vnode *vb = (const vnode *)b;
+    return (int)va->self->node_id - (int)vb->self->node_id;
+}
+
+vnode *vnodes_init(uint16_t base_id, size_t count, const char *hostname,
+                   const char *port) {
+    if (count == 0 || count > VNODES_MAX) {
+        fprintf(stderr, "Number of virtual nodes must be in [1, %d]!\n",
+                VNODES_MAX);
+        return NULL;
+    }
+
+    vnode *vn = calloc(count, sizeof(vnode));
+    size_t index = 0;
+    for (size_t i = 0; i < count; i++) {
+        // skip derived IDs that collide with one of our own
+        uint16_t id;
+        do {
+            id = vnode_derive_id(base_id, index++);
+        } while (vnode_find(vn, i, id) != NULL);
+
+        vn[i].self = peer_init(id, hostname, port);
+        if (vn[i].self == NULL) {
+            free(vn);
+            return NULL;
+        }
+    }
+
+    qsort(vn, count, sizeof(vnode), vnode_cmp);
+    return vn;
+}
+
+void vnodes_link_local(vnode *vn, size_t count) {
+    if (count < 2) {
+        return; // a single node in a new DHT has neither pred nor succ
+    }
+
+    char portstr[16];
+    snprintf(portstr, 16, "%d", vn[0].self->port);
+
+    for (size_t i = 0; i < count; i++) {
+        peer *p = vn[(i + count - 1) % count].self;
+        peer *s = vn[(i + 1) % count].self;
+        vn[i].pred = peer_init(p->node_id, p->hostname, portstr);
+        vn[i].succ = peer_init(s->node_id, s->hostname, portstr);
+    }
+}
+
+vnode *vnode_find(vnode *vn, size_t count, uint16_t node_id) {
+    for (size_t i = 0; i < count; i++) {
+        if (vn[i].self != NULL && vn[i].self->node_id == node_id) {
+            return &vn[i];
+        }
+    }
+    return NULL;
+}
+
+vnode *vnode_responsible(vnode *vn, size_t count, uint16_t hash_id) {
+    for (size_t i = 0; i < count; i++) {
+        if (vn[i].pred == NULL) {
+            if (vn[i].succ == NULL) {
+                return &vn[i]; // alone in the ring
+            }
+            continue;
+        }
+        if (peer_is_responsible(vn[i].pred->node_id, vn[i].self->node_id,
+                                hash_id)) {
+            return &vn[i];
+        }
+    }
+    return NULL;
+}
+
+vnode *vnode_closest(vnode *vn, size_t count, uint16_t id) {
+    vnode *best = NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (vn[i].succ == NULL) {
+            continue;
+        }
+        if (best == NULL || ring_dist(vn[i].self->node_id, id) <
+                                ring_dist(best->self->node_id, id)) {
+            best = &vn[i];
+        }
+    }
+    return best;
+}
+
+vnode *vnode_successor_of(vnode *vn, size_t count, uint16_t id) {
+    vnode *best = &vn[0];
+    for (size_t i = 1; i < count; i++) {
+        // distance - 1 so that the ID itself is the farthest candidate
+        if ((uint16_t)(ring_dist(id, vn[i].self->node_id) - 1) <
+            (uint16_t)(ring_dist(id, best->self->node_id) - 1)) {
+            best = &vn[i];
+        }
+    }
+    return best;
+}
+
+peer *vnode_closest_preceding_finger(const vnode *v, uint16_t hash_id) {
+    return vnode_lookup_hop(v, hash_id, 0);
+}
+
+static void add_hop(peer **hops, size_t *n, peer *p) {
+    for (size_t i = 0; i < *n; i++) {
+        if (hops[i]->node_id == p->node_id) {
+            return;
+        }
+    }
+    hops[(*n)++] = p;
+}
+
+peer *vnode_lookup_hop(const vnode *v, uint16_t hash_id, int attempt) {
+    peer *hops[SIZE_OF_FT + 1];
+    size_t n = 0;
+
+    finger_table *fng_tab = v->fng_tab;
+    if (fng_tab != NULL && fng_tab->state == FT_ACTIVE) {
+        uint16_t dist = ring_dist(v->self->node_id, hash_id);
+        for (int i = SIZE_OF_FT - 1; i >= 0; i--) {
+            peer *f = fng_tab->ft[i];
+            if (f == NULL) {
+                continue;
+            }
+            uint16_t fdist = ring_dist(v->self->node_id, f->node_id);
+            if (fdist > 0 && fdist < dist) {
+                add_hop(hops, &n, f); // f lies in (self, hash_id)
+            }
+        }
+    }
+    peer *succ = v->succ;
+    if (succ != NULL) {
+        add_hop(hops, &n, succ);
+    }
+
+    if (n == 0) {
+        return succ;
+    }
+    return hops[attempt % n];
+}
+
+void finger_table_free(void *fng_tab) {
+    finger_table *t = (finger_table *)fng_tab;
+    for (size_t i = 0; i < SIZE_OF_FT; i++) {
+        if (t->ft[i] != NULL) {
+            peer_free(t->ft[i]);
+        }
+    }
+    free(t->ft);
+    free(t);
+}
+
+uint16_t finger_start(uint16_t node_id, size_t i) {
+    return (uint16_t)(node_id + (1u << i));
+}
+
+unsigned vnode_on_join(const vnode *v, uint16_t joining_id) {
+    if (v->pred == NULL) {
+        // alone (or not linked yet): the joining node is pred and maybe succ
+        return RING_SET_PRED | (v->succ == NULL ? RING_SET_SUCC : 0) |
+               RING_REPLY;
+    }
+    if (peer_is_responsible(v->pred->node_id, v->self->node_id, joining_id)) {
+        return RING_SET_PRED | RING_REPLY;
+    }
+    return RING_FORWARD;
+}
+
+unsigned vnode_on_stabilize(const vnode *v, uint16_t sender_id) {
+    unsigned actions = 0;
+    if (v->succ == NULL) {
+        actions = RING_SET_SUCC; // we have no succ yet, time to get one
+    } else if (v->pred == NULL ||
+               peer_is_responsible(v->pred->node_id, v->self->node_id,
+                                   sender_id)) {
+        actions = RING_SET_PRED;
+    }
+    if (v->pred != NULL || (actions & RING_SET_PRED)) {
+        actions |= RING_REPLY;
+    }
+    return actions;
+}
+
+unsigned vnode_on_notify(const vnode *v, uint16_t named_id) {
+    if (v->succ == NULL ||
+        peer_is_responsible(v->self->node_id, v->succ->node_id, named_id)) {
+        return RING_SET_SUCC;
+    }
+    return 0;
+}
+
+route vnode_route(vnode *vn, size_t count, uint16_t hash_id, bool iterative) {
+    route r = {ROUTE_NONE, NULL, NULL};
+    vnode *v = vnode_responsible(vn, count, hash_id);
+    if (v != NULL) {
+        r.kind = ROUTE_SELF;
+        r.v = v;
+        r.next = v->self;
+        return r;
+    }
+
+    v = vnode_closest(vn, count, hash_id);
+    peer *succ = v != NULL ? v->succ : NULL; // load the published succ once
+    r.v = v;
+    if (succ == NULL) {
+        return r;
+    }
+    if (peer_is_responsible(v->self->node_id, succ->node_id, hash_id)) {
+        r.kind = ROUTE_SUCC;
+        r.next = succ;
+    } else {
+        // the FT falls back to succ as long as it is not built yet
+        r.kind = iterative ? ROUTE_REFER : ROUTE_FORWARD;
+        r.next = vnode_closest_preceding_finger(v, hash_id);
+    }
+    return r;
+}
+
+finger_table *finger_table_new(void) {
+    finger_table *fng_tab = calloc(1, sizeof(finger_table));
+    fng_tab->ft = calloc(SIZE_OF_FT, sizeof(peer *));
+    fng_tab->finger_count = 0;
+    fng_tab->state = FT_INIT;
+    return fng_tab;
+}
+
+void vnode_add_finger(vnode *v, uint16_t hash_id, const peer *p) {
+    finger_table *fng_tab = v->fng_tab;
+    if (fng_tab == NULL || fng_tab->state != FT_INIT ||
+        fng_tab->finger_count >= SIZE_OF_FT) {
+        return;
+    }
+
+    // make sure we find the correct position for the entry
+    for (size_t i = 0; i < SIZE_OF_FT; i++) {
+        if (hash_id == finger_start(v->self->node_id, i) &&
+            fng_tab->ft[i] == NULL) {
+            fng_tab->ft[i] = peer_dup(p);
+            fng_tab->finger_count++;
+            break;
+        }
+    }
+
+    // filling the FT completed
+    if (fng_tab->finger_count == SIZE_OF_FT) {
+        fng_tab->state = FT_ACTIVE; // publishes the entries to readers
+    }
+}